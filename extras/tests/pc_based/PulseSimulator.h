@@ -0,0 +1,384 @@
+#ifndef PULSE_SIMULATOR_H
+#define PULSE_SIMULATOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "StreamRecorder.h"
+
+// FastAccelStepper.h and StepperISR.h need to be included before.
+//
+// The PulseSimulator drains fas_queue[] in the same way as the stepper
+// interrupts of the real devices do. The model follows the avr
+// implementation:
+//
+// - a compare event is scheduled at the start of each step period
+// - the step of a queue entry with steps > 0 happens at the start of the
+//   period and queue_entry::steps is counted down after the step
+// - toggle_dir is applied and the position events are raised, when the next
+//   entry gets active
+// - a pause entry with steps > 1 is repeated for steps periods
+// - a queue running out of commands executes the ticks of the last entry
+//   and then checks again (_prepareForStop). If then still empty, the queue
+//   stops and isRunning() gets false
+//
+// Because queue_entry::steps is counted down like in the avr isr,
+// getCurrentPosition() can be compared with the simulated position.
+//
+// Optionally all edges are written to a binary pulse timeline file.
+// All values are little endian:
+//
+//   header:  "FASP"
+//            version      u8 (=1)
+//            num_queues   u8
+//            reserved     u16
+//            ticks_per_s  u32
+//   records: event u8 = (queue << 2) | PULSE_EVENT_xxx
+//            followed by the ticks since the previous record as unsigned
+//            LEB128 varint. The records of all queues are time ordered.
+//
+// For a step rate of e.g. 20kHz a step record needs 3 bytes.
+
+#define PULSE_TIMELINE_VERSION 1
+
+extern FastAccelStepper fas_stepper[MAX_STEPPER];
+
+#define PULSE_EVENT_STEP 0
+#define PULSE_EVENT_DIR_LOW 1
+#define PULSE_EVENT_DIR_HIGH 2
+#define PULSE_EVENT_STOP 3
+
+// Duration of the simulation in ticks
+#define MS_TO_TICKS(ms) ((uint64_t)(ms) * (TICKS_PER_S / 1000))
+
+struct pulse_event_s {
+  uint64_t ticks;
+  uint8_t queue;
+  uint8_t type;
+};
+
+struct sim_queue_s {
+  uint64_t next_compare;
+  uint64_t start_ticks;  // of the latest start
+  uint64_t stop_ticks;   // of the latest stop
+  uint64_t steps;
+  int32_t pos;
+  uint32_t starts;
+  uint32_t dir_changes;
+  uint32_t dir_errors;  // step with dir pin not matching countUp
+  bool running;
+  bool step_pending;     // output set to one for next compare
+  bool prepare_for_stop;  // avr _prepareForStop
+  bool dir_high;
+  bool dir_valid;
+  fas_queue_idx_t next_record;  // next queue entry for the stream recorder
+};
+
+class PulseSimulator {
+ public:
+  uint64_t now;
+  uint64_t events;
+  struct sim_queue_s q[NUM_QUEUES];
+
+  PulseSimulator() {
+    _timeline = NULL;
+    reset();
+  }
+
+  void reset() {
+    now = 0;
+    events = 0;
+    _last_event_ticks = 0;
+    memset(q, 0, sizeof(q));
+    stream_start_scenario();
+  }
+
+  bool open_timeline(const char *fname) {
+    close_timeline();
+    _timeline = fopen(fname, "wb");
+    if (_timeline == NULL) {
+      return false;
+    }
+    uint8_t header[12] = {'F', 'A', 'S', 'P', PULSE_TIMELINE_VERSION,
+                          NUM_QUEUES};
+    uint32_t f = TICKS_PER_S;
+    for (uint8_t i = 0; i < 4; i++) {
+      header[8 + i] = f & 0xff;
+      f >>= 8;
+    }
+    fwrite(header, sizeof(header), 1, _timeline);
+    _buf_len = 0;
+    _last_event_ticks = now;
+    return true;
+  }
+  void close_timeline() {
+    if (_timeline != NULL) {
+      _flush();
+      fclose(_timeline);
+      _timeline = NULL;
+    }
+  }
+
+  bool is_idle() {
+    for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+      if (q[i].running || fas_queue[i]._isRunning) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Process all compare events of all queues up to now + ticks.
+  // A queue started by startQueue() since last call, starts at now.
+  void advance(uint32_t ticks) {
+    for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+      if (!q[i].running && fas_queue[i]._isRunning) {
+        _start(i);
+      }
+    }
+    uint64_t until = now + ticks;
+    while (true) {
+      uint8_t next_q = NUM_QUEUES;
+      uint64_t next_ticks = until;
+      for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+        if (q[i].running && (q[i].next_compare < next_ticks)) {
+          next_q = i;
+          next_ticks = q[i].next_compare;
+        }
+      }
+      if (next_q == NUM_QUEUES) {
+        break;
+      }
+      now = next_ticks;
+      _compare(next_q);
+    }
+    now = until;
+  }
+
+  // Run the engine like the stepper task/interrupt with the given period
+  // until all steppers are idle. Returns false on timeout.
+  bool run_until_idle(FastAccelStepperEngine *engine, uint32_t cycle_ticks,
+                      uint64_t max_ticks) {
+    uint64_t end = now + max_ticks;
+    while (now < end) {
+      engine->manageSteppers();
+      if (is_idle()) {
+        bool active = false;
+        for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+          if (fas_stepper[i].isRunning()) {
+            active = true;
+          }
+        }
+        if (!active) {
+          return true;
+        }
+      }
+      advance(cycle_ticks);
+    }
+    return false;
+  }
+
+ private:
+  FILE *_timeline;
+  uint64_t _last_event_ticks;
+  uint8_t _buf[4096];
+  uint16_t _buf_len;
+
+  void _flush() {
+    if (_buf_len > 0) {
+      fwrite(_buf, _buf_len, 1, _timeline);
+      _buf_len = 0;
+    }
+  }
+  void _record(uint8_t queue, uint8_t type) {
+    events++;
+    if (_timeline == NULL) {
+      return;
+    }
+    if (_buf_len > sizeof(_buf) - 11) {
+      _flush();
+    }
+    _buf[_buf_len++] = (queue << 2) | type;
+    uint64_t delta = now - _last_event_ticks;
+    _last_event_ticks = now;
+    while (delta >= 0x80) {
+      _buf[_buf_len++] = (delta & 0x7f) | 0x80;
+      delta >>= 7;
+    }
+    _buf[_buf_len++] = delta;
+  }
+  void _set_dir(uint8_t i, bool high) {
+    struct sim_queue_s *sq = &q[i];
+    if (!sq->dir_valid || (sq->dir_high != high)) {
+      sq->dir_valid = true;
+      sq->dir_high = high;
+      sq->dir_changes++;
+      _record(i, high ? PULSE_EVENT_DIR_HIGH : PULSE_EVENT_DIR_LOW);
+    }
+  }
+  void _step(uint8_t i, struct queue_entry *e) {
+    struct sim_queue_s *sq = &q[i];
+    StepperQueue *fq = &fas_queue[i];
+    if (fq->dirPin != PIN_UNDEFINED) {
+      bool expected = (e->countUp == 1) == fq->dirHighCountsUp;
+      if (sq->dir_high != expected) {
+        sq->dir_errors++;
+      }
+    }
+    sq->steps++;
+    sq->pos += e->countUp ? 1 : -1;
+    _record(i, PULSE_EVENT_STEP);
+  }
+  void _activate(uint8_t i, struct queue_entry *e) {
+    // next entry gets active: output for step and dir toggle
+    q[i].step_pending = e->hasSteps;
+    if (e->toggle_dir && (fas_queue[i].dirPin != PIN_UNDEFINED)) {
+      _set_dir(i, !q[i].dir_high);
+    }
+    fas_queue[i].checkPositionEvents(e);
+  }
+  void _start(uint8_t i) {
+    struct sim_queue_s *sq = &q[i];
+    StepperQueue *fq = &fas_queue[i];
+    sq->running = true;
+    sq->prepare_for_stop = false;
+    sq->starts++;
+    sq->start_ticks = now;
+    sq->next_compare = now;
+    fas_queue_idx_t rp = fq->read_idx;
+    sq->next_record = rp;
+    if (rp == fq->next_write_idx) {
+      return;
+    }
+    struct queue_entry *e = &fq->entry[rp & QUEUE_LEN_MASK];
+    if (fq->dirPin != PIN_UNDEFINED) {
+      // addQueueEntry() has set the dir pin directly for the first entry
+      _set_dir(i, (e->countUp == 1) == fq->dirHighCountsUp);
+    }
+    sq->step_pending = e->hasSteps;
+    fq->checkPositionEvents(e);
+  }
+  void _compare(uint8_t i) {
+    struct sim_queue_s *sq = &q[i];
+    StepperQueue *fq = &fas_queue[i];
+    fq->stat_isr_calls++;
+    fas_queue_idx_t rp = fq->read_idx;
+    if (rp == fq->next_write_idx) {
+      // queue is empty => stop
+      sq->running = false;
+      sq->step_pending = false;
+      sq->prepare_for_stop = false;
+      sq->stop_ticks = now;
+      fq->_isRunning = false;
+      _record(i, PULSE_EVENT_STOP);
+      return;
+    }
+    struct queue_entry *e = &fq->entry[rp & QUEUE_LEN_MASK];
+    if (rp == sq->next_record) {
+      // first compare of this entry, so the steps are not yet counted down
+      stream_record(i, e);
+      sq->next_record = rp + 1;
+    }
+    sq->next_compare = now + e->ticks;
+    if (sq->step_pending) {
+      sq->step_pending = false;
+      _step(i, e);
+      if (e->steps-- > 1) {
+        sq->step_pending = true;
+        return;
+      }
+    } else if (sq->prepare_for_stop) {
+      // new command received after running out of commands
+      sq->prepare_for_stop = false;
+      fq->stat_late_refills++;
+      if (e->toggle_dir && (fq->dirPin != PIN_UNDEFINED)) {
+        _set_dir(i, !sq->dir_high);
+      }
+      fq->checkPositionEvents(e);
+      if (e->hasSteps) {
+        _step(i, e);
+        if (e->steps-- > 1) {
+          sq->step_pending = true;
+          return;
+        }
+      }
+    }
+    if (!e->hasSteps && (e->steps > 1)) {
+      // pause with more periods
+      e->steps--;
+      return;
+    }
+    rp++;
+    fq->read_idx = rp;
+    fq->checkWakeup(rp);
+    if (rp != fq->next_write_idx) {
+      _activate(i, &fq->entry[rp & QUEUE_LEN_MASK]);
+    } else {
+      sq->prepare_for_stop = true;
+    }
+  }
+};
+
+// Reader for the binary pulse timeline
+class PulseTimelineReader {
+ public:
+  uint8_t num_queues;
+  uint32_t ticks_per_s;
+
+  PulseTimelineReader() { _file = NULL; }
+  bool open(const char *fname) {
+    close();
+    _file = fopen(fname, "rb");
+    if (_file == NULL) {
+      return false;
+    }
+    uint8_t header[12];
+    if ((fread(header, sizeof(header), 1, _file) != 1) ||
+        (memcmp(header, "FASP", 4) != 0) ||
+        (header[4] != PULSE_TIMELINE_VERSION)) {
+      close();
+      return false;
+    }
+    num_queues = header[5];
+    ticks_per_s = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      ticks_per_s |= (uint32_t)header[8 + i] << (8 * i);
+    }
+    _ticks = 0;
+    return true;
+  }
+  void close() {
+    if (_file != NULL) {
+      fclose(_file);
+      _file = NULL;
+    }
+  }
+  bool next(struct pulse_event_s *ev) {
+    int c = getc(_file);
+    if (c == EOF) {
+      return false;
+    }
+    uint64_t delta = 0;
+    uint8_t shift = 0;
+    int b;
+    do {
+      b = getc(_file);
+      if (b == EOF) {
+        return false;
+      }
+      delta |= (uint64_t)(b & 0x7f) << shift;
+      shift += 7;
+    } while (b & 0x80);
+    _ticks += delta;
+    ev->ticks = _ticks;
+    ev->queue = c >> 2;
+    ev->type = c & 3;
+    return true;
+  }
+
+ private:
+  FILE *_file;
+  uint64_t _ticks;
+};
+#endif
@@ -1,5 +1,8 @@
+#include <math.h>
 #include <stdlib.h>
 
+#include "StreamRecorder.h"
+
 class RampChecker {
  public:
   uint64_t total_ticks;
@@ -19,6 +22,23 @@ class RampChecker {
   float avg_accel = 0;
   FILE *gp_file = NULL;
 
+  // Jerk check: The speed is averaged over windows of complete commands with
+  // at least jerk_window_ticks, so the rounding of the ticks of a single
+  // command is smoothed out. Acceleration and jerk are the first and second
+  // derivation of these averaged speeds. Each ramp starts from standstill.
+  // Jerk and acceleration are not checked, if max_jerk/max_accel is 0.
+  uint32_t jerk_window_ticks = 16000000 / 50;
+  float max_jerk = 0;
+  float max_accel = 0;
+  float measured_max_jerk;
+  float measured_max_accel;
+  uint32_t jerk_violations;
+  uint32_t accel_violations;
+  int32_t win_steps;
+  uint64_t win_ticks;
+  float win_v[3];       // averaged speed of the last three windows
+  uint64_t win_mid[3];  // center of the last three windows in ticks
+
   void next_ramp() {
     increase_ok = true;
     decrease_ok = false;
@@ -30,11 +50,27 @@ class RampChecker {
     time_coasting = 0;
     accelerate_till = 0;
     reversing_allowed = false;
+    measured_max_jerk = 0;
+    measured_max_accel = 0;
+    jerk_violations = 0;
+    accel_violations = 0;
+    standstill_windows();
+  }
+  // The motor has been at standstill for the last three windows
+  void standstill_windows() {
+    win_steps = 0;
+    win_ticks = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+      win_v[i] = 0;
+      win_mid[i] = total_ticks - (3 - i) * jerk_window_ticks +
+                   jerk_window_ticks / 2;
+    }
   }
   RampChecker() {
     total_ticks = 0;
     pos = 0;
     next_ramp();
+    stream_start_scenario();
   }
   void start_plot(char *fname) {
     gp_file = fopen(fname, "w");
@@ -60,23 +96,61 @@ class RampChecker {
       gp_file = NULL;
     }
   }
+  void check_jerk(int32_t steps, uint32_t ticks) {
+    win_steps += steps;
+    win_ticks += ticks;
+    if (win_ticks < jerk_window_ticks) {
+      return;
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+      win_v[i] = win_v[i + 1];
+      win_mid[i] = win_mid[i + 1];
+    }
+    win_v[2] = win_steps * 16000000.0 / win_ticks;
+    win_mid[2] = total_ticks - win_ticks / 2;
+    win_steps = 0;
+    win_ticks = 0;
+    float a1 = (win_v[1] - win_v[0]) * 16000000.0 / (win_mid[1] - win_mid[0]);
+    float a2 = (win_v[2] - win_v[1]) * 16000000.0 / (win_mid[2] - win_mid[1]);
+    float jerk = (a2 - a1) * 2 * 16000000.0 / (win_mid[2] - win_mid[0]);
+    measured_max_accel = max(measured_max_accel, fabsf(a2));
+    measured_max_jerk = max(measured_max_jerk, fabsf(jerk));
+    if ((max_accel > 0) && (fabsf(a2) > max_accel)) {
+      printf("acceleration %.0f exceeds %.0f @%.6fs\n", a2, max_accel,
+             total_ticks / 16000000.0);
+      accel_violations++;
+    }
+    if ((max_jerk > 0) && (fabsf(jerk) > max_jerk)) {
+      printf("jerk %.0f exceeds %.0f @%.6fs\n", jerk, max_jerk,
+             total_ticks / 16000000.0);
+      jerk_violations++;
+    }
+  }
   void check_section(struct queue_entry *e) {
-    uint8_t steps = e->steps;
-    if (steps == 0) {
-      // Just a pause
-      if (ticks_since_last_step <= 0xffff0000) {
-        ticks_since_last_step += e->ticks;
+    stream_record(0, e);
+    uint32_t steps = e->steps;
+    if (!e->hasSteps) {
+      // Just a pause, eventually of several periods
+      for (uint32_t i = 0; i < fas_max(steps, 1); i++) {
+        if (ticks_since_last_step <= 0xffff0000) {
+          ticks_since_last_step += e->ticks;
+        }
+        total_ticks += e->ticks;
+        check_jerk(0, e->ticks);
+        printf("process pause %d => %u\n", e->ticks, ticks_since_last_step);
       }
-      total_ticks += e->ticks;
-      printf("process pause %d => %u\n", e->ticks, ticks_since_last_step);
       return;
     }
-    if (e->toggle_dir) {
+    // The period of the step with direction change spans the standstill
+    bool toggled = e->toggle_dir;
+    if (toggled) {
       assert(reversing_allowed);
       dir_high = !dir_high;
       increase_ok = true;
       last_dt = ~0;
       decrease_ok = false;
+      // The windows' averaged speed cannot resolve the direction change
+      standstill_windows();
     }
     if (dir_high) {
       pos += steps;
@@ -85,6 +159,7 @@ class RampChecker {
     }
     uint32_t curr_dt = ticks_since_last_step;
     total_ticks += steps * e->ticks;
+    check_jerk(dir_high ? steps : -steps, steps * e->ticks);
     if (!first) {
       min_dt = min(min_dt, curr_dt);
     }
@@ -123,7 +198,7 @@ class RampChecker {
       time_coasting += steps * curr_dt;
     }
 
-    if (!first) {
+    if (!first && !toggled) {
       last_dt = curr_dt;
     }
 
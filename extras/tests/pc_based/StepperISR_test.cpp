@@ -5,6 +5,16 @@
 // Here are the global variables to interface with the interrupts
 // StepperQueue fas_queue[NUM_QUEUES];
 
+uint32_t fas_test_critical_sections = 0;
+
+uint32_t (*fas_test_clock)() = NULL;
+uint32_t micros() { return fas_test_clock == NULL ? 0 : fas_test_clock(); }
+
+// The stepper task is simulated by the tests
+uint32_t fas_test_task_notifications = 0;
+void fas_notify_task_from_isr() { fas_test_task_notifications++; }
+void fas_notify_task() { fas_test_task_notifications++; }
+
 void fas_init_engine(FastAccelStepperEngine* engine, uint8_t cpu_core) {}
 
 void StepperQueue::init(uint8_t queue_num, uint8_t step_pin) { _initVars(); }
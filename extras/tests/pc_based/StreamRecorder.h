@@ -0,0 +1,54 @@
+#ifndef STREAM_RECORDER_H
+#define STREAM_RECORDER_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// StepperISR.h needs to be included before.
+//
+// Recording of the command streams for the golden files in golden/.
+//
+// If the environment variable FAS_STREAM_FILE is set, the queue entries
+// processed by RampChecker and PulseSimulator are written to this file. Each
+// RampChecker and each (re)started PulseSimulator begins a new scenario:
+//
+//     scenario <n>
+//     <queue> <steps> <ticks> <dir>
+//     ...
+//
+// with dir = 1 for counting up. The golden files are created by
+//     make golden
+// and compared against the current tree with stream_compare by
+//     make golden_compare
+
+static FILE *stream_file = NULL;
+static uint16_t stream_scenarios = 0;
+
+static void stream_start_scenario() {
+  const char *fname = getenv("FAS_STREAM_FILE");
+  if (fname == NULL) {
+    return;
+  }
+  if (stream_file == NULL) {
+    stream_file = fopen(fname, "w");
+    assert(stream_file != NULL);
+  }
+  fprintf(stream_file, "scenario %u\n", ++stream_scenarios);
+}
+
+// A pause entry of several periods is recorded as single pauses, so the
+// streams do not depend on the combination of pause periods.
+static void stream_record(uint8_t queue, const struct queue_entry *e) {
+  if (stream_file != NULL) {
+    if (!e->hasSteps) {
+      for (uint32_t i = 0; i < fas_max(e->steps, (fas_steps_t)1); i++) {
+        fprintf(stream_file, "%u 0 %u %u\n", queue, e->ticks, e->countUp);
+      }
+      return;
+    }
+    fprintf(stream_file, "%u %u %u %u\n", queue, e->steps, e->ticks,
+            e->countUp);
+  }
+}
+#endif
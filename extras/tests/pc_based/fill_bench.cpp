@@ -0,0 +1,188 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Benchmark of the fill order of manageSteppers() with many fast steppers.
+//
+// The steppers run random moves on the PulseSimulator. The stepper task is
+// simulated with a cpu cost model: each queue entry costs cost_per_entry_us
+// and the simulated time advances by this cost while the task is filling the
+// queues. So the queues drain, while the other steppers are served. The
+// clock is provided to micros(), so the fill budget works on the same time.
+//
+// Compared are:
+// - fixed order: the steppers in slot order, as manageSteppers() did before
+// - deadline order: manageSteppers()
+// each without and with the same budget per cycle.
+//
+// An underrun is a start of a queue, which has not been caused by a move.
+//
+// Built with 8 steppers in the subdirectory steppers8 and run by:
+//     make fill_bench8
+// The cost per queue entry in us can be given as parameter.
+
+#define CYCLE_US (DELAY_MS_BASE * 1000)
+#define SIM_US 20000000
+#define TICKS_PER_US (TICKS_PER_S / 1000000)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *steppers[MAX_STEPPER];
+
+uint32_t cost_per_entry_us = 120;
+uint32_t horizon_us = 20000;
+uint64_t cpu_us;
+uint32_t max_cycle_us;
+fas_queue_idx_t last_wp[NUM_QUEUES];
+
+// Account the cost of the queue entries added since the last call
+uint32_t sim_clock() {
+  uint32_t entries = 0;
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    fas_queue_idx_t wp = fas_queue[i].next_write_idx;
+    entries += (fas_queue_idx_t)(wp - last_wp[i]);
+    last_wp[i] = wp;
+  }
+  uint32_t us = entries * cost_per_entry_us;
+  cpu_us += us;
+  sim.advance(us * TICKS_PER_US);
+  return sim.now / TICKS_PER_US;
+}
+
+class FastAccelStepperTest {
+ public:
+  static void fill(FastAccelStepper *s) { s->fill_queue(); }
+};
+
+uint16_t fill_budget_us;
+
+void fixed_order_cycle() {
+  uint32_t start_us = sim_clock();
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    if ((fill_budget_us != 0) && (i > 0) &&
+        (sim_clock() - start_us >= fill_budget_us)) {
+      break;
+    }
+    FastAccelStepperTest::fill(steppers[i]);
+  }
+  sim_clock();
+}
+
+void deadline_order_cycle() {
+  sim_clock();
+  engine.manageSteppers();
+  sim_clock();
+}
+
+void run(const char *name, void (*cycle)(), uint16_t budget_us) {
+  srand(1);
+  sim.reset();
+  engine.setFillBudgetInUs(budget_us);
+  fill_budget_us = budget_us;
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    last_wp[i] = fas_queue[i].next_write_idx;
+  }
+  cpu_us = 0;
+  max_cycle_us = 0;
+  uint32_t moves = 0;
+  uint32_t cycles = 0;
+  uint64_t steps = 0;
+  while (sim.now < (uint64_t)SIM_US * TICKS_PER_US) {
+    for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+      FastAccelStepper *s = steppers[i];
+      if (!s->isRunning()) {
+        // speeds from 10kHz to 40kHz
+        s->setSpeedInUs(25 + rand() % 76);
+        s->setAcceleration(50000 + rand() % 200000);
+        int32_t target = rand() % 40000 - 20000;
+        if (target != s->getCurrentPosition()) {
+          s->moveTo(target);
+          moves++;
+        }
+      }
+    }
+    uint64_t start = sim.now;
+    uint64_t cpu_start = cpu_us;
+    cycle();
+    cycles++;
+    max_cycle_us = fas_max(max_cycle_us, (uint32_t)(cpu_us - cpu_start));
+    uint64_t next = start + CYCLE_US * TICKS_PER_US;
+    if (sim.now < next) {
+      sim.advance(next - sim.now);
+    }
+  }
+  uint32_t starts = 0;
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    starts += sim.q[i].starts;
+    steps += sim.q[i].steps;
+  }
+  // the moves still running have not yet started
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    if (steppers[i]->isRunning() && !fas_queue[i].isRunning()) {
+      moves--;
+    }
+  }
+  uint32_t underruns = starts - moves;
+
+  // stop all steppers for the next run
+  fas_test_clock = NULL;
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    steppers[i]->stopMove();
+  }
+  sim.run_until_idle(&engine, CYCLE_US * TICKS_PER_US, TICKS_PER_S * 10);
+  fas_test_clock = sim_clock;
+  printf("%-26s %8u %8u %9.1f %7.2f%% %6u %10u\n", name, moves, cycles,
+         cpu_us / 1000.0, 100.0 * cpu_us / (sim.now / TICKS_PER_US),
+         max_cycle_us, underruns);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    cost_per_entry_us = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    horizon_us = atoi(argv[2]);
+  }
+  engine.init();
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    FastAccelStepper *s = engine.stepperConnectToPin(i);
+    assert(s != NULL);
+    s->setDirectionPin(100 + i);
+    s->setLatencyBoundsInUs(horizon_us, horizon_us);
+    steppers[i] = s;
+  }
+  fas_test_clock = sim_clock;
+
+  printf("%u steppers, cycle %uus, %uus per queue entry, %.0fs\n",
+         MAX_STEPPER, CYCLE_US, cost_per_entry_us, SIM_US / 1e6);
+  printf("%-26s %8s %8s %9s %8s %6s %10s\n", "fill order, budget", "moves", "cycles",
+         "cpu ms", "load", "max us", "underruns");
+  uint16_t budgets[] = {0, 750, 500, 300, 200};
+  for (uint8_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+    char name[40];
+    sprintf(name, "fixed order, %uus", budgets[i]);
+    run(name, fixed_order_cycle, budgets[i]);
+    sprintf(name, "deadline order, %uus", budgets[i]);
+    run(name, deadline_order_cycle, budgets[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,507 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "RampChecker.h"
+
+// Fuzz harness for sequences of API calls of FastAccelStepper like those of
+// the examples/IssueNNN reproducers.
+//
+// Each input byte sequence is decoded into API calls (moveTo during
+// deceleration, setAcceleration mid-ramp, forceStopAndNewPosition,
+// moveByAcceleration reversals, velocity targets,...) interleaved with
+// cycles of the stepper task. The queue is consumed in simulated time like
+// by the isr and each queue entry is checked by the RampChecker. The queue
+// entries generated after an API call may start a new ramp segment, so the
+// RampChecker allows acceleration and deceleration again from there.
+// Checked are:
+// - the asserts of the library, e.g. in _getNextCommand()
+// - the RampChecker invariants
+// - no step period below the highest speed set since the start
+// - the position of the consumed steps equals getCurrentPosition()
+// - stopMove() stops the stepper within the time for the deceleration and
+//   getCurrentSpeedInMilliHz() returns 0 then
+// - a move from standstill starts towards the target
+//
+// Built with the quiet library by:
+//     make fuzz_ramp
+// and used as:
+//     ./fuzz_ramp -r <n> [-s <seed>]   n random inputs, e.g. for make fuzz
+//     ./fuzz_ramp [-v] <file>...      run the given inputs, e.g. crashes.
+//                                     -v prints the decoded API calls
+//     ./fuzz_ramp <input              AFL: afl-fuzz -i in -o out ./fuzz_ramp
+// For libFuzzer the main() is left out with -DFAS_LIBFUZZER:
+//     clang++ -g -O1 -fsanitize=fuzzer,address -DFAS_LIBFUZZER -DTEST
+//         -DTEST_QUIET -DF_CPU=16000000 -I../../../src fuzz_ramp.cpp
+//         ../../../src/*.cpp StepperISR_test.cpp
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#define MAX_STOP_S 10
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+FastAccelStepper *s;
+RampChecker rc;
+uint32_t credit_ticks;  // ticks the isr may consume
+int32_t pos;            // position of the consumed steps
+uint32_t min_period;    // of the highest speed set
+// The jerk limited ramp overshoots a lowered speed limit, while the
+// acceleration is released. So min_period is checked only for ramps, which
+// have started from standstill without jerk.
+bool jerk_ramp;
+// Changed parameters take effect only with the next move command. So the
+// bounds below use the extremes of the values set since the start.
+uint32_t max_period;
+uint32_t min_accel;
+uint32_t max_accel;
+uint32_t min_jerk;
+uint32_t linear_steps;
+uint64_t api_calls;
+bool verbose;
+
+// The queue indices at the API calls, from where a new ramp segment may
+// start
+#define MAX_MARKS 64
+fas_queue_idx_t marks[MAX_MARKS];
+uint8_t marks_rd;
+uint8_t marks_cnt;
+// The ramp steps are recalculated from the current speed after an API call,
+// which is not exact. So the first steps of a new ramp segment are not
+// checked for monotony. The jerk limited ramp needs the time to change the
+// acceleration from -a to +a for a change of the trend.
+#define SETTLE_STEPS 8
+uint8_t settle_steps;
+uint64_t settle_ticks;
+
+static void mark_api_call() {
+  api_calls++;
+  if (marks_cnt == MAX_MARKS) {
+    marks_rd++;
+    marks_cnt--;
+  }
+  marks[(marks_rd + marks_cnt++) % MAX_MARKS] = fas_queue[0].next_write_idx;
+}
+
+// The next queue entry starts from standstill
+static void standstill() {
+  rc.last_dt = ~0;
+  rc.ticks_since_last_step = 0;
+  rc.first = true;
+  rc.increase_ok = true;
+  rc.decrease_ok = false;
+  jerk_ramp = s->getJerk() > 0;
+}
+
+// Consume the queue like the isr for the given ticks
+static void consume(uint32_t ticks) {
+  StepperQueue *q = &fas_queue[0];
+  credit_ticks += ticks;
+  while (q->_isRunning) {
+    fas_queue_idx_t rp = q->read_idx;
+    if (rp == q->next_write_idx) {
+      // queue has run out of commands
+      q->_isRunning = false;
+      credit_ticks = 0;
+      standstill();
+      break;
+    }
+    struct queue_entry *e = &q->entry[rp & QUEUE_LEN_MASK];
+    uint32_t duration = fas_max(e->steps, (fas_steps_t)1) * e->ticks;
+    if (duration > credit_ticks) {
+      break;
+    }
+    credit_ticks -= duration;
+    while ((marks_cnt > 0) &&
+           ((fas_queue_idx_t)(rp - marks[marks_rd % MAX_MARKS]) <=
+            QUEUE_LEN)) {
+      // entries planned after an API call
+      settle_steps = SETTLE_STEPS;
+      settle_ticks =
+          min_jerk > 0 ? 2 * (uint64_t)max_accel * TICKS_PER_S / min_jerk : 0;
+      marks_rd++;
+      marks_cnt--;
+    }
+    if (verbose) {
+      fprintf(stdout, "  entry %s%d x %u ticks\n",
+              e->toggle_dir ? "toggle " : "", e->countUp ? e->steps : -e->steps,
+              e->ticks);
+    }
+    if (((settle_steps > 0) || (settle_ticks > 0)) && e->hasSteps) {
+      rc.increase_ok = true;
+      rc.decrease_ok = true;
+      settle_steps -= settle_steps > 0 ? 1 : 0;
+    }
+    settle_ticks -= fas_min(settle_ticks, duration);
+    if (e->hasSteps) {
+      // the period of a step is continued by following pauses
+      assert(jerk_ramp || rc.first || e->toggle_dir ||
+             (rc.ticks_since_last_step >= min_period));
+      assert(jerk_ramp || (e->steps == 1) || (e->ticks >= min_period));
+      pos += e->countUp ? e->steps : -e->steps;
+    }
+    rc.check_section(e);
+    q->read_idx = rp + 1;
+  }
+}
+
+static void cycle() {
+  engine.manageSteppers();
+  consume(CYCLE_TICKS);
+}
+
+static void set_speed_limit() {
+  min_period = fas_min(min_period, s->getSpeedInTicks());
+  max_period = fas_max(max_period, s->getSpeedInTicks());
+}
+
+static void set_accel(uint32_t accel) {
+  if (accel > 0) {
+    min_accel = fas_min(min_accel, accel);
+    max_accel = fas_max(max_accel, accel);
+  }
+}
+
+// Input decoding: values from exhausted input are 0
+struct input_s {
+  const uint8_t *data;
+  size_t size;
+};
+
+static uint8_t next_u8(struct input_s *in) {
+  if (in->size == 0) {
+    return 0;
+  }
+  in->size--;
+  return *in->data++;
+}
+
+static uint16_t next_u16(struct input_s *in) {
+  uint16_t v = next_u8(in);
+  return v | (next_u8(in) << 8);
+}
+
+static void setup() {
+  static bool initialized = false;
+  if (!initialized) {
+    engine.init();
+    s = engine.stepperConnectToPin(0);
+    assert(s != NULL);
+    s->setDirectionPin(10);
+    initialized = true;
+  }
+  // Bring the stepper into a defined state without the checks
+  s->forceStopAndNewPosition(0);
+  fas_queue[0].read_idx = fas_queue[0].next_write_idx;
+  fas_queue[0]._isRunning = false;
+  engine.manageSteppers();
+  s->setSpeedInUs(1000);
+  s->setAcceleration(10000);
+  s->setLinearAcceleration(0);
+  s->setJumpStart(0);
+  s->setJerk(0);
+  rc = RampChecker();
+  rc.reversing_allowed = true;
+  credit_ticks = 0;
+  pos = 0;
+  min_period = s->getSpeedInTicks();
+  max_period = min_period;
+  min_accel = s->getAcceleration();
+  max_accel = min_accel;
+  min_jerk = 0;
+  jerk_ramp = false;
+  linear_steps = 0;
+  marks_cnt = 0;
+  settle_steps = 0;
+  settle_ticks = 0;
+}
+
+// Fill the stack below the caller, so that uninitialized local variables of
+// a following call are not zero by chance
+static void __attribute__((noinline)) poison_stack() {
+  volatile uint8_t buf[512];
+  for (uint16_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = 0x55;
+  }
+}
+
+// A move from standstill starts with a step towards the target
+static void check_start(fas_queue_idx_t wp, bool count_up) {
+  StepperQueue *q = &fas_queue[0];
+  for (; wp != q->next_write_idx; wp++) {
+    struct queue_entry *e = &q->entry[wp & QUEUE_LEN_MASK];
+    if (e->hasSteps) {
+      assert(e->countUp == count_up);
+      return;
+    }
+  }
+}
+
+static const char *op_names[] = {
+    "moveTo",    "move",          "setSpeedInUs",
+    "setSpeedInHz", "setAcceleration", "applySpeedAcceleration",
+    "runForward", "runBackward",   "stopMove",
+    "forceStopAndNewPosition", "moveByAcceleration", "setLinearAcceleration",
+    "setJumpStart", "setJerk",     "keepRunning",
+    "cycles",    "cycles",        "cycles",
+    "setTargetVelocityInMilliHz"};
+static void run_input(const uint8_t *data, size_t size) {
+  struct input_s in = {data, size};
+  setup();
+  while (in.size > 0) {
+    // The ops 15-17 are cycles. Later added ops are decoded from the byte
+    // values above, so the inputs in fuzz_corpus/ keep their meaning
+    uint8_t op = next_u8(&in);
+    op = (op == 255) ? 18 : op % 18;
+    int32_t arg = 0;
+    bool from_standstill = !s->isRunning();
+    fas_queue_idx_t wp = fas_queue[0].next_write_idx;
+    switch (op) {
+      case 0:
+        arg = (int16_t)next_u16(&in);
+        s->moveTo(arg);
+        break;
+      case 1:
+        arg = (int16_t)next_u16(&in);
+        s->move(arg);
+        break;
+      case 2:
+        arg = 1 + next_u16(&in) % 20000;
+        s->setSpeedInUs(arg);
+        set_speed_limit();
+        break;
+      case 3:
+        arg = 1 + 4 * (uint32_t)next_u16(&in);
+        s->setSpeedInHz(arg);
+        set_speed_limit();
+        break;
+      case 4:
+        arg = 100 + 8 * (uint32_t)next_u16(&in);
+        s->setAcceleration(arg);
+        set_accel(arg);
+        break;
+      case 5:
+        s->applySpeedAcceleration();
+        break;
+      case 6:
+        s->runForward();
+        break;
+      case 7:
+        s->runBackward();
+        break;
+      case 8:
+        s->stopMove();
+        break;
+      case 9:
+        arg = (int16_t)next_u16(&in);
+        s->forceStopAndNewPosition(arg);
+        // the isr stops and the queue is emptied
+        fas_queue[0].read_idx = fas_queue[0].next_write_idx;
+        fas_queue[0]._isRunning = false;
+        pos = arg;
+        marks_cnt = 0;
+        credit_ticks = 0;
+        standstill();
+        break;
+      case 10:
+        arg = 8 * (int32_t)(int16_t)next_u16(&in);
+        s->moveByAcceleration(arg, next_u8(&in) & 1);
+        // 0 keeps the speed with acceleration 1
+        set_accel(arg != 0 ? abs(arg) : 1);
+        break;
+      case 11:
+        arg = 16 * next_u8(&in);
+        s->setLinearAcceleration(arg);
+        linear_steps = arg;
+        break;
+      case 12:
+        arg = next_u8(&in);
+        s->setJumpStart(arg);
+        break;
+      case 13:
+        arg = next_u8(&in) * 1000;
+        s->setJerk(arg);
+        jerk_ramp |= arg > 0;
+        if (arg > 0) {
+          min_jerk = min_jerk > 0 ? fas_min(min_jerk, arg) : arg;
+        }
+        break;
+      case 14:
+        s->keepRunning();
+        break;
+      case 18:
+        arg = 4 * (int32_t)(int16_t)next_u16(&in);
+        s->setTargetVelocityInMilliHz(arg * 1000);
+        if (arg != 0) {
+          uint32_t ticks = TICKS_PER_S / abs(arg);
+          ticks = fas_max(ticks, s->getMaxSpeedInTicks());
+          min_period = fas_min(min_period, ticks);
+          max_period = fas_max(max_period, ticks);
+        }
+        break;
+      default:
+        arg = next_u8(&in);
+        break;
+    }
+    if (verbose) {
+      fprintf(stdout, "@%.3fs pos=%d speed=%dmHz state=%d: %s(%d)\n",
+              rc.total_ticks / (float)TICKS_PER_S, pos,
+              s->getCurrentSpeedInMilliHz(false), s->rampState(),
+              op_names[op], arg);
+    }
+    if ((op >= 15) && (op <= 17)) {
+      // the API calls take effect in the next cycles
+      for (int32_t i = 0; i < arg; i++) {
+        cycle();
+      }
+      continue;
+    }
+    int32_t start_pos = pos;
+    mark_api_call();
+    cycle();
+    if (from_standstill && ((op == 6) || (op == 7))) {
+      check_start(wp, op == 6);
+    } else if (from_standstill && (op <= 1)) {
+      // the target is set, when the move command is applied in the cycle
+      int32_t delta = s->targetPos() - start_pos;
+      if (delta != 0) {
+        check_start(wp, delta > 0);
+      }
+    }
+  }
+  // stopMove() stops the stepper within the time of the deceleration. The
+  // jerk limited ramp needs in addition the time to release the acceleration
+  // and to build up the deceleration. With a speed limit lowered to a few
+  // Hz, the stopping distance of the former speed is run at this speed.
+  uint64_t speed_hz = abs(s->getCurrentSpeedInMilliHz(false)) / 1000;
+  // The deceleration takes v/a and longer with linear acceleration. The
+  // jerk limited ramp may still accelerate and its current speed is not
+  // known exactly, so the highest speed set is used.
+  uint32_t factor = linear_steps > 0 ? 6 : 3;
+  if (min_jerk > 0) {
+    speed_hz = TICKS_PER_S / min_period;
+    factor = 6;
+  }
+  uint64_t stop_s = factor * speed_hz / min_accel + 2;
+  if (min_jerk > 0) {
+    stop_s += 3 * (uint64_t)max_accel / min_jerk + 1;
+  }
+  uint64_t stop_steps = speed_hz * speed_hz / (2 * min_accel);
+  stop_s += (stop_steps + 16) * max_period / TICKS_PER_S;
+  if (stop_s > MAX_STOP_S) {
+    return;
+  }
+  s->stopMove();
+  mark_api_call();
+  uint32_t cycles = stop_s * 1000 / DELAY_MS_BASE;
+  for (uint32_t i = 0; i < cycles; i++) {
+    cycle();
+    if (!s->isRunning() && !fas_queue[0]._isRunning) {
+      break;
+    }
+  }
+  assert(!s->isRunning());
+  assert(!fas_queue[0]._isRunning);
+  assert(pos == s->getCurrentPosition());
+  poison_stack();
+  assert(s->getCurrentSpeedInMilliHz(false) == 0);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  run_input(data, size);
+  return 0;
+}
+
+#if !defined(FAS_LIBFUZZER)
+// The random input, which has failed, is written for the reproduction
+static const uint8_t *current_data;
+static size_t current_size;
+
+static void write_crash(int sig) {
+  FILE *f = fopen("crash-fuzz_ramp", "wb");
+  if (f != NULL) {
+    fwrite(current_data, 1, current_size, f);
+    fclose(f);
+    fprintf(stderr, "input written to crash-fuzz_ramp\n");
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static void run_file(FILE *f) {
+  static uint8_t buf[65536];
+  size_t size = fread(buf, 1, sizeof(buf), f);
+  run_input(buf, size);
+}
+
+int main(int argc, char **argv) {
+  uint32_t random_runs = 0;
+  uint32_t seed = 1;
+  int i = 1;
+  for (; i < argc; i++) {
+    if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+      random_runs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+      setvbuf(stdout, NULL, _IOLBF, 0);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      seed = atoi(argv[++i]);
+    } else {
+      break;
+    }
+  }
+  if (random_runs > 0) {
+    srand(seed);
+    signal(SIGABRT, write_crash);
+    clock_t start = clock();
+    uint8_t buf[256];
+    for (uint32_t run = 0; run < random_runs; run++) {
+      size_t size = rand() % sizeof(buf);
+      for (size_t k = 0; k < size; k++) {
+        buf[k] = rand();
+      }
+      current_data = buf;
+      current_size = size;
+      run_input(buf, size);
+    }
+    double s_cpu = (double)(clock() - start) / CLOCKS_PER_SEC;
+    fprintf(stdout, "%u inputs, %llu API calls in %.1fs: %.1f million/min\n",
+            random_runs, (unsigned long long)api_calls, s_cpu,
+            api_calls / s_cpu * 60 / 1e6);
+    fprintf(stdout, "FUZZ_RAMP PASSED\n");
+    return 0;
+  }
+  if (i == argc) {
+    run_file(stdin);
+    return 0;
+  }
+  for (; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    run_file(f);
+    fclose(f);
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,161 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "RampCalculator.h"
+
+// This is compiled with TEST_QUIET to silence the debug output of
+// RampCalculator.h, but the benchmark results shall be printed
+#undef printf
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+uint32_t fas_test_critical_sections = 0;
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// Benchmark of the PoorManFloat variant against double precision.
+//
+// This file is compiled twice: pmf_bench uses PoorManFloat.cpp and
+// pmf32_bench is compiled with FAS_PMF_32BIT and uses PoorManFloat32.cpp.
+//
+// Reported are:
+//   - relative error of pmfl_to_u32(pmfl_from(x))
+//   - relative error of ramp_config_s::calculate_ticks() against the ideal
+//     ramp for a grid of acceleration and s_h. The unavoidable error of the
+//     integer ticks (+-0.5) is not counted
+//   - number of tick jumps: calculate_ticks(s+1) > calculate_ticks(s) during
+//     acceleration, which means the speed drops while it should increase
+//   - run time of the conversions and calculate_ticks()
+
+#if defined(FAS_PMF_32BIT)
+#define VARIANT "32 bit"
+#else
+#define VARIANT "16 bit"
+#endif
+
+#define ELEMENTS(x) (sizeof(x) / sizeof(x[0]))
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct error_s {
+  double max;
+  double sum;
+  uint32_t n;
+};
+
+static void add_error(struct error_s *e, double ideal, double value,
+                      double tolerance) {
+  double err = fabs(value - ideal) - tolerance;
+  if (err < 0) {
+    err = 0;
+  }
+  err /= ideal;
+  if (err > e->max) {
+    e->max = err;
+  }
+  e->sum += err;
+  e->n++;
+}
+
+// ideal ramp as per RampCalculator.h with linear acceleration for s < s_h
+static double ideal_ticks(uint32_t steps, double accel, uint32_t s_h) {
+  if (steps >= s_h) {
+    double s = steps - ((s_h + 2) >> 2);
+    return TICKS_PER_S / sqrt(2.0 * accel * s);
+  }
+  double cubic = TICKS_PER_S * sqrt(cbrt((double)s_h) / (1.5 * accel));
+  return cubic / pow(steps, 2.0 / 3.0);
+}
+
+volatile uint32_t sink;
+
+int main() {
+  printf("PoorManFloat %s variant\n", VARIANT);
+
+  // Conversion round trip
+  struct error_s conv = {0, 0, 0};
+  for (double x = 1.0; x < 4.0e9; x *= 1.0001) {
+    uint32_t v = (uint32_t)x;
+    uint32_t r = pmfl_to_u32(pmfl_from(v));
+    add_error(&conv, v, r, 0);
+  }
+  printf("conversion u32->pmfl->u32: max error=%.2e avg error=%.2e\n",
+         conv.max, conv.sum / conv.n);
+
+  // Ramp calculation
+  static const uint32_t accelerations[] = {100, 1000, 10000, 100000, 1000000};
+  static const uint32_t linear_steps[] = {0, 1000};
+  struct error_s ramp = {0, 0, 0};
+  uint32_t jumps = 0;
+  for (uint8_t ai = 0; ai < ELEMENTS(accelerations); ai++) {
+    for (uint8_t li = 0; li < ELEMENTS(linear_steps); li++) {
+      struct ramp_config_s c;
+      c.init();
+      c.parameters.setAcceleration(accelerations[ai]);
+      c.parameters.setSpeedInTicks(TICKS_PER_S / 1000000);
+      c.parameters.setCubicAccelerationSteps(linear_steps[li]);
+      c.update();
+      struct error_s e = {0, 0, 0};
+      uint32_t last_ticks = 0xffffffff;
+      uint32_t j = 0;
+      for (uint32_t s = 1; s <= 100000; s++) {
+        uint32_t ticks = c.calculate_ticks(s);
+        if (ticks < TICKS_PER_S / 1000000) {
+          break;
+        }
+        if (ticks > last_ticks) {
+          j++;
+        }
+        last_ticks = ticks;
+        double ideal = ideal_ticks(s, accelerations[ai], c.parameters.s_h);
+        add_error(&e, ideal, ticks, 0.5);
+        add_error(&ramp, ideal, ticks, 0.5);
+      }
+      jumps += j;
+      printf(
+          "ramp a=%7u s_h=%4u: max error=%.2e avg error=%.2e tick jumps=%u\n",
+          accelerations[ai], linear_steps[li], e.max, e.sum / e.n, j);
+    }
+  }
+  printf("ramp total: max error=%.2e avg error=%.2e tick jumps=%u\n", ramp.max,
+         ramp.sum / ramp.n, jumps);
+
+  // Speed
+  const uint32_t loops = 10000000;
+  uint64_t t0 = now_ns();
+  uint32_t acc = 0;
+  for (uint32_t i = 1; i <= loops; i++) {
+    acc += pmfl_to_u32(pmfl_from(i * 419));
+  }
+  uint64_t t_conv = now_ns() - t0;
+  sink = acc;
+
+  struct ramp_config_s c;
+  c.init();
+  c.parameters.setAcceleration(10000);
+  c.parameters.setSpeedInTicks(TICKS_PER_S / 1000000);
+  c.update();
+  t0 = now_ns();
+  for (uint32_t i = 1; i <= loops; i++) {
+    acc += c.calculate_ticks((i & 0xfffff) + 1);
+  }
+  uint64_t t_calc = now_ns() - t0;
+  sink = acc;
+  printf("run time: pmfl_from+pmfl_to_u32=%.1f ns calculate_ticks=%.1f ns\n",
+         (double)t_conv / loops, (double)t_calc / loops);
+  return 0;
+}
@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Command line driven simulation of FastAccelStepper using the commands of
+// the StepperDemo (subset):
+//
+//   M1/M2/...  select stepper
+//   V<us>      speed in us/step
+//   H<hz>      speed in steps/s
+//   A<accel>   acceleration in steps/s^2
+//   J<steps>   linear acceleration steps from standstill
+//   j<steps>   linear acceleration steps for speed changes
+//   P<pos>     moveTo(pos)
+//   R<n>       move(n)
+//   f / b      runForward() / runBackward()
+//   K          forceStopAndNewPosition(0)
+//   S          stopMove()
+//   U          applySpeedAcceleration()
+//   W          wait until the selected stepper has stopped
+//   w<ms>      wait for the given time
+//
+// Example:
+//   ./pulse_sim -o ramp.fasp M1 V20 A10000 P100000 W M2 V50 A5000 R-30000 W
+//
+// Options:
+//   -o <file>  write binary pulse timeline (see PulseSimulator.h)
+//   -c <us>    cycle time of the stepper task (default 1000us*DELAY_MS_BASE)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+uint32_t cycle_ticks = TICKS_PER_S / 1000 * DELAY_MS_BASE;
+
+static double wall_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void cycle() {
+  engine.manageSteppers();
+  sim.advance(cycle_ticks);
+}
+
+static bool wait_stopped(FastAccelStepper *s) {
+  // A timeout of one simulated hour catches endless runs e.g. after f/b
+  uint64_t end = sim.now + (uint64_t)TICKS_PER_S * 3600;
+  while (s->isRunning()) {
+    if (sim.now >= end) {
+      return false;
+    }
+    cycle();
+  }
+  return true;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-o timeline] [-c cycle_us] commands...\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *timeline = NULL;
+  int argi = 1;
+  while ((argi < argc) && (argv[argi][0] == '-') &&
+         ((argv[argi][1] == 'o') || (argv[argi][1] == 'c'))) {
+    if (argi + 1 >= argc) {
+      usage(argv[0]);
+    }
+    if (argv[argi][1] == 'o') {
+      timeline = argv[argi + 1];
+    } else {
+      cycle_ticks = atol(argv[argi + 1]) * (TICKS_PER_S / 1000000);
+    }
+    argi += 2;
+  }
+  if (argi >= argc) {
+    usage(argv[0]);
+  }
+
+  engine.init();
+  FastAccelStepper *stepper[NUM_QUEUES];
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    stepper[i] = engine.stepperConnectToPin(i + 1);
+    assert(stepper[i] != NULL);
+    stepper[i]->setDirectionPin(NUM_QUEUES + 1 + i);
+  }
+  if ((timeline != NULL) && !sim.open_timeline(timeline)) {
+    fprintf(stderr, "Cannot create %s\n", timeline);
+    return 1;
+  }
+
+  double t_start = wall_time();
+  FastAccelStepper *s = stepper[0];
+  for (; argi < argc; argi++) {
+    const char *cmd = argv[argi];
+    long val = atol(&cmd[1]);
+    int8_t res = 0;
+    switch (cmd[0]) {
+      case 'M':
+        if ((val < 1) || (val > NUM_QUEUES)) {
+          fprintf(stderr, "Invalid stepper %s\n", cmd);
+          return 1;
+        }
+        s = stepper[val - 1];
+        break;
+      case 'V':
+        res = s->setSpeedInUs(val);
+        break;
+      case 'H':
+        res = s->setSpeedInHz(val);
+        break;
+      case 'A':
+        res = s->setAcceleration(val);
+        break;
+      case 'J':
+        s->setLinearAcceleration(val);
+        break;
+      case 'j':
+        s->setJumpStart(val);
+        break;
+      case 'P':
+        res = s->moveTo(val);
+        break;
+      case 'R':
+        res = s->move(val);
+        break;
+      case 'f':
+        res = s->runForward();
+        break;
+      case 'b':
+        res = s->runBackward();
+        break;
+      case 'K':
+        s->forceStopAndNewPosition(0);
+        break;
+      case 'S':
+        s->stopMove();
+        break;
+      case 'U':
+        s->applySpeedAcceleration();
+        break;
+      case 'W':
+        if (!wait_stopped(s)) {
+          fprintf(stderr, "Stepper does not stop\n");
+          return 1;
+        }
+        break;
+      case 'w':
+        for (long t = 0; t < val; t += DELAY_MS_BASE) {
+          cycle();
+        }
+        break;
+      default:
+        fprintf(stderr, "Unknown command %s\n", cmd);
+        return 1;
+    }
+    if (res != 0) {
+      fprintf(stderr, "Command %s returned error %d\n", cmd, res);
+      return 1;
+    }
+  }
+  // Finish all pending moves
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    if (!wait_stopped(stepper[i])) {
+      fprintf(stderr, "Stepper %d does not stop\n", i + 1);
+      return 1;
+    }
+  }
+  double t_wall = wall_time() - t_start;
+  sim.close_timeline();
+
+  uint64_t steps = 0;
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    steps += sim.q[i].steps;
+    printf("M%d: pos=%d steps=%llu starts=%u dir_changes=%u dir_errors=%u\n",
+           i + 1, stepper[i]->getCurrentPosition(),
+           (unsigned long long)sim.q[i].steps, sim.q[i].starts,
+           sim.q[i].dir_changes, sim.q[i].dir_errors);
+  }
+  printf("simulated %.3fs, %llu steps, %llu events in %.3fs => %.2f Msteps/s\n",
+         sim.now * 1.0 / TICKS_PER_S, (unsigned long long)steps,
+         (unsigned long long)sim.events, t_wall,
+         t_wall > 0 ? steps / t_wall * 1e-6 : 0.0);
+  return 0;
+}
@@ -0,0 +1,333 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FastAccelStepper.h"
+#include "RampGenerator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// Micro benchmark of the ramp generator.
+//
+// The fill_queue() loop calls for each queue entry getNextCommand() and
+// afterCommandEnqueued(). On avr this runs in the timer overflow interrupt
+// and on esp32 in the StepperTask. This benchmark executes these calls for
+// a grid of acceleration, speed, linear acceleration steps (s_h) and move
+// length. Each call pair is timed individually.
+//
+// Reported are per grid point:
+//   ns/cmd    average time per command
+//   p99/max   99th percentile and max. time per command in ns
+//   cmds      commands generated for the complete ramp
+//
+// The max value includes scheduling jitter of the host, so p99 is the more
+// stable figure.
+//
+// The last line is the summary over all grid points, which should be tracked
+// for changes of the ramp generator. Run it with: make bench
+//
+// Option -c <entries> runs the benchmark with a ramp ticks cache. Each ramp
+// starts with an invalidated cache.
+//
+// Afterwards fill_queue() is compared with the filling of one queue entry
+// after the other as before the batched queue fill. Reported are the
+// critical sections (interrupts disabled) per filled ms and the run time
+// per command. Between two fill_queue() calls the simulated isr drains the
+// queue for the fill period of the avr.
+
+static const uint32_t accelerations[] = {1000, 10000, 100000, 1000000};
+static const uint32_t speeds_us[] = {5, 20, 100, 1000};
+static const uint32_t linear_steps[] = {0, 100, 5000};
+static const int32_t moves[] = {100, 10000, 1000000};
+static const uint32_t fill_speeds_us[] = {20, 50, 200, 1000};
+// fill_queue() is called on avr with the timer overflow
+#define FILL_PERIOD_TICKS 65536
+
+#define ELEMENTS(x) (sizeof(x) / sizeof(x[0]))
+
+static uint32_t *ticks_cache = NULL;
+static uint16_t ticks_cache_entries = 0;
+
+static uint32_t *samples = NULL;
+static uint32_t samples_size = 0;
+static uint32_t *all_samples = NULL;
+static uint32_t all_samples_size = 0;
+static uint32_t all_samples_cnt = 0;
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t va = *(const uint32_t *)a;
+  uint32_t vb = *(const uint32_t *)b;
+  return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static void add_sample(uint32_t cnt, uint32_t ns) {
+  if (cnt >= samples_size) {
+    samples_size = samples_size == 0 ? 65536 : samples_size * 2;
+    samples = (uint32_t *)realloc(samples, samples_size * sizeof(uint32_t));
+    assert(samples != NULL);
+  }
+  samples[cnt] = ns;
+}
+
+static void add_to_summary(uint32_t cnt) {
+  if (all_samples_cnt + cnt > all_samples_size) {
+    while (all_samples_cnt + cnt > all_samples_size) {
+      all_samples_size =
+          all_samples_size == 0 ? 1048576 : all_samples_size * 2;
+    }
+    all_samples = (uint32_t *)realloc(all_samples,
+                                      all_samples_size * sizeof(uint32_t));
+    assert(all_samples != NULL);
+  }
+  memcpy(&all_samples[all_samples_cnt], samples, cnt * sizeof(uint32_t));
+  all_samples_cnt += cnt;
+}
+
+struct result_s {
+  uint32_t cmds;
+  uint64_t total_ns;
+  uint32_t p99_ns;
+  uint32_t max_ns;
+};
+
+static void evaluate(uint32_t *s, uint32_t cnt, uint64_t total_ns,
+                     struct result_s *res) {
+  qsort(s, cnt, sizeof(uint32_t), cmp_u32);
+  res->cmds = cnt;
+  res->total_ns = total_ns;
+  res->p99_ns = s[(uint32_t)((cnt - 1) * 0.99)];
+  res->max_ns = s[cnt - 1];
+}
+
+// Execute one move from standstill to standstill.
+static bool run_ramp(RampGenerator *rg, uint32_t accel, uint32_t speed_us,
+                     uint32_t s_h, int32_t move, struct result_s *res) {
+  struct queue_end_s qe;
+  qe.pos = 0;
+  qe.count_up = true;
+  qe.dir = true;
+
+  rg->init();
+  rg->setTargetPosition(0);
+  rg->setSpeedInTicks(speed_us * (TICKS_PER_S / 1000000));
+  rg->setAcceleration(accel);
+  rg->setLinearAcceleration(s_h);
+  rg->setTicksCache(ticks_cache, ticks_cache_entries);
+  if (rg->move(move, &qe) != MOVE_OK) {
+    return false;
+  }
+
+  NextCommand cmd;
+  uint32_t cnt = 0;
+  uint64_t total_ns = 0;
+  while (rg->isRampGeneratorActive()) {
+    uint64_t t0 = now_ns();
+    rg->getNextCommand(&qe, &cmd);
+    rg->afterCommandEnqueued(&cmd);
+    uint64_t dt = now_ns() - t0;
+    if (cmd.command.ticks == 0) {
+      break;
+    }
+    total_ns += dt;
+    add_sample(cnt++, dt);
+    // this is done by addQueueEntry()
+    if (cmd.command.count_up) {
+      qe.pos += cmd.command.steps;
+    } else {
+      qe.pos -= cmd.command.steps;
+    }
+    qe.count_up = cmd.command.count_up;
+  }
+  if ((qe.pos != move) || (cnt == 0)) {
+    printf("move %d ended at %d\n", move, qe.pos);
+    return false;
+  }
+  add_to_summary(cnt);
+  evaluate(samples, cnt, total_ns, res);
+  return true;
+}
+
+class FastAccelStepperTest {
+ public:
+  FastAccelStepper s;
+
+  void init(uint32_t speed_us, int32_t move) {
+    StepperQueue *q = &fas_queue[0];
+    q->_initVars();
+    q->queue_end.pos = 0;
+    q->queue_end.count_up = true;
+    q->queue_end.dir = true;
+    s = FastAccelStepper();
+    s.init(NULL, 0, 0);
+    s.setDirectionPin(0);
+    s.setSpeedInUs(speed_us);
+    s.setAcceleration(100000);
+    int8_t res = s.move(move);
+    assert(res == MOVE_OK);
+  }
+
+  // The queue fill one entry after the other
+  void fill_queue_per_entry() {
+    StepperQueue *q = &fas_queue[0];
+    NextCommand cmd;
+    bool delayed_start = !q->isRunning();
+    uint32_t ticksPrepared = q->ticksInQueue();
+    while (!s.isQueueFull() &&
+           ((ticksPrepared < TICKS_PER_S / 50) || q->queueEntries() <= 1) &&
+           s._rg.isRampGeneratorActive()) {
+      s._rg.getNextCommand(&q->queue_end, &cmd);
+      if (cmd.command.ticks == 0) {
+        // ramp completed
+        s._rg.afterCommandEnqueued(&cmd);
+        break;
+      }
+      if (s.addQueueEntry(&cmd.command, !delayed_start) != AQE_OK) {
+        break;
+      }
+      s._rg.afterCommandEnqueued(&cmd);
+      ticksPrepared += cmd.command.steps <= 1
+                           ? cmd.command.ticks
+                           : (uint32_t)cmd.command.ticks * cmd.command.steps;
+    }
+    if (delayed_start) {
+      s.addQueueEntry(NULL, true);
+    }
+  }
+
+  // Drain the queue for one fill period as the isr would do
+  uint32_t drain(uint32_t *carry_ticks) {
+    StepperQueue *q = &fas_queue[0];
+    uint32_t drained = 0;
+    while ((*carry_ticks < FILL_PERIOD_TICKS) &&
+           (q->read_idx != q->next_write_idx)) {
+      struct queue_entry *e = &q->entry[q->read_idx & QUEUE_LEN_MASK];
+      uint32_t ticks = e->ticks;
+      if (e->steps > 1) {
+        ticks *= e->steps;
+      }
+      *carry_ticks += ticks;
+      drained += ticks;
+      q->read_idx++;
+    }
+    *carry_ticks -= fas_min(*carry_ticks, FILL_PERIOD_TICKS);
+    if (q->read_idx == q->next_write_idx) {
+      q->_isRunning = false;
+    }
+    return drained;
+  }
+
+  void run(uint32_t speed_us, bool batched) {
+    init(speed_us, 100000);
+    uint32_t sections = 0;
+    uint64_t filled_ticks = 0;
+    uint64_t fill_ns = 0;
+    uint32_t cmds = 0;
+    uint32_t carry_ticks = 0;
+    while (s.isRampGeneratorActive() || !s.isQueueEmpty()) {
+      uint8_t before = fas_queue[0].next_write_idx;
+      uint32_t cs = fas_test_critical_sections;
+      uint64_t t0 = now_ns();
+      if (batched) {
+        s.fill_queue();
+      } else {
+        fill_queue_per_entry();
+      }
+      fill_ns += now_ns() - t0;
+      sections += fas_test_critical_sections - cs;
+      cmds += (uint8_t)(fas_queue[0].next_write_idx - before);
+      filled_ticks += drain(&carry_ticks);
+    }
+    double filled_ms = filled_ticks * 1000.0 / TICKS_PER_S;
+    printf("%-10s %5u %8u %9.1f %11.2f %7.1f\n",
+           batched ? "batched" : "per entry", speed_us, cmds, filled_ms,
+           sections / filled_ms, (double)fill_ns / cmds);
+  }
+
+  void run_all() {
+    printf("\n%-10s %5s %8s %9s %11s %7s\n", "fill", "us", "cmds", "ms",
+           "crit/ms", "ns/cmd");
+    for (uint8_t vi = 0; vi < ELEMENTS(fill_speeds_us); vi++) {
+      run(fill_speeds_us[vi], false);
+      run(fill_speeds_us[vi], true);
+    }
+  }
+};
+
+int main(int argc, char **argv) {
+  RampGenerator rg;
+  uint64_t total_ns = 0;
+
+  if ((argc == 3) && (strcmp(argv[1], "-c") == 0)) {
+    ticks_cache_entries = atoi(argv[2]);
+    ticks_cache = (uint32_t *)malloc(ticks_cache_entries * sizeof(uint32_t));
+    assert(ticks_cache != NULL);
+  } else if (argc != 1) {
+    printf("Usage: %s [-c ticks_cache_entries]\n", argv[0]);
+    return 1;
+  }
+  printf("ticks cache entries: %u\n", ticks_cache_entries);
+
+  // warm up caches and cpu frequency
+  struct result_s res;
+  for (uint8_t i = 0; i < 10; i++) {
+    run_ramp(&rg, 100000, 10, 0, 100000, &res);
+  }
+  all_samples_cnt = 0;
+
+  printf("%8s %5s %5s %8s %8s %7s %7s %7s\n", "accel", "us", "s_h", "move",
+         "cmds", "ns/cmd", "p99", "max");
+  for (uint8_t ai = 0; ai < ELEMENTS(accelerations); ai++) {
+    for (uint8_t vi = 0; vi < ELEMENTS(speeds_us); vi++) {
+      for (uint8_t li = 0; li < ELEMENTS(linear_steps); li++) {
+        for (uint8_t mi = 0; mi < ELEMENTS(moves); mi++) {
+          if (!run_ramp(&rg, accelerations[ai], speeds_us[vi],
+                        linear_steps[li], moves[mi], &res)) {
+            printf("FAILED\n");
+            return 1;
+          }
+          total_ns += res.total_ns;
+          printf("%8u %5u %5u %8d %8u %7.1f %7u %7u\n", accelerations[ai],
+                 speeds_us[vi], linear_steps[li], moves[mi], res.cmds,
+                 (double)res.total_ns / res.cmds, res.p99_ns, res.max_ns);
+        }
+      }
+    }
+  }
+  uint32_t ramps = ELEMENTS(accelerations) * ELEMENTS(speeds_us) *
+                   ELEMENTS(linear_steps) * ELEMENTS(moves);
+  evaluate(all_samples, all_samples_cnt, total_ns, &res);
+  printf(
+      "SUMMARY: %u ramps, %u cmds, %.1f cmds/ramp, %.1f ns/cmd, p99=%u ns, "
+      "max=%u ns\n",
+      ramps, res.cmds, (double)res.cmds / ramps,
+      (double)res.total_ns / res.cmds, res.p99_ns, res.max_ns);
+
+  FastAccelStepperTest fill;
+  fill.run_all();
+
+  free(samples);
+  free(all_samples);
+  free(ticks_cache);
+  return 0;
+}
@@ -7,6 +7,8 @@
 
 // Not a real test case
 
+uint32_t fas_test_critical_sections = 0;
+
 int main() {
   uint32_t res;
 
@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// Stress test of the lock-free StepperQueue (FAS_SPSC_QUEUE).
+//
+// The main thread is the producer and adds the commands alternating with
+// addQueueEntry() and as batch. A second thread acts as the isr and consumes
+// the entries. A third thread polls like an application task on another
+// core. Checked are:
+// - the isr sees every command unchanged and in order
+// - queueEntries() never exceeds QUEUE_LEN
+// - getCurrentPosition() is monotonic and between the positions reported by
+//   the isr before and after the call. A torn read of queue_end or of the
+//   entry is off by 0x4000 or more
+// - adding and polling need no critical section
+// The threads yield, if they have to wait, so the test works on a single
+// cpu, too. Then the preemption of the threads creates the interleaving.
+//
+// Built and run by:
+//     make test_spsc
+
+#if !defined(SUPPORT_SPSC_QUEUE)
+#error "spsc_stress needs the build flag FAS_SPSC_QUEUE"
+#endif
+
+#define COMMANDS 500000
+#define MAX_STEPS 3
+
+StepperQueue *q = &fas_queue[0];
+volatile int32_t isr_pos = 0;  // position after the completed entries
+volatile bool done = false;
+
+// The command number i is encoded in ticks and steps
+void command_for(uint32_t i, struct stepper_command_s *cmd) {
+  cmd->steps = 1 + i % MAX_STEPS;
+  cmd->ticks = MIN_CMD_TICKS + i % 10007;
+  cmd->count_up = true;
+}
+
+void *isr_thread(void *arg) {
+  uint32_t i = 0;
+  int32_t pos = 0;
+  while (i < COMMANDS) {
+    fas_queue_idx_t rp = q->read_idx;
+    if (rp == fas_load_acquire(&q->next_write_idx)) {
+      sched_yield();
+      continue;
+    }
+    struct queue_entry *e = &q->entry[rp & QUEUE_LEN_MASK];
+    struct stepper_command_s cmd;
+    command_for(i, &cmd);
+    if ((e->steps != cmd.steps) || (e->ticks != cmd.ticks) ||
+        (e->countUp != 1)) {
+      printf("entry %u corrupted: steps=%u ticks=%u\n", i, e->steps,
+             e->ticks);
+      abort();
+    }
+    pos += e->steps;
+    test(e->end_pos_last16 == (fas_entry_pos_t)pos, "wrong end position");
+    fas_store_release(&isr_pos, pos);
+    fas_store_release(&q->read_idx, (fas_queue_idx_t)(rp + 1));
+    i++;
+  }
+  return NULL;
+}
+
+uint32_t polls = 0;
+
+void check_position() {
+  int32_t before = fas_load_acquire(&isr_pos);
+  int32_t pos = q->getCurrentPosition();
+  int32_t after = fas_load_acquire(&isr_pos);
+  if ((pos < before - MAX_STEPS) || (pos > after)) {
+    printf("position %d outside of %d..%d\n", pos, before, after);
+    abort();
+  }
+  test(q->queueEntries() <= QUEUE_LEN, "too many entries");
+}
+
+void *poll_thread(void *arg) {
+  int32_t last = 0;
+  while (!fas_load_acquire(&done)) {
+    check_position();
+    int32_t pos = q->getCurrentPosition();
+    test(pos >= last, "position not monotonic");
+    last = pos;
+    polls++;
+    if ((polls & 15) == 0) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+int main() {
+  q->init(0, 0);
+  fas_test_critical_sections = 0;
+
+  pthread_t isr;
+  pthread_t poll;
+  test(pthread_create(&isr, NULL, isr_thread, NULL) == 0, "no isr thread");
+  test(pthread_create(&poll, NULL, poll_thread, NULL) == 0, "no poll thread");
+
+  uint32_t i = 0;
+  uint32_t full = 0;
+  uint32_t batches = 0;
+  struct stepper_command_s cmd;
+  while (i < COMMANDS) {
+    if ((i / 64) & 1) {
+      struct queue_batch_s batch;
+      q->beginBatch(&batch);
+      while (i < COMMANDS) {
+        command_for(i, &cmd);
+        if (q->addBatchEntry(&batch, &cmd) != AQE_OK) {
+          break;
+        }
+        i++;
+      }
+      if (batch.entries > 0) {
+        batches++;
+      }
+      test(q->commitBatch(&batch, false) == AQE_OK, "commit failed");
+    } else {
+      command_for(i, &cmd);
+      int8_t res = q->addQueueEntry(&cmd, false);
+      if (res == AQE_OK) {
+        i++;
+      } else {
+        test(res == AQE_QUEUE_FULL, "unexpected error");
+      }
+    }
+    if (q->isQueueFull()) {
+      full++;
+      check_position();
+      sched_yield();
+    }
+  }
+  pthread_join(isr, NULL);
+  fas_store_release(&done, true);
+  pthread_join(poll, NULL);
+
+  int32_t end_pos = 0;
+  for (uint32_t j = 0; j < COMMANDS; j++) {
+    command_for(j, &cmd);
+    end_pos += cmd.steps;
+  }
+  printf("%u commands, %u batches, queue full %u times, %u polls\n", COMMANDS,
+         batches, full, polls);
+  test(q->isQueueEmpty(), "queue not empty");
+  test(q->getCurrentPosition() == end_pos, "wrong end position");
+  test(q->queue_end.pos == end_pos, "wrong queue end");
+  test(fas_test_critical_sections == 0, "critical section used");
+  printf("SPSC_STRESS PASSED\n");
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Benchmark of the steps per queue entry for a long move.
+//
+// A move of 1M steps is executed on the PulseSimulator with a 1ms loop for
+// several speeds. Built normally and with FAS_WIDE_STEPS by:
+//     make bench
+//
+// Reported are per speed:
+//   entries   queue entries of the move. The esp32 mcpwm/pcnt and rmt isr
+//             and the sam due isr run once per entry
+//   per s     queue entries per s while coasting
+//   fills     calls of fill_queue() with active ramp
+//   per fill  ramp generator commands per fill_queue()
+//   max steps max. steps of a queue entry
+//   stop      steps of stopMove() at full speed beyond the ramp's v²/2a
+
+#define MOVE_STEPS 1000000
+#define ACCEL 1000000
+#define CYCLE_TICKS (TICKS_PER_S / 1000)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+
+static const uint32_t speeds_hz[] = {20000, 50000, 100000, 200000};
+
+static uint32_t max_steps;
+static uint32_t entries;
+static fas_queue_idx_t last_wp;
+
+// counts the entries added since the last call
+static void count_entries() {
+  fas_queue_idx_t wp = fas_queue[0].next_write_idx;
+  while (last_wp != wp) {
+    struct queue_entry *e = &fas_queue[0].entry[last_wp & QUEUE_LEN_MASK];
+    if (e->hasSteps) {
+      max_steps = fas_max(max_steps, (uint32_t)e->steps);
+    }
+    entries++;
+    last_wp++;
+  }
+}
+
+static void cycle() {
+  engine.manageSteppers();
+  count_entries();
+  sim.advance(CYCLE_TICKS);
+}
+
+int main() {
+  engine.init();
+  FastAccelStepper *s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(ACCEL);
+
+  printf("FAS_WIDE_STEPS %s, max. %u steps per entry\n",
+#if defined(SUPPORT_WIDE_STEPS)
+         "on",
+#else
+         "off",
+#endif
+         MAX_CMD_STEPS);
+  printf("%8s %9s %8s %7s %8s %9s %6s\n", "speed", "entries", "per s",
+         "fills", "per fill", "max steps", "stop");
+  for (uint8_t i = 0; i < sizeof(speeds_hz) / sizeof(speeds_hz[0]); i++) {
+    uint32_t hz = speeds_hz[i];
+    sim.reset();
+    s->setCurrentPosition(0);
+    s->setSpeedInHz(hz);
+    struct stepper_stats_s stats;
+    s->getStats(&stats, true);
+    last_wp = fas_queue[0].next_write_idx;
+    entries = 0;
+    max_steps = 0;
+    test(s->move(MOVE_STEPS) == MOVE_OK, "move failed");
+    uint32_t coast_entries = 0;
+    uint32_t coast_ms = 0;
+    while (s->isRunning()) {
+      uint32_t before = entries;
+      cycle();
+      if ((s->rampState() & RAMP_STATE_MASK) == RAMP_STATE_COAST) {
+        coast_entries += entries - before;
+        coast_ms++;
+      }
+    }
+    s->getStats(&stats, true);
+    uint32_t move_entries = entries;
+    test(s->getCurrentPosition() == MOVE_STEPS, "position");
+    test(sim.q[0].pos == MOVE_STEPS, "simulated position");
+    test(stats.underruns == 0, "underruns");
+
+    // stopMove() in the middle of a coast
+    sim.reset();
+    s->setCurrentPosition(0);
+    test(s->move(MOVE_STEPS) == MOVE_OK, "move failed");
+    while (s->getCurrentPosition() < MOVE_STEPS / 2) {
+      cycle();
+    }
+    int32_t stop_pos = s->getCurrentPosition();
+    s->stopMove();
+    while (s->isRunning()) {
+      cycle();
+    }
+    int32_t ramp_steps = (uint64_t)hz * hz / 2 / ACCEL;
+    int32_t extra = s->getCurrentPosition() - stop_pos - ramp_steps;
+
+    printf("%8u %9u %8u %7u %8.2f %9u %6d\n", hz, move_entries,
+           coast_ms ? coast_entries * 1000 / coast_ms : 0, stats.fills,
+           (double)stats.commands / stats.fills, max_steps, extra);
+  }
+  return 0;
+}
@@ -0,0 +1,288 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Comparison of a command stream against its golden file, see
+// StreamRecorder.h. Files ending with .gz are read via gzip.
+//
+// Usage:
+//     ./stream_compare [-t <ticks>] [-v] <golden> <stream>
+//
+// The queue entries are expanded into the times of the single steps, so a
+// different split of the same steps into queue entries is no divergence.
+// For each scenario and queue are reported:
+// - the first step with different time or direction
+// - the delta of the total time of all entries
+// - per move, which is a sequence of steps in one direction, the deltas of
+//   start, acceleration, coasting and deceleration. Coasting is from the
+//   first to the last step period equal to the minimum period of the move.
+//
+// Returns 0, if the number and direction of the steps are identical and no
+// step time, total time or phase duration differs by more than the
+// tolerance given with -t (default 0 ticks). With -v the matching scenarios
+// are listed, too.
+
+#define MAX_QUEUES 16
+#define TICKS_PER_S 16000000.0
+
+struct step_list_s {
+  uint64_t *t;
+  uint8_t *dir;
+  uint32_t n;
+  uint32_t cap;
+  uint64_t end;
+};
+
+struct stream_s {
+  struct step_list_s *lists;  // [scenario * MAX_QUEUES + queue]
+  uint16_t scenarios;
+};
+
+static void add_step(struct step_list_s *l, uint64_t t, uint8_t dir) {
+  if (l->n == l->cap) {
+    l->cap = l->cap ? 2 * l->cap : 1024;
+    l->t = (uint64_t *)realloc(l->t, l->cap * sizeof(l->t[0]));
+    l->dir = (uint8_t *)realloc(l->dir, l->cap * sizeof(l->dir[0]));
+    if ((l->t == NULL) || (l->dir == NULL)) {
+      fprintf(stderr, "out of memory\n");
+      exit(2);
+    }
+  }
+  l->t[l->n] = t;
+  l->dir[l->n] = dir;
+  l->n++;
+}
+
+static bool read_stream(const char *fname, struct stream_s *s) {
+  memset(s, 0, sizeof(*s));
+  size_t len = strlen(fname);
+  bool gz = (len > 3) && (strcmp(fname + len - 3, ".gz") == 0);
+  FILE *f;
+  if (gz) {
+    if (access(fname, R_OK) != 0) {
+      perror(fname);
+      return false;
+    }
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "gzip -dc '%s'", fname);
+    f = popen(cmd, "r");
+  } else {
+    f = fopen(fname, "r");
+  }
+  if (f == NULL) {
+    perror(fname);
+    return false;
+  }
+  char line[100];
+  uint32_t line_nr = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line_nr++;
+    unsigned int scenario, queue, steps, ticks, dir;
+    if (sscanf(line, "scenario %u", &scenario) == 1) {
+      s->scenarios++;
+      s->lists = (struct step_list_s *)realloc(
+          s->lists, s->scenarios * MAX_QUEUES * sizeof(s->lists[0]));
+      memset(&s->lists[(s->scenarios - 1) * MAX_QUEUES], 0,
+             MAX_QUEUES * sizeof(s->lists[0]));
+      continue;
+    }
+    if ((sscanf(line, "%u %u %u %u", &queue, &steps, &ticks, &dir) != 4) ||
+        (s->scenarios == 0) || (queue >= MAX_QUEUES)) {
+      fprintf(stderr, "%s:%u: invalid line\n", fname, line_nr);
+      ok = false;
+      break;
+    }
+    struct step_list_s *l = &s->lists[(s->scenarios - 1) * MAX_QUEUES + queue];
+    for (unsigned int i = 0; i < steps; i++) {
+      add_step(l, l->end, dir);
+      l->end += ticks;
+    }
+    if (steps == 0) {
+      l->end += ticks;
+    }
+  }
+  if (gz) {
+    ok &= (pclose(f) == 0);
+  } else {
+    fclose(f);
+  }
+  return ok;
+}
+
+static int64_t max_abs_delta;
+
+static void update_max(int64_t delta) {
+  if (delta < 0) {
+    delta = -delta;
+  }
+  if (delta > max_abs_delta) {
+    max_abs_delta = delta;
+  }
+}
+
+// Durations of the phases of the move with the steps [b, e)
+static void move_phases(struct step_list_s *l, uint32_t b, uint32_t e,
+                        int64_t phase[4]) {
+  uint64_t min_period = UINT64_MAX;
+  for (uint32_t k = b; k + 1 < e; k++) {
+    uint64_t period = l->t[k + 1] - l->t[k];
+    if (period < min_period) {
+      min_period = period;
+    }
+  }
+  uint32_t first_min = b;
+  uint32_t last_min = b;
+  bool found = false;
+  for (uint32_t k = b; k + 1 < e; k++) {
+    if (l->t[k + 1] - l->t[k] == min_period) {
+      if (!found) {
+        first_min = k;
+        found = true;
+      }
+      last_min = k + 1;
+    }
+  }
+  phase[0] = l->t[b];
+  phase[1] = l->t[first_min] - l->t[b];
+  phase[2] = l->t[last_min] - l->t[first_min];
+  phase[3] = l->t[e - 1] - l->t[last_min];
+}
+
+static uint32_t move_end(struct step_list_s *l, uint32_t b) {
+  uint32_t e = b + 1;
+  while ((e < l->n) && (l->dir[e] == l->dir[b])) {
+    e++;
+  }
+  return e;
+}
+
+// Returns false, if steps or directions differ
+static bool compare_list(const char *name, uint16_t scenario, uint8_t queue,
+                         struct step_list_s *g, struct step_list_s *n,
+                         bool verbose) {
+  max_abs_delta = 0;
+  uint32_t common = g->n < n->n ? g->n : n->n;
+  uint32_t first = common;
+  bool dir_differs = false;
+  for (uint32_t k = 0; k < common; k++) {
+    int64_t delta = (int64_t)(n->t[k] - g->t[k]);
+    update_max(delta);
+    if ((first == common) && ((delta != 0) || (g->dir[k] != n->dir[k]))) {
+      first = k;
+    }
+    dir_differs |= g->dir[k] != n->dir[k];
+  }
+  int64_t total_delta = (int64_t)(n->end - g->end);
+  update_max(total_delta);
+  bool identical =
+      (first == common) && (g->n == n->n) && (total_delta == 0);
+  if (identical && !verbose) {
+    return true;
+  }
+  printf("%s scenario %u queue %u: %u/%u steps, total time %.6fs", name,
+         scenario, queue, g->n, n->n, g->end / TICKS_PER_S);
+  if (identical) {
+    printf(" identical\n");
+    return true;
+  }
+  printf(" delta %+lld ticks\n", (long long)total_delta);
+  if (first < common) {
+    printf("  first divergence at step %u @%.6fs: golden %llu dir %u, new %llu "
+           "dir %u\n",
+           first, g->t[first] / TICKS_PER_S, (unsigned long long)g->t[first],
+           g->dir[first], (unsigned long long)n->t[first], n->dir[first]);
+  } else if (g->n != n->n) {
+    printf("  first divergence at step %u: missing in %s\n", common,
+           g->n > n->n ? "new" : "golden");
+  }
+  if ((g->n != n->n) || dir_differs) {
+    return false;
+  }
+  const char *phase_name[4] = {"start", "accelerate", "coast", "decelerate"};
+  uint32_t move = 0;
+  for (uint32_t b = 0; b < g->n; b = move_end(g, b)) {
+    uint32_t e = move_end(g, b);
+    int64_t gp[4], np[4];
+    move_phases(g, b, e, gp);
+    move_phases(n, b, e, np);
+    move++;
+    if (memcmp(gp, np, sizeof(gp)) == 0) {
+      continue;
+    }
+    printf("  move %u (%u steps %s):", move, e - b, g->dir[b] ? "up" : "down");
+    for (uint8_t i = 0; i < 4; i++) {
+      update_max(np[i] - gp[i]);
+      printf(" %s %+lld", phase_name[i], (long long)(np[i] - gp[i]));
+    }
+    printf(" ticks\n");
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int64_t tolerance = 0;
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:v")) != -1) {
+    switch (opt) {
+      case 't':
+        tolerance = atoll(optarg);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-t <ticks>] [-v] <golden> <stream>\n",
+                argv[0]);
+        return 2;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-t <ticks>] [-v] <golden> <stream>\n",
+            argv[0]);
+    return 2;
+  }
+  const char *name = strrchr(argv[optind + 1], '/');
+  name = name ? name + 1 : argv[optind + 1];
+
+  struct stream_s golden, current;
+  if (!read_stream(argv[optind], &golden) ||
+      !read_stream(argv[optind + 1], &current)) {
+    return 2;
+  }
+  bool ok = true;
+  if (golden.scenarios != current.scenarios) {
+    printf("%s: %u scenarios in golden, %u in new\n", name, golden.scenarios,
+           current.scenarios);
+    ok = false;
+  }
+  uint16_t scenarios = golden.scenarios < current.scenarios
+                           ? golden.scenarios
+                           : current.scenarios;
+  uint16_t identical = 0;
+  int64_t max_delta = 0;
+  for (uint16_t s = 0; s < scenarios; s++) {
+    bool same = true;
+    for (uint8_t q = 0; q < MAX_QUEUES; q++) {
+      struct step_list_s *g = &golden.lists[s * MAX_QUEUES + q];
+      struct step_list_s *n = &current.lists[s * MAX_QUEUES + q];
+      if ((g->n == 0) && (n->n == 0) && (g->end == 0) && (n->end == 0)) {
+        continue;
+      }
+      ok &= compare_list(name, s + 1, q, g, n, verbose);
+      if (max_abs_delta > max_delta) {
+        max_delta = max_abs_delta;
+      }
+      same &= (max_abs_delta == 0) && (g->n == n->n);
+    }
+    identical += same ? 1 : 0;
+  }
+  ok &= max_delta <= tolerance;
+  printf("%s: %u scenarios, %u identical, max delta %lld ticks => %s\n", name,
+         scenarios, identical, (long long)max_delta,
+         !ok ? "DIFFERS" : (max_delta == 0 ? "MATCH" : "WITHIN TOLERANCE"));
+  return ok ? 0 : 1;
+}
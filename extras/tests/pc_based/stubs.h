@@ -12,9 +12,20 @@ void inject_fill_interrupt(int mark);
 #define _BV(x) 0
 #define ISR(x) void x()
 #define inline
-#define micros() 0
 
 #include <math.h>
+#include <stdint.h>
+
+// micros() returns 0, unless a test provides a clock
+extern uint32_t (*fas_test_clock)();
+uint32_t micros();
+
+// Silence the TEST diagnostics of the library for the simulation tools
+#ifdef TEST_QUIET
+#include <stdio.h>
+#define printf(...) ((void)0)
+#define puts(x) ((void)0)
+#endif
 
 #define abs(x) ((x) > 0 ? (x) : -(x))
 #define min(a, b) ((a) > (b) ? (b) : (a))
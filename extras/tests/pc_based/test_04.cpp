@@ -158,12 +158,56 @@ class FastAccelStepperTest {
     printf("CHECKSUM for %d/%d/%d: %d\n", steps, travel_dt, accel, s.checksum);
 #endif
   }
+  void speed_limit_raised_in_small_steps() {
+    puts("Test test_speed_limit_raised_in_small_steps");
+    init_queue();
+    FastAccelStepper s = FastAccelStepper();
+    s.init(NULL, 0, 0);
+    RampChecker rc = RampChecker();
+
+    // Raise the speed limit by 1 Hz on every fill up to 2500 Hz. Identified
+    // bug was a ramp up step count running away from the speed, so the
+    // deceleration started with a long coasting phase
+    s.setSpeedInHz(1000);
+    s.setAcceleration(1000);
+    s.runForward();
+    uint32_t speed_hz = 1000;
+    int32_t stop_pos = -1;
+    for (int i = 0; i < 100000; i++) {
+      if (!s.isRampGeneratorActive()) {
+        break;
+      }
+      if (speed_hz < 2500) {
+        speed_hz++;
+        s.setSpeedInHz(speed_hz);
+        s.applySpeedAcceleration();
+      } else if (stop_pos < 0) {
+        stop_pos = s.getPositionAfterCommandsCompleted();
+        s.stopMove();
+      }
+      s.fill_queue();
+      while (!s.isQueueEmpty()) {
+        rc.check_section(
+            &fas_queue[0].entry[fas_queue[0].read_idx & QUEUE_LEN_MASK]);
+        fas_queue[0].read_idx++;
+      }
+    }
+    assert(!s.isRampGeneratorActive());
+    assert(stop_pos > 0);
+
+    // 2500 Hz at 1000 steps/s² needs 3125 steps to stop
+    int32_t stop_steps = s.getCurrentPosition() - stop_pos;
+    printf("stop steps = %d\n", stop_steps);
+    assert(stop_steps >= 3125);
+    assert(stop_steps < 3200);
+  }
 };
 
 int main() {
   FastAccelStepperTest test;
   test.speed_increase();
   test.speed_decrease();
+  test.speed_limit_raised_in_small_steps();
   printf("TEST_04 PASSED\n");
   return 0;
 }
@@ -108,6 +108,12 @@ int main() {
     test.ramp(INT32_MAX, 50, s, false);
     puts("");
   }
+  // At high speed the last command of a short move must not get too short
+  for (uint16_t s = 1; s <= 255; s++) {
+    printf("test with high speed and steps s=%d\n", s);
+    test.ramp(10000000, 20, s, false);
+    puts("");
+  }
   printf("TEST_13 PASSED\n");
   return 0;
 }
@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+
+void run_and_compare_positions(FastAccelStepper *s[], uint8_t n) {
+  // manageSteppers() is called with the period of the stepper task and
+  // between the calls the isr is simulated. The position reported by
+  // getCurrentPosition() needs to match the simulated one.
+  for (uint32_t cycle = 0; cycle < 100000; cycle++) {
+    engine.manageSteppers();
+    bool running = false;
+    for (uint8_t i = 0; i < n; i++) {
+      running |= s[i]->isRunning();
+    }
+    if (!running) {
+      return;
+    }
+    sim.advance(CYCLE_TICKS);
+    for (uint8_t i = 0; i < n; i++) {
+      int32_t pos = s[i]->getCurrentPosition();
+      if (pos != sim.q[i].pos) {
+        printf("cycle %d stepper %d: position %d, simulated %d\n", cycle, i,
+               pos, sim.q[i].pos);
+      }
+      test(pos == sim.q[i].pos, "position mismatch");
+    }
+  }
+  test(false, "steppers do not stop");
+}
+
+void check_timeline(const char *fname, FastAccelStepper *s[], uint8_t n) {
+  PulseTimelineReader reader;
+  test(reader.open(fname), "cannot open timeline");
+  test(reader.num_queues == NUM_QUEUES, "wrong number of queues");
+  test(reader.ticks_per_s == TICKS_PER_S, "wrong ticks_per_s");
+
+  int32_t pos[NUM_QUEUES] = {0};
+  bool dir_high[NUM_QUEUES] = {false};
+  uint32_t steps[NUM_QUEUES] = {0};
+  uint32_t min_period[NUM_QUEUES];
+  uint64_t last_step[NUM_QUEUES] = {0};
+  uint64_t last_ticks = 0;
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    min_period[i] = ~0;
+  }
+  struct pulse_event_s ev;
+  while (reader.next(&ev)) {
+    test(ev.ticks >= last_ticks, "timeline not ordered");
+    test(ev.queue < n, "event for unused queue");
+    last_ticks = ev.ticks;
+    uint8_t i = ev.queue;
+    switch (ev.type) {
+      case PULSE_EVENT_STEP:
+        if (steps[i] > 0) {
+          uint32_t period = ev.ticks - last_step[i];
+          min_period[i] = fas_min(min_period[i], period);
+        }
+        last_step[i] = ev.ticks;
+        steps[i]++;
+        if (dir_high[i] == s[i]->directionPinHighCountsUp()) {
+          pos[i]++;
+        } else {
+          pos[i]--;
+        }
+        break;
+      case PULSE_EVENT_DIR_LOW:
+        dir_high[i] = false;
+        break;
+      case PULSE_EVENT_DIR_HIGH:
+        dir_high[i] = true;
+        break;
+    }
+  }
+  reader.close();
+  for (uint8_t i = 0; i < n; i++) {
+    printf("timeline queue %d: steps=%d pos=%d min period=%d ticks\n", i,
+           steps[i], pos[i], min_period[i]);
+    test(steps[i] == sim.q[i].steps, "step count of timeline mismatch");
+    test(pos[i] == s[i]->getCurrentPosition(), "timeline position mismatch");
+    test(min_period[i] >= s[i]->getSpeedInTicks(), "speed limit exceeded");
+  }
+}
+
+int main() {
+  engine.init();
+  FastAccelStepper *s[2];
+  s[0] = engine.stepperConnectToPin(1);
+  s[1] = engine.stepperConnectToPin(2);
+  assert(s[0] != NULL);
+  assert(s[1] != NULL);
+  s[0]->setDirectionPin(3);
+  s[1]->setDirectionPin(4, false);
+
+  const char *fname = "test_16.fasp";
+  test(sim.open_timeline(fname), "cannot create timeline");
+
+  // two independent moves
+  s[0]->setSpeedInUs(20);
+  s[0]->setAcceleration(100000);
+  s[1]->setSpeedInUs(50);
+  s[1]->setAcceleration(40000);
+  s[0]->moveTo(15000);
+  s[1]->moveTo(-8000);
+  run_and_compare_positions(s, 2);
+  test(s[0]->getCurrentPosition() == 15000, "wrong end position");
+  test(s[1]->getCurrentPosition() == -8000, "wrong end position");
+  // Each queue has been started once. More starts would indicate an underrun
+  test(sim.q[0].starts == 1, "underrun stepper 0");
+  test(sim.q[1].starts == 1, "underrun stepper 1");
+
+  // moveTo() while running reverses the direction
+  s[0]->moveTo(20000);
+  s[1]->moveTo(-5000);
+  for (uint8_t i = 0; i < 20; i++) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  s[0]->moveTo(0);
+  run_and_compare_positions(s, 2);
+  test(s[0]->getCurrentPosition() == 0, "wrong end position");
+  test(s[1]->getCurrentPosition() == -5000, "wrong end position");
+  test(sim.q[0].starts == 2, "underrun stepper 0");
+  test(sim.q[1].starts == 2, "underrun stepper 1");
+
+  for (uint8_t i = 0; i < 2; i++) {
+    printf(
+        "queue %d: steps=%llu dir changes=%d dir errors=%d, stopped at "
+        "%.6fs\n",
+        i, (unsigned long long)sim.q[i].steps, sim.q[i].dir_changes,
+        sim.q[i].dir_errors, sim.q[i].stop_ticks * 1.0 / TICKS_PER_S);
+    test(sim.q[i].dir_errors == 0, "step with wrong direction");
+  }
+  test(sim.q[0].dir_changes == 2, "expect initial dir and one reversal");
+  sim.close_timeline();
+
+  check_timeline(fname, s, 2);
+
+  printf("TEST_16 PASSED\n");
+  return 0;
+}
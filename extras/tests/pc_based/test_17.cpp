@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FastAccelStepper.h"
+#include "RampGenerator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// The ramp generator with ticks cache has to produce the identical command
+// stream as without cache.
+
+#define MAX_CMDS 20000
+struct stepper_command_s cmds_ref[MAX_CMDS];
+struct stepper_command_s cmds_cache[MAX_CMDS];
+
+uint32_t ticks_cache[300];
+
+struct queue_end_s qe_ref;
+struct queue_end_s qe_cache;
+
+uint32_t run_ramp(RampGenerator *rg, struct queue_end_s *qe,
+                  struct stepper_command_s *cmds) {
+  NextCommand cmd;
+  uint32_t cnt = 0;
+  while (rg->isRampGeneratorActive()) {
+    rg->getNextCommand(qe, &cmd);
+    rg->afterCommandEnqueued(&cmd);
+    if (cmd.command.ticks == 0) {
+      break;
+    }
+    test(cnt < MAX_CMDS, "too many commands");
+    cmds[cnt++] = cmd.command;
+    if (cmd.command.count_up) {
+      qe->pos += cmd.command.steps;
+    } else {
+      qe->pos -= cmd.command.steps;
+    }
+    qe->count_up = cmd.command.count_up;
+  }
+  return cnt;
+}
+
+void init_rg(RampGenerator *rg, struct queue_end_s *qe) {
+  rg->init();
+  rg->setTargetPosition(0);
+  qe->pos = 0;
+  qe->count_up = true;
+  qe->dir = true;
+}
+
+void compare(RampGenerator *rg_ref, RampGenerator *rg_cache,
+             uint32_t speed_us, uint32_t accel, uint32_t s_h, int32_t move) {
+  printf("Compare: speed=%uus accel=%u s_h=%u move=%d\n", speed_us, accel,
+         s_h, move);
+  RampGenerator *rgs[2] = {rg_ref, rg_cache};
+  for (uint8_t i = 0; i < 2; i++) {
+    rgs[i]->setSpeedInTicks(speed_us * (TICKS_PER_S / 1000000));
+    rgs[i]->setAcceleration(accel);
+    rgs[i]->setLinearAcceleration(s_h);
+  }
+  int32_t target = qe_ref.pos + move;
+  test(rg_ref->moveTo(target, &qe_ref) == MOVE_OK, "moveTo failed");
+  test(rg_cache->moveTo(target, &qe_cache) == MOVE_OK, "moveTo failed");
+  uint32_t n_ref = run_ramp(rg_ref, &qe_ref, cmds_ref);
+  uint32_t n_cache = run_ramp(rg_cache, &qe_cache, cmds_cache);
+  printf("%u commands without cache, %u with cache\n", n_ref, n_cache);
+  test(n_ref == n_cache, "different number of commands");
+  for (uint32_t i = 0; i < n_ref; i++) {
+    if ((cmds_ref[i].ticks != cmds_cache[i].ticks) ||
+        (cmds_ref[i].steps != cmds_cache[i].steps) ||
+        (cmds_ref[i].count_up != cmds_cache[i].count_up)) {
+      printf("command %u: %u*%u != %u*%u\n", i, cmds_ref[i].steps,
+             cmds_ref[i].ticks, cmds_cache[i].steps, cmds_cache[i].ticks);
+    }
+    test(cmds_ref[i].ticks == cmds_cache[i].ticks, "ticks mismatch");
+    test(cmds_ref[i].steps == cmds_cache[i].steps, "steps mismatch");
+    test(cmds_ref[i].count_up == cmds_cache[i].count_up, "count_up mismatch");
+  }
+  test(qe_ref.pos == target, "target not reached");
+  test(qe_cache.pos == target, "target not reached");
+}
+
+uint32_t cache_entries_used() {
+  uint32_t n = 0;
+  for (uint16_t i = 0; i < 300; i++) {
+    if (ticks_cache[i] != 0) {
+      n++;
+    }
+  }
+  return n;
+}
+
+int main() {
+  RampGenerator rg_ref;
+  RampGenerator rg_cache;
+  init_rg(&rg_ref, &qe_ref);
+  init_rg(&rg_cache, &qe_cache);
+  rg_cache.setTicksCache(ticks_cache, 300);
+
+  // Fill the cache and then use the filled cache
+  compare(&rg_ref, &rg_cache, 40, 10000, 0, 1000);
+  uint32_t used = cache_entries_used();
+  printf("cache entries used: %u\n", used);
+  test(used > 10, "cache is not used");
+  compare(&rg_ref, &rg_cache, 40, 10000, 0, -1000);
+
+  // Changed acceleration needs to invalidate the cache
+  compare(&rg_ref, &rg_cache, 40, 1000, 0, 2000);
+  compare(&rg_ref, &rg_cache, 40, 100000, 0, -2000);
+
+  // Speed change keeps the cache valid
+  compare(&rg_ref, &rg_cache, 10, 100000, 0, 5000);
+
+  // Changed linear acceleration needs to invalidate the cache
+  compare(&rg_ref, &rg_cache, 10, 100000, 100, -5000);
+  compare(&rg_ref, &rg_cache, 10, 100000, 1000, 5000);
+
+  // Ramp longer than the cache: calculation beyond the cache
+  compare(&rg_ref, &rg_cache, 5, 10000, 0, 20000);
+  compare(&rg_ref, &rg_cache, 5, 10000, 0, -20000);
+
+  // Short moves, which do not reach full speed
+  for (int32_t move = 1; move < 50; move += 7) {
+    compare(&rg_ref, &rg_cache, 20, 50000, 0, move);
+  }
+
+  // Enlarged cache in the same buffer: the added entries need to be cleared
+  rg_cache.setTicksCache(ticks_cache, 100);
+  compare(&rg_ref, &rg_cache, 5, 10000, 0, 3000);
+  for (uint16_t i = 100; i < 300; i++) {
+    ticks_cache[i] = 12345;
+  }
+  rg_cache.setTicksCache(ticks_cache, 300);
+  compare(&rg_ref, &rg_cache, 5, 10000, 0, -3000);
+
+  // Removal of the cache
+  rg_cache.setTicksCache(NULL, 300);
+  memset(ticks_cache, 0, sizeof(ticks_cache));
+  compare(&rg_ref, &rg_cache, 20, 20000, 0, 3000);
+  test(cache_entries_used() == 0, "cache is still in use");
+
+  printf("TEST_17 PASSED\n");
+  return 0;
+}
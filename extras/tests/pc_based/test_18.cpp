@@ -0,0 +1,227 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Coordinated linear moves with FastAccelStepperEngine::moveLinear().
+// The queues are drained by the PulseSimulator and checked for:
+// - all moving axes stop at the same tick
+// - all axes reach their target position
+// - the followers stay on the straight line defined by the leader
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s[NUM_QUEUES];
+
+// Returns the number of the leading axis
+uint8_t leading_axis(const int32_t start[], const int32_t targets[]) {
+  uint8_t leader = 0;
+  uint32_t max_steps = 0;
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    int32_t delta = targets[i] - start[i];
+    uint32_t steps = delta >= 0 ? delta : -delta;
+    if (steps > max_steps) {
+      max_steps = steps;
+      leader = i;
+    }
+  }
+  return leader;
+}
+
+void check_on_line(const int32_t start[], const int32_t targets[]) {
+  uint8_t l = leading_axis(start, targets);
+  int64_t dl = targets[l] - start[l];
+  int64_t pl = sim.q[l].pos - start[l];
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    int64_t di = targets[i] - start[i];
+    int64_t pi = sim.q[i].pos - start[i];
+    // deviation from the line in steps of axis i multiplied by dl
+    int64_t dev = pi * dl - pl * di;
+    if (dev < 0) {
+      dev = -dev;
+    }
+    if (dev > 2 * (dl >= 0 ? dl : -dl)) {
+      printf("axis %d at %d, leader at %d\n", i, sim.q[i].pos, sim.q[l].pos);
+    }
+    test(dev <= 2 * (dl >= 0 ? dl : -dl), "follower off the line");
+  }
+}
+
+// Execute a linear move from the current position to targets. If stop_after
+// is not 0, then the leader is stopped after this number of cycles.
+void linear_move(const int32_t targets[], uint32_t stop_after) {
+  int32_t start[NUM_QUEUES];
+  uint32_t starts[NUM_QUEUES];
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    start[i] = s[i]->getCurrentPosition();
+    starts[i] = sim.q[i].starts;
+  }
+  printf("Linear move from (%d,%d,%d) to (%d,%d,%d)\n", start[0], start[1],
+         start[2], targets[0], targets[1], targets[2]);
+  test(engine.moveLinear(s, targets, NUM_QUEUES) == MOVE_OK,
+       "moveLinear failed");
+  test(engine.isLinearMoveActive(), "linear move not active");
+  uint8_t l = leading_axis(start, targets);
+
+  uint32_t cycle;
+  for (cycle = 0; cycle < 100000; cycle++) {
+    engine.manageSteppers();
+    if (sim.is_idle() && !engine.isLinearMoveActive()) {
+      break;
+    }
+    if ((stop_after != 0) && (cycle == stop_after)) {
+      s[l]->stopMove();
+    }
+    sim.advance(CYCLE_TICKS);
+    check_on_line(start, targets);
+  }
+  test(cycle < 100000, "linear move does not end");
+
+  uint64_t stop_ticks = sim.q[l].stop_ticks;
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    if (targets[i] == start[i]) {
+      test(sim.q[i].starts == starts[i], "stepper without move started");
+      continue;
+    }
+    printf("axis %d: pos=%d start=%llu stop=%llu\n", i,
+           s[i]->getCurrentPosition(),
+           (unsigned long long)sim.q[i].start_ticks,
+           (unsigned long long)sim.q[i].stop_ticks);
+    test(sim.q[i].starts == starts[i] + 1, "underrun");
+    test(sim.q[i].start_ticks == sim.q[l].start_ticks, "different start");
+    test(sim.q[i].stop_ticks == stop_ticks, "different stop");
+    test(sim.q[i].dir_errors == 0, "step with wrong direction");
+    test(s[i]->getCurrentPosition() == sim.q[i].pos, "position mismatch");
+    if (stop_after == 0) {
+      test(sim.q[i].pos == targets[i], "target not reached");
+    }
+  }
+}
+
+// The leader is stopped before the first fill. The linear move has to end,
+// so that the leader can move alone afterwards.
+void stop_before_first_fill(bool force) {
+  int32_t start[NUM_QUEUES];
+  uint32_t starts[NUM_QUEUES];
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    start[i] = s[i]->getCurrentPosition();
+    starts[i] = sim.q[i].starts;
+  }
+  int32_t targets[NUM_QUEUES] = {start[0] + 1000, start[1] + 2000,
+                                 start[2] + 400};
+  test(engine.moveLinear(s, targets, NUM_QUEUES) == MOVE_OK,
+       "moveLinear failed");
+  if (force) {
+    s[1]->forceStopAndNewPosition(start[1]);
+  } else {
+    s[1]->stopMove();
+  }
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S),
+       "stepper does not stop");
+  test(!engine.isLinearMoveActive(), "linear move still active");
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    test(s[i]->getCurrentPosition() == start[i], "stepper has moved");
+  }
+  test(engine.moveLinear(s, targets, NUM_QUEUES) == MOVE_OK,
+       "moveLinear blocked");
+  s[1]->forceStopAndNewPosition(start[1]);
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S),
+       "stepper does not stop");
+
+  // only the leader moves
+  test(s[1]->moveTo(targets[1]) == MOVE_OK, "moveTo failed");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S),
+       "stepper does not stop");
+  test(s[1]->getCurrentPosition() == targets[1], "target not reached");
+  for (uint8_t i = 0; i < NUM_QUEUES; i += 2) {
+    test(s[i]->getCurrentPosition() == start[i], "follower has moved");
+    test(sim.q[i].starts == starts[i], "follower started");
+  }
+}
+
+int main() {
+  engine.init();
+  for (uint8_t i = 0; i < NUM_QUEUES; i++) {
+    s[i] = engine.stepperConnectToPin(i + 1);
+    assert(s[i] != NULL);
+    s[i]->setDirectionPin(NUM_QUEUES + 1 + i);
+    s[i]->setSpeedInUs(20);
+    s[i]->setAcceleration(50000);
+  }
+
+  // Invalid calls
+  int32_t targets[NUM_QUEUES] = {1000, 1000, 1000};
+  test(engine.moveLinear(s, targets, 0) == MOVE_ERR_INVALID_AXES, "n=0");
+  test(engine.moveLinear(s, targets, NUM_QUEUES + 1) == MOVE_ERR_INVALID_AXES,
+       "n too big");
+  FastAccelStepper *dup[2] = {s[0], s[0]};
+  test(engine.moveLinear(dup, targets, 2) == MOVE_ERR_INVALID_AXES,
+       "same stepper twice");
+  s[2]->move(100);
+  test(engine.moveLinear(s, targets, NUM_QUEUES) ==
+           MOVE_ERR_STEPPER_IS_RUNNING,
+       "stepper is running");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S),
+       "stepper does not stop");
+
+  // three axes with different directions
+  int32_t t1[NUM_QUEUES] = {20000, -7000, 1234};
+  linear_move(t1, 0);
+
+  // leader reverses the direction, one axis does not move
+  int32_t t2[NUM_QUEUES] = {-3000, -7000, 5555};
+  linear_move(t2, 0);
+
+  // slow followers need pauses between the steps
+  s[0]->setSpeedInUs(1000);
+  s[0]->setAcceleration(2000);
+  int32_t t3[NUM_QUEUES] = {2000, -7003, 5557};
+  linear_move(t3, 0);
+  s[0]->setSpeedInUs(20);
+  s[0]->setAcceleration(50000);
+
+  // high speed leader
+  s[1]->setSpeedInUs(5);
+  s[1]->setAcceleration(1000000);
+  int32_t t4[NUM_QUEUES] = {-20000, 90000, 40000};
+  linear_move(t4, 0);
+
+  // a single axis
+  int32_t t5[NUM_QUEUES] = {-20000, 80000, 40000};
+  linear_move(t5, 0);
+
+  // stop of the leader during the move
+  int32_t t6[NUM_QUEUES] = {0, 0, 0};
+  linear_move(t6, 10);
+  test(s[1]->getCurrentPosition() > 0, "leader has not been stopped");
+
+  // finish the stopped move
+  linear_move(t6, 0);
+
+  // stop of the leader before the first fill
+  stop_before_first_fill(false);
+  stop_before_first_fill(true);
+
+  printf("TEST_18 PASSED\n");
+  return 0;
+}
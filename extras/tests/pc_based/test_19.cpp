@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Look-ahead planner with planMoveTo(). The steps are recorded in a pulse
+// timeline and checked for:
+// - no standstill at junctions without direction change
+// - speed limit of each segment
+// - the stepper reaches the final position without overshoot
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#define MAX_SEGMENTS 40
+#define PLANNER_ENTRIES 8
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+struct planner_segment_s planner[PLANNER_ENTRIES];
+
+struct segment_s {
+  int32_t target;
+  uint32_t speed_us;
+};
+
+struct result_s {
+  uint64_t ticks;  // from start to stop
+  uint32_t steps;
+  uint32_t dir_changes;
+  // max. step period between the end of the first and the begin of the last
+  // segment. Only meaningful for moves without direction change
+  uint32_t max_period;
+  uint32_t violations;  // steps faster than the segment's speed
+};
+
+// Returns the index of the segment, which contains the step from pos to
+// pos +/- 1
+uint8_t segment_of_step(const struct segment_s seg[], uint8_t n, int32_t start,
+                        int32_t pos, bool count_up) {
+  int32_t from = start;
+  for (uint8_t i = 0; i < n; i++) {
+    int32_t to = seg[i].target;
+    if (count_up && (from <= pos) && (pos < to)) {
+      return i;
+    }
+    if (!count_up && (to < pos) && (pos <= from)) {
+      return i;
+    }
+    from = to;
+  }
+  return n;
+}
+
+void evaluate(const char *fname, const struct segment_s seg[], uint8_t n,
+              int32_t start, struct result_s *res) {
+  PulseTimelineReader reader;
+  test(reader.open(fname), "cannot open timeline");
+  struct pulse_event_s ev;
+  bool dir_high = true;
+  bool dir_changed = true;
+  int32_t pos = start;
+  uint64_t last_step = 0;
+  uint64_t first_step = 0;
+  res->steps = 0;
+  res->dir_changes = 0;
+  res->max_period = 0;
+  res->violations = 0;
+  res->ticks = 0;
+  while (reader.next(&ev)) {
+    switch (ev.type) {
+      case PULSE_EVENT_DIR_LOW:
+      case PULSE_EVENT_DIR_HIGH:
+        dir_high = ev.type == PULSE_EVENT_DIR_HIGH;
+        dir_changed = true;
+        res->dir_changes++;
+        break;
+      case PULSE_EVENT_STEP: {
+        bool count_up = dir_high == s->directionPinHighCountsUp();
+        if (res->steps == 0) {
+          first_step = ev.ticks;
+        } else if (!dir_changed) {
+          uint32_t period = ev.ticks - last_step;
+          // the period belongs to the previous step
+          int32_t prev_pos = count_up ? pos - 1 : pos + 1;
+          uint8_t i = segment_of_step(seg, n, start, prev_pos, count_up);
+          test(i < n, "step outside of the segments");
+          if (period < US_TO_TICKS(seg[i].speed_us) * 98 / 100) {
+            printf("step at %d: period %u too fast for segment %d\n", pos,
+                   period, i);
+            res->violations++;
+          }
+          int32_t lo = fas_min(seg[0].target, seg[n - 2].target);
+          int32_t hi = fas_max(seg[0].target, seg[n - 2].target);
+          if ((n > 1) && (lo <= prev_pos) && (prev_pos < hi)) {
+            res->max_period = fas_max(res->max_period, period);
+          }
+        }
+        dir_changed = false;
+        last_step = ev.ticks;
+        res->steps++;
+        pos += count_up ? 1 : -1;
+        break;
+      }
+      case PULSE_EVENT_STOP:
+        res->ticks = ev.ticks - first_step;
+        break;
+    }
+  }
+  reader.close();
+  test(pos == seg[n - 1].target, "timeline ends at wrong position");
+}
+
+// Execute the segments with the planner. If sequential is true, then each
+// segment is executed by moveTo() and waiting for standstill.
+void run(const struct segment_s seg[], uint8_t n, bool sequential,
+         struct result_s *res) {
+  const char *fname = "test_19.fasp";
+  sim.reset();
+  test(sim.open_timeline(fname), "cannot create timeline");
+  int32_t start = s->getCurrentPosition();
+  uint8_t planned = 0;
+  uint32_t cycles = 0;
+  while (true) {
+    if (sequential) {
+      if (!s->isRunning() && (planned < n)) {
+        s->setSpeedInUs(seg[planned].speed_us);
+        test(s->moveTo(seg[planned].target) == MOVE_OK, "moveTo failed");
+        planned++;
+      }
+    } else {
+      while (planned < n) {
+        int8_t r = s->planMoveTo(seg[planned].target, seg[planned].speed_us);
+        if (r == MOVE_ERR_PLANNER_FULL) {
+          break;
+        }
+        test(r == MOVE_OK, "planMoveTo failed");
+        planned++;
+      }
+    }
+    engine.manageSteppers();
+    if ((planned == n) && sim.is_idle() && !s->isRunning()) {
+      break;
+    }
+    sim.advance(CYCLE_TICKS);
+    test(++cycles < 1000000, "does not stop");
+  }
+  sim.close_timeline();
+  test(s->getCurrentPosition() == seg[n - 1].target, "wrong end position");
+  test(sim.q[0].dir_errors == 0, "step with wrong direction");
+  evaluate(fname, seg, n, start, res);
+  printf(
+      "%s: %u segments %u steps in %.3fs, starts=%u dir changes=%u max "
+      "period=%u\n",
+      sequential ? "sequential" : "planned", n, res->steps,
+      res->ticks * 1.0 / TICKS_PER_S, sim.q[0].starts, res->dir_changes,
+      res->max_period);
+  test(res->violations == 0, "speed limit exceeded");
+}
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(100000);
+  s->setSpeedInUs(20);
+  s->setPlannerBuffer(planner, PLANNER_ENTRIES);
+
+  // Invalid parameters
+  test(s->planMoveTo(100, 0) == MOVE_ERR_SPEED_IS_UNDEFINED, "speed 0");
+  struct result_s res_seq;
+  struct result_s res_plan;
+
+  // 30 short segments in the same direction as from a G-code front end. This
+  // runs more segments than the planner buffer can hold.
+  struct segment_s seg[MAX_SEGMENTS];
+  for (uint8_t i = 0; i < 30; i++) {
+    seg[i].target = (i + 1) * 500;
+    seg[i].speed_us = 100;
+  }
+  run(seg, 30, true, &res_seq);
+  test(sim.q[0].starts == 30, "sequential moves stop at each segment");
+  s->setCurrentPosition(0);
+  run(seg, 30, false, &res_plan);
+  test(sim.q[0].starts == 1, "planned moves stopped");
+  test(res_plan.max_period <= US_TO_TICKS(100) * 102 / 100,
+       "motor slowed down at junctions");
+  test(res_plan.ticks * 2 < res_seq.ticks, "planner does not speed up");
+
+  // different speeds per segment
+  struct segment_s seg2[] = {{-2000, 20},  {-3000, 50},  {-3500, 20},
+                             {-3600, 100}, {-6000, 10},  {-6010, 200},
+                             {-9000, 15},  {-9100, 15}};
+  uint8_t n2 = sizeof(seg2) / sizeof(seg2[0]);
+  run(seg2, n2, false, &res_plan);
+  test(sim.q[0].starts == 1, "planned moves stopped");
+  test(res_plan.dir_changes == 1, "overshoot");
+
+  // direction changes need a stop
+  struct segment_s seg3[] = {{-8000, 20}, {-7000, 20}, {-7500, 30},
+                             {-7400, 40}, {-7300, 40}, {-7000, 40}};
+  uint8_t n3 = sizeof(seg3) / sizeof(seg3[0]);
+  run(seg3, n3, false, &res_plan);
+  test(res_plan.dir_changes == 3, "wrong number of direction changes");
+
+  // short segments at the end limit the junction speed
+  struct segment_s seg4[] = {{20000, 10}, {20010, 10}, {20020, 10}};
+  run(seg4, 3, false, &res_plan);
+  test(res_plan.dir_changes == 1, "overshoot");
+
+  // stopMove() discards the planned segments
+  for (uint8_t i = 0; i < 5; i++) {
+    test(s->planMoveTo(20000 + (i + 1) * 10000, 20) == MOVE_OK,
+         "planMoveTo failed");
+  }
+  test(s->planMoveTo(100000, 20) == MOVE_OK, "planMoveTo failed");
+  test(s->planMoveTo(110000, 20) == MOVE_OK, "planMoveTo failed");
+  test(s->planMoveTo(120000, 20) == MOVE_ERR_PLANNER_FULL, "planner not full");
+  for (uint8_t i = 0; i < 100; i++) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  s->stopMove();
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "does not stop");
+  int32_t pos = s->getCurrentPosition();
+  printf("stopped at %d\n", pos);
+  test((pos > 20000) && (pos < 40000), "stopMove() failed");
+
+  // moveTo() discards the planned segments
+  test(s->planMoveTo(pos + 30000, 20) == MOVE_OK, "planMoveTo failed");
+  test(s->planMoveTo(pos + 60000, 20) == MOVE_OK, "planMoveTo failed");
+  for (uint8_t i = 0; i < 50; i++) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  s->moveTo(pos + 10000);
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "does not stop");
+  test(s->getCurrentPosition() == pos + 10000, "moveTo() failed");
+
+  printf("TEST_19 PASSED\n");
+  return 0;
+}
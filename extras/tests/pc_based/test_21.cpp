@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// getCurrentPosition() and the queue indices with completely filled queues
+// of 255 step entries. The entries store only the last 16 bits of the
+// position, so the queue covers up to QUEUE_LEN * 255 steps. This is run for
+// the default QUEUE_LEN and with FAS_QUEUE_LEN=256 by make test_queue256.
+// The index wraps around after 256 respectively 65536 entries.
+
+#define ROUNDS (65536 / QUEUE_LEN + 4)
+
+StepperQueue *q = &fas_queue[0];
+int32_t isr_pos;  // position after the completed entries
+
+void drain_one() {
+  struct queue_entry *e = &q->entry[q->read_idx & QUEUE_LEN_MASK];
+  isr_pos += e->countUp ? e->steps : -e->steps;
+  q->read_idx++;
+}
+
+void check_position(const char *msg) {
+  int32_t pos = q->getCurrentPosition();
+  if (pos != isr_pos) {
+    printf("%s: position %d, expected %d\n", msg, pos, isr_pos);
+  }
+  test(pos == isr_pos, msg);
+}
+
+// Fill the queue completely and drain it one by one. The direction changes
+// every <dir_period> entries, with 0 no direction change.
+void fill_and_drain(uint16_t dir_period, uint32_t entries) {
+  bool count_up = true;
+  uint32_t added = 0;
+  uint32_t drained = 0;
+  while (drained < entries) {
+    while ((added < entries) && !q->isQueueFull()) {
+      if ((dir_period != 0) && (added % dir_period == 0)) {
+        count_up = !count_up;
+      }
+      struct stepper_command_s cmd = {
+          .ticks = 100, .steps = 255, .count_up = count_up};
+      test(q->addQueueEntry(&cmd, false) == AQE_OK, "cannot add entry");
+      added++;
+    }
+    if (added < entries) {
+      test(q->queueEntries() == QUEUE_LEN, "queue not full");
+    }
+    check_position("position with full queue");
+    drain_one();
+    drained++;
+    check_position("position after drain");
+  }
+  test(q->isQueueEmpty(), "queue not empty");
+  test(q->queue_end.pos == isr_pos, "wrong queue end");
+}
+
+void start_at(int32_t pos) {
+  q->_initVars();
+  q->queue_end.pos = pos;
+  isr_pos = pos;
+}
+
+int main() {
+  printf("QUEUE_LEN=%d index bytes=%d entry bytes=%d\n", QUEUE_LEN,
+         (int)sizeof(fas_queue_idx_t), (int)sizeof(struct queue_entry));
+
+  int32_t starts[] = {0, -70000, 0x3f00, 0xfff0, -0x10010, 0x7ff00000};
+  for (uint8_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+    printf("start at %d\n", starts[i]);
+    start_at(starts[i]);
+    fill_and_drain(0, QUEUE_LEN * 3);
+    start_at(starts[i]);
+    fill_and_drain(QUEUE_LEN / 2 + 1, QUEUE_LEN * 3);
+    start_at(starts[i]);
+    fill_and_drain(3, QUEUE_LEN * 3);
+  }
+
+  // index wrap around
+  start_at(0);
+  fill_and_drain(QUEUE_LEN + 3, (uint32_t)QUEUE_LEN * ROUNDS);
+  printf("after %u entries at %d\n", (uint32_t)QUEUE_LEN * ROUNDS, isr_pos);
+
+  printf("TEST_21 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Adaptive planning horizon with setLatencyBoundsInUs(). The fill cycle is
+// delayed like a StepperTask under load and the PulseSimulator detects queue
+// underruns as additional starts of the queue.
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+uint32_t max_horizon_us;
+
+// Run the fill cycles with the given interval in ms
+void run_cycles(uint32_t duration_ms, uint32_t min_ms, uint32_t max_ms) {
+  uint64_t end = sim.now + MS_TO_TICKS(duration_ms);
+  while (sim.now < end) {
+    engine.manageSteppers();
+    max_horizon_us = fas_max(max_horizon_us, s->getPlanningHorizonInUs());
+    uint32_t interval_ms = min_ms;
+    if (max_ms > min_ms) {
+      interval_ms += rand() % (max_ms - min_ms + 1);
+    }
+    sim.advance(MS_TO_TICKS(interval_ms));
+  }
+}
+
+void start() {
+  sim.reset();
+  s->setCurrentPosition(0);
+  test(s->runForward() == MOVE_OK, "runForward failed");
+  // let the motor reach the speed
+  run_cycles(500, 1, 1);
+}
+
+void stop() {
+  s->stopMove();
+  test(sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10),
+       "does not stop");
+}
+
+int main() {
+  srand(1);
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(10000);
+  s->setSpeedInUs(4000);
+
+  // Invalid bounds
+  test(s->setLatencyBoundsInUs(100, 10000) == DELAY_TOO_LOW, "too low");
+  test(s->setLatencyBoundsInUs(20000, 10000) == DELAY_TOO_LOW, "min > max");
+  test(s->setLatencyBoundsInUs(1000, 2000000) == DELAY_TOO_HIGH, "too high");
+  test(s->getPlanningHorizonInUs() == 20000, "default horizon");
+
+  // The fixed 20ms horizon runs empty on a fill task delayed by 30ms
+  start();
+  run_cycles(30, 30, 30);
+  run_cycles(100, 1, 1);
+  printf("fixed horizon: starts=%u\n", sim.q[0].starts);
+  test(sim.q[0].starts > 1, "no underrun with fixed horizon");
+  stop();
+
+  test(s->setLatencyBoundsInUs(2000, 100000) == DELAY_OK, "bounds");
+
+  // Quiet system: the horizon and so the latency shrinks
+  start();
+  uint32_t quiet_us = s->getPlanningHorizonInUs();
+  printf("quiet: horizon=%uus\n", quiet_us);
+  test(quiet_us <= 10000, "horizon not reduced");
+
+  // Increasing load up to 10ms and then random intervals up to 25ms
+  max_horizon_us = 0;
+  for (uint32_t max_ms = 2; max_ms <= 10; max_ms++) {
+    run_cycles(100, 1, max_ms);
+  }
+  run_cycles(3000, 1, 25);
+  printf("busy: max horizon=%uus starts=%u\n", max_horizon_us,
+         sim.q[0].starts);
+  test(sim.q[0].starts == 1, "queue underrun");
+  test(max_horizon_us >= 40000, "horizon not increased");
+
+  // Quiet again
+  run_cycles(2000, 1, 1);
+  printf("quiet again: horizon=%uus\n", s->getPlanningHorizonInUs());
+  test(s->getPlanningHorizonInUs() <= 10000, "horizon does not decay");
+  test(sim.q[0].starts == 1, "queue underrun");
+
+  // The latency jumps above the horizon in one step. The queue runs empty,
+  // but the next fill raises the horizon to at least twice the ticks, which
+  // have been in the queue. So the horizon doubles on each underrun until it
+  // covers the latency.
+  uint32_t horizon_us = s->getPlanningHorizonInUs();
+  uint32_t jump_ms = 6 * horizon_us / 1000;
+  for (uint8_t i = 0; i < 5; i++) {
+    uint32_t starts = sim.q[0].starts;
+    run_cycles(jump_ms, jump_ms, jump_ms);
+    // the fill after the jump
+    run_cycles(1, 1, 1);
+    uint32_t raised_us = s->getPlanningHorizonInUs();
+    printf("jump %ums: horizon=%uus starts=%u\n", jump_ms, raised_us,
+           sim.q[0].starts);
+    if (i == 0) {
+      test(sim.q[0].starts == starts + 1, "no underrun on latency jump");
+      test(raised_us >= 2 * horizon_us, "horizon not raised after underrun");
+    }
+    run_cycles(20, 1, 1);
+  }
+  test(sim.q[0].starts <= 4, "repeated underruns on the same latency");
+  stop();
+
+  printf("TEST_22 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Wakeup of the stepper task by the low watermark of the queue. The stepper
+// task is simulated: after manageSteppers() it sleeps for the ticks of
+// taskSleepInTicks() or until the PulseSimulator as isr or a move command
+// notifies it. The wake up takes the given latency. Without timeout the task
+// relies on the notifications alone.
+
+#define SLICE_TICKS (TICKS_PER_S / 10000)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+uint32_t wakeups;
+uint32_t notified_wakeups;
+uint32_t min_ticks_at_wakeup;  // ticks in queue at wakeup of a running ramp
+
+void run_task(uint32_t duration_ms, uint32_t latency_ms,
+              bool use_timeout = true) {
+  uint64_t end = sim.now + MS_TO_TICKS(duration_ms);
+  while (sim.now < end) {
+    if (s->isRampGeneratorActive() && s->isQueueRunning()) {
+      min_ticks_at_wakeup = fas_min(min_ticks_at_wakeup, s->ticksInQueue());
+    }
+    engine.manageSteppers();
+    wakeups++;
+    uint32_t sleep_ticks = engine.taskSleepInTicks();
+    if (!use_timeout && (sleep_ticks > TASK_WAKEUP_POLL_TICKS)) {
+      sleep_ticks = TASK_WAKEUP_MAX_SLEEP_TICKS;
+    }
+    uint64_t wakeup = sim.now + sleep_ticks;
+    uint32_t notifications = fas_test_task_notifications;
+    while ((sim.now < wakeup) &&
+           (notifications == fas_test_task_notifications)) {
+      sim.advance(SLICE_TICKS);
+    }
+    if (notifications != fas_test_task_notifications) {
+      notified_wakeups++;
+    }
+    sim.advance(MS_TO_TICKS(latency_ms));
+  }
+}
+
+void reset_counters() {
+  wakeups = 0;
+  notified_wakeups = 0;
+  min_ticks_at_wakeup = 0xffffffff;
+}
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(10000);
+  s->setSpeedInUs(1000);
+
+  // Idle stepper: sleep as long as possible
+  engine.manageSteppers();
+  test(engine.taskSleepInTicks() == TASK_WAKEUP_MAX_SLEEP_TICKS,
+       "idle stepper needs task");
+
+  // A move command notifies the task
+  uint32_t notifications = fas_test_task_notifications;
+  test(s->moveTo(3000) == MOVE_OK, "moveTo failed");
+  test(fas_test_task_notifications == notifications + 1, "no notification");
+
+  // 3000 steps need about 3.3s. Polling with 1ms would need 3300 wakeups.
+  // The queue of 16 entries with one step each is refilled at half.
+  reset_counters();
+  run_task(4000, 0);
+  printf("move: wakeups=%u min ticks in queue=%u starts=%u\n", wakeups,
+         min_ticks_at_wakeup, sim.q[0].starts);
+  test(s->getCurrentPosition() == 3000, "target not reached");
+  test(sim.q[0].starts == 1, "queue underrun");
+  test(wakeups < 600, "too many wakeups");
+  test(min_ticks_at_wakeup >= MS_TO_TICKS(5), "woken up too late");
+
+  // Only the isr wakes up the task
+  reset_counters();
+  test(s->moveTo(0) == MOVE_OK, "moveTo failed");
+  run_task(4000, 0, false);
+  printf("isr only: wakeups=%u notified=%u min ticks in queue=%u starts=%u\n",
+         wakeups, notified_wakeups, min_ticks_at_wakeup, sim.q[0].starts);
+  test(s->getCurrentPosition() == 0, "target not reached");
+  test(sim.q[0].starts == 2, "queue underrun");
+  test(wakeups < 600, "too many wakeups");
+  test(notified_wakeups + 10 >= wakeups, "not notified by isr");
+  test(min_ticks_at_wakeup >= MS_TO_TICKS(5), "woken up too late");
+
+  // With 4ms wakeup latency the queue still does not run empty
+  reset_counters();
+  test(s->moveTo(3000) == MOVE_OK, "moveTo failed");
+  run_task(4000, 4);
+  printf("move with latency: wakeups=%u min ticks in queue=%u starts=%u\n",
+         wakeups, min_ticks_at_wakeup, sim.q[0].starts);
+  test(s->getCurrentPosition() == 3000, "target not reached");
+  test(sim.q[0].starts == 3, "queue underrun");
+
+  // Auto disable is counted in calls of manageSteppers(), so the task polls
+  // until the outputs are disabled
+  s->setEnablePin(5);
+  s->setAutoEnable(true);
+  s->setDelayToDisable(50);
+  test(s->moveTo(3100) == MOVE_OK, "moveTo failed");
+  run_task(1000, 0);
+  test(s->getCurrentPosition() == 3100, "target not reached");
+  engine.manageSteppers();
+  test(engine.taskSleepInTicks() == TASK_WAKEUP_MAX_SLEEP_TICKS,
+       "outputs not disabled");
+  reset_counters();
+  run_task(1000, 0);
+  printf("idle: wakeups=%u\n", wakeups);
+  test(wakeups <= 10, "idle task too busy");
+
+  printf("TEST_23 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Auto disable with shared enable pins. The steppers sharing enable pins -
+// also indirectly - form a group and a group is only disabled, if all its
+// steppers are idle. The enable pins are external pins, so their level is
+// recorded by the callback.
+
+#define PIN_A (PIN_EXTERNAL_FLAG | 1)
+#define PIN_B (PIN_EXTERNAL_FLAG | 2)
+#define PIN_C (PIN_EXTERNAL_FLAG | 3)
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s[3];
+uint8_t pin_level[4];
+
+bool setExternalPin(uint8_t pin, uint8_t value) {
+  pin_level[pin & 3] = value;
+  return value;
+}
+
+void run_ms(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    engine.manageSteppers();
+    sim.advance(MS_TO_TICKS(1));
+  }
+}
+
+bool idle() {
+  for (uint8_t i = 0; i < 3; i++) {
+    if (s[i]->isRunning()) {
+      return false;
+    }
+  }
+  return sim.is_idle();
+}
+
+// Run until all steppers are stopped and check the running stepper's pins
+// stay enabled until then
+void run_until_idle(uint8_t pin, uint8_t enabled_level) {
+  for (uint32_t ms = 0; ms < 10000; ms++) {
+    if (idle()) {
+      return;
+    }
+    test(pin_level[pin & 3] == enabled_level, "disabled while running");
+    engine.manageSteppers();
+    sim.advance(MS_TO_TICKS(1));
+  }
+  test(false, "does not stop");
+}
+
+int main() {
+  engine.init();
+  engine.setExternalCallForPin(setExternalPin);
+  for (uint8_t i = 0; i < 3; i++) {
+    s[i] = engine.stepperConnectToPin(i);
+    assert(s[i] != NULL);
+    s[i]->setDirectionPin(10 + i);
+    s[i]->setAutoEnable(true);
+    s[i]->setDelayToDisable(10);
+    s[i]->setAcceleration(100000);
+    s[i]->setSpeedInUs(100);
+  }
+
+  // s0 and s1 share the low active pin A, s1 and s2 the high active pin B.
+  // So all three are in one group.
+  s[0]->setEnablePin(PIN_A, true);
+  s[1]->setEnablePin(PIN_A, true);
+  s[1]->setEnablePin(PIN_B, false);
+  s[2]->setEnablePin(PIN_B, false);
+  test(pin_level[1] == HIGH, "pin A not disabled");
+  test(pin_level[2] == LOW, "pin B not disabled");
+
+  // A short move of s0 during a long move of s2: the idle s1 must not
+  // switch off pin B of the running s2
+  test(s[2]->move(5000) == MOVE_OK, "move s2");
+  test(s[0]->move(100) == MOVE_OK, "move s0");
+  run_ms(100);
+  test(!s[0]->isRunning(), "s0 still running");
+  test(s[2]->isRunning(), "s2 not running");
+  run_until_idle(PIN_B, HIGH);
+  printf("one group: s0 at %d, s2 at %d\n", s[0]->getCurrentPosition(),
+         s[2]->getCurrentPosition());
+  test(s[2]->getCurrentPosition() == 5000, "s2 not at target");
+  test(pin_level[1] == LOW, "pin A disabled too early");
+  run_ms(20);
+  test(pin_level[1] == HIGH, "pin A not disabled");
+  test(pin_level[2] == LOW, "pin B not disabled");
+
+  // s1 uses now pin C: the groups are {s0} and {s1, s2}. s0 is disabled
+  // while s2 is running.
+  s[1]->setEnablePin(PIN_UNDEFINED, true);
+  s[1]->setEnablePin(PIN_UNDEFINED, false);
+  s[1]->setEnablePin(PIN_C, true);
+  s[2]->setEnablePin(PIN_C, true);
+  test(s[1]->getEnablePinHighActive() == PIN_UNDEFINED, "s1 still on pin B");
+  test(s[2]->move(-5000) == MOVE_OK, "move s2");
+  test(s[0]->move(-100) == MOVE_OK, "move s0");
+  run_ms(100);
+  test(pin_level[1] == HIGH, "separate group of s0 not disabled");
+  test(pin_level[3] == LOW, "pin C of s2 not enabled");
+  run_until_idle(PIN_C, LOW);
+  run_ms(20);
+  test(pin_level[3] == HIGH, "pin C not disabled");
+
+  // Two steppers without enable pin do not share a group
+  s[0]->setEnablePin(PIN_UNDEFINED, true);
+  test(s[0]->move(100) == MOVE_OK, "move s0");
+  run_until_idle(PIN_C, HIGH);
+  run_ms(20);
+  test(pin_level[3] == HIGH, "pin C enabled");
+
+  printf("TEST_24 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Runtime statistics of engine and stepper. The PulseSimulator counts the
+// isr calls and the starts of the queue, which are compared with the
+// statistics. micros() advances by 5us per call, so the durations are known.
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+uint32_t clock_us;
+uint32_t test_clock() {
+  clock_us += 5;
+  return clock_us;
+}
+
+uint32_t cycles;
+void run_cycles(uint32_t duration_ms, uint32_t interval_ms) {
+  uint64_t end = sim.now + MS_TO_TICKS(duration_ms);
+  while (sim.now < end) {
+    engine.manageSteppers();
+    cycles++;
+    sim.advance(MS_TO_TICKS(interval_ms));
+  }
+}
+
+void print_stats(const char *name, struct stepper_stats_s *st) {
+  printf(
+      "%s: underruns=%u late=%u min ticks=%u commands=%u fills=%u "
+      "max/avg fill=%u/%uus isr=%u\n",
+      name, st->underruns, st->late_refills, st->min_ticks_in_queue,
+      st->commands, st->fills, st->max_fill_us, st->avg_fill_us,
+      st->isr_calls);
+}
+
+int main() {
+  fas_test_clock = test_clock;
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(10000);
+  s->setSpeedInUs(500);
+
+  struct stepper_stats_s st;
+  struct engine_stats_s es;
+  s->getStats(&st);
+  test(st.underruns == 0, "underruns after init");
+  test(st.fills == 0, "fills after init");
+  test(st.min_ticks_in_queue == 0xffffffff, "min ticks after init");
+  test(st.isr_calls == 0, "isr calls after init");
+
+  // Regular fill cycles: no underrun
+  test(s->moveTo(2000) == MOVE_OK, "moveTo failed");
+  test(sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10),
+       "does not stop");
+  s->getStats(&st, true);
+  print_stats("regular", &st);
+  test(s->getCurrentPosition() == 2000, "target not reached");
+  test(sim.q[0].starts == 1, "queue underrun");
+  test(st.underruns == 0, "underrun counted");
+  test(st.commands > 0, "no commands");
+  test(st.fills > 0, "no fills");
+  test(st.min_ticks_in_queue > 0, "min ticks not measured");
+  test(st.min_ticks_in_queue < MS_TO_TICKS(20), "min ticks above horizon");
+  test(st.max_fill_us == 5, "wrong max fill duration");
+  test(st.avg_fill_us == 5, "wrong average fill duration");
+  // one isr call per step and per entry without step, plus the stop
+  test(st.isr_calls >= 2000, "too few isr calls");
+
+  // reset has cleared the counters
+  s->getStats(&st);
+  test(st.fills == 0, "fills not reset");
+  test(st.commands == 0, "commands not reset");
+  test(st.isr_calls == 0, "isr calls not reset");
+  test(st.min_ticks_in_queue == 0xffffffff, "min ticks not reset");
+
+  // The engine has measured all cycles
+  engine.getStats(&es, true);
+  printf("engine: cycles=%u max/avg cycle=%u/%uus\n", es.cycles,
+         es.max_cycle_us, es.avg_cycle_us);
+  test(es.cycles > 0, "no cycles");
+  test(es.max_cycle_us == 15, "wrong max cycle duration");
+  test(es.avg_cycle_us > 5, "wrong average cycle duration");
+  test(es.avg_cycle_us < 15, "wrong average cycle duration");
+
+  // Delayed fill cycles: the queue runs empty in the middle of the move
+  cycles = 0;
+  test(s->moveTo(0) == MOVE_OK, "moveTo failed");
+  run_cycles(300, 1);
+  run_cycles(100, 50);
+  run_cycles(300, 1);
+  test(sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10),
+       "does not stop");
+  s->getStats(&st);
+  print_stats("delayed", &st);
+  test(s->getCurrentPosition() == 0, "target not reached");
+  printf("starts=%u\n", sim.q[0].starts);
+  test(sim.q[0].starts > 2, "no underrun");
+  test(st.underruns == sim.q[0].starts - 2, "underruns not counted");
+
+  engine.getStats(&es);
+  test(es.cycles >= cycles, "cycles not counted");
+
+  printf("TEST_25 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+#include "fas_trace.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Binary trace of the fill path. The events are read after each cycle of
+// manageSteppers() and written as dump to test_26.trace, which can be shown
+// by:
+//     ./trace_decode test_26.trace
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+FILE *dump;
+
+uint32_t counts[FAS_TRACE_TYPE_MASK + 1];
+int32_t planned_steps;
+int32_t pushed_steps;
+uint8_t ramp_states[16];
+uint8_t num_ramp_states;
+
+void reset_counts() {
+  for (uint8_t i = 0; i <= FAS_TRACE_TYPE_MASK; i++) {
+    counts[i] = 0;
+  }
+  planned_steps = 0;
+  pushed_steps = 0;
+  num_ramp_states = 0;
+}
+
+void read_events() {
+  struct fas_trace_event_s ev[16];
+  uint16_t n;
+  while ((n = fas_trace_read(ev, 16)) > 0) {
+    fwrite(ev, sizeof(ev[0]), n, dump);
+    for (uint16_t i = 0; i < n; i++) {
+      uint8_t type = ev[i].type & FAS_TRACE_TYPE_MASK;
+      int32_t steps = (ev[i].type & FAS_TRACE_COUNT_UP) ? ev[i].a : -ev[i].a;
+      test(ev[i].queue == 0, "wrong queue");
+      counts[type]++;
+      switch (type) {
+        case FAS_TRACE_PLAN:
+          planned_steps += steps;
+          break;
+        case FAS_TRACE_PUSH:
+          pushed_steps += steps;
+          break;
+        case FAS_TRACE_RAMP_STATE:
+          if (num_ramp_states < sizeof(ramp_states)) {
+            ramp_states[num_ramp_states++] = ev[i].a & RAMP_STATE_MASK;
+          }
+          break;
+      }
+    }
+  }
+}
+
+void run_cycles(uint32_t duration_ms, uint32_t interval_ms) {
+  uint64_t end = sim.now + MS_TO_TICKS(duration_ms);
+  while (sim.now < end) {
+    engine.manageSteppers();
+    read_events();
+    sim.advance(MS_TO_TICKS(interval_ms));
+  }
+}
+
+void run_until_idle() {
+  for (uint32_t ms = 0; ms < 10000; ms++) {
+    if (!s->isRunning() && sim.is_idle()) {
+      return;
+    }
+    run_cycles(1, 1);
+  }
+  test(false, "does not stop");
+}
+
+int main() {
+  dump = fopen("test_26.trace", "wb");
+  uint8_t header[FAS_TRACE_HEADER_LEN];
+  fas_trace_header(header);
+  test(header[0] == 'F' && header[3] == 'T', "wrong magic");
+  test(header[4] == FAS_TRACE_VERSION, "wrong version");
+  test(header[5] == NUM_QUEUES, "wrong number of queues");
+  test(header[9] == ((TICKS_PER_S >> 8) & 0xff), "wrong tick rate");
+  fwrite(header, 1, sizeof(header), dump);
+
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(10000);
+  s->setSpeedInUs(500);
+
+  // A complete ramp: the pushed entries add up to the planned steps
+  fas_trace_clear();
+  reset_counts();
+  test(s->moveTo(2000) == MOVE_OK, "moveTo failed");
+  run_until_idle();
+  printf("ramp: plan=%u push=%u start=%u underrun=%u states=%u lost=%u\n",
+         counts[FAS_TRACE_PLAN], counts[FAS_TRACE_PUSH],
+         counts[FAS_TRACE_START], counts[FAS_TRACE_UNDERRUN], num_ramp_states,
+         fas_trace_lost());
+  test(s->getCurrentPosition() == 2000, "target not reached");
+  test(fas_trace_lost() == 0, "events lost");
+  test(counts[FAS_TRACE_START] == 1, "wrong number of starts");
+  test(counts[FAS_TRACE_UNDERRUN] == 0, "underrun traced");
+  test(counts[FAS_TRACE_PUSH] >= counts[FAS_TRACE_PLAN], "missing pushes");
+  test(planned_steps == 2000, "wrong planned steps");
+  test(pushed_steps == 2000, "wrong pushed steps");
+  test(num_ramp_states >= 4, "too few ramp states");
+  test(ramp_states[0] == RAMP_STATE_ACCELERATE, "no acceleration");
+  test(ramp_states[num_ramp_states - 1] == RAMP_STATE_IDLE, "not idle");
+  bool coast = false;
+  bool decelerate = false;
+  for (uint8_t i = 0; i < num_ramp_states; i++) {
+    coast |= ramp_states[i] == RAMP_STATE_COAST;
+    decelerate |= ramp_states[i] == RAMP_STATE_DECELERATE;
+  }
+  test(coast, "no coasting");
+  test(decelerate, "no deceleration");
+
+  // Delayed fill cycles: the underruns are traced
+  struct stepper_stats_s st;
+  s->getStats(&st, true);
+  reset_counts();
+  test(s->moveTo(0) == MOVE_OK, "moveTo failed");
+  run_cycles(300, 1);
+  run_cycles(100, 50);
+  run_cycles(300, 1);
+  run_until_idle();
+  s->getStats(&st);
+  printf("delayed: push=%u start=%u underrun=%u/%u\n", counts[FAS_TRACE_PUSH],
+         counts[FAS_TRACE_START], counts[FAS_TRACE_UNDERRUN], st.underruns);
+  test(s->getCurrentPosition() == 0, "target not reached");
+  test(st.underruns > 0, "no underrun");
+  test(counts[FAS_TRACE_UNDERRUN] == st.underruns, "underruns not traced");
+  test(counts[FAS_TRACE_START] == st.underruns + 1, "restarts not traced");
+  test(pushed_steps == -2000, "wrong pushed steps");
+  fclose(dump);
+
+  // Without reading the oldest events are overwritten
+  fas_trace_clear();
+  test(s->moveTo(2000) == MOVE_OK, "moveTo failed");
+  for (uint32_t ms = 0; ms < 10000; ms++) {
+    engine.manageSteppers();
+    sim.advance(MS_TO_TICKS(1));
+  }
+  test(s->getCurrentPosition() == 2000, "target not reached");
+  struct fas_trace_event_s ev[FAS_TRACE_LEN + 1];
+  uint16_t n = fas_trace_read(ev, FAS_TRACE_LEN + 1);
+  printf("overflow: read=%u lost=%u\n", n, fas_trace_lost());
+  test(n == FAS_TRACE_LEN, "ring not full");
+  test(fas_trace_lost() > 0, "no events lost");
+  test((ev[n - 1].type & FAS_TRACE_TYPE_MASK) == FAS_TRACE_RAMP_STATE,
+       "last event lost");
+  test(fas_trace_read(ev, 1) == 0, "ring not empty");
+
+  printf("TEST_26 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Velocity streaming with setTargetVelocityInMilliHz() from a 1kHz control
+// loop. The speed of the simulated steps is measured over a window and
+// compared with the ideal speed, which follows the target with the
+// acceleration limit. The queue delays the steps by the planning horizon,
+// so the ideal speed is shifted by the delay with the least error.
+//
+// On start and reversal the stepper has to stop, and a target near zero
+// means steps of several ms, which cannot be shortened once queued. So the
+// speed lags behind after leaving zero and these intervals are not checked.
+
+#define ACCEL 100000
+#define MAX_MS 4000
+// Half window for the measurement of the speed
+#define WINDOW_MS 5
+#define MAX_DELAY_MS 40
+#define REVERSAL_MS 100
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+int32_t pos[MAX_MS];
+float ideal[MAX_MS];
+
+// The loop of the application: one target per ms
+void run_loop(uint32_t ms, float (*target_hz)(uint32_t ms)) {
+  float v = 0;
+  for (uint32_t t = 0; t < ms; t++) {
+    float target = target_hz(t);
+    test(s->setTargetVelocityInMilliHz((int32_t)(target * 1000)) == MOVE_OK,
+         "setTargetVelocityInMilliHz failed");
+    // slew of the ideal speed
+    float dv = target - v;
+    float max_dv = ACCEL / 1000.0;
+    v += dv > max_dv ? max_dv : (dv < -max_dv ? -max_dv : dv);
+    ideal[t] = v;
+    engine.manageSteppers();
+    sim.advance(MS_TO_TICKS(1));
+    pos[t] = sim.q[0].pos;
+  }
+}
+
+static int sign(float v) { return v > 0 ? 1 : (v < 0 ? -1 : 0); }
+
+// Max. error of the measured speed against the delayed ideal speed
+float tracking_error(uint32_t ms, uint32_t *best_delay) {
+  float best = 1e9;
+  for (uint32_t delay = 0; delay <= MAX_DELAY_MS; delay++) {
+    float max_err = 0;
+    // both runs start from standstill
+    uint32_t reversal = WINDOW_MS + delay;
+    for (uint32_t t = WINDOW_MS + delay; t + WINDOW_MS < ms; t++) {
+      float prev = ideal[t - delay - 1];
+      float curr = ideal[t - delay];
+      if ((t > WINDOW_MS + delay) && (sign(prev) != sign(curr))) {
+        reversal = t;
+      }
+      if (t < reversal + REVERSAL_MS) {
+        continue;
+      }
+      float v = (pos[t + WINDOW_MS] - pos[t - WINDOW_MS]) * 1000.0 /
+                (2 * WINDOW_MS);
+      float err = fabs(v - curr);
+      if (err > max_err) {
+        max_err = err;
+      }
+    }
+    if (max_err < best) {
+      best = max_err;
+      *best_delay = delay;
+    }
+  }
+  return best;
+}
+
+float sine(uint32_t ms) { return 10000.0 * sin(2 * M_PI * ms / 1000.0); }
+float steps(uint32_t ms) {
+  if (ms < 300) {
+    return 5000.0;
+  }
+  if (ms < 800) {
+    return 20000.0;
+  }
+  if (ms < 1500) {
+    return -15000.0;
+  }
+  if (ms < 2100) {
+    return 5000.0;
+  }
+  return 0.0;
+}
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+
+  // Needs acceleration and for negative speeds the direction pin
+  test(s->setTargetVelocityInMilliHz(1000) ==
+           MOVE_ERR_ACCELERATION_IS_UNDEFINED,
+       "no acceleration");
+  s->setAcceleration(ACCEL);
+  test(s->setTargetVelocityInMilliHz(-1000) == MOVE_ERR_NO_DIRECTION_PIN,
+       "no direction pin");
+  s->setDirectionPin(4);
+  test(!s->isVelocityMode(), "velocity mode");
+
+  // Sine wave, which is within the acceleration limit
+  uint32_t delay;
+  run_loop(3000, sine);
+  test(s->isVelocityMode(), "no velocity mode");
+  float err = tracking_error(3000, &delay);
+  printf("sine: max error %.0f Hz with delay %ums\n", err, delay);
+  test(err < 500, "sine not tracked");
+  test(delay <= 25, "delay above the planning horizon");
+
+  test(s->setTargetVelocityInMilliHz(0) == MOVE_OK, "stop failed");
+  test(sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10),
+       "does not stop");
+  test(s->isVelocityMode(), "no velocity mode at standstill");
+  test(s->getCurrentPosition() == sim.q[0].pos, "position mismatch");
+
+  // Steps of the target: the speed slews with the acceleration limit
+  sim.reset();
+  s->setCurrentPosition(0);
+  run_loop(2800, steps);
+  err = tracking_error(2800, &delay);
+  printf("steps: max error %.0f Hz with delay %ums\n", err, delay);
+  test(err < 500, "steps not tracked");
+  test(delay <= 25, "delay above the planning horizon");
+  test(!s->isRunning(), "not stopped");
+  test(s->getCurrentPosition() == sim.q[0].pos, "position mismatch");
+
+  // The speed is limited to the maximum of the driver and the speed set by
+  // setSpeedInUs() is not used
+  s->setSpeedInUs(1000);
+  test(s->setTargetVelocityInMilliHz(1000000000) == MOVE_OK, "too fast");
+  for (uint32_t t = 0; t < 2500; t++) {
+    engine.manageSteppers();
+    sim.advance(MS_TO_TICKS(1));
+  }
+  int32_t max_hz = TICKS_PER_S / s->getMaxSpeedInTicks();
+  int32_t hz = s->getCurrentSpeedInMilliHz(false) / 1000;
+  printf("limited: %d Hz with maximum %d Hz\n", hz, max_hz);
+  test(hz <= max_hz, "maximum speed exceeded");
+  test(hz > max_hz * 9 / 10, "maximum speed not reached");
+
+  // A move command ends the mode
+  s->setSpeedInUs(10);
+  test(s->moveTo(0) == MOVE_OK, "moveTo failed");
+  test(!s->isVelocityMode(), "velocity mode after moveTo");
+  test(sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10),
+       "does not stop");
+  test(s->getCurrentPosition() == 0, "target not reached");
+
+  // stopMove() ends the mode, too
+  test(s->setTargetVelocityInMilliHz(-5000000) == MOVE_OK, "restart");
+  for (uint32_t t = 0; t < 100; t++) {
+    engine.manageSteppers();
+    sim.advance(MS_TO_TICKS(1));
+  }
+  test(s->isRunning(), "not running");
+  test(s->getCurrentPosition() < 0, "wrong direction");
+  s->stopMove();
+  test(!s->isVelocityMode(), "velocity mode after stopMove");
+  test(sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10),
+       "does not stop");
+  test(s->getCurrentPosition() == sim.q[0].pos, "position mismatch");
+
+  printf("TEST_27 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,246 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "RampGenerator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Trajectory playback with playTrajectory(). A table is recorded from the
+// ramp generator like trajectory_gen does. The playback on the
+// PulseSimulator has to produce the same step periods as the moves
+// executed with move(). Checked are as well the error codes, the position
+// and the end of the playback by stopMove(), forceStop() and moveTo().
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#define MAX_ENTRIES 1000
+#define MAX_STEPS 20000
+#define SPEED_US 50
+#define ACCEL 20000
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+struct stepper_command_s table[MAX_ENTRIES];
+uint16_t entries = 0;
+
+const int32_t moves[] = {3200, -1000, 500};
+
+// Record the commands of the moves from standstill to standstill
+void record() {
+  RampGenerator rg;
+  rg.init();
+  rg.setTargetPosition(0);
+  rg.setSpeedInTicks(SPEED_US * (TICKS_PER_S / 1000000));
+  rg.setAcceleration(ACCEL);
+  struct queue_end_s qe;
+  qe.pos = 0;
+  qe.count_up = true;
+  qe.dir = true;
+  for (uint8_t i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+    test(rg.move(moves[i], &qe) == MOVE_OK, "move failed");
+    NextCommand cmd;
+    while (rg.isRampGeneratorActive()) {
+      rg.getNextCommand(&qe, &cmd);
+      rg.afterCommandEnqueued(&cmd);
+      if (cmd.command.ticks == 0) {
+        break;
+      }
+      test(entries < MAX_ENTRIES, "table too small");
+      table[entries++] = cmd.command;
+      qe.pos += cmd.command.count_up ? cmd.command.steps : -cmd.command.steps;
+      qe.count_up = cmd.command.count_up;
+    }
+  }
+  printf("recorded %u entries\n", entries);
+}
+
+// The step times of a timeline
+uint32_t read_steps(const char *fname, uint64_t *t) {
+  PulseTimelineReader reader;
+  test(reader.open(fname), "cannot open timeline");
+  struct pulse_event_s ev;
+  uint32_t n = 0;
+  while (reader.next(&ev)) {
+    if ((ev.queue == 0) && (ev.type == PULSE_EVENT_STEP)) {
+      test(n < MAX_STEPS, "too many steps");
+      t[n++] = ev.ticks;
+    }
+  }
+  reader.close();
+  return n;
+}
+
+uint64_t ref_t[MAX_STEPS];
+uint64_t play_t[MAX_STEPS];
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  record();
+
+  // Errors before start
+  test(s->playTrajectory(table, 0) == MOVE_ERR_INVALID_TRAJECTORY,
+       "empty table");
+  test(s->playTrajectory(table, entries) == MOVE_ERR_NO_DIRECTION_PIN,
+       "no direction pin");
+  s->setDirectionPin(4);
+  test(s->playTrajectory(table, entries) == MOVE_ERR_SPEED_IS_UNDEFINED,
+       "no speed");
+  s->setSpeedInUs(SPEED_US);
+  s->setAcceleration(ACCEL);
+  struct stepper_command_s too_fast = {.ticks = 10, .steps = 1,
+                                       .count_up = true};
+  test(s->playTrajectory(&too_fast, 1) == MOVE_ERR_INVALID_TRAJECTORY,
+       "command too fast");
+  test(!s->isRunning(), "running after errors");
+
+  // Reference: the moves one after the other
+  test(sim.open_timeline("test_28_ref.fasp"), "cannot create timeline");
+  int32_t end_pos = 0;
+  for (uint8_t i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+    test(s->move(moves[i]) == MOVE_OK, "move failed");
+    test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+         "move does not stop");
+    end_pos += moves[i];
+  }
+  sim.close_timeline();
+  test(s->getCurrentPosition() == end_pos, "reference position");
+
+  // Playback of the table
+  s->setCurrentPosition(0);
+  sim.reset();
+  test(sim.open_timeline("test_28_play.fasp"), "cannot create timeline");
+  test(s->playTrajectory(table, entries, true) == MOVE_OK, "play failed");
+  test(s->isPlayingTrajectory(), "not playing");
+  test(s->targetPos() == end_pos, "target position");
+  test(s->playTrajectory(table, entries) == MOVE_ERR_STEPPER_IS_RUNNING,
+       "second playback");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "playback does not stop");
+  sim.close_timeline();
+  test(!s->isPlayingTrajectory(), "still playing");
+  test(s->getCurrentPosition() == end_pos, "playback position");
+  test(sim.q[0].pos == end_pos, "simulated position");
+  test(sim.q[0].dir_errors == 0, "direction errors");
+
+  // The step periods are identical except for the standstill between the
+  // moves of the reference
+  uint32_t n_ref = read_steps("test_28_ref.fasp", ref_t);
+  uint32_t n_play = read_steps("test_28_play.fasp", play_t);
+  printf("steps: reference %u, playback %u\n", n_ref, n_play);
+  test(n_ref == n_play, "number of steps");
+  uint32_t move_end = 0;
+  uint32_t diffs = 0;
+  for (uint8_t i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+    uint32_t move_start = move_end;
+    move_end += fas_abs(moves[i]);
+    for (uint32_t k = move_start + 1; k < move_end; k++) {
+      if (ref_t[k] - ref_t[k - 1] != play_t[k] - play_t[k - 1]) {
+        diffs++;
+      }
+    }
+  }
+  test(diffs == 0, "step periods differ");
+
+  // stopMove() at full speed: the ramp generator decelerates from the
+  // speed of the playback
+  s->setCurrentPosition(0);
+  sim.reset();
+  test(s->playTrajectory(table, entries) == MOVE_OK, "play failed");
+  while (s->getCurrentPosition() < 1000) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  int32_t stop_pos = s->getCurrentPosition();
+  uint32_t hz = s->getCurrentSpeedInMilliHz() / 1000;
+  s->stopMove();
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "stopMove does not stop");
+  test(!s->isPlayingTrajectory(), "playing after stopMove");
+  // v²/2a steps plus the steps in the queue, which is still accelerating.
+  // The queue holds 20ms.
+  int32_t ramp_steps = hz * hz / 2 / ACCEL;
+  int32_t stop_steps = s->getCurrentPosition() - stop_pos;
+  printf("stopMove at %d with %u Hz: %d steps to stop, ramp %d steps\n",
+         stop_pos, hz, stop_steps, ramp_steps);
+  test(stop_steps >= ramp_steps - 10, "stop too fast");
+  test(stop_steps < ramp_steps + (int32_t)hz / 20, "stop too slow");
+  test(s->getCurrentPosition() < 3200, "stop at the end of the trajectory");
+  test(sim.q[0].pos == s->getCurrentPosition(), "position mismatch");
+
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  // The jerk limited ramp takes over, too
+  s->setCurrentPosition(0);
+  sim.reset();
+  s->setJerk(10000000);
+  test(s->playTrajectory(table, entries) == MOVE_OK, "play failed");
+  while (s->getCurrentPosition() < 1000) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  stop_pos = s->getCurrentPosition();
+  s->stopMove();
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "stopMove does not stop");
+  stop_steps = s->getCurrentPosition() - stop_pos;
+  printf("jerk limited stopMove at %d: %d steps to stop\n", stop_pos,
+         stop_steps);
+  test(stop_steps >= ramp_steps - 10, "jerk limited stop too fast");
+  test(s->getCurrentPosition() < 3200, "stop at the end of the trajectory");
+  test(sim.q[0].pos == s->getCurrentPosition(), "position mismatch");
+  s->setJerk(0);
+#endif
+
+  // forceStop() ends the playback after the queue
+  s->setCurrentPosition(0);
+  sim.reset();
+  test(s->playTrajectory(table, entries) == MOVE_OK, "play failed");
+  for (uint8_t i = 0; i < 50; i++) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  s->forceStop();
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "forceStop does not stop");
+  test(!s->isPlayingTrajectory(), "playing after forceStop");
+  test(s->getCurrentPosition() < 3200, "forceStop too late");
+  test(sim.q[0].pos == s->getCurrentPosition(), "position mismatch");
+
+  // moveTo() takes over with the current speed
+  s->setCurrentPosition(0);
+  sim.reset();
+  test(s->playTrajectory(table, entries) == MOVE_OK, "play failed");
+  while (s->getCurrentPosition() < 1000) {
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+  }
+  test(s->moveTo(5000) == MOVE_OK, "moveTo failed");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "moveTo does not stop");
+  test(!s->isPlayingTrajectory(), "playing after moveTo");
+  test(s->getCurrentPosition() == 5000, "moveTo position");
+  test(sim.q[0].pos == 5000, "simulated position");
+  test(sim.q[0].starts == 1, "standstill on takeover");
+
+  printf("TEST_28 PASSED\n");
+  return 0;
+}
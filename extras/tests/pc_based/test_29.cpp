@@ -0,0 +1,303 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FastAccelStepper.h"
+#include "RampGenerator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Compressed trajectory streams with playTrajectoryStream(). A table is
+// recorded from the ramp generator and written with the TrajectoryEncoder
+// into the file test_29.fasc. The file is decoded in chunks of any size
+// back into the table. Then the file is streamed into the ring buffer with
+// a limited number of bytes per ms like a serial link. The playback on the
+// PulseSimulator has to produce the same step times as playTrajectory()
+// of the table. Checked are as well a too slow link and corrupted streams.
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#define MAX_ENTRIES 4000
+#define MAX_STEPS 40000
+#define MAX_BYTES 16000
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+struct stepper_command_s table[MAX_ENTRIES];
+uint16_t entries = 0;
+
+// speed in us, acceleration and move
+const int32_t moves[][3] = {
+    {50, 20000, 3200}, {20, 100000, -10000}, {200, 5000, 1000}, {1000, 0, 30}};
+
+void record() {
+  RampGenerator rg;
+  rg.init();
+  rg.setTargetPosition(0);
+  struct queue_end_s qe;
+  qe.pos = 0;
+  qe.count_up = true;
+  qe.dir = true;
+  for (uint8_t i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+    rg.setSpeedInTicks(moves[i][0] * (TICKS_PER_S / 1000000));
+    if (moves[i][1] != 0) {
+      rg.setAcceleration(moves[i][1]);
+    }
+    test(rg.move(moves[i][2], &qe) == MOVE_OK, "move failed");
+    NextCommand cmd;
+    while (rg.isRampGeneratorActive()) {
+      rg.getNextCommand(&qe, &cmd);
+      rg.afterCommandEnqueued(&cmd);
+      if (cmd.command.ticks == 0) {
+        break;
+      }
+      test(entries < MAX_ENTRIES, "table too small");
+      table[entries++] = cmd.command;
+      qe.pos += cmd.command.count_up ? cmd.command.steps : -cmd.command.steps;
+      qe.count_up = cmd.command.count_up;
+    }
+    // dwell of 100ms
+    struct stepper_command_s pause = {
+        .ticks = 50000, .steps = 0, .count_up = qe.count_up};
+    for (uint8_t j = 0; j < 32; j++) {
+      test(entries < MAX_ENTRIES, "table too small");
+      table[entries++] = pause;
+    }
+  }
+}
+
+uint8_t data[MAX_BYTES];
+uint32_t data_len = 0;
+
+void encode(const char *fname) {
+  TrajectoryEncoder enc;
+  enc.init();
+  data_len = enc.header(data);
+  for (uint16_t i = 0; i < entries; i++) {
+    test(data_len + TRAJECTORY_MAX_RECORD_LEN <= MAX_BYTES, "data too long");
+    data_len += enc.add(&table[i], &data[data_len]);
+  }
+  data_len += enc.finish(&data[data_len]);
+  FILE *f = fopen(fname, "wb");
+  test(f != NULL, "cannot create file");
+  fwrite(data, 1, data_len, f);
+  fclose(f);
+}
+
+void load(const char *fname) {
+  FILE *f = fopen(fname, "rb");
+  test(f != NULL, "cannot open file");
+  data_len = fread(data, 1, MAX_BYTES, f);
+  fclose(f);
+}
+
+// Decode the stream without stepper with the given chunk size
+void decode(uint8_t chunk) {
+  TrajectoryStream stream;
+  stream.reset();
+  stream.setLimits(0, true);
+  uint32_t rd = 0;
+  uint16_t n = 0;
+  while (true) {
+    uint8_t len = fas_min(chunk, data_len - rd);
+    rd += stream.write(&data[rd], len);
+    struct stepper_command_s cmd;
+    int8_t res;
+    while ((res = stream.peek(&cmd)) == TRAJECTORY_OK) {
+      test(n < entries, "too many commands");
+      test((cmd.ticks == table[n].ticks) && (cmd.steps == table[n].steps) &&
+               (cmd.count_up == table[n].count_up),
+           "command differs");
+      stream.consume();
+      n++;
+    }
+    if (res == TRAJECTORY_END) {
+      break;
+    }
+    test(res == TRAJECTORY_NEED_DATA, "decoding error");
+    test(rd < data_len, "stream without end");
+  }
+  test(n == entries, "commands missing");
+  test(rd == data_len, "data after the end");
+}
+
+TrajectoryStream stream;
+uint32_t stream_rd;
+
+// Like the loop of the application: each ms up to bytes_per_ms bytes are
+// read from the source into the stream
+void play_stream(uint32_t bytes_per_ms) {
+  stream.reset();
+  stream_rd = 0;
+  stream_rd += stream.write(data, fas_min(data_len, bytes_per_ms));
+  test(s->playTrajectoryStream(&stream) == MOVE_OK, "play failed");
+  test(s->isPlayingTrajectory(), "not playing");
+  for (uint32_t ms = 0; ms < 100000; ms++) {
+    uint32_t n = fas_min(data_len - stream_rd, bytes_per_ms);
+    n = fas_min(n, stream.availableForWrite());
+    stream_rd += stream.write(&data[stream_rd], n);
+    engine.manageSteppers();
+    sim.advance(CYCLE_TICKS);
+    if (!s->isRunning() && !s->isPlayingTrajectory()) {
+      return;
+    }
+  }
+  test(false, "playback does not stop");
+}
+
+uint32_t read_steps(const char *fname, uint64_t *t) {
+  PulseTimelineReader reader;
+  test(reader.open(fname), "cannot open timeline");
+  struct pulse_event_s ev;
+  uint32_t n = 0;
+  while (reader.next(&ev)) {
+    if ((ev.queue == 0) && (ev.type == PULSE_EVENT_STEP)) {
+      test(n < MAX_STEPS, "too many steps");
+      t[n++] = ev.ticks;
+    }
+  }
+  reader.close();
+  return n;
+}
+
+uint64_t ref_t[MAX_STEPS];
+uint64_t play_t[MAX_STEPS];
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setSpeedInUs(20);
+  s->setAcceleration(10000);
+
+  record();
+  encode("test_29.fasc");
+  load("test_29.fasc");
+  uint64_t ticks = 0;
+  for (uint16_t i = 0; i < entries; i++) {
+    ticks += table[i].steps <= 1 ? table[i].ticks
+                                 : (uint32_t)table[i].ticks * table[i].steps;
+  }
+  uint32_t ms = ticks / (TICKS_PER_S / 1000);
+  printf("%u entries in %u ms: %u bytes instead of %u, %u bytes/s\n", entries,
+         ms, data_len, entries * 4, data_len * 1000 / ms);
+  test(data_len * 2 < entries * 4, "compression below 2:1");
+  printf("RAM of the decoder: %u bytes\n", (uint32_t)sizeof(TrajectoryStream));
+
+  // Decoding in chunks of any size
+  for (uint8_t chunk = 1; chunk <= TRAJECTORY_BUFFER_LEN; chunk++) {
+    decode(chunk);
+  }
+
+  // Reference: the table
+  test(sim.open_timeline("test_29_ref.fasp"), "cannot create timeline");
+  test(s->playTrajectory(table, entries) == MOVE_OK, "play failed");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 20),
+       "playback does not stop");
+  sim.close_timeline();
+  int32_t end_pos = s->getCurrentPosition();
+
+  // The stream with 16 bytes per ms, which is far above the average data
+  // rate and fills the buffer quickly
+  s->setCurrentPosition(0);
+  sim.reset();
+  struct stepper_stats_s stats;
+  s->getStats(&stats, true);
+  test(sim.open_timeline("test_29_play.fasp"), "cannot create timeline");
+  play_stream(16);
+  sim.close_timeline();
+  s->getStats(&stats, true);
+  test(stream.state() == TRAJECTORY_END, "stream not complete");
+  test(stream_rd == data_len, "stream not read");
+  test(s->getCurrentPosition() == end_pos, "stream position");
+  test(s->targetPos() == end_pos, "target position");
+  test(sim.q[0].pos == end_pos, "simulated position");
+  test(sim.q[0].dir_errors == 0, "direction errors");
+  printf("16 bytes/ms: %u underruns\n", stats.underruns);
+  test(stats.underruns == 0, "underruns");
+
+  uint32_t n_ref = read_steps("test_29_ref.fasp", ref_t);
+  uint32_t n_play = read_steps("test_29_play.fasp", play_t);
+  test(n_ref == n_play, "number of steps");
+  uint32_t diffs = 0;
+  for (uint32_t k = 1; k < n_ref; k++) {
+    if (ref_t[k] - ref_t[k - 1] != play_t[k] - play_t[k - 1]) {
+      diffs++;
+    }
+  }
+  printf("steps: %u with %u different periods\n", n_ref, diffs);
+  test(diffs == 0, "step periods differ");
+
+  // A link, which is too slow for the acceleration phase: the queue runs
+  // empty, but all steps are executed
+  s->setCurrentPosition(0);
+  sim.reset();
+  play_stream(1);
+  s->getStats(&stats, true);
+  printf("1 byte/ms: %u underruns, %u starts\n", stats.underruns,
+         sim.q[0].starts);
+  test(stats.underruns > 0, "no underruns");
+  test(stream.state() == TRAJECTORY_END, "stream not complete");
+  test(s->getCurrentPosition() == end_pos, "slow stream position");
+  test(sim.q[0].pos == end_pos, "simulated position");
+
+  // Wrong header: the stepper does not start
+  s->setCurrentPosition(0);
+  sim.reset();
+  data[4]++;
+  play_stream(16);
+  data[4]--;
+  test(stream.state() == TRAJECTORY_ERR_HEADER, "header accepted");
+  test(s->getCurrentPosition() == 0, "started with wrong header");
+  test(s->playTrajectoryStream(&stream) == MOVE_ERR_INVALID_TRAJECTORY,
+       "stream not reset");
+
+  // Without direction pin the first count down command is an error, which
+  // stops the stepper like stopMove() before the end of the first move
+  s->setCurrentPosition(0);
+  sim.reset();
+  s->setDirectionPin(PIN_UNDEFINED);
+  play_stream(16);
+  test(stream.state() == TRAJECTORY_ERR_COMMAND, "no command error");
+  int32_t pos = s->getCurrentPosition();
+  printf("stopped at %d\n", pos);
+  test((pos > 3000) && (pos <= 3200), "stop position");
+  test(sim.q[0].pos == pos, "simulated position");
+
+  // A varint longer than 32 bits in the middle of the acceleration is a
+  // format error, and the stepper decelerates from the last speed
+  s->setDirectionPin(4);
+  s->setCurrentPosition(0);
+  sim.reset();
+  uint8_t saved[5];
+  memcpy(saved, &data[200], 5);
+  memset(&data[200], 0xff, 5);
+  play_stream(16);
+  memcpy(&data[200], saved, 5);
+  printf("corrupted stream: stopped at %d\n", s->getCurrentPosition());
+  test(stream.state() == TRAJECTORY_ERR_FORMAT, "no format error");
+  test(s->getCurrentPosition() > 0, "not started");
+  test(!s->isRunning(), "still running");
+  test(sim.q[0].pos == s->getCurrentPosition(), "simulated position");
+
+  printf("TEST_29 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,220 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "RampGenerator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Long pauses in one queue entry. At slow speed the ramp generator splits
+// the pause after a step into periods of 65535 ticks. fill_queue() puts
+// these periods into one pause entry, which the isr repeats. The reference
+// is the playback of the recorded ramp generator commands, which queues one
+// entry per period as before. Both need to produce the same step periods,
+// while the move needs far fewer queue entries. Checked is as well the
+// delay to enable, which can be up to MAX_ON_DELAY_TICKS (about 1s).
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#define MAX_ENTRIES 4000
+#define MAX_STEPS 100
+#define SPEED_HZ 4
+#define ACCEL 2
+#define MOVE_STEPS 20
+#define ON_DELAY_US 500000
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+struct stepper_command_s table[MAX_ENTRIES];
+uint16_t entries = 0;
+
+// Record the commands of the move as playTrajectory() table
+void record() {
+  RampGenerator rg;
+  rg.init();
+  rg.setTargetPosition(0);
+  rg.setSpeedInTicks(TICKS_PER_S / SPEED_HZ);
+  rg.setAcceleration(ACCEL);
+  struct queue_end_s qe;
+  qe.pos = 0;
+  qe.count_up = true;
+  qe.dir = true;
+  test(rg.move(MOVE_STEPS, &qe) == MOVE_OK, "move failed");
+  NextCommand cmd;
+  while (rg.isRampGeneratorActive()) {
+    rg.getNextCommand(&qe, &cmd);
+    rg.afterCommandEnqueued(&cmd);
+    if (cmd.command.ticks == 0) {
+      break;
+    }
+    test(entries < MAX_ENTRIES, "table too small");
+    table[entries++] = cmd.command;
+    qe.pos += cmd.command.count_up ? cmd.command.steps : -cmd.command.steps;
+    qe.count_up = cmd.command.count_up;
+  }
+}
+
+struct run_stats_s {
+  uint32_t entries;        // queue entries of the move
+  uint32_t max_occupancy;  // max. entries in the queue after a fill
+  uint32_t occupancy_sum;  // sum of the entries in the queue after a fill
+  uint32_t fills;
+  uint32_t isr_calls;
+};
+
+// Run the move or the playback of the table and count the queue entries
+void run(bool playback, const char *fname, struct run_stats_s *stats) {
+  s->setCurrentPosition(0);
+  sim.reset();
+  stats->entries = 0;
+  stats->max_occupancy = 0;
+  stats->occupancy_sum = 0;
+  stats->fills = 0;
+  fas_queue[0].stat_isr_calls = 0;
+  fas_queue_idx_t last_wp = fas_queue[0].next_write_idx;
+  test(sim.open_timeline(fname), "cannot create timeline");
+  if (playback) {
+    test(s->playTrajectory(table, entries) == MOVE_OK, "play failed");
+  } else {
+    test(s->move(MOVE_STEPS) == MOVE_OK, "move failed");
+  }
+  for (uint32_t ms = 0; ms < 60000; ms++) {
+    engine.manageSteppers();
+    fas_queue_idx_t wp = fas_queue[0].next_write_idx;
+    stats->entries += (fas_queue_idx_t)(wp - last_wp);
+    last_wp = wp;
+    uint32_t occupancy = fas_queue[0].queueEntries();
+    stats->max_occupancy = fas_max(stats->max_occupancy, occupancy);
+    stats->occupancy_sum += occupancy;
+    stats->fills++;
+    sim.advance(CYCLE_TICKS);
+    if (!s->isRunning()) {
+      break;
+    }
+  }
+  sim.close_timeline();
+  test(!s->isRunning(), "move does not stop");
+  test(s->getCurrentPosition() == MOVE_STEPS, "position");
+  test(sim.q[0].pos == MOVE_STEPS, "simulated position");
+  stats->isr_calls = fas_queue[0].stat_isr_calls;
+}
+
+// The step times of a timeline
+uint32_t read_steps(const char *fname, uint64_t *t) {
+  PulseTimelineReader reader;
+  test(reader.open(fname), "cannot open timeline");
+  struct pulse_event_s ev;
+  uint32_t n = 0;
+  while (reader.next(&ev)) {
+    if ((ev.queue == 0) && (ev.type == PULSE_EVENT_STEP)) {
+      test(n < MAX_STEPS, "too many steps");
+      t[n++] = ev.ticks;
+    }
+  }
+  reader.close();
+  return n;
+}
+
+uint64_t ref_t[MAX_STEPS];
+uint64_t move_t[MAX_STEPS];
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setSpeedInHz(SPEED_HZ);
+  s->setAcceleration(ACCEL);
+  record();
+
+  struct run_stats_s ref;
+  struct run_stats_s rep;
+  run(true, "test_30_ref.fasp", &ref);
+  run(false, "test_30_move.fasp", &rep);
+  printf("queue entries: %u with single periods, %u with repeated periods\n",
+         ref.entries, rep.entries);
+  printf("queue occupancy: avg %.2f max %u vs avg %.2f max %u\n",
+         (float)ref.occupancy_sum / ref.fills, ref.max_occupancy,
+         (float)rep.occupancy_sum / rep.fills, rep.max_occupancy);
+  // The isr is still called once per period of 65535 ticks
+  printf("isr calls: %u vs %u\n", ref.isr_calls, rep.isr_calls);
+  test(ref.entries == entries, "reference entries");
+  test(rep.entries * 10 < ref.entries, "too many entries");
+  test(rep.occupancy_sum < ref.occupancy_sum, "queue occupancy");
+  test(rep.max_occupancy <= ref.max_occupancy, "max. queue occupancy");
+  test(rep.isr_calls == ref.isr_calls, "isr calls differ");
+
+  uint32_t n_ref = read_steps("test_30_ref.fasp", ref_t);
+  uint32_t n_move = read_steps("test_30_move.fasp", move_t);
+  test(n_ref == MOVE_STEPS, "reference steps");
+  test(n_move == MOVE_STEPS, "steps");
+  uint32_t diffs = 0;
+  for (uint32_t k = 1; k < n_ref; k++) {
+    if (ref_t[k] - ref_t[k - 1] != move_t[k] - move_t[k - 1]) {
+      diffs++;
+    }
+  }
+  test(diffs == 0, "step periods differ");
+
+  // Delay to enable of 500ms: the pause entries before the first step need
+  // only three entries instead of 123
+  s->setEnablePin(5);
+  s->setAutoEnable(true);
+  test(s->setDelayToEnable(MAX_ON_DELAY_TICKS / (TICKS_PER_S / 1000000) +
+                           1) == DELAY_TOO_HIGH,
+       "delay to enable too high accepted");
+  test(s->setDelayToEnable(ON_DELAY_US) == DELAY_OK, "delay to enable");
+  s->setSpeedInHz(1000);
+  s->setAcceleration(10000);
+  s->setCurrentPosition(0);
+  sim.reset();
+  test(sim.open_timeline("test_30_delay.fasp"), "cannot create timeline");
+  test(s->move(100) == MOVE_OK, "move failed");
+  engine.manageSteppers();
+  StepperQueue *q = &fas_queue[0];
+  uint8_t pauses = 0;
+  uint32_t pause_ticks = 0;
+  for (fas_queue_idx_t rp = q->read_idx; rp != q->next_write_idx; rp++) {
+    struct queue_entry *e = &q->entry[rp & QUEUE_LEN_MASK];
+    if (e->hasSteps) {
+      break;
+    }
+    pauses++;
+    pause_ticks += (uint32_t)e->ticks * fas_max(e->steps, (fas_steps_t)1);
+  }
+  printf("delay to enable: %u pause entries with %u ticks\n", pauses,
+         pause_ticks);
+  test(pauses <= 3, "too many pause entries");
+  test(pause_ticks == US_TO_TICKS(ON_DELAY_US), "delay ticks");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "move does not stop");
+  sim.close_timeline();
+  test(s->getCurrentPosition() == 100, "position after delay");
+  test(sim.q[0].pos == 100, "simulated position after delay");
+  n_move = read_steps("test_30_delay.fasp", move_t);
+  test(n_move == 100, "steps after delay");
+  printf("first step after %llu ticks\n",
+         (unsigned long long)(move_t[0] - sim.q[0].start_ticks));
+  test(move_t[0] - sim.q[0].start_ticks == US_TO_TICKS(ON_DELAY_US),
+       "first step not after the delay");
+
+  printf("TEST_30 PASSED\n");
+  return 0;
+}
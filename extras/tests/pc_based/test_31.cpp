@@ -0,0 +1,144 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "RampCalculator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// Compile time constants with pmfl_const_from() and pmfl_const_square().
+// Both need to be bit-identical to pmfl_from() and pmfl_square() of the
+// selected PoorManFloat variant. Checked are all values up to 2^17, powers of
+// two with neighbours and pseudo random 32 bit values. The constants for the
+// timer frequencies are evaluated by the compiler and compared with the run
+// time calculation, the hand computed constants and double precision.
+
+#if defined(FAS_PMF_32BIT)
+#define PMF_FRACTION_BITS 16
+#else
+#define PMF_FRACTION_BITS 9
+#endif
+
+// The constants of the ramp calculation are constant expressions
+static_assert(PMF_TICKS_PER_S == pmfl_const_from((uint32_t)TICKS_PER_S),
+              "timer frequency");
+static_assert(PMF_ACCEL_FACTOR ==
+                  pmfl_const_square(PMF_TICKS_PER_S) - pmfl_const_from(2),
+              "acceleration factor");
+
+struct timer_freq_s {
+  uint32_t freq;
+  pmf_logarithmic pmfl_freq;
+  pmf_logarithmic pmfl_div_sqrt_of_2;
+  pmf_logarithmic pmfl_square_div_2;
+};
+
+#define TIMER_FREQ(f)                                                   \
+  {f, pmfl_const_from((uint32_t)f),                                     \
+   pmfl_divide(pmfl_const_from((uint32_t)f), pmfl_sqrt(pmfl_const_from(2))), \
+   pmfl_divide(pmfl_const_square(pmfl_const_from((uint32_t)f)),          \
+               pmfl_const_from(2))}
+
+static constexpr struct timer_freq_s timer_freqs[] = {
+    TIMER_FREQ(16000000), TIMER_FREQ(21000000), TIMER_FREQ(40000000),
+    TIMER_FREQ(80000000), TIMER_FREQ(84000000)};
+
+uint32_t checked = 0;
+
+void check_from(uint32_t x) {
+  pmf_logarithmic c = pmfl_const_from(x);
+  pmf_logarithmic r = pmfl_from(x);
+  if (c != r) {
+    printf("pmfl_const_from(%u) = %x, pmfl_from() = %x\n", x, c, r);
+    test(false, "pmfl_const_from() differs");
+  }
+  checked++;
+}
+
+// The difference to the exact value in units of the last bit
+double lsb_error(pmf_logarithmic x, double v) {
+  return x - log2(v) * (1 << PMF_FRACTION_BITS);
+}
+
+int main() {
+  for (uint32_t x = 0; x < 0x20000; x++) {
+    check_from(x);
+  }
+  for (uint8_t n = 2; n < 32; n++) {
+    uint32_t x = ((uint32_t)1) << n;
+    check_from(x - 1);
+    check_from(x);
+    check_from(x + 1);
+  }
+  check_from(0xffffffff);
+  uint32_t x = 1;
+  for (uint32_t i = 0; i < 1000000; i++) {
+    x = x * 1664525 + 1013904223;
+    check_from(x);
+    check_from(x >> (i & 31));
+  }
+  printf("pmfl_const_from(): %u values identical\n", checked);
+
+  pmf_logarithmic max = PMF_CONST_MAX;
+  pmf_logarithmic step = max / 1000;
+  for (pmf_logarithmic p = -max; p <= max - step; p += step) {
+    test(pmfl_const_square(p) == pmfl_square(p), "pmfl_const_square() differs");
+  }
+  test(pmfl_const_square(max) == pmfl_square(max), "square of max");
+  test(pmfl_const_square(-max) == pmfl_square(-max), "square of -max");
+
+  for (uint8_t i = 0; i < sizeof(timer_freqs) / sizeof(timer_freqs[0]); i++) {
+    const struct timer_freq_s *t = &timer_freqs[i];
+    pmf_logarithmic f = pmfl_from(t->freq);
+    test(t->pmfl_freq == f, "timer frequency");
+    test(t->pmfl_div_sqrt_of_2 ==
+             pmfl_divide(f, pmfl_sqrt(pmfl_from((uint32_t)2))),
+         "timer frequency / sqrt(2)");
+    test(t->pmfl_square_div_2 ==
+             pmfl_divide(pmfl_square(f), pmfl_from((uint32_t)2)),
+         "timer frequency^2 / 2");
+    double e_freq = lsb_error(t->pmfl_freq, t->freq);
+    double e_accel =
+        lsb_error(t->pmfl_square_div_2, (double)t->freq * t->freq / 2);
+    printf("%u Hz: %x %x %x, error %.2f %.2f lsb\n", t->freq, t->pmfl_freq,
+           t->pmfl_div_sqrt_of_2, t->pmfl_square_div_2, e_freq, e_accel);
+    test(fabs(e_freq) <= 1, "error of timer frequency");
+    test(fabs(e_accel) <= 3, "error of acceleration factor");
+  }
+
+  // The hand computed constants of 16 MHz and 21 MHz
+  const struct timer_freq_s *t16 = &timer_freqs[0];
+  const struct timer_freq_s *t21 = &timer_freqs[1];
+  test(t16->pmfl_freq == PMF_CONST_16E6, "PMF_CONST_16E6");
+  test(t16->pmfl_div_sqrt_of_2 == PMF_CONST_16E6_DIV_SQRT_OF_2,
+       "PMF_CONST_16E6_DIV_SQRT_OF_2");
+  test(t21->pmfl_freq == PMF_CONST_21E6, "PMF_CONST_21E6");
+  test(t21->pmfl_div_sqrt_of_2 == PMF_CONST_21E6_DIV_SQRT_OF_2,
+       "PMF_CONST_21E6_DIV_SQRT_OF_2");
+  test(t21->pmfl_square_div_2 == PMF_CONST_2205E11, "PMF_CONST_2205E11");
+#if defined(FAS_PMF_32BIT)
+  // PMF_CONST_128E12 is the exact value rounded, while the table
+  // interpolation of 16e6 yields one lsb less
+  test(t16->pmfl_square_div_2 == PMF_CONST_128E12 - 1, "PMF_CONST_128E12");
+#else
+  test(t16->pmfl_square_div_2 == PMF_CONST_128E12, "PMF_CONST_128E12");
+#endif
+
+  printf("TEST_31 PASSED\n");
+  return 0;
+}
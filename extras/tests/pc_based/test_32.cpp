@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Position events: fill_queue() splits the commands at the step to an
+// event's position and the PulseSimulator raises the event, when it starts
+// the entry with this step. This is at the step before. Each move is run
+// without and with events: the step times need to be identical. A slow move
+// has entries of at least MIN_CMD_TICKS per step, so the events are exact.
+// At high speed an event may come up to 3 * MIN_CMD_TICKS earlier. Checked
+// are as well events at the same position, the backward direction, unused
+// events and the number of events.
+
+#define CYCLE_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#define MAX_STEPS 25000
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+FastAccelStepper *s;
+
+uint64_t event_ticks[MAX_POSITION_EVENTS];
+uint8_t event_calls[MAX_POSITION_EVENTS];
+
+void event_callback(FastAccelStepper *stepper, uint8_t event) {
+  test(stepper == s, "wrong stepper");
+  test(event < MAX_POSITION_EVENTS, "wrong event");
+  event_ticks[event] = sim.now;
+  event_calls[event]++;
+}
+
+uint32_t read_steps(const char *fname, uint64_t *t) {
+  PulseTimelineReader reader;
+  test(reader.open(fname), "cannot open timeline");
+  struct pulse_event_s ev;
+  uint32_t n = 0;
+  while (reader.next(&ev)) {
+    if ((ev.queue == 0) && (ev.type == PULSE_EVENT_STEP)) {
+      test(n < MAX_STEPS, "too many steps");
+      t[n++] = ev.ticks;
+    }
+  }
+  reader.close();
+  return n;
+}
+
+uint64_t ref_t[MAX_STEPS];
+uint64_t move_t[MAX_STEPS];
+
+// Move from the current position to target, once without and once with the
+// events at positions. Returns the max. ticks an event comes before the
+// step preceding the event's position.
+uint32_t run(uint32_t speed_hz, uint32_t accel, int32_t target,
+             const int32_t *positions, uint8_t n, uint8_t expected) {
+  int32_t start = s->getCurrentPosition();
+  s->setSpeedInHz(speed_hz);
+  s->setAcceleration(accel);
+
+  sim.reset();
+  sim.q[0].pos = start;
+  test(sim.open_timeline("test_32_ref.fasp"), "cannot create timeline");
+  test(s->moveTo(target) == MOVE_OK, "move failed");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "move does not stop");
+  sim.close_timeline();
+  uint32_t steps = read_steps("test_32_ref.fasp", ref_t);
+  test(s->getPositionEvents() == 0, "events without events");
+
+  s->setCurrentPosition(start);
+  sim.reset();
+  sim.q[0].pos = start;
+  int8_t events[MAX_POSITION_EVENTS];
+  for (uint8_t i = 0; i < n; i++) {
+    events[i] = s->addPositionEvent(positions[i]);
+    test(events[i] >= 0, "no free event");
+    event_calls[events[i]] = 0;
+  }
+  test(sim.open_timeline("test_32_events.fasp"), "cannot create timeline");
+  test(s->moveTo(target) == MOVE_OK, "move failed");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "move does not stop");
+  sim.close_timeline();
+  test(s->getCurrentPosition() == target, "position");
+  test(sim.q[0].pos == target, "simulated position");
+  test(read_steps("test_32_events.fasp", move_t) == steps, "steps differ");
+  for (uint32_t k = 0; k < steps; k++) {
+    test(ref_t[k] - ref_t[0] == move_t[k] - move_t[0], "step times differ");
+  }
+
+  uint8_t raised = s->getPositionEvents();
+  test(s->getPositionEvents() == 0, "events not cleared");
+  uint8_t found = 0;
+  uint32_t max_early = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t e = events[i];
+    if ((raised & (1 << e)) == 0) {
+      test(event_calls[e] == 0, "callback of event not raised");
+      continue;
+    }
+    found++;
+    test(event_calls[e] == 1, "callback not called once");
+    // the step to the position and the step before
+    uint32_t k = abs(positions[i] - start) - 1;
+    uint64_t before = k > 0 ? move_t[k - 1] : move_t[0];
+    printf("event %d at %d: %llu ticks before the step\n", e, positions[i],
+           (unsigned long long)(move_t[k] - event_ticks[e]));
+    test(event_ticks[e] <= before, "event too late");
+    max_early = fas_max(max_early, (uint32_t)(before - event_ticks[e]));
+  }
+  test(found == expected, "number of raised events");
+  return max_early;
+}
+
+int main() {
+  engine.init();
+  s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setPositionEventCallback(event_callback);
+
+  // At 4kHz a step period exceeds MIN_CMD_TICKS. The events at the queue
+  // start, in acceleration, coasting and deceleration are exact
+  const int32_t slow[] = {1, 100, 2000, 3000};
+  test(run(4000, 40000, 3000, slow, 4, 4) == 0, "slow events not exact");
+
+  // At 50kHz an event can be moved earlier
+  const int32_t fast[] = {3050, 13000, 22990};
+  uint32_t early = run(50000, 200000, 23000, fast, 3, 3);
+  printf("fast: %u ticks early\n", early);
+  test(early <= 3 * MIN_CMD_TICKS, "fast events too early");
+
+  // Backward with two events at the same position and one just after
+  const int32_t backward[] = {15000, 5000, 5000, 4999};
+  early = run(50000, 200000, 0, backward, 4, 4);
+  test(early <= 3 * MIN_CMD_TICKS, "backward events too early");
+
+  // Not all events are in use. Those not reached stay in use
+  const int32_t unused[] = {500, -100, 4000};
+  test(run(4000, 40000, 1000, unused, 3, 1) == 0, "unused events");
+  test(s->addPositionEvent(0) >= 0, "free event in use");
+  test(s->addPositionEvent(0) >= 0, "raised event still in use");
+  test(s->addPositionEvent(0) == POSITION_EVENT_ERR_FULL, "too many events");
+  s->clearPositionEvents();
+  for (uint8_t i = 0; i < MAX_POSITION_EVENTS; i++) {
+    test(s->addPositionEvent(0) >= 0, "event not free after clear");
+  }
+  test(s->addPositionEvent(0) == POSITION_EVENT_ERR_FULL, "too many events");
+  s->clearPositionEvents();
+
+  // Cleared events are not raised
+  s->addPositionEvent(500);
+  s->clearPositionEvents();
+  test(s->moveTo(0) == MOVE_OK, "move failed");
+  test(sim.run_until_idle(&engine, CYCLE_TICKS, TICKS_PER_S * 10),
+       "move does not stop");
+  test(s->getPositionEvents() == 0, "cleared event raised");
+
+  printf("TEST_32 PASSED\n");
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+// Only the format of the dump is needed, not the ring
+#undef SUPPORT_TRACE
+#include "fas_trace.h"
+
+// The decoder is a viewer: the checks of RampChecker would abort on the
+// moves of an application, which e.g. change the speed during a ramp.
+#define NDEBUG
+#undef assert
+#define assert(x)
+#include "RampChecker.h"
+
+// Decoder of a binary trace dump as written by the application with
+// fas_trace_header() and fas_trace_read(). See src/fas_trace.h
+//
+// Usage:
+//     ./trace_decode dump.trace
+//
+// The queue entries are fed per queue into the RampChecker, which prints
+// the per command view as the pc based tests do. The other events are
+// printed with the time of the queue in seconds.
+
+struct decoder_queue_s {
+  RampChecker rc;
+  bool has_dir;
+  bool count_up;
+  uint32_t pushes;
+};
+struct decoder_queue_s queues[256];
+
+static const char *ramp_state_name(uint8_t state) {
+  switch (state & RAMP_STATE_MASK) {
+    case RAMP_STATE_IDLE:
+      return "IDLE";
+    case RAMP_STATE_COAST:
+      return "COAST";
+    case RAMP_STATE_ACCELERATE:
+      return "ACCELERATE";
+    case RAMP_STATE_DECELERATE:
+      return "DECELERATE";
+    case RAMP_STATE_REVERSE:
+      return "REVERSE";
+  }
+  return "?";
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <trace dump>\n", argv[0]);
+    return 1;
+  }
+  FILE *f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  uint8_t header[FAS_TRACE_HEADER_LEN];
+  if ((fread(header, 1, sizeof(header), f) != sizeof(header)) ||
+      (memcmp(header, "FAST", 4) != 0)) {
+    fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+    return 1;
+  }
+  if (header[4] != FAS_TRACE_VERSION) {
+    fprintf(stderr, "%s: unsupported version %d\n", argv[1], header[4]);
+    return 1;
+  }
+  uint8_t num_queues = header[5];
+  uint32_t ticks_per_s = header[8] | (header[9] << 8) | (header[10] << 16) |
+                         ((uint32_t)header[11] << 24);
+  printf("trace with %d queues, %u ticks/s\n", num_queues, ticks_per_s);
+  if (ticks_per_s != 16000000) {
+    // RampChecker calculates with 16MHz
+    printf("times and speeds are scaled by %.3f\n", ticks_per_s / 16e6);
+  }
+
+  for (uint8_t i = 0; i < num_queues; i++) {
+    queues[i].has_dir = false;
+    queues[i].pushes = 0;
+  }
+
+  struct fas_trace_event_s ev;
+  uint32_t events = 0;
+  while (fread(&ev, sizeof(ev), 1, f) == 1) {
+    events++;
+    if (ev.queue >= num_queues) {
+      printf("event %u: invalid queue %d\n", events, ev.queue);
+      continue;
+    }
+    struct decoder_queue_s *dq = &queues[ev.queue];
+    bool count_up = (ev.type & FAS_TRACE_COUNT_UP) != 0;
+    double t = dq->rc.total_ticks / (double)ticks_per_s;
+    switch (ev.type & FAS_TRACE_TYPE_MASK) {
+      case FAS_TRACE_RAMP_STATE:
+        printf("Q%d @%.6fs RAMP %s %s ticks=%u\n", ev.queue, t,
+               ramp_state_name(ev.a),
+               (ev.a & RAMP_DIRECTION_COUNT_UP)     ? "UP"
+               : (ev.a & RAMP_DIRECTION_COUNT_DOWN) ? "DOWN"
+                                                    : "",
+               ev.b);
+        if ((ev.a & RAMP_STATE_MASK) == RAMP_STATE_IDLE) {
+          // the next ramp starts from standstill
+          dq->rc.next_ramp();
+          dq->has_dir = false;
+        }
+        break;
+      case FAS_TRACE_PLAN:
+        printf("Q%d @%.6fs PLAN %s steps=%u ticks=%u\n", ev.queue, t,
+               count_up ? "U" : "D", ev.a, ev.b);
+        break;
+      case FAS_TRACE_PUSH: {
+        struct queue_entry e;
+        memset(&e, 0, sizeof(e));
+        e.steps = ev.a;
+        e.ticks = ev.b;
+        e.countUp = count_up;
+        e.toggle_dir = dq->has_dir && (count_up != dq->count_up);
+        dq->has_dir = true;
+        dq->count_up = count_up;
+        dq->pushes++;
+        printf("Q%d PUSH %s ", ev.queue, count_up ? "U" : "D");
+        dq->rc.check_section(&e);
+      } break;
+      case FAS_TRACE_START:
+        printf("Q%d @%.6fs START\n", ev.queue, t);
+        break;
+      case FAS_TRACE_UNDERRUN:
+        printf("Q%d @%.6fs UNDERRUN #%u\n", ev.queue, t, ev.b);
+        break;
+      default:
+        printf("event %u: unknown type %d\n", events, ev.type);
+        break;
+    }
+  }
+  fclose(f);
+  for (uint8_t i = 0; i < num_queues; i++) {
+    printf("Q%d: %u queue entries, %.6fs\n", i, queues[i].pushes,
+           queues[i].rc.total_ticks / (double)ticks_per_s);
+  }
+  printf("%u events\n", events);
+  return 0;
+}
@@ -0,0 +1,269 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FastAccelStepper.h"
+#include "RampGenerator.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+// Generator of trajectory tables for playTrajectory().
+//
+// The moves are executed by the ramp generator and the commands are written
+// as C header with a const table in FAS_PROGMEM or as compressed stream for
+// playTrajectoryStream(). The commands are those,
+// which fill_queue() would add to the queue. Each move starts and ends at
+// standstill. The commands are a subset of the StepperDemo:
+//
+//   V<us>      speed in us/step
+//   H<hz>      speed in steps/s
+//   A<accel>   acceleration in steps/s^2
+//   J<steps>   linear acceleration steps from standstill
+//   j<steps>   linear acceleration steps for speed changes
+//   P<pos>     moveTo(pos)
+//   R<n>       move(n)
+//   w<ms>      dwell for the given time
+//
+// Example:
+//   ./trajectory_gen -n pick trajectory.h V50 A20000 R3200 w200 R-3200
+//
+// Options:
+//   -n <name>  name of the table (default trajectory)
+//   -m <ticks> min. ticks of a command on the target (default 8000 for
+//              esp32). avr needs only 640. Fails, if a command is shorter.
+//   -b         write the binary stream format of TrajectoryStream.h
+//
+// The ticks are for TICKS_PER_S=16MHz. The header checks this on the target.
+
+#define MAX_ENTRIES 65535
+
+static struct stepper_command_s entries[MAX_ENTRIES];
+static uint32_t entry_cnt = 0;
+static struct queue_end_s qe;
+static uint32_t min_cmd_ticks = 8000;
+
+static bool add_entry(const struct stepper_command_s *cmd) {
+  if (entry_cnt == MAX_ENTRIES) {
+    fprintf(stderr, "More than %u entries\n", MAX_ENTRIES);
+    return false;
+  }
+  uint32_t cmd_ticks = cmd->ticks;
+  if (cmd->steps > 1) {
+    cmd_ticks *= cmd->steps;
+  }
+  if (cmd_ticks < min_cmd_ticks) {
+    fprintf(stderr, "Entry %u with %u steps of %u ticks is below %u ticks\n",
+            entry_cnt, cmd->steps, cmd->ticks, min_cmd_ticks);
+    return false;
+  }
+  entries[entry_cnt++] = *cmd;
+  if (cmd->count_up) {
+    qe.pos += cmd->steps;
+  } else {
+    qe.pos -= cmd->steps;
+  }
+  qe.count_up = cmd->count_up;
+  return true;
+}
+
+// Run the ramp generator from standstill to standstill as fill_queue() does
+static bool record_move(RampGenerator *rg) {
+  NextCommand cmd;
+  while (rg->isRampGeneratorActive()) {
+    rg->getNextCommand(&qe, &cmd);
+    rg->afterCommandEnqueued(&cmd);
+    if (cmd.command.ticks == 0) {
+      break;
+    }
+    if (!add_entry(&cmd.command)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool dwell(uint32_t ms) {
+  uint32_t delay = ms * (TICKS_PER_S / 1000);
+  // pauses keep the direction. The last one is not shorter than 32768 ticks
+  while (delay > 0) {
+    uint32_t ticks = delay >> 1;
+    uint16_t ticks_u16 = ticks;
+    if (ticks > 65535) {
+      ticks_u16 = 65535;
+    } else if (ticks < 32768) {
+      ticks_u16 = delay;
+    }
+    struct stepper_command_s pause = {
+        .ticks = ticks_u16, .steps = 0, .count_up = qe.count_up};
+    if (!add_entry(&pause)) {
+      return false;
+    }
+    delay -= ticks_u16;
+  }
+  return true;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-n name] [-m min_cmd_ticks] [-b] <file> commands...\n",
+          prog);
+  exit(1);
+}
+
+static uint64_t write_stream(FILE *f) {
+  TrajectoryEncoder enc;
+  uint8_t buf[TRAJECTORY_MAX_RECORD_LEN + 2];
+  enc.init();
+  uint64_t bytes = enc.header(buf);
+  fwrite(buf, 1, bytes, f);
+  for (uint32_t i = 0; i < entry_cnt; i++) {
+    uint8_t n = enc.add(&entries[i], buf);
+    fwrite(buf, 1, n, f);
+    bytes += n;
+  }
+  uint8_t n = enc.finish(buf);
+  fwrite(buf, 1, n, f);
+  return bytes + n;
+}
+
+int main(int argc, char **argv) {
+  const char *name = "trajectory";
+  bool binary = false;
+  int argi = 1;
+  while ((argi < argc) && (argv[argi][0] == '-') &&
+         ((argv[argi][1] == 'n') || (argv[argi][1] == 'm') ||
+          (argv[argi][1] == 'b'))) {
+    if (argv[argi][1] == 'b') {
+      binary = true;
+      argi++;
+      continue;
+    }
+    if (argi + 1 >= argc) {
+      usage(argv[0]);
+    }
+    if (argv[argi][1] == 'n') {
+      name = argv[argi + 1];
+    } else {
+      min_cmd_ticks = atol(argv[argi + 1]);
+    }
+    argi += 2;
+  }
+  if (argi + 1 >= argc) {
+    usage(argv[0]);
+  }
+  const char *fname = argv[argi++];
+  int first_cmd = argi;
+
+  RampGenerator rg;
+  rg.init();
+  qe.pos = 0;
+  qe.count_up = true;
+  qe.dir = true;
+  rg.setTargetPosition(0);
+  uint64_t total_ticks = 0;
+  for (; argi < argc; argi++) {
+    const char *cmd = argv[argi];
+    long val = atol(&cmd[1]);
+    int8_t res = 0;
+    bool ok = true;
+    switch (cmd[0]) {
+      case 'V':
+        rg.setSpeedInTicks(val * (TICKS_PER_S / 1000000));
+        break;
+      case 'H':
+        rg.setSpeedInTicks(rg.divForHz(val));
+        break;
+      case 'A':
+        res = rg.setAcceleration(val);
+        break;
+      case 'J':
+        rg.setLinearAcceleration(val);
+        break;
+      case 'j':
+        rg.setJumpStart(val);
+        break;
+      case 'P':
+        res = rg.moveTo(val, &qe);
+        ok = (res == MOVE_OK) && record_move(&rg);
+        break;
+      case 'R':
+        res = rg.move(val, &qe);
+        ok = (res == MOVE_OK) && record_move(&rg);
+        break;
+      case 'w':
+        ok = dwell(val);
+        break;
+      default:
+        fprintf(stderr, "Unknown command %s\n", cmd);
+        return 1;
+    }
+    if (res != 0) {
+      fprintf(stderr, "Command %s returned error %d\n", cmd, res);
+      return 1;
+    }
+    if (!ok) {
+      return 1;
+    }
+  }
+
+  FILE *f = fopen(fname, "w");
+  if (f == NULL) {
+    perror(fname);
+    return 1;
+  }
+  uint64_t steps = 0;
+  for (uint32_t i = 0; i < entry_cnt; i++) {
+    steps += entries[i].steps;
+    total_ticks += entries[i].steps <= 1
+                       ? entries[i].ticks
+                       : (uint32_t)entries[i].ticks * entries[i].steps;
+  }
+  if (binary) {
+    uint64_t bytes = write_stream(f);
+    fclose(f);
+    printf("%s: %u entries, %llu steps, end position %d, %.3fs\n", fname,
+           entry_cnt, (unsigned long long)steps, qe.pos,
+           (double)total_ticks / TICKS_PER_S);
+    printf("%llu bytes instead of %u, %.0f bytes/s\n",
+           (unsigned long long)bytes, entry_cnt * 4,
+           bytes * (double)TICKS_PER_S / total_ticks);
+    return 0;
+  }
+  fprintf(f, "// Generated by trajectory_gen");
+  for (int i = first_cmd; i < argc; i++) {
+    fprintf(f, " %s", argv[i]);
+  }
+  fprintf(f, "\n// %u entries, %llu steps, end position %d, %.3fs\n",
+          entry_cnt, (unsigned long long)steps, qe.pos,
+          (double)total_ticks / TICKS_PER_S);
+  fprintf(f, "#include \"FastAccelStepper.h\"\n\n");
+  fprintf(f, "#if TICKS_PER_S != %ld\n", (long)TICKS_PER_S);
+  fprintf(f, "#error \"%s has been generated for %ld ticks/s\"\n", name,
+          (long)TICKS_PER_S);
+  fprintf(f, "#endif\n\n");
+  fprintf(f, "const struct stepper_command_s %s[] FAS_PROGMEM = {\n", name);
+  for (uint32_t i = 0; i < entry_cnt; i++) {
+    fprintf(f, "    {%u, %u, %s},\n", entries[i].ticks, entries[i].steps,
+            entries[i].count_up ? "true" : "false");
+  }
+  fprintf(f, "};\n");
+  fclose(f);
+  printf("%s: %u entries, %llu steps, end position %d, %.3fs\n", name,
+         entry_cnt, (unsigned long long)steps, qe.pos,
+         (double)total_ticks / TICKS_PER_S);
+  return 0;
+}
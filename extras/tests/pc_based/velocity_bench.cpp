@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "FastAccelStepper.h"
+#include "StepperISR.h"
+
+char TCCR1A;
+char TCCR1B;
+char TCCR1C;
+char TIMSK1;
+char TIFR1;
+unsigned short OCR1A;
+unsigned short OCR1B;
+
+StepperQueue fas_queue[NUM_QUEUES];
+
+void inject_fill_interrupt(int mark) {}
+void noInterrupts() {}
+void interrupts() {}
+
+#include "PulseSimulator.h"
+
+// Benchmark of the speed updates from a 1kHz control loop.
+//
+// Each ms the loop sets a new speed, which follows a sine between 2kHz and
+// 18kHz, and the queue is filled. The steps are drained by the
+// PulseSimulator. Compared are the update methods:
+//   apply     setSpeedInHz() and applySpeedAcceleration()
+//   moveBy    setSpeedInHz() and moveByAcceleration()
+//   velocity  setTargetVelocityInMilliHz()
+//
+// Reported are per method:
+//   update    ns per call of the update method(s)
+//   fill      ns per fill_queue(), which for apply/moveBy includes the
+//             recalculation of the ramp steps with the new speed
+//   cmds      queue entries per fill_queue()
+//   max       max. of update + fill in ns per cycle
+//
+// The max value includes scheduling jitter of the host. Run it with:
+//     make bench
+
+#define ACCEL 100000
+#define CYCLES 20000
+#define REPEAT 5
+
+enum method_e { APPLY, MOVE_BY, VELOCITY };
+static const char *method_names[] = {"apply", "moveBy", "velocity"};
+
+FastAccelStepperEngine engine = FastAccelStepperEngine();
+PulseSimulator sim;
+
+class FastAccelStepperTest {
+ public:
+  static void fill(FastAccelStepper *s) { s->fill_queue(); }
+};
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t target_hz(uint32_t ms) {
+  return (uint32_t)(10000.0 + 8000.0 * sin(2 * M_PI * ms / 1000.0));
+}
+
+static void run(FastAccelStepper *s, enum method_e method, bool report) {
+  uint64_t update_ns = 0;
+  uint64_t fill_ns = 0;
+  uint64_t max_ns = 0;
+  uint32_t cmds = 0;
+  uint32_t cycles = 0;
+  for (uint8_t r = 0; r < REPEAT; r++) {
+    sim.reset();
+    s->setCurrentPosition(0);
+    s->setSpeedInHz(target_hz(0));
+    s->runForward();
+    for (uint32_t t = 0; t < CYCLES; t++) {
+      uint32_t hz = target_hz(t);
+      uint64_t t0 = now_ns();
+      switch (method) {
+        case APPLY:
+          s->setSpeedInHz(hz);
+          s->applySpeedAcceleration();
+          break;
+        case MOVE_BY:
+          s->setSpeedInHz(hz);
+          s->moveByAcceleration(ACCEL);
+          break;
+        case VELOCITY:
+          s->setTargetVelocityInMilliHz(hz * 1000);
+          break;
+      }
+      uint64_t t1 = now_ns();
+      fas_queue_idx_t wp = fas_queue[0].next_write_idx;
+      FastAccelStepperTest::fill(s);
+      uint64_t t2 = now_ns();
+      cmds += (fas_queue_idx_t)(fas_queue[0].next_write_idx - wp);
+      update_ns += t1 - t0;
+      fill_ns += t2 - t1;
+      if (t2 - t0 > max_ns) {
+        max_ns = t2 - t0;
+      }
+      cycles++;
+      sim.advance(MS_TO_TICKS(1));
+    }
+    s->forceStop();
+    sim.run_until_idle(&engine, MS_TO_TICKS(1), TICKS_PER_S * 10);
+  }
+  if (!report) {
+    return;
+  }
+  printf("%-10s %8.1f %8.1f %8.2f %8u\n", method_names[method],
+         (double)update_ns / cycles, (double)fill_ns / cycles,
+         (double)cmds / cycles, (uint32_t)max_ns);
+}
+
+int main() {
+  engine.init();
+  FastAccelStepper *s = engine.stepperConnectToPin(1);
+  assert(s != NULL);
+  s->setDirectionPin(4);
+  s->setAcceleration(ACCEL);
+
+  // warm up caches and cpu frequency
+  run(s, VELOCITY, false);
+  printf("\n%-10s %8s %8s %8s %8s\n", "method", "update", "fill", "cmds",
+         "max");
+  run(s, APPLY, true);
+  run(s, MOVE_BY, true);
+  run(s, VELOCITY, true);
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include "FastAccelStepper.h"
 #include "StepperISR.h"
+#include "fas_trace.h"
 
 // This define in order to not shoot myself.
 #ifndef TEST
@@ -16,21 +17,45 @@ static uint16_t fas_debug_led_cnt = 0;
 // dynamic allocation seems to not work so well on avr
 FastAccelStepper fas_stepper[MAX_STEPPER];
 
+#define ENABLE_GROUP_NONE 255
+#define ENABLE_GROUP_NEEDS_DISABLE 1
+#define ENABLE_GROUP_IN_USE 2
+
+// Queues running empty within two cycles are filled regardless of the budget
+#define FILL_URGENT_TICKS (2 * TICKS_PER_S / 1000 * DELAY_MS_BASE)
+
+// A new or changed ramp needs the stepper task without delay
+static void wakeupStepperTask() {
+#if defined(SUPPORT_TASK_WAKEUP)
+  fas_notify_task();
+#endif
+}
+
 //*************************************************************************************************
 //*************************************************************************************************
 void FastAccelStepperEngine::init() {
   _externalCallForPin = NULL;
+  _linear_leader = NULL;
+  _fill_budget_us = 0;
   _stepper_cnt = 0;
+  resetStats();
   fas_init_engine(this, 255);
   for (uint8_t i = 0; i < MAX_STEPPER; i++) {
     _stepper[i] = NULL;
+    _enable_group[i] = ENABLE_GROUP_NONE;
   }
 }
 
 #if defined(SUPPORT_CPU_AFFINITY)
 void FastAccelStepperEngine::init(uint8_t cpu_core) {
   _externalCallForPin = NULL;
+  _linear_leader = NULL;
+  _fill_budget_us = 0;
   _stepper_cnt = 0;
+  resetStats();
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    _enable_group[i] = ENABLE_GROUP_NONE;
+  }
   fas_init_engine(this, cpu_core);
 }
 #endif
@@ -121,6 +146,109 @@ FastAccelStepper* FastAccelStepperEngine::stepperConnectToPin(
   return s;
 }
 //*************************************************************************************************
+// The groups are the connected components of the steppers linked by shared
+// enable pins. So disabling a group never switches off a pin of a stepper
+// outside of the group. This runs only on configuration changes.
+void FastAccelStepperEngine::updateEnablePinGroups() {
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    FastAccelStepper* s = _stepper[i];
+    _enable_group[i] = ENABLE_GROUP_NONE;
+    if (s == NULL) {
+      continue;
+    }
+    uint8_t high_active_pin = s->getEnablePinHighActive();
+    uint8_t low_active_pin = s->getEnablePinLowActive();
+    if ((high_active_pin == PIN_UNDEFINED) &&
+        (low_active_pin == PIN_UNDEFINED)) {
+      continue;
+    }
+    _enable_group[i] = i;
+    for (uint8_t j = 0; j < i; j++) {
+      FastAccelStepper* other = _stepper[j];
+      if (other == NULL) {
+        continue;
+      }
+      uint8_t g = _enable_group[j];
+      if ((g == ENABLE_GROUP_NONE) || (g == _enable_group[i])) {
+        continue;
+      }
+      if (other->usesAutoEnablePin(high_active_pin) ||
+          other->usesAutoEnablePin(low_active_pin)) {
+        // merge the two groups into the one with the lower index
+        uint8_t from = fas_max(g, _enable_group[i]);
+        uint8_t to = fas_min(g, _enable_group[i]);
+        for (uint8_t k = 0; k <= i; k++) {
+          if (_enable_group[k] == from) {
+            _enable_group[k] = to;
+          }
+        }
+      }
+    }
+  }
+}
+//*************************************************************************************************
+// A group is disabled, if one of its steppers needs auto disable and all
+// others agree. One pass collects the state of all groups and a second pass
+// is only needed, if a group is to be disabled.
+void FastAccelStepperEngine::manageAutoDisable() {
+  uint8_t group_state[MAX_STEPPER];
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    group_state[i] = 0;
+  }
+  bool any_need = false;
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    uint8_t g = _enable_group[i];
+    if (g == ENABLE_GROUP_NONE) {
+      continue;
+    }
+    FastAccelStepper* s = _stepper[i];
+    if (s->needAutoDisable()) {
+      group_state[g] |= ENABLE_GROUP_NEEDS_DISABLE;
+      any_need = true;
+    } else if (!s->agreeWithAutoDisable()) {
+      group_state[g] |= ENABLE_GROUP_IN_USE;
+    }
+  }
+  if (!any_need) {
+    return;
+  }
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    uint8_t g = _enable_group[i];
+    if (g == ENABLE_GROUP_NONE) {
+      continue;
+    }
+    if (group_state[g] == ENABLE_GROUP_NEEDS_DISABLE) {
+      // if successful, then the _auto_disable_delay_counter is zero
+      // Otherwise in next loop will be checked for auto disable again
+      _stepper[i]->disableOutputs();
+    }
+  }
+}
+//*************************************************************************************************
+void FastAccelStepperEngine::resetStats() {
+  _stats.cycles = 0;
+  _stats.max_cycle_us = 0;
+  _stats.avg_cycle_us = 0;
+  _cycle_us_total = 0;
+}
+void FastAccelStepperEngine::getStats(struct engine_stats_s* stats,
+                                      bool reset) {
+  fasDisableInterrupts();
+  *stats = _stats;
+  uint32_t cycle_us_total = _cycle_us_total;
+  if (reset) {
+    resetStats();
+  }
+  fasEnableInterrupts();
+  if (stats->cycles > 0) {
+    stats->avg_cycle_us = cycle_us_total / stats->cycles;
+  }
+}
+//*************************************************************************************************
+void FastAccelStepperEngine::setFillBudgetInUs(uint16_t budget_us) {
+  _fill_budget_us = budget_us;
+}
+//*************************************************************************************************
 void FastAccelStepperEngine::setDebugLed(uint8_t ledPin) {
   fas_ledPin = ledPin;
   pinMode(fas_ledPin, OUTPUT);
@@ -140,61 +268,52 @@ void FastAccelStepperEngine::manageSteppers() {
     }
   }
 #endif
+  // The steppers are served in the order of their deadlines, so the queue,
+  // which runs empty first, is filled first
+  uint8_t order[MAX_STEPPER];
+  uint32_t deadline[MAX_STEPPER];
+  uint8_t cnt = 0;
   for (uint8_t i = 0; i < MAX_STEPPER; i++) {
     FastAccelStepper* s = _stepper[i];
     if (s) {
-#ifdef SUPPORT_EXTERNAL_DIRECTION_PIN
-      if (s->externalDirPinChangeCompletedIfNeeded()) {
-        s->fill_queue();
+      uint32_t d = s->fillDeadline();
+      uint8_t j = cnt++;
+      while ((j > 0) && (deadline[j - 1] > d)) {
+        order[j] = order[j - 1];
+        deadline[j] = deadline[j - 1];
+        j--;
       }
-#else
-      s->fill_queue();
-#endif
+      order[j] = i;
+      deadline[j] = d;
     }
   }
-
-  // Check for auto disable
-  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
-    FastAccelStepper* s = _stepper[i];
-    if (s) {
-      if (s->needAutoDisable()) {
-        uint8_t high_active_pin = s->getEnablePinHighActive();
-        uint8_t low_active_pin = s->getEnablePinLowActive();
-
-        // fasDisableInterrupts(); // TODO
-        bool agree = true;
-        for (uint8_t j = 0; j < MAX_STEPPER; j++) {
-          if (i != j) {
-            FastAccelStepper* other = _stepper[j];
-            if (other) {
-              if (other->usesAutoEnablePin(high_active_pin) ||
-                  other->usesAutoEnablePin(low_active_pin)) {
-                if (!other->agreeWithAutoDisable()) {
-                  agree = false;
-                  break;
-                }
-              }
-            }
-          }
-        }
-        if (agree) {
-          for (uint8_t j = 0; j < MAX_STEPPER; j++) {
-            FastAccelStepper* current = _stepper[j];
-            if (current) {
-              if (current->usesAutoEnablePin(high_active_pin) ||
-                  current->usesAutoEnablePin(low_active_pin)) {
-                // if successful, then the _auto_disable_delay_counter is zero
-                // Otherwise in next loop will be checked for auto disable again
-                current->disableOutputs();
-              }
-            }
-          }
-        }
-        // fasEnableInterrupts();
+  uint32_t start_us = micros();
+  for (uint8_t k = 0; k < cnt; k++) {
+    // A stepper, whose queue would run empty before the next cycle, is
+    // served in any case
+    if ((_fill_budget_us != 0) && (deadline[k] > FILL_URGENT_TICKS)) {
+      if ((uint32_t)(micros() - start_us) >= _fill_budget_us) {
+        // the remaining steppers are served in the next cycle
+        break;
       }
     }
+    FastAccelStepper* s = _stepper[order[k]];
+    if (s == _linear_leader) {
+      // this fills the queues of all steppers of the linear move
+      fill_linear_queues();
+      continue;
+    }
+#ifdef SUPPORT_EXTERNAL_DIRECTION_PIN
+    if (s->externalDirPinChangeCompletedIfNeeded()) {
+      s->fill_queue();
+    }
+#else
+    s->fill_queue();
+#endif
   }
 
+  manageAutoDisable();
+
   // Update the auto disable counters
   for (uint8_t i = 0; i < MAX_STEPPER; i++) {
     FastAccelStepper* s = _stepper[i];
@@ -205,6 +324,271 @@ void FastAccelStepperEngine::manageSteppers() {
       fasEnableInterrupts();
     }
   }
+
+  uint32_t cycle_us = micros() - start_us;
+  _stats.cycles++;
+  _stats.max_cycle_us = fas_max(_stats.max_cycle_us, cycle_us);
+  _cycle_us_total += cycle_us;
+}
+
+#if defined(SUPPORT_TASK_WAKEUP)
+uint32_t FastAccelStepperEngine::taskSleepInTicks() {
+  uint32_t ticks = TASK_WAKEUP_MAX_SLEEP_TICKS;
+  for (uint8_t i = 0; i < MAX_STEPPER; i++) {
+    FastAccelStepper* s = _stepper[i];
+    if (s) {
+      ticks = fas_min(ticks, s->taskWakeupTicks());
+    }
+  }
+  // The followers of a linear move may still need to catch up
+  if ((_linear_leader != NULL) && !_linear_leader->isRampGeneratorActive()) {
+    ticks = fas_min(ticks, (uint32_t)TASK_WAKEUP_POLL_TICKS);
+  }
+  return ticks;
+}
+#endif
+
+//*************************************************************************************************
+// Coordinated linear move
+//
+// The leading axis is driven by its ramp generator. Each command of the
+// leading axis defines a span of ticks. The follower steps to be executed
+// within this span are derived by integer arithmetic from the leader's
+// progress. The span is then converted into queue commands, which sum up
+// exactly to the ticks of the span. So all queues run in lockstep.
+//
+// If the span's ticks cannot be distributed evenly onto the follower steps,
+// then the first steps get one tick more. If this would create commands
+// below MIN_CMD_TICKS, the remainder is carried over to the next span.
+//*************************************************************************************************
+int8_t FastAccelStepperEngine::moveLinear(FastAccelStepper* steppers[],
+                                          const int32_t targets[], uint8_t n) {
+  if ((n == 0) || (n > MAX_STEPPER)) {
+    return MOVE_ERR_INVALID_AXES;
+  }
+  if (_linear_leader != NULL) {
+    return MOVE_ERR_STEPPER_IS_RUNNING;
+  }
+  uint8_t leader = 0;
+  uint32_t leader_steps = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    FastAccelStepper* s = steppers[i];
+    if (s == NULL) {
+      return MOVE_ERR_INVALID_AXES;
+    }
+    for (uint8_t j = 0; j < i; j++) {
+      if (steppers[j] == s) {
+        return MOVE_ERR_INVALID_AXES;
+      }
+    }
+    if (s->isRunning()) {
+      return MOVE_ERR_STEPPER_IS_RUNNING;
+    }
+    int32_t delta = targets[i] - s->getPositionAfterCommandsCompleted();
+    if ((delta < 0) && (s->getDirectionPin() == PIN_UNDEFINED)) {
+      return MOVE_ERR_NO_DIRECTION_PIN;
+    }
+    uint32_t steps = fas_abs(delta);
+    if (steps > leader_steps) {
+      leader = i;
+      leader_steps = steps;
+    }
+  }
+  if (leader_steps == 0) {
+    return MOVE_OK;
+  }
+
+  uint8_t cnt = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    FastAccelStepper* s = steppers[i];
+    int32_t delta = targets[i] - s->getPositionAfterCommandsCompleted();
+    if ((i == leader) || (delta == 0)) {
+      continue;
+    }
+    struct linear_follower_s* f = &_linear_follower[cnt++];
+    f->stepper = s;
+    f->steps = fas_abs(delta);
+    f->done = 0;
+    f->span_ticks = 0;
+    f->pause_left = 0;
+    f->span_steps = 0;
+    f->carry = 0;
+    f->count_up = delta > 0;
+    f->final_span = false;
+  }
+  _linear_follower_cnt = cnt;
+  _linear_steps = leader_steps;
+  _linear_done = 0;
+
+  // From now on manageSteppers() fills the queues of all involved steppers
+  fasDisableInterrupts();
+  _linear_leader = steppers[leader];
+  fasEnableInterrupts();
+  int8_t res = steppers[leader]->moveTo(targets[leader]);
+  if (res != MOVE_OK) {
+    fasDisableInterrupts();
+    _linear_leader = NULL;
+    fasEnableInterrupts();
+  }
+  return res;
+}
+
+static uint16_t linear_pause_ticks(uint32_t ticks) {
+  // same split of long pauses as in the ramp generator
+  if (ticks > 65535) {
+    ticks >>= 1;
+    ticks = fas_min(ticks, 65535);
+  }
+  return ticks;
+}
+
+int8_t FastAccelStepperEngine::fill_linear_follower(
+    struct linear_follower_s* f, bool start) {
+  while ((f->span_ticks != 0) || (f->pause_left != 0)) {
+    struct stepper_command_s cmd;
+    cmd.count_up = f->count_up;
+    cmd.steps = 0;
+    uint32_t pause = 0;
+    fas_steps_t carry = 0;
+    if (f->pause_left != 0) {
+      cmd.ticks = linear_pause_ticks(f->pause_left);
+    } else if (f->span_steps == 0) {
+      cmd.ticks = linear_pause_ticks(f->span_ticks);
+    } else {
+      uint32_t period = f->span_ticks / f->span_steps;
+      fas_steps_t rest = f->span_ticks % f->span_steps;
+      cmd.steps = f->span_steps;
+      if (period > 65535) {
+        // slow follower: one step and the remaining period as pause
+        cmd.steps = 1;
+        cmd.ticks = linear_pause_ticks(period);
+        pause = period - cmd.ticks;
+      } else if (rest == 0) {
+        cmd.ticks = period;
+      } else if ((rest * (period + 1) >= MIN_CMD_TICKS) &&
+                 ((uint32_t)(cmd.steps - rest) * period >= MIN_CMD_TICKS)) {
+        cmd.steps = rest;
+        cmd.ticks = period + 1;
+      } else if (f->final_span) {
+        // no carry possible, so last step gets the remainder
+        cmd.steps--;
+        cmd.ticks = period;
+      } else {
+        cmd.ticks = period;
+        carry = rest;
+      }
+    }
+    int8_t res = f->stepper->addQueueEntry(&cmd, start);
+    if (res != AQE_OK) {
+      return res;
+    }
+    if (f->pause_left != 0) {
+      f->pause_left -= cmd.ticks;
+    } else if (cmd.steps == 0) {
+      f->span_ticks -= cmd.ticks;
+    } else {
+      uint32_t ticks = cmd.ticks;
+      ticks *= cmd.steps;
+      f->span_ticks -= ticks + pause + carry;
+      f->span_steps -= cmd.steps;
+      f->pause_left = pause;
+      f->carry = carry;
+    }
+  }
+  return AQE_OK;
+}
+
+void FastAccelStepperEngine::fill_linear_queues() {
+  FastAccelStepper* leader = _linear_leader;
+  StepperQueue* q = &fas_queue[leader->_queue_num];
+  q->ignore_commands = false;
+
+  NextCommand cmd;
+  bool delayed_start = !q->isRunning();
+  bool need_delayed_start = false;
+  uint32_t ticksPrepared = q->ticksInQueue();
+  uint32_t horizon = leader->planningHorizon(ticksPrepared, !delayed_start);
+  while (true) {
+    // The followers need to catch up with the last command of the leader
+    bool followers_ready = true;
+    for (uint8_t i = 0; i < _linear_follower_cnt; i++) {
+      struct linear_follower_s* f = &_linear_follower[i];
+      int8_t res = fill_linear_follower(f, !delayed_start);
+      if (res < 0) {
+#ifdef TEST
+        printf("ERROR: Abort linear move due to queue error (%d)\n", res);
+        assert(false);
+#endif
+        leader->_rg.stopRamp();
+        f->span_ticks = 0;
+        f->pause_left = 0;
+      } else if (res != AQE_OK) {
+        followers_ready = false;
+      }
+    }
+    if (!followers_ready) {
+      break;
+    }
+    if (!leader->_rg.isRampGeneratorActive()) {
+      // The move is completed or has been stopped, even before the first
+      // command e.g. by forceStopAndNewPosition()
+      _linear_leader = NULL;
+      break;
+    }
+    if (q->isQueueFull() ||
+        ((ticksPrepared >= horizon) && (q->queueEntries() > 1))) {
+      break;
+    }
+    leader->_rg.getNextCommand(&q->queue_end, &cmd);
+    if (cmd.command.ticks == 0) {
+      leader->_rg.afterCommandEnqueued(&cmd);
+      if (leader->_rg.isRampGeneratorActive()) {
+        break;
+      }
+      // the ramp has ended without a command, so the move ends above
+      continue;
+    }
+    int8_t res = leader->addQueueEntry(&cmd.command, !delayed_start);
+    if (res != AQE_OK) {
+      if (res < 0) {
+#ifdef TEST
+        printf("ERROR: Abort linear move due to queue error (%d)\n", res);
+        assert(false);
+#endif
+        leader->_rg.stopRamp();
+      }
+      break;
+    }
+    leader->_rg.afterCommandEnqueued(&cmd);
+    need_delayed_start = delayed_start;
+    uint32_t cmd_ticks = cmd.command.ticks;
+    if (cmd.command.steps > 1) {
+      cmd_ticks *= cmd.command.steps;
+    }
+    ticksPrepared += cmd_ticks;
+
+    // Derive the spans of the followers
+    _linear_done += cmd.command.steps;
+    for (uint8_t i = 0; i < _linear_follower_cnt; i++) {
+      struct linear_follower_s* f = &_linear_follower[i];
+      uint64_t target = _linear_done;
+      target *= f->steps;
+      target /= _linear_steps;
+      f->span_steps = (uint32_t)target - f->done;
+      f->done = (uint32_t)target;
+      f->span_ticks = cmd_ticks + f->carry;
+      f->carry = 0;
+      f->final_span = (_linear_done == _linear_steps);
+    }
+  }
+  if (need_delayed_start) {
+    // start all queues in the same cycle
+    leader->addQueueEntry(NULL, true);
+    for (uint8_t i = 0; i < _linear_follower_cnt; i++) {
+      _linear_follower[i].stepper->addQueueEntry(NULL, true);
+    }
+  }
+  leader->_ticks_after_fill = ticksPrepared;
 }
 
 //*************************************************************************************************
@@ -224,6 +608,12 @@ void FastAccelStepperEngine::manageSteppers() {
 //*************************************************************************************************
 int8_t FastAccelStepper::addQueueEntry(const struct stepper_command_s* cmd,
                                        bool start) {
+  return addQueueEntryWithEvents(cmd, start, 0);
+}
+
+// events is the bit mask of the position events for the entry of cmd
+int8_t FastAccelStepper::addQueueEntryWithEvents(
+    const struct stepper_command_s* cmd, bool start, uint8_t events) {
   StepperQueue* q = &fas_queue[_queue_num];
   if (cmd == NULL) {
     return q->addQueueEntry(NULL, start);
@@ -269,15 +659,19 @@ int8_t FastAccelStepper::addQueueEntry(const struct stepper_command_s* cmd,
         while (delay > 0) {
           uint32_t ticks = delay >> 1;
           uint16_t ticks_u16 = ticks;
+          uint32_t periods = 1;
           if (ticks > 65535) {
+            // all periods of 65535 ticks in one entry
             ticks_u16 = 65535;
+            periods = fas_min(fas_pause_periods(delay),
+                              (uint32_t)MAX_PAUSE_PERIODS);
           } else if (ticks < 32768) {
             ticks_u16 = delay;
           }
           struct stepper_command_s start_cmd = {
               .ticks = ticks_u16, .steps = 0, .count_up = cmd->count_up};
-          q->addQueueEntry(&start_cmd, false);
-          delay -= ticks_u16;
+          q->addQueueEntry(&start_cmd, false, periods);
+          delay -= ticks_u16 * periods;
         }
         res = q->addQueueEntry(NULL, start);
         if (res != AQE_OK) {
@@ -317,7 +711,7 @@ int8_t FastAccelStepper::addQueueEntry(const struct stepper_command_s* cmd,
       }
     }
   }
-  res = q->addQueueEntry(cmd, start);
+  res = q->addQueueEntry(cmd, start, 1, events);
   if (_autoEnable) {
     if (res == AQE_OK) {
       fasDisableInterrupts();
@@ -348,6 +742,21 @@ bool FastAccelStepper::externalDirPinChangeCompletedIfNeeded() {
 }
 #endif
 
+#if defined(SUPPORT_POSITION_EVENTS)
+// The pauses, which addQueueEntry() may add before a command: three for the
+// delay to enable and two for a direction change with external pin
+#define MAX_PAUSES_BEFORE_COMMAND 5
+
+// A command split at position events into parts. Each part gets a queue
+// entry, which raises the events of the part.
+struct event_split_s {
+  uint8_t parts;
+  uint8_t found;  // all events of the command
+  fas_steps_t steps[MAX_POSITION_EVENTS + 1];
+  uint8_t events[MAX_POSITION_EVENTS + 1];
+};
+#endif
+
 //*************************************************************************************************
 // fill_queue generates commands to the stepper for executing a ramp
 //
@@ -360,6 +769,8 @@ bool FastAccelStepper::externalDirPinChangeCompletedIfNeeded() {
 void FastAccelStepper::fill_queue() {
   // Check preconditions to be allowed to fill the queue
   if (!_rg.isRampGeneratorActive()) {
+    _ticks_after_fill = 0;
+    _ramp_needs_queue = false;
     return;
   }
   if (!_rg.hasValidConfig()) {
@@ -374,35 +785,93 @@ void FastAccelStepper::fill_queue() {
   // stopped. So the ramp generator will not create a new command, unless new
   // move command has been given after forceStop..(). So we just clear the flag
   q->ignore_commands = false;
+  uint32_t start_us = micros();
 
   // preconditions are fulfilled, so create the command(s)
   NextCommand cmd;
-  // Plan ahead for max. 20 ms. Currently hard coded
   bool delayed_start = !q->isRunning();
   bool need_delayed_start = false;
   uint32_t ticksPrepared = q->ticksInQueue();
-  while (!isQueueFull() &&
-         ((ticksPrepared < TICKS_PER_S / 50) || q->queueEntries() <= 1) &&
-         _rg.isRampGeneratorActive()) {
+  if (!delayed_start) {
+    _stats.min_ticks_in_queue =
+        fas_min(_stats.min_ticks_in_queue, ticksPrepared);
+  } else if (_ramp_needs_queue) {
+    // the queue has stopped, while the ramp is not yet completed
+    _stats.underruns++;
+    FAS_TRACE_EVENT(FAS_TRACE_UNDERRUN, _queue_num, 0, _stats.underruns);
+  }
+  uint32_t horizon = planningHorizon(ticksPrepared, !delayed_start);
+
+  // With running queue, the commands are collected in a batch and published
+  // together. This keeps the interrupts disabled only twice per fill_queue().
+  // Start of the queue, enabling of the outputs and the delay on direction
+  // change are handled by addQueueEntry().
+  struct queue_batch_s batch;
+  q->beginBatch(&batch);
+  bool use_batch = !delayed_start;
+  if (use_batch && _autoEnable) {
+    fasDisableInterrupts();
+    use_batch = (_auto_disable_delay_counter != 0);
+    fasEnableInterrupts();
+  }
+  while (_rg.isRampGeneratorActive()) {
+    fas_queue_idx_t entries = QUEUE_LEN - batch.free + batch.entries;
+    if (entries == QUEUE_LEN) {
+      break;
+    }
+    if ((ticksPrepared >= horizon) && (entries > 1)) {
+      break;
+    }
 #if (TEST_MEASURE_ISR_SINGLE_FILL == 1)
     // For run time measurement
     uint32_t runtime_us = micros();
 #endif
     int8_t res = AQE_OK;
-    _rg.getNextCommand(&q->queue_end, &cmd);
+    fas_steps_t periods = 1;
+#if defined(SUPPORT_TRACE)
+    uint8_t prev_ramp_state = _rg.rampState();
+#endif
+    _rg.getNextCommand(&batch.queue_end, &cmd);
+#if defined(SUPPORT_TRACE)
+    if (cmd.rw.ramp_state != prev_ramp_state) {
+      FAS_TRACE_EVENT(FAS_TRACE_RAMP_STATE, _queue_num, cmd.rw.ramp_state,
+                      cmd.rw.curr_ticks);
+    }
+#endif
     if (cmd.command.ticks != 0) {
-      res = addQueueEntry(&cmd.command, !delayed_start);
+      FAS_TRACE_EVENT(
+          FAS_TRACE_PLAN | (cmd.command.count_up ? FAS_TRACE_COUNT_UP : 0),
+          _queue_num, cmd.command.steps, cmd.command.ticks);
+#if defined(SUPPORT_POSITION_EVENTS)
+      struct event_split_s split;
+      if (splitAtPositionEvents(&cmd.command, batch.queue_end.pos, &split)) {
+        bool batchable =
+            use_batch && isBatchable(&cmd.command, &batch.queue_end);
+        res = addSplitCommand(&batch, &cmd.command, &split, batchable,
+                              !delayed_start);
+      } else
+#endif
+      if (use_batch && isBatchable(&cmd.command, &batch.queue_end)) {
+        // The following pause periods of a slow step go into the same entry
+        if (!_rg.isPlayingTrajectory()) {
+          periods = cmd.repeatPause(MAX_PAUSE_PERIODS);
+        }
+        res = q->addBatchEntry(&batch, &cmd.command, periods);
+      } else {
+        q->commitBatch(&batch, !delayed_start);
+        res = addQueueEntry(&cmd.command, !delayed_start);
+        q->beginBatch(&batch);
+      }
     }
     if (res == AQE_OK) {
       _rg.afterCommandEnqueued(&cmd);
-      need_delayed_start = delayed_start;
-      if (cmd.command.steps <= 1) {
-        ticksPrepared += cmd.command.ticks;
-      } else {
-        uint32_t tmp = cmd.command.ticks;
-        tmp *= cmd.command.steps;
-        ticksPrepared += tmp;
+      if (cmd.command.ticks != 0) {
+        _stats.commands++;
       }
+      need_delayed_start = delayed_start;
+      uint32_t tmp = cmd.command.ticks;
+      tmp *= fas_max(cmd.command.steps, periods);
+      ticksPrepared += tmp;
     }
 
 #if (TEST_MEASURE_ISR_SINGLE_FILL == 1)
@@ -439,11 +908,289 @@ void FastAccelStepper::fill_queue() {
       }
     }
   }
+  if (batch.entries > 0) {
+    q->commitBatch(&batch, !delayed_start);
+    if (_autoEnable) {
+      fasDisableInterrupts();
+      _auto_disable_delay_counter = _off_delay_count;
+      fasEnableInterrupts();
+    }
+  }
   if (need_delayed_start) {
     addQueueEntry(NULL, true);
   }
+  _ticks_after_fill = ticksPrepared;
+  _ramp_needs_queue = _rg.isRampGeneratorActive() && q->isRunning();
+
+  uint32_t fill_us = micros() - start_us;
+  _stats.fills++;
+  _stats.max_fill_us = fas_max(_stats.max_fill_us, fill_us);
+  _fill_us_total += fill_us;
+}
+
+// The queue is consumed in real time. So the ticks drained since the end of
+// the last fill are the interval between the two fills. After an underrun the
+// drained ticks are unknown, but the interval has been at least the ticks,
+// which have been in the queue after the last fill.
+uint32_t FastAccelStepper::planningHorizon(uint32_t ticks_in_queue,
+                                           bool running) {
+  if (_min_horizon_ticks == _max_horizon_ticks) {
+    return _max_horizon_ticks;
+  }
+  if (running && (_ticks_after_fill > ticks_in_queue)) {
+    uint32_t interval = _ticks_after_fill - ticks_in_queue;
+    uint32_t peak = _fill_interval_peak - _fill_interval_peak / 256;
+    _fill_interval_peak = fas_max(peak, interval);
+  } else if (!running && _ramp_needs_queue) {
+    _fill_interval_peak = fas_max(_fill_interval_peak, _ticks_after_fill);
+  }
+  uint32_t horizon = 2 * _fill_interval_peak;
+  horizon = fas_max(horizon, _min_horizon_ticks);
+  horizon = fas_min(horizon, _max_horizon_ticks);
+  _horizon_ticks = horizon;
+  return horizon;
+}
+
+#if defined(SUPPORT_TASK_WAKEUP)
+// Ticks until this stepper needs manageSteppers() again. A running ramp arms
+// the notification at half of the planning horizon. Everything, which is
+// counted in calls of manageSteppers() or waits for external events, falls
+// back to polling.
+uint32_t FastAccelStepper::taskWakeupTicks() {
+  StepperQueue* q = &fas_queue[_queue_num];
+  if (!_rg.isRampGeneratorActive()) {
+    q->disarmWakeup();
+    if (_auto_disable_delay_counter == 0) {
+      return TASK_WAKEUP_MAX_SLEEP_TICKS;
+    }
+    if (!isRunning()) {
+      return TASK_WAKEUP_POLL_TICKS;
+    }
+    // auto disable starts counting after the queue has run empty
+    return fas_max(q->ticksInQueue(), (uint32_t)TASK_WAKEUP_POLL_TICKS);
+  }
+#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
+  if ((_dirPin != PIN_UNDEFINED) && ((_dirPin & PIN_EXTERNAL_FLAG) != 0)) {
+    q->disarmWakeup();
+    return TASK_WAKEUP_POLL_TICKS;
+  }
+#endif
+  if (!q->isRunning()) {
+    q->disarmWakeup();
+    return TASK_WAKEUP_POLL_TICKS;
+  }
+  uint32_t ticks = q->armWakeup(_horizon_ticks / 2);
+  if (ticks == 0) {
+    return TASK_WAKEUP_POLL_TICKS;
+  }
+  // The next fill is planned at the watermark, so planningHorizon() sees
+  // only the latency of the wakeup as fill interval
+  _ticks_after_fill -= fas_min(_ticks_after_fill, ticks);
+  return ticks;
+}
+#endif
+
+// The deadline is the time until the queue runs empty. A stepper without ramp
+// has nothing to do.
+uint32_t FastAccelStepper::fillDeadline() {
+  if (!_rg.isRampGeneratorActive() && (this != _engine->_linear_leader)) {
+    return 0xffffffff;
+  }
+  StepperQueue* q = &fas_queue[_queue_num];
+  if (!q->isRunning()) {
+    // A queue cannot run empty before it has been started. So it is filled
+    // after the urgent ones, but before all others.
+    return FILL_URGENT_TICKS + 1;
+  }
+  return q->ticksInQueue();
 }
 
+// A command can be added to the batch, if addQueueEntry() would not need to
+// add pauses before
+bool FastAccelStepper::isBatchable(const struct stepper_command_s* cmd,
+                                   const struct queue_end_s* queue_end) {
+  if (cmd->ticks < fas_queue[_queue_num].max_speed_in_ticks) {
+    return false;
+  }
+  if (queue_end->count_up == cmd->count_up) {
+    return true;
+  }
+  if (_dirPin == PIN_UNDEFINED) {
+    return false;
+  }
+  if (_dirPin & PIN_EXTERNAL_FLAG) {
+    return false;
+  }
+  return (_dir_change_delay_ticks == 0) || (cmd->steps == 0);
+}
+
+#if defined(SUPPORT_POSITION_EVENTS)
+// Split the command starting at pos into parts, so that the step to an
+// event's position is the first step of a part. Each part needs
+// MIN_CMD_TICKS, so an event too close to the start of a part is merged into
+// this part and a part too close to the end of the command starts earlier.
+// Returns the events found in the command.
+uint8_t FastAccelStepper::splitAtPositionEvents(
+    const struct stepper_command_s* cmd, int32_t pos,
+    struct event_split_s* split) {
+  fas_steps_t steps = cmd->steps;
+  fas_steps_t first_step[MAX_POSITION_EVENTS];
+  uint8_t found = 0;
+  uint8_t pending = _events_pending;
+  if ((pending == 0) || (steps == 0)) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < MAX_POSITION_EVENTS; i++) {
+    if (pending & (1 << i)) {
+      int32_t k = _event_pos[i] - pos;
+      if (!cmd->count_up) {
+        k = -k;
+      }
+      if ((k >= 1) && (k <= steps)) {
+        found |= 1 << i;
+        first_step[i] = k;
+      }
+    }
+  }
+  if (found == 0) {
+    return 0;
+  }
+  fas_steps_t min_steps = 1;
+  if (cmd->ticks < MIN_CMD_TICKS) {
+    min_steps = (MIN_CMD_TICKS + cmd->ticks - 1) / cmd->ticks;
+  }
+  fas_steps_t part_start[MAX_POSITION_EVENTS + 1];
+  uint8_t p = 0;
+  part_start[0] = 1;
+  split->events[0] = 0;
+  // the events in the order of their step
+  uint8_t todo = found;
+  while (todo != 0) {
+    uint8_t next = 0;
+    for (uint8_t i = 0; i < MAX_POSITION_EVENTS; i++) {
+      if ((todo & (1 << i)) &&
+          (((todo & (1 << next)) == 0) || (first_step[i] < first_step[next]))) {
+        next = i;
+      }
+    }
+    todo &= ~(1 << next);
+    fas_steps_t k = first_step[next];
+    if (k + min_steps - 1 > steps) {
+      k = steps - min_steps + 1;
+    }
+    if (k < part_start[p] + min_steps) {
+      split->events[p] |= 1 << next;
+    } else {
+      p++;
+      part_start[p] = k;
+      split->events[p] = 1 << next;
+    }
+  }
+  split->parts = p + 1;
+  for (uint8_t i = 0; i < p; i++) {
+    split->steps[i] = part_start[i + 1] - part_start[i];
+  }
+  split->steps[p] = steps + 1 - part_start[p];
+  split->found = found;
+  return found;
+}
+
+// Add the parts of a command split by splitAtPositionEvents(). Either all
+// parts are added or none, because the ramp generator accounts the command
+// as a whole.
+int8_t FastAccelStepper::addSplitCommand(struct queue_batch_s* batch,
+                                         const struct stepper_command_s* cmd,
+                                         const struct event_split_s* split,
+                                         bool batchable, bool start) {
+  StepperQueue* q = &fas_queue[_queue_num];
+  struct stepper_command_s part = *cmd;
+  int8_t res = AQE_OK;
+  if (batchable) {
+    if ((fas_queue_idx_t)(batch->free - batch->entries) < split->parts) {
+      return AQE_QUEUE_FULL;
+    }
+    struct queue_end_s queue_end = batch->queue_end;
+    fas_queue_idx_t entries = batch->entries;
+    for (uint8_t i = 0; i < split->parts; i++) {
+      part.steps = split->steps[i];
+      res = q->addBatchEntry(batch, &part, 1, split->events[i]);
+      if (res != AQE_OK) {
+        batch->queue_end = queue_end;
+        batch->entries = entries;
+        return res;
+      }
+    }
+  } else {
+    q->commitBatch(batch, start);
+    // The first part may need pauses before, the other parts not
+    if (q->queueEntries() + split->parts + MAX_PAUSES_BEFORE_COMMAND >
+        QUEUE_LEN) {
+      res = AQE_QUEUE_FULL;
+    } else {
+      part.steps = split->steps[0];
+      res = addQueueEntryWithEvents(&part, start, split->events[0]);
+      for (uint8_t i = 1; (i < split->parts) && (res == AQE_OK); i++) {
+        part.steps = split->steps[i];
+        res = q->addQueueEntry(&part, start, 1, split->events[i]);
+      }
+    }
+    q->beginBatch(batch);
+  }
+  if (res == AQE_OK) {
+    fasDisableInterrupts();
+    _events_pending &= ~split->found;
+    _events_queued |= split->found;
+    fasEnableInterrupts();
+  }
+  return res;
+}
+
+int8_t FastAccelStepper::addPositionEvent(int32_t position) {
+  StepperQueue* q = &fas_queue[_queue_num];
+  int8_t event = POSITION_EVENT_ERR_FULL;
+  fasDisableInterrupts();
+  uint8_t used = _events_pending | (_events_queued & ~q->events_raised);
+  for (uint8_t i = 0; i < MAX_POSITION_EVENTS; i++) {
+    uint8_t mask = 1 << i;
+    if ((used & mask) == 0) {
+      _event_pos[i] = position;
+      _events_queued &= ~mask;
+      q->events_raised &= ~mask;
+      _events_pending |= mask;
+      event = i;
+      break;
+    }
+  }
+  fasEnableInterrupts();
+  return event;
+}
+
+void FastAccelStepper::clearPositionEvents() {
+  fasDisableInterrupts();
+  _events_pending = 0;
+  fasEnableInterrupts();
+}
+
+uint8_t FastAccelStepper::getPositionEvents() {
+  StepperQueue* q = &fas_queue[_queue_num];
+  fasDisableInterrupts();
+  uint8_t events = q->events_raised;
+  q->events_raised = 0;
+  _events_queued &= ~events;
+  fasEnableInterrupts();
+  return events;
+}
+
+void FastAccelStepper::setPositionEventCallback(
+    void (*func)(FastAccelStepper* stepper, uint8_t event)) {
+  StepperQueue* q = &fas_queue[_queue_num];
+  fasDisableInterrupts();
+  q->event_stepper = this;
+  q->event_callback = func;
+  fasEnableInterrupts();
+}
+#endif
+
 void FastAccelStepper::updateAutoDisable() {
   // FastAccelStepperEngine will call with interrupts disabled
   // fasDisableInterrupts();
@@ -503,6 +1250,12 @@ void FastAccelStepper::init(FastAccelStepperEngine* engine, uint8_t num,
   _on_delay_ticks = 0;
   _off_delay_count = 1;
   _auto_disable_delay_counter = 0;
+  _horizon_ticks = TICKS_PER_S / 50;
+  _min_horizon_ticks = _horizon_ticks;
+  _max_horizon_ticks = _horizon_ticks;
+  _fill_interval_peak = TICKS_PER_S / 1000 * DELAY_MS_BASE;
+  _ticks_after_fill = 0;
+  _ramp_needs_queue = false;
   _stepPin = step_pin;
   _dirHighCountsUp = true;
   _dirPin = PIN_UNDEFINED;
@@ -512,9 +1265,14 @@ void FastAccelStepper::init(FastAccelStepperEngine* engine, uint8_t num,
 
   _queue_num = num;
   fas_queue[_queue_num].init(_queue_num, step_pin);
+  resetStats();
 #if defined(SUPPORT_ESP32_PULSE_COUNTER)
   _attached_pulse_cnt_unit = -1;
 #endif
+#if defined(SUPPORT_POSITION_EVENTS)
+  _events_pending = 0;
+  _events_queued = 0;
+#endif
 }
 uint8_t FastAccelStepper::getStepPin() { return _stepPin; }
 void FastAccelStepper::setDirectionPin(uint8_t dirPin, bool dirHighCountsUp,
@@ -577,6 +1335,7 @@ void FastAccelStepper::setEnablePin(uint8_t enablePin,
       }
     }
   }
+  _engine->updateEnablePinGroups();
 }
 void FastAccelStepper::setAutoEnable(bool auto_enable) {
   _autoEnable = auto_enable;
@@ -597,6 +1356,51 @@ int8_t FastAccelStepper::setDelayToEnable(uint32_t delay_us) {
   _on_delay_ticks = delay_ticks;
   return DELAY_OK;
 }
+int8_t FastAccelStepper::setLatencyBoundsInUs(uint32_t min_us,
+                                              uint32_t max_us) {
+  if (max_us > 1000000) {
+    return DELAY_TOO_HIGH;
+  }
+  uint32_t min_ticks = US_TO_TICKS(min_us);
+  if ((min_ticks < MIN_CMD_TICKS) || (min_us > max_us)) {
+    return DELAY_TOO_LOW;
+  }
+  _min_horizon_ticks = min_ticks;
+  _max_horizon_ticks = US_TO_TICKS(max_us);
+  _horizon_ticks = fas_min(fas_max(_horizon_ticks, _min_horizon_ticks),
+                           _max_horizon_ticks);
+  return DELAY_OK;
+}
+uint32_t FastAccelStepper::getPlanningHorizonInUs() {
+  return _horizon_ticks / (TICKS_PER_S / 1000000);
+}
+void FastAccelStepper::resetStats() {
+  StepperQueue* q = &fas_queue[_queue_num];
+  _stats.underruns = 0;
+  _stats.min_ticks_in_queue = 0xffffffff;
+  _stats.commands = 0;
+  _stats.fills = 0;
+  _stats.max_fill_us = 0;
+  _fill_us_total = 0;
+  q->stat_isr_calls = 0;
+  q->stat_late_refills = 0;
+}
+void FastAccelStepper::getStats(struct stepper_stats_s* stats, bool reset) {
+  StepperQueue* q = &fas_queue[_queue_num];
+  fasDisableInterrupts();
+  *stats = _stats;
+  stats->late_refills = q->stat_late_refills;
+  stats->isr_calls = q->stat_isr_calls;
+  uint32_t fill_us_total = _fill_us_total;
+  if (reset) {
+    resetStats();
+  }
+  fasEnableInterrupts();
+  stats->avg_fill_us = 0;
+  if (stats->fills > 0) {
+    stats->avg_fill_us = fill_us_total / stats->fills;
+  }
+}
 void FastAccelStepper::setDelayToDisable(uint16_t delay_ms) {
   uint16_t delay_count = delay_ms / DELAY_MS_BASE;
   if ((delay_ms > 0) && (delay_count < 2)) {
@@ -605,10 +1409,19 @@ void FastAccelStepper::setDelayToDisable(uint16_t delay_ms) {
   }
   _off_delay_count = fas_max(delay_count, (uint16_t)1);
 }
-int8_t FastAccelStepper::runForward() { return _rg.startRun(true); }
-int8_t FastAccelStepper::runBackward() { return _rg.startRun(false); }
+int8_t FastAccelStepper::runForward() {
+  int8_t res = _rg.startRun(true);
+  wakeupStepperTask();
+  return res;
+}
+int8_t FastAccelStepper::runBackward() {
+  int8_t res = _rg.startRun(false);
+  wakeupStepperTask();
+  return res;
+}
 int8_t FastAccelStepper::moveTo(int32_t position, bool blocking) {
   int8_t res = _rg.moveTo(position, &fas_queue[_queue_num].queue_end);
+  wakeupStepperTask();
   if ((res == MOVE_OK) && blocking) {
     while (isRunning()) {
       noop_or_wait;
@@ -616,11 +1429,25 @@ int8_t FastAccelStepper::moveTo(int32_t position, bool blocking) {
   }
   return res;
 }
+int8_t FastAccelStepper::planMoveTo(int32_t position, uint32_t speed_us) {
+  if (speed_us >= TICKS_TO_US(0xffffffff)) {
+    return MOVE_ERR_SPEED_IS_UNDEFINED;
+  }
+  uint32_t min_step_ticks = US_TO_TICKS(speed_us);
+  if (min_step_ticks < getMaxSpeedInTicks()) {
+    return MOVE_ERR_SPEED_IS_UNDEFINED;
+  }
+  int8_t res = _rg.planMoveTo(position, min_step_ticks,
+                               &fas_queue[_queue_num].queue_end);
+  wakeupStepperTask();
+  return res;
+}
 int8_t FastAccelStepper::move(int32_t move, bool blocking) {
   if ((move < 0) && (_dirPin == PIN_UNDEFINED)) {
     return MOVE_ERR_NO_DIRECTION_PIN;
   }
   int8_t res = _rg.move(move, &fas_queue[_queue_num].queue_end);
+  wakeupStepperTask();
   if ((res == MOVE_OK) && blocking) {
     while (isRunning()) {
       noop_or_wait;
@@ -628,10 +1455,91 @@ int8_t FastAccelStepper::move(int32_t move, bool blocking) {
   }
   return res;
 }
-void FastAccelStepper::keepRunning() { _rg.setKeepRunning(); }
-void FastAccelStepper::stopMove() { _rg.initiateStop(); }
+void FastAccelStepper::keepRunning() {
+  _rg.setKeepRunning();
+  wakeupStepperTask();
+}
+int8_t FastAccelStepper::setTargetVelocityInMilliHz(int32_t velocity_mhz) {
+  bool count_up = velocity_mhz >= 0;
+  if (!count_up && (_dirPin == PIN_UNDEFINED)) {
+    return MOVE_ERR_NO_DIRECTION_PIN;
+  }
+  uint32_t speed_mhz =
+      count_up ? (uint32_t)velocity_mhz : -(uint32_t)velocity_mhz;
+  uint32_t ticks = 0;
+  if (speed_mhz > (1000LL * TICKS_PER_S / 0x7fffffff + 1)) {
+    ticks = fas_max(_rg.divForMilliHz(speed_mhz), getMaxSpeedInTicks());
+  }
+  bool was_active = _rg.isRampGeneratorActive();
+  int8_t res = _rg.setTargetVelocityInTicks(ticks, count_up);
+  if (!was_active) {
+    // A running stepper task picks up the new target with the next cycle
+    wakeupStepperTask();
+  }
+  return res;
+}
+int8_t FastAccelStepper::playTrajectory(const struct stepper_command_s* table,
+                                        uint16_t entries, bool in_progmem) {
+  if ((table == NULL) || (entries == 0)) {
+    return MOVE_ERR_INVALID_TRAJECTORY;
+  }
+  if (_rg.isRampGeneratorActive()) {
+    return MOVE_ERR_STEPPER_IS_RUNNING;
+  }
+  // The table is checked once here, so the stepper task only copies it
+  uint16_t max_speed_in_ticks = getMaxSpeedInTicks();
+  int32_t end_pos = getPositionAfterCommandsCompleted();
+  for (uint16_t i = 0; i < entries; i++) {
+    struct stepper_command_s cmd;
+    if (in_progmem) {
+      fas_read_command_P(&cmd, &table[i]);
+    } else {
+      cmd = table[i];
+    }
+    uint32_t cmd_ticks = cmd.ticks;
+    if (cmd.steps > 1) {
+      cmd_ticks *= cmd.steps;
+    }
+    if ((cmd.ticks < max_speed_in_ticks) || (cmd_ticks < MIN_CMD_TICKS)) {
+      return MOVE_ERR_INVALID_TRAJECTORY;
+    }
+    if (cmd.count_up) {
+      end_pos += cmd.steps;
+    } else if (_dirPin == PIN_UNDEFINED) {
+      return MOVE_ERR_NO_DIRECTION_PIN;
+    } else {
+      end_pos -= cmd.steps;
+    }
+  }
+  int8_t res = _rg.startPlayback(table, entries, in_progmem, NULL, end_pos);
+  if (res == MOVE_OK) {
+    wakeupStepperTask();
+  }
+  return res;
+}
+int8_t FastAccelStepper::playTrajectoryStream(TrajectoryStream* stream) {
+  if ((stream == NULL) || !stream->isActive()) {
+    return MOVE_ERR_INVALID_TRAJECTORY;
+  }
+  if (_rg.isRampGeneratorActive()) {
+    return MOVE_ERR_STEPPER_IS_RUNNING;
+  }
+  // The stream cannot be checked in advance, so it is done while decoding
+  stream->setLimits(getMaxSpeedInTicks(), _dirPin != PIN_UNDEFINED);
+  int8_t res = _rg.startPlayback(NULL, 0, false, stream,
+                                 getPositionAfterCommandsCompleted());
+  if (res == MOVE_OK) {
+    wakeupStepperTask();
+  }
+  return res;
+}
+void FastAccelStepper::stopMove() {
+  _rg.initiateStop();
+  wakeupStepperTask();
+}
 void FastAccelStepper::applySpeedAcceleration() {
   _rg.applySpeedAcceleration();
+  wakeupStepperTask();
 }
 int8_t FastAccelStepper::moveByAcceleration(int32_t acceleration,
                                             bool allow_reverse) {
@@ -664,6 +1572,7 @@ void FastAccelStepper::forceStop() {
 
   // inform ramp generator to force stop
   _rg.forceStop();
+  wakeupStepperTask();
 }
 void FastAccelStepper::forceStopAndNewPosition(uint32_t new_pos) {
   StepperQueue* q = &fas_queue[_queue_num];
@@ -676,9 +1585,18 @@ void FastAccelStepper::forceStopAndNewPosition(uint32_t new_pos) {
 
   // stop the stepper interrupt and empty the queue
   q->forceStop();
+  _ramp_needs_queue = false;
+#if defined(SUPPORT_POSITION_EVENTS)
+  // the events of the discarded entries are dropped
+  fasDisableInterrupts();
+  _events_queued &= q->events_raised;
+  fasEnableInterrupts();
+#endif
 
   // set the new position. This should be safe
+  q->beginQueueEndUpdate();
   q->queue_end.pos = new_pos;
+  q->endQueueEndUpdate();
   _rg.setTargetPosition(new_pos);
 }
 bool FastAccelStepper::disableOutputs() {
@@ -761,6 +1679,10 @@ void FastAccelStepper::getCurrentSpeedInTicks(struct actual_ticks_s* speed,
   if (!valid) {
     if (_rg.isRampGeneratorActive()) {
       _rg.getCurrentSpeedInTicks(speed);
+    } else {
+      // standstill
+      speed->ticks = 0;
+      speed->count_up = true;
     }
   }
 }
@@ -842,24 +1764,30 @@ int8_t FastAccelStepper::setSpeedInMilliHz(uint32_t speed_mhz) {
 void FastAccelStepper::setCurrentPosition(int32_t new_pos) {
   int32_t delta = new_pos - getCurrentPosition();
   if (delta != 0) {
-    struct queue_end_s* queue_end = &fas_queue[_queue_num].queue_end;
+    StepperQueue* q = &fas_queue[_queue_num];
+    struct queue_end_s* queue_end = &q->queue_end;
     fasDisableInterrupts();
+    q->beginQueueEndUpdate();
     queue_end->pos += delta;
+    q->endQueueEndUpdate();
     _rg.advanceTargetPosition(delta, queue_end);
     fasEnableInterrupts();
   }
 }
 void FastAccelStepper::setPositionAfterCommandsCompleted(int32_t new_pos) {
-  struct queue_end_s* queue_end = &fas_queue[_queue_num].queue_end;
+  StepperQueue* q = &fas_queue[_queue_num];
+  struct queue_end_s* queue_end = &q->queue_end;
   fasDisableInterrupts();
-  int32_t delta = new_pos - fas_queue[_queue_num].queue_end.pos;
+  int32_t delta = new_pos - queue_end->pos;
+  q->beginQueueEndUpdate();
   queue_end->pos = new_pos;
+  q->endQueueEndUpdate();
   if (delta != 0) {
     _rg.advanceTargetPosition(delta, queue_end);
   }
   fasEnableInterrupts();
 }
-uint8_t FastAccelStepper::queueEntries() {
+uint16_t FastAccelStepper::queueEntries() {
   return fas_queue[_queue_num].queueEntries();
 }
 uint32_t FastAccelStepper::ticksInQueue() {
@@ -41,6 +41,39 @@
 
 class FastAccelStepper;
 
+// ## Runtime statistics
+//
+// The counters are always maintained and retrieved as snapshot by getStats()
+// of the engine and the steppers. With reset set, the counters are cleared
+// after the snapshot, so the next snapshot covers the interval in between.
+// The durations are measured with micros().
+struct engine_stats_s {
+  // calls of manageSteppers() by the task/interrupt
+  uint32_t cycles;
+  // duration of manageSteppers(): longest and average call
+  uint32_t max_cycle_us;
+  uint32_t avg_cycle_us;
+};
+struct stepper_stats_s {
+  // the queue has run empty, while the ramp generator had still commands to
+  // deliver. The motor has stopped in the middle of the move.
+  uint32_t underruns;
+  // avr only: the isr has found the queue empty, but the next entry has been
+  // added just in time before the next step
+  uint32_t late_refills;
+  // ticks in the queue before a fill of the running queue
+  uint32_t min_ticks_in_queue;
+  // commands generated by the ramp generator
+  uint32_t commands;
+  // calls of fill_queue() with active ramp and their longest and average
+  // duration
+  uint32_t fills;
+  uint32_t max_fill_us;
+  uint32_t avg_fill_us;
+  // stepper interrupts of the queue
+  uint32_t isr_calls;
+};
+
 class FastAccelStepperEngine {
   //
   // ## FastAccelStepperEngine
@@ -72,6 +105,12 @@ class FastAccelStepperEngine {
   // values 0 and 1, xTaskCreatePinnedToCore() is used, or else xTaskCreate()
   void init(uint8_t cpu_core);
 
+  // The task polls the steppers every 4ms. With the build flag
+  // `FAS_TASK_WAKEUP` the task sleeps instead, until a queue has run down to
+  // half of the planning horizon or to half of its entries, or until a move
+  // command has been issued. If the task is not notified, it wakes up at the
+  // latest after 100ms. The auto disable delay and an external direction pin
+  // still need polling.
 #endif
 
   // ### Creation of FastAccelStepper
@@ -132,6 +171,24 @@ class FastAccelStepperEngine {
   // to determine, if a pin is external or internal.
   void setExternalCallForPin(bool (*func)(uint8_t pin, uint8_t value));
 
+  // ### Fill order and budget
+  //
+  // The stepper task/interrupt fills the queues in the order of their
+  // deadlines: The stepper, whose queue runs empty first, is served first.
+  // With many fast steppers the filling of all queues may take too long in
+  // one cycle. With a budget in us, the cycle stops after the budget has been
+  // used up and the remaining steppers are served in the next cycle. At least
+  // one stepper is served per cycle and steppers, whose queue would run empty
+  // within the next two cycles, are served regardless of the budget. The time
+  // is measured with micros() and a budget of 0 disables it, which is the
+  // default.
+  void setFillBudgetInUs(uint16_t budget_us);
+
+  // ### Statistics
+  //
+  // Snapshot of the cycle counters of the engine, see Runtime statistics.
+  void getStats(struct engine_stats_s* stats, bool reset = false);
+
   // ### Debug LED
   //
   // If blinking of a LED is required to indicate, the stepper controller is
@@ -139,14 +196,88 @@ class FastAccelStepperEngine {
   // the engine. The periodic task will let the associated LED blink with 1 Hz
   void setDebugLed(uint8_t ledPin);
 
+  // ### Coordinated linear move
+  //
+  // moveLinear() moves up to MAX_STEPPER steppers on a straight line to the
+  // given absolute target positions. All steppers start in the same
+  // stepper task/interrupt cycle and the last steps of all steppers are
+  // completed at the same tick.
+  // ```cpp
+  //   FastAccelStepper* axes[2] = {stepperX, stepperY};
+  //   int32_t targets[2] = {10000, -3000};
+  //   engine.moveLinear(axes, targets, 2);
+  // ```
+  // The stepper with the largest distance to go is the leading axis. Its
+  // ramp generator with its speed and acceleration settings defines the
+  // move. The commands for the other steppers are derived from each command
+  // of the leading axis by distributing the follower steps with integer
+  // arithmetic (Bresenham) over the same number of ticks. So speed and
+  // acceleration of the followers are lower by the ratio of the distances.
+  //
+  // All steppers need to be stopped. The call returns MOVE_OK or:
+  // - MOVE_ERR_STEPPER_IS_RUNNING: one of the steppers is still running or
+  //   another linear move is active
+  // - MOVE_ERR_INVALID_AXES: n is 0 or too big, a stepper is NULL, or a
+  //   stepper is listed twice
+  // - the error of moveTo() of the leading axis
+  //
+  // The move can be stopped by stopMove() of the leading axis, then the
+  // followers decelerate proportionally. Other move commands to any of the
+  // steppers are not supported, while the linear move is active.
+  // A direction change delay, an auto enable on-delay or an external
+  // direction pin add pauses before the first step of the respective
+  // stepper, which delays this stepper's move accordingly.
+  int8_t moveLinear(FastAccelStepper* steppers[], const int32_t targets[],
+                    uint8_t n);
+  bool isLinearMoveActive() { return _linear_leader != NULL; }
+
   /* This should be only called from ISR or stepper task. So do not call it */
   void manageSteppers();
+#if defined(SUPPORT_TASK_WAKEUP)
+  /* Ticks the stepper task may sleep after manageSteppers(), if not notified
+   * earlier. This arms the notifications of the queues. So do not call it */
+  uint32_t taskSleepInTicks();
+#endif
 
  private:
   bool isDirPinBusy(uint8_t dirPin, uint8_t except_stepper);
 
+  /* State of a follower axis of a coordinated linear move */
+  struct linear_follower_s {
+    FastAccelStepper* stepper;
+    uint32_t steps;          /* total steps of the move */
+    uint32_t done;           /* steps handed over to the spans */
+    uint32_t span_ticks;     /* ticks of the span not yet in the queue */
+    uint32_t pause_left;     /* pause after a slow step not yet in the queue */
+    fas_steps_t span_steps;  /* steps of the span not yet in the queue */
+    fas_steps_t carry;       /* ticks shifted from this span into the next */
+    bool count_up;
+    bool final_span;
+  };
+
+  void fill_linear_queues();
+  int8_t fill_linear_follower(struct linear_follower_s* f, bool start);
+
+  FastAccelStepper* _linear_leader;
+  uint32_t _linear_steps;
+  uint32_t _linear_done;
+  uint8_t _linear_follower_cnt;
+  struct linear_follower_s _linear_follower[MAX_STEPPER - 1];
+
   uint8_t _stepper_cnt;
   FastAccelStepper* _stepper[MAX_STEPPER];
+  uint16_t _fill_budget_us;
+
+  struct engine_stats_s _stats;
+  uint32_t _cycle_us_total;
+
+  /* Steppers sharing enable pins - also indirectly - form a group, which is
+   * identified by the lowest stepper index. ENABLE_GROUP_NONE for a stepper
+   * without enable pin */
+  uint8_t _enable_group[MAX_STEPPER];
+  void updateEnablePinGroups();
+  void manageAutoDisable();
+  void resetStats();
 
   bool _isValidStepPin(uint8_t step_pin);
   bool (*_externalCallForPin)(uint8_t pin, uint8_t value);
@@ -162,6 +293,11 @@ class FastAccelStepperEngine {
 // MOVE_ERR_SPEED_IS_UNDEFINED: The maximum speed has not been set yet
 // MOVE_ERR_ACCELERATION_IS_UNDEFINED: The acceleration to use has not been set
 // yet
+// MOVE_ERR_STEPPER_IS_RUNNING: moveLinear() called for a running stepper
+// MOVE_ERR_INVALID_AXES: moveLinear() called with invalid stepper list
+// MOVE_ERR_PLANNER_FULL: planMoveTo() without free planner entry
+// MOVE_ERR_INVALID_TRAJECTORY: playTrajectory() with an empty table or a
+// command, which is too fast for the driver
 
 // ### Return codes of `rampState()`
 //
@@ -223,7 +359,9 @@ class FastAccelStepperEngine {
 //
 // # FastAccelStepper
 
-#define MAX_ON_DELAY_TICKS ((uint32_t)(65535 * (QUEUE_LEN - 1)))
+// The delay to enable needs at most three pause entries: 255 periods of
+// 65535 ticks and the rest in two halves
+#define MAX_ON_DELAY_TICKS ((uint32_t)65535 * (255 + 2))
 
 #define PIN_UNDEFINED 255
 #define PIN_EXTERNAL_FLAG 128
@@ -288,8 +426,8 @@ class FastAccelStepper {
   // afterwards. The delay from stepper enabled till first step and from
   // last step to stepper disabled can be separately adjusted.
   // The delay from enable to first step is done in ticks and as such is limited
-  // to MAX_ON_DELAY_TICKS, which translates approximately to 120ms for
-  // esp32 and 60ms for avr at 16 MHz). The delay till disable is done in period
+  // to MAX_ON_DELAY_TICKS, which translates approximately to 1s for
+  // esp32 and avr at 16 MHz). The delay till disable is done in period
   // interrupt/task with 4 or 10 ms repetition rate and as such is with several
   // ms jitter.
   void setAutoEnable(bool auto_enable);
@@ -299,6 +437,32 @@ class FastAccelStepper {
 #define DELAY_TOO_LOW -1
 #define DELAY_TOO_HIGH -2
 
+  // ## Planning horizon
+  // The queue is filled with commands for the planning horizon ahead. This
+  // is the latency from e.g. moveTo() or stopMove() till the motor follows.
+  // By default the horizon is fixed 20ms.
+  //
+  // With setLatencyBoundsInUs() the horizon adapts to the measured interval
+  // between two fills of the queue: it is twice the recent maximum interval
+  // limited to min_us..max_us. So the latency shrinks, if the fill task runs
+  // regularly, and the horizon increases immediately, if the fill task is
+  // delayed e.g. by wifi load. A delay, which lets the queue run empty, at
+  // least doubles the horizon. The maximum decays slowly. The horizon is
+  // limited by the queue length, too.
+  //
+  // min_us == max_us gives a fixed horizon. Returns DELAY_TOO_LOW, if min_us
+  // is below the minimum command time or greater than max_us, and
+  // DELAY_TOO_HIGH for max_us above 1s.
+  int8_t setLatencyBoundsInUs(uint32_t min_us, uint32_t max_us);
+  // The current planning horizon
+  uint32_t getPlanningHorizonInUs();
+
+  // ## Statistics
+  // Snapshot of the counters of this stepper, see Runtime statistics. Too
+  // many underruns or a low min_ticks_in_queue with respect to the planning
+  // horizon show, that the stepper task cannot keep up with the steppers.
+  void getStats(struct stepper_stats_s* stats, bool reset = false);
+
   // ## Stepper Position
   // Retrieve the current position of the stepper
   //
@@ -453,6 +617,53 @@ class FastAccelStepper {
   // move/moveTo/runForward/runBackward
   inline void setJumpStart(uint32_t jump_step) { _rg.setJumpStart(jump_step); }
 
+  // ## Jerk limited ramp
+  // setJerk() selects the jerk limited ramp (S-curve) with the given jerk in
+  // steps/s³. With a jerk limit, the acceleration does not jump, but changes
+  // linearly over time. This applies to the start, the transition to and from
+  // constant speed and the stop. So the ramp excites less resonances, which
+  // may allow a higher acceleration for heavy loads.
+  //
+  // If for example the acceleration of 10000 steps/s² should be reached
+  // within 50ms, then call setJerk(200000).
+  //
+  // The default value 0 selects the constant acceleration ramp.
+  // setLinearAcceleration() and setJumpStart() are not used by the jerk
+  // limited ramp. The junction speeds of the look-ahead planner are
+  // calculated for constant acceleration and so only approximated.
+  //
+  // The ramp is calculated with float arithmetic and not available for avr.
+  //
+  // New value will be used after call to
+  // move/moveTo/runForward/runBackward/applySpeedAcceleration
+  //
+  // note: no update on stopMove()
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  inline void setJerk(uint32_t jerk) { _rg.setJerk(jerk); }
+  inline uint32_t getJerk() { return _rg.getJerk(); }
+#endif
+
+  // ## Ramp ticks cache
+  // The ramp generator calculates for each command the step period from the
+  // ramp step using the logarithmic representation of PoorManFloat. With a
+  // ticks cache, the result for the first `entries` ramp steps is calculated
+  // only once and then taken from the cache. This reduces the run time
+  // of the fill isr especially during acceleration and deceleration.
+  //
+  // The cache is provided by the application and needs 4 bytes per entry.
+  // It must stay valid until replaced by another cache or NULL.
+  // The cache is invalidated on change of acceleration or linear
+  // acceleration. Ramp steps beyond the cache are calculated as before.
+  //
+  //     static uint32_t ticks_cache[256];
+  //     stepper->setRampTicksCache(ticks_cache, 256);
+  //
+  // New value will be used after call to
+  // move/moveTo/runForward/runBackward/applySpeedAcceleration/moveByAcceleration
+  inline void setRampTicksCache(uint32_t* cache, uint16_t entries) {
+    _rg.setTicksCache(cache, entries);
+  }
+
   // ## Apply new speed/acceleration value
   // This function applies new values for speed/acceleration.
   // This is convenient especially, if the stepper is set to continuous running.
@@ -470,6 +681,42 @@ class FastAccelStepper {
   int8_t move(int32_t move, bool blocking = false);
   int8_t moveTo(int32_t position, bool blocking = false);
 
+  // ## Look-ahead planner
+  // A sequence of moveTo targets can be planned with planMoveTo(). Each
+  // segment has its own speed in us/step. The planner calculates the speed at
+  // each junction, so the stepper does not stop between two segments in the
+  // same direction. The junction speed is the lower speed of the two adjacent
+  // segments and is further reduced, if the following planned segments are
+  // too short to decelerate to standstill at the end of the last one.
+  // On direction change, the stepper stops at the junction.
+  //
+  // The planner buffer is provided by the application and needs 21 bytes per
+  // entry on avr and 24 bytes on esp32. It must stay valid until replaced by
+  // another buffer or NULL.
+  // One entry is kept free, so up to `entries - 1` segments can be planned.
+  // The active segment is included.
+  //
+  //     static struct planner_segment_s planner[16];
+  //     stepper->setPlannerBuffer(planner, 16);
+  //     stepper->planMoveTo(1000, 50);
+  //     stepper->planMoveTo(1500, 100);
+  //     stepper->planMoveTo(1200, 20);
+  //
+  // New segments can be added while the stepper is running. Acceleration and
+  // linear acceleration are taken from the stepper's settings.
+  // planMoveTo() returns MOVE_OK, MOVE_ERR_PLANNER_FULL if there is no free
+  // entry, or the errors of moveTo(). The speed of the stepper given by
+  // setSpeedInUs() and similar is not used for planned segments.
+  //
+  // move/moveTo/runForward/runBackward discard the planned segments.
+  // stopMove() and forceStop...() do this, too.
+  inline void setPlannerBuffer(struct planner_segment_s* buffer,
+                               uint8_t entries) {
+    _rg.setPlannerBuffer(buffer, entries);
+  }
+  int8_t planMoveTo(int32_t position, uint32_t speed_us);
+  inline bool isPlannerFull() { return _rg.isPlannerFull(); }
+
   // This command flags the stepper to keep run continuously into current
   // direction. It can be stopped by stopMove.
   // Be aware, if the motor is currently decelerating towards reversed
@@ -504,6 +751,71 @@ class FastAccelStepper {
   // return value as with move/moveTo
   int8_t moveByAcceleration(int32_t acceleration, bool allow_reverse = true);
 
+  // ## Velocity streaming
+  // For a control loop, which updates the speed of the stepper at a high
+  // rate, e.g. every 1ms. setTargetVelocityInMilliHz() only stores the new
+  // target speed and the stepper task slews the speed towards it with the
+  // acceleration set by setAcceleration(). Neither ramp steps nor any other
+  // part of the ramp configuration are recalculated by the call.
+  //
+  //    velocity > 0  => run forward with up to velocity
+  //    velocity = 0  => decelerate to standstill
+  //    velocity < 0  => run backward with up to -velocity
+  //
+  // A target above the maximum speed of the driver is limited to it. The
+  // speed set by setSpeedInUs() and similar is not used. The linear
+  // acceleration and the jerk limited ramp apply as for runForward().
+  // The mode is ended by move/moveTo/runForward/runBackward/planMoveTo,
+  // stopMove() and forceStop...().
+  //
+  // Returns MOVE_OK, MOVE_ERR_ACCELERATION_IS_UNDEFINED or
+  // MOVE_ERR_NO_DIRECTION_PIN for a negative velocity without direction pin
+  int8_t setTargetVelocityInMilliHz(int32_t velocity_mhz);
+  inline bool isVelocityMode() { return _rg.isVelocityMode(); }
+
+  // ## Trajectory playback
+  // A trajectory is a table of stepper commands, which has been generated
+  // once, e.g. on the host with the tool trajectory_gen in
+  // extras/tests/pc_based. The stepper task copies the commands into the
+  // queue without any ramp calculation. The table can be placed in flash:
+  //
+  //    const struct stepper_command_s move[] FAS_PROGMEM = {...};
+  //    stepper->playTrajectory(move, sizeof(move) / sizeof(move[0]), true);
+  //
+  // in_progmem = true is only needed for a table declared with FAS_PROGMEM.
+  // The table must stay valid during the playback. The commands are checked
+  // on start against the max. speed of the driver and the direction pin.
+  // The ticks of the table are valid for the TICKS_PER_S of the generator.
+  //
+  // Speed and acceleration need to be set: A move command, stopMove() or
+  // applySpeedAcceleration() during the playback ends it and the ramp
+  // generator takes over with the speed of the last played command.
+  // forceStop...() stops the playback like a ramp.
+  //
+  // Returns MOVE_OK, MOVE_ERR_STEPPER_IS_RUNNING, if a ramp is active,
+  // MOVE_ERR_NO_DIRECTION_PIN, MOVE_ERR_INVALID_TRAJECTORY or the errors of
+  // move() for undefined speed and acceleration
+  int8_t playTrajectory(const struct stepper_command_s* table,
+                        uint16_t entries, bool in_progmem = false);
+  inline bool isPlayingTrajectory() { return _rg.isPlayingTrajectory(); }
+
+  // The commands can be streamed, too, e.g. from SD card or Serial. The
+  // stream is delta encoded with about two bytes per command instead of
+  // four, see TrajectoryStream.h for the format and the usage. trajectory_gen
+  // writes it with option -b. The stepper task decodes the commands from a
+  // ring buffer of TRAJECTORY_BUFFER_LEN bytes, which the application keeps
+  // filled. The stream should start with the header already written.
+  //
+  // The commands are checked while decoding. A corrupted stream or a command
+  // too fast for the driver stops the stepper like stopMove(), and
+  // stream->state() tells the reason. targetPos() is the position after
+  // the last queued command. Otherwise the same as playTrajectory().
+  //
+  // Returns MOVE_OK, MOVE_ERR_STEPPER_IS_RUNNING, MOVE_ERR_INVALID_TRAJECTORY
+  // for a stream, which is not reset, or the errors of move() for undefined
+  // speed and acceleration
+  int8_t playTrajectoryStream(TrajectoryStream* stream);
+
   // stop the running stepper with normal deceleration.
   // This only sets a flag and can be called from an interrupt !
   void stopMove();
@@ -533,6 +845,52 @@ class FastAccelStepper {
   // In keep running mode, the targetPos() is not updated
   inline int32_t targetPos() { return _rg.targetPosition(); }
 
+#if defined(SUPPORT_POSITION_EVENTS)
+  // ## Position events
+  // Only available with the build flag FAS_POSITION_EVENTS. An event is
+  // raised, when the stepper makes the step to the given position, e.g. to
+  // trigger a camera while moving:
+  //
+  //    int8_t event = stepper->addPositionEvent(1000);
+  //    stepper->moveTo(2000);
+  //    ...
+  //    if (stepper->getPositionEvents() & (1 << event)) {...}
+  //
+  // The position is resolved, when the stepper task plans the commands. A
+  // command with the step to the position is split there and the queue
+  // entry starting with this step raises the event, when the isr starts
+  // it. The isr starts an entry with the last step of the previous entry,
+  // so the event comes up to one step period early. A queue entry needs
+  // MIN_CMD_TICKS (200us), so at high speed the event is moved up to three
+  // times this value earlier. The esp32 rmt driver raises it, when the
+  // entry is written into the rmt buffer, which is up to 31 steps ahead.
+  //
+  // Each event is raised once. Only commands planned after the call are
+  // checked, so the event should be added before the move is started.
+  // Otherwise it is raised at the next step to the position. Up to
+  // MAX_POSITION_EVENTS (4) events per stepper are supported. An event is
+  // in use until raised. The events of entries discarded by
+  // forceStopAndNewPosition() are dropped. moveLinear() does not check the
+  // events.
+  //
+  // addPositionEvent() returns the event number 0..MAX_POSITION_EVENTS-1 or
+  // POSITION_EVENT_ERR_FULL, if all events are in use.
+  int8_t addPositionEvent(int32_t position);
+#define POSITION_EVENT_ERR_FULL -1
+
+  // Remove the events, which are not yet planned. The events already in the
+  // queue are still raised.
+  void clearPositionEvents();
+
+  // Returns the bit mask of the events raised since the last call.
+  uint8_t getPositionEvents();
+
+  // The callback is called by the isr for each raised event. So it has to
+  // return quickly and on esp32 it needs to be placed in IRAM (IRAM_ATTR).
+  void setPositionEventCallback(void (*func)(FastAccelStepper* stepper,
+                                             uint8_t event));
+#endif
+
   // ## Low Level Stepper Queue Management (low level access)
   //
   // If the queue is already running, then the start parameter is obsolote.
@@ -571,18 +929,21 @@ class FastAccelStepper {
   //
   // To retrieve the forward planning time in the queue, ticksInQueue()
   // can be used. It sums up all ticks of the not yet processed commands.
-  // For commands defining pauses, the summed up value is entry.ticks.
+  // For commands defining pauses, the summed up value is entry.ticks times
+  // the periods of the pause, of which the currently processed command
+  // contributes the remaining periods.
   // For commands with steps, the summed up value is entry.steps*entry.ticks
   uint32_t ticksInQueue();
 
   // This function can be used to check, if the commands in the queue
   // will last for <min_ticks> ticks. This is again without the
-  // currently processed command.
+  // currently processed command, except the remaining periods of a pause.
   bool hasTicksInQueue(uint32_t min_ticks);
 
   // This function allows to check the number of commands in the queue.
-  // This is including the currently processed command.
-  uint8_t queueEntries();
+  // This is including the currently processed command. With FAS_QUEUE_LEN
+  // the queue can have more than 255 entries.
+  uint16_t queueEntries();
 
   // Get the future position of the stepper after all commands in queue are
   // completed
@@ -662,11 +1023,29 @@ class FastAccelStepper {
   bool externalDirPinChangeCompletedIfNeeded();
 #endif
   void fill_queue();
+  uint32_t planningHorizon(uint32_t ticks_in_queue, bool running);
+  uint32_t fillDeadline();
+#if defined(SUPPORT_TASK_WAKEUP)
+  uint32_t taskWakeupTicks();
+#endif
+  bool isBatchable(const struct stepper_command_s* cmd,
+                   const struct queue_end_s* queue_end);
+  int8_t addQueueEntryWithEvents(const struct stepper_command_s* cmd,
+                                 bool start, uint8_t events);
+#if defined(SUPPORT_POSITION_EVENTS)
+  uint8_t splitAtPositionEvents(const struct stepper_command_s* cmd,
+                                int32_t pos, struct event_split_s* split);
+  int8_t addSplitCommand(struct queue_batch_s* batch,
+                         const struct stepper_command_s* cmd,
+                         const struct event_split_s* split, bool batchable,
+                         bool start);
+#endif
   void updateAutoDisable();
   void blockingWaitForForceStopComplete();
   bool needAutoDisable();
   bool agreeWithAutoDisable();
   bool usesAutoEnablePin(uint8_t pin);
+  void resetStats();
   void getCurrentSpeedInTicks(struct actual_ticks_s* speed, bool realtime);
 
   FastAccelStepperEngine* _engine;
@@ -684,9 +1063,24 @@ class FastAccelStepper {
   uint16_t _off_delay_count;
   uint16_t _auto_disable_delay_counter;
 
+  uint32_t _horizon_ticks;
+  uint32_t _min_horizon_ticks;
+  uint32_t _max_horizon_ticks;
+  uint32_t _fill_interval_peak;  /* decaying max. interval between two fills */
+  uint32_t _ticks_after_fill;    /* ticks in queue at end of the last fill */
+
+  struct stepper_stats_s _stats;
+  uint32_t _fill_us_total;
+  bool _ramp_needs_queue;  /* ramp active and queue running after last fill */
+
 #if defined(SUPPORT_ESP32_PULSE_COUNTER)
   int16_t _attached_pulse_cnt_unit;
 #endif
+#if defined(SUPPORT_POSITION_EVENTS)
+  int32_t _event_pos[MAX_POSITION_EVENTS];
+  uint8_t _events_pending;  /* added, but not yet found in a command */
+  uint8_t _events_queued;   /* in a queue entry, maybe already raised */
+#endif
 #if (TEST_MEASURE_ISR_SINGLE_FILL == 1)
   uint32_t max_micros;
 #endif
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#if !defined(FAS_PMF_32BIT)
 #if defined(ARDUINO_ARCH_AVR)
 #include <avr/pgmspace.h>
 #else
@@ -99,21 +100,10 @@
 // For better precision y_yyyy is shifted by 2 and can be calculated as:
 //	   [round((math.log2(i/256) * 256 - (i-256))*4) for i in range(256,512)]
 //
+// The values are defined in PoorManFloat.h, because pmfl_const_from() needs
+// them at compile time.
 const PROGMEM uint8_t log2_minus_x_plus_one_shifted_by_2[256] = {
-    0,  2,  3,  5,  7,  9,  10, 12, 13, 15, 17, 18, 20, 21, 23, 24, 26, 27, 28,
-    30, 31, 32, 34, 35, 36, 38, 39, 40, 41, 43, 44, 45, 46, 47, 48, 49, 50, 51,
-    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 64, 65, 66, 67, 68, 68,
-    69, 70, 70, 71, 72, 72, 73, 74, 74, 75, 75, 76, 77, 77, 78, 78, 79, 79, 80,
-    80, 80, 81, 81, 82, 82, 83, 83, 83, 84, 84, 84, 84, 85, 85, 85, 86, 86, 86,
-    86, 86, 87, 87, 87, 87, 87, 87, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88,
-    88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 87, 87, 87, 87, 87, 87, 86, 86,
-    86, 86, 86, 85, 85, 85, 85, 84, 84, 84, 84, 83, 83, 83, 82, 82, 82, 81, 81,
-    81, 80, 80, 79, 79, 79, 78, 78, 77, 77, 76, 76, 75, 75, 74, 74, 73, 73, 72,
-    72, 71, 71, 70, 70, 69, 68, 68, 67, 67, 66, 65, 65, 64, 63, 63, 62, 61, 61,
-    60, 59, 59, 58, 57, 57, 56, 55, 54, 54, 53, 52, 51, 51, 50, 49, 48, 47, 47,
-    46, 45, 44, 43, 42, 42, 41, 40, 39, 38, 37, 36, 35, 34, 34, 33, 32, 31, 30,
-    29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11,
-    10, 9,  8,  7,  6,  4,  3,  2,  1};
+    PMF_LOG2_MINUS_X_PLUS_ONE_SHIFTED_BY_2};
 
 // For the inverse pow(2,x) needs to be calculated. Similarly it makes sense to
 // evaluate instead
@@ -288,3 +278,4 @@ pmf_logarithmic pmfl_square(pmf_logarithmic x) {
   }
   return x + x;
 }
+#endif
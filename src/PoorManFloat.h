@@ -2,6 +2,12 @@
 #define POORMANFLOAT_H
 #include <stdint.h>
 
+// With the build flag FAS_PMF_32BIT the 32 bit variant with same interface
+// is used instead.
+#if defined(FAS_PMF_32BIT)
+#include "PoorManFloat32.h"
+#else
+
 typedef int16_t pmf_logarithmic;
 
 #define PMF_CONST_INVALID ((pmf_logarithmic)0x8000)
@@ -18,7 +24,7 @@ typedef int16_t pmf_logarithmic;
 #define PMF_CONST_21E6 ((pmf_logarithmic)0x30a5)
 #define PMF_CONST_42000 ((pmf_logarithmic)0x1eb7)
 #define PMF_CONST_21E6_DIV_SQRT_OF_2 ((pmf_logarithmic)0x2fa5)
-#define PMF_CONST_2205E11 ((pmf_logarithmic)0x5f96)
+#define PMF_CONST_2205E11 ((pmf_logarithmic)0x5f4a)
 pmf_logarithmic pmfl_from(uint8_t x);
 pmf_logarithmic pmfl_from(uint16_t x);
 pmf_logarithmic pmfl_from(uint32_t x);
@@ -50,5 +56,81 @@ inline pmf_logarithmic pmfl_pow_div_3(pmf_logarithmic x) {
 
 pmf_logarithmic pmfl_square(pmf_logarithmic x);
 
+// pmfl_from() and pmfl_square() as constexpr with bit-identical results.
+// These are meant for constants like the timer frequency, which are then
+// evaluated by the compiler for any TICKS_PER_S. pmfl_sqrt(), pmfl_shr()
+// and the like are macros and can be used in constant expressions as well.
+// Do not call them with variables: the table would be placed in RAM.
+//
+// The table of log2(x) - x + 1 for the mantissa, see PoorManFloat.cpp
+#define PMF_LOG2_MINUS_X_PLUS_ONE_SHIFTED_BY_2 \
+    0, 2, 3, 5, 7, 9, 10, 12, 13, 15, 17, 18, 20, 21, 23, 24, 26, 27, 28, \
+    30, 31, 32, 34, 35, 36, 38, 39, 40, 41, 43, 44, 45, 46, 47, 48, 49, 50, \
+    51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 64, 65, 66, 67, \
+    68, 68, 69, 70, 70, 71, 72, 72, 73, 74, 74, 75, 75, 76, 77, 77, 78, 78, \
+    79, 79, 80, 80, 80, 81, 81, 82, 82, 83, 83, 83, 84, 84, 84, 84, 85, 85, \
+    85, 86, 86, 86, 86, 86, 87, 87, 87, 87, 87, 87, 88, 88, 88, 88, 88, 88, \
+    88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 88, 87, 87, \
+    87, 87, 87, 87, 86, 86, 86, 86, 86, 85, 85, 85, 85, 84, 84, 84, 84, 83, \
+    83, 83, 82, 82, 82, 81, 81, 81, 80, 80, 79, 79, 79, 78, 78, 77, 77, 76, \
+    76, 75, 75, 74, 74, 73, 73, 72, 72, 71, 71, 70, 70, 69, 68, 68, 67, 67, \
+    66, 65, 65, 64, 63, 63, 62, 61, 61, 60, 59, 59, 58, 57, 57, 56, 55, 54, \
+    54, 53, 52, 51, 51, 50, 49, 48, 47, 47, 46, 45, 44, 43, 42, 42, 41, 40, \
+    39, 38, 37, 36, 35, 34, 34, 33, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, \
+    22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 4, 3, 2, \
+    1
+static constexpr uint8_t pmfl_const_log2_tab[256] = {
+    PMF_LOG2_MINUS_X_PLUS_ONE_SHIFTED_BY_2};
+
+static constexpr uint8_t pmfl_const_leading_zeros(uint8_t x) {
+  return (x & 0x80)  ? 0
+         : (x == 0) ? 8
+                    : 1 + pmfl_const_leading_zeros((uint8_t)(x << 1));
+}
+// m is x shifted left until the msb is shifted out
+static constexpr pmf_logarithmic pmfl_const_from_m8(uint8_t m,
+                                                    uint8_t exponent) {
+  return (((((uint16_t)exponent) << 8) | m) << 1) +
+         ((pmfl_const_log2_tab[m] + 1) >> 1);
+}
+static constexpr pmf_logarithmic pmfl_const_from_u8(uint8_t x) {
+  return (x == 0) ? PMF_CONST_INVALID
+                  : pmfl_const_from_m8(
+                        (uint8_t)(x << (pmfl_const_leading_zeros(x) + 1)),
+                        7 - pmfl_const_leading_zeros(x));
+}
+// m are the ten bits right from the msb
+static constexpr uint8_t pmfl_const_offset_u16(uint16_t m) {
+  return ((m & 2) && ((m >> 2) != 255))
+             ? (pmfl_const_log2_tab[m >> 2] +
+                pmfl_const_log2_tab[(m >> 2) + 1] + 1) >>
+                   1
+             : pmfl_const_log2_tab[m >> 2];
+}
+static constexpr pmf_logarithmic pmfl_const_from_m16(uint16_t m,
+                                                     uint8_t exponent) {
+  return ((m + pmfl_const_offset_u16(m)) >> 1) + (((uint16_t)exponent) << 9);
+}
+static constexpr pmf_logarithmic pmfl_const_from_u16(uint16_t x) {
+  return (pmfl_const_leading_zeros(x >> 8) == 8)
+             ? pmfl_const_from_u8((uint8_t)x)
+             : pmfl_const_from_m16(
+                   ((uint16_t)(x << (pmfl_const_leading_zeros(x >> 8) + 1))) >>
+                       6,
+                   15 - pmfl_const_leading_zeros(x >> 8));
+}
+static constexpr pmf_logarithmic pmfl_const_from(uint32_t x) {
+  return ((x & 0xffff0000) == 0) ? pmfl_const_from_u16((uint16_t)x)
+         : ((x & 0xff000000) == 0)
+             ? pmfl_const_from_u16((uint16_t)(x >> 8)) + 0x1000
+             : pmfl_const_from_u16((uint16_t)(x >> 16)) + 0x2000;
+}
+static constexpr pmf_logarithmic pmfl_const_square(pmf_logarithmic x) {
+  return (x >= 0x4000)    ? PMF_CONST_MAX
+         : (x <= -0x4000) ? (pmf_logarithmic)0x8001
+                          : x + x;
+}
+
 uint8_t leading_zeros(uint8_t x);
 #endif
+#endif
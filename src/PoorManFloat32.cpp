@@ -0,0 +1,150 @@
+#include <stdint.h>
+#if defined(FAS_PMF_32BIT)
+#include "PoorManFloat32.h"
+
+// 32 bit variant of the logarithmic representation in PoorManFloat.cpp.
+//
+// pmf_logarithmic is log2(x) as signed fixed point with 16 fractional bits.
+// Compared to the 16 bit variant with 9 fractional bits, the resolution is
+// approx. 1e-5 instead of 1.4e-3 relative error per conversion.
+//
+// Both directions use a table with 257 entries for the upper 8 bits of the
+// mantissa/fraction and linear interpolation between two entries. The error
+// of the interpolation is below 3e-6.
+//
+// The tables need 2kB and are not placed in PROGMEM, because this variant
+// is meant for 32 bit MCUs. For avr use the 16 bit variant.
+//
+// Using python3 the tables can be calculated by:
+//     [round(math.log2(1+i/256)*65536) for i in range(257)]
+//     [round(math.pow(2,i/256)*2**30) for i in range(257)]
+//
+// The log2 table is defined in PoorManFloat32.h, because pmfl_const_from()
+// needs it at compile time.
+
+static const uint32_t pmf32_pow2_tab[257] = {
+    1073741824, 1076653033, 1079572136, 1082499153, 1085434106, 1088377016,
+    1091327906, 1094286796, 1097253708, 1100228665, 1103211687, 1106202798,
+    1109202018, 1112209370, 1115224875, 1118248556, 1121280436, 1124320536,
+    1127368878, 1130425485, 1133490379, 1136563583, 1139645120, 1142735011,
+    1145833280, 1148939949, 1152055042, 1155178580, 1158310587, 1161451085,
+    1164600099, 1167757650, 1170923762, 1174098458, 1177281762, 1180473697,
+    1183674286, 1186883552, 1190101520, 1193328213, 1196563654, 1199807867,
+    1203060876, 1206322705, 1209593378, 1212872918, 1216161350, 1219458698,
+    1222764986, 1226080238, 1229404479, 1232737732, 1236080024, 1239431376,
+    1242791816, 1246161366, 1249540052, 1252927899, 1256324931, 1259731174,
+    1263146652, 1266571390, 1270005413, 1273448747, 1276901417, 1280363448,
+    1283834865, 1287315695, 1290805962, 1294305692, 1297814910, 1301333643,
+    1304861917, 1308399756, 1311947188, 1315504238, 1319070932, 1322647296,
+    1326233356, 1329829140, 1333434672, 1337049980, 1340675091, 1344310030,
+    1347954824, 1351609500, 1355274085, 1358948606, 1362633090, 1366327563,
+    1370032052, 1373746586, 1377471191, 1381205894, 1384950723, 1388705706,
+    1392470869, 1396246240, 1400031848, 1403827719, 1407633882, 1411450365,
+    1415277195, 1419114401, 1422962010, 1426820052, 1430688553, 1434567544,
+    1438457051, 1442357104, 1446267730, 1450188960, 1454120821, 1458063343,
+    1462016553, 1465980482, 1469955159, 1473940611, 1477936870, 1481943963,
+    1485961921, 1489990772, 1494030547, 1498081275, 1502142985, 1506215708,
+    1510299473, 1514394310, 1518500250, 1522617322, 1526745556, 1530884983,
+    1535035634, 1539197537, 1543370725, 1547555228, 1551751076, 1555958300,
+    1560176931, 1564406999, 1568648537, 1572901575, 1577166143, 1581442275,
+    1585730000, 1590029350, 1594340357, 1598663052, 1602997467, 1607343634,
+    1611701585, 1616071351, 1620452965, 1624846459, 1629251865, 1633669214,
+    1638098541, 1642539877, 1646993254, 1651458706, 1655936265, 1660425963,
+    1664927835, 1669441912, 1673968228, 1678506817, 1683057710, 1687620943,
+    1692196547, 1696784557, 1701385007, 1705997930, 1710623359, 1715261330,
+    1719911875, 1724575029, 1729250827, 1733939301, 1738640488, 1743354420,
+    1748081133, 1752820662, 1757573041, 1762338305, 1767116489, 1771907628,
+    1776711757, 1781528911, 1786359126, 1791202437, 1796058879, 1800928489,
+    1805811301, 1810707353, 1815616678, 1820539314, 1825475297, 1830424663,
+    1835387448, 1840363688, 1845353420, 1850356681, 1855373507, 1860403934,
+    1865448001, 1870505744, 1875577199, 1880662405, 1885761398, 1890874216,
+    1896000896, 1901141476, 1906295993, 1911464486, 1916646992, 1921843549,
+    1927054196, 1932278970, 1937517909, 1942771053, 1948038440, 1953320108,
+    1958616096, 1963926443, 1969251188, 1974590370, 1979944027, 1985312200,
+    1990694927, 1996092249, 2001504204, 2006930832, 2012372174, 2017828268,
+    2023299156, 2028784876, 2034285470, 2039800978, 2045331439, 2050876895,
+    2056437387, 2062012954, 2067603638, 2073209480, 2078830522, 2084466803,
+    2090118366, 2095785251, 2101467502, 2107165158, 2112878262, 2118606857,
+    2124350982, 2130110682, 2135885998, 2141676973, 2147483648};
+
+static uint8_t msb_pos(uint32_t x) {
+  uint8_t e = 31;
+  if ((x & 0xffff0000) == 0) {
+    x <<= 16;
+    e -= 16;
+  }
+  if ((x & 0xff000000) == 0) {
+    x <<= 8;
+    e -= 8;
+  }
+  if ((x & 0xf0000000) == 0) {
+    x <<= 4;
+    e -= 4;
+  }
+  if ((x & 0xc0000000) == 0) {
+    x <<= 2;
+    e -= 2;
+  }
+  if ((x & 0x80000000) == 0) {
+    e -= 1;
+  }
+  return e;
+}
+
+pmf_logarithmic pmfl_from(uint8_t x) { return pmfl_from((uint32_t)x); }
+pmf_logarithmic pmfl_from(uint16_t x) { return pmfl_from((uint32_t)x); }
+pmf_logarithmic pmfl_from(uint32_t x) {
+  // calling with x == 0 is considered an error.
+  if (x == 0) {
+    return PMF_CONST_INVALID;
+  }
+  uint8_t e = msb_pos(x);
+  // normalize to 1mmm_mmmm_ffff_ffff_ffff_ffff_xxxx_xxxx
+  x <<= 31 - e;
+  uint8_t index = (x >> 23) & 0xff;
+  uint32_t f = (x >> 7) & 0xffff;
+  uint32_t l = pmf32_log2_tab[index];
+  uint32_t delta = pmf32_log2_tab[index + 1] - l;
+  l += (delta * f + 0x8000) >> 16;
+  return (((int32_t)e) << 16) + l;
+}
+uint16_t pmfl_to_u16(pmf_logarithmic x) {
+  if (x >= 0x100000) {
+    return 0xffff;
+  }
+  uint32_t res = pmfl_to_u32(x);
+  if (res > 0xffff) {
+    return 0xffff;
+  }
+  return res;
+}
+uint32_t pmfl_to_u32(pmf_logarithmic x) {
+  if (x < 0) {
+    return 0;
+  }
+  if (x >= 0x200000) {
+    return 0xffffffff;
+  }
+  uint8_t e = x >> 16;
+  uint8_t index = (x >> 8) & 0xff;
+  uint32_t f = x & 0xff;
+  // mantissa 1.0 <= m < 2.0 in fixed point with 30 fractional bits
+  uint32_t m = pmf32_pow2_tab[index];
+  uint32_t delta = pmf32_pow2_tab[index + 1] - m;
+  m += (delta * f + 0x80) >> 8;
+  if (e >= 30) {
+    return m << (e - 30);
+  }
+  uint8_t shift = 30 - e;
+  return (m + (((uint32_t)1) << (shift - 1))) >> shift;
+}
+pmf_logarithmic pmfl_square(pmf_logarithmic x) {
+  if (x >= 0x40000000) {
+    return PMF_CONST_MAX;
+  }
+  if (x <= -0x40000000) {
+    return PMF_CONST_INVALID + 1;
+  }
+  return x + x;
+}
+#endif
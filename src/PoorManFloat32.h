@@ -0,0 +1,102 @@
+#ifndef POORMANFLOAT32_H
+#define POORMANFLOAT32_H
+#include <stdint.h>
+
+// This is the 32 bit variant of PoorManFloat.h, selected with the build flag
+// FAS_PMF_32BIT. pmf_logarithmic is log2(x) with 16 fractional bits.
+// Interface and constants are the same as for the 16 bit variant.
+
+typedef int32_t pmf_logarithmic;
+
+#define PMF_CONST_INVALID ((pmf_logarithmic)0x80000000)
+#define PMF_CONST_MAX ((pmf_logarithmic)0x7fffffff)
+#define PMF_CONST_1 ((pmf_logarithmic)0x00000000)
+#define PMF_CONST_3_DIV_2 ((pmf_logarithmic)0x000095c0)
+#define PMF_CONST_128E12 ((pmf_logarithmic)0x002edcf7)
+#define PMF_CONST_16E6 ((pmf_logarithmic)0x0017ee7b)
+#define PMF_CONST_500 ((pmf_logarithmic)0x0008f73e)
+#define PMF_CONST_1000 ((pmf_logarithmic)0x0009f73e)
+#define PMF_CONST_2000 ((pmf_logarithmic)0x000af73e)
+#define PMF_CONST_32000 ((pmf_logarithmic)0x000ef73e)
+#define PMF_CONST_16E6_DIV_SQRT_OF_2 ((pmf_logarithmic)0x00176e7b)
+#define PMF_CONST_21E6 ((pmf_logarithmic)0x001852ea)
+#define PMF_CONST_42000 ((pmf_logarithmic)0x000f5bad)
+#define PMF_CONST_21E6_DIV_SQRT_OF_2 ((pmf_logarithmic)0x0017d2ea)
+#define PMF_CONST_2205E11 ((pmf_logarithmic)0x002fa5d4)
+pmf_logarithmic pmfl_from(uint8_t x);
+pmf_logarithmic pmfl_from(uint16_t x);
+pmf_logarithmic pmfl_from(uint32_t x);
+
+uint16_t pmfl_to_u16(pmf_logarithmic x);
+uint32_t pmfl_to_u32(pmf_logarithmic x);
+
+#define pmfl_shl(x, n) ((x) + (((int32_t)(n)) << 16))
+#define pmfl_shr(x, n) ((x) - (((int32_t)(n)) << 16))
+
+#define pmfl_multiply(x, y) ((x) + (y))
+#define pmfl_divide(x, y) ((x) - (y))
+#define pmfl_reciprocal(x) (-(x))
+#define pmfl_sqrt(x) ((x) / 2)
+#define pmfl_rsqrt(x) (-(x) / 2)
+#define pmfl_rsquare(x) pmfl_reciprocal(pmfl_square(x))
+
+#define pmfl_pow_div_3(x) ((x) / 3)
+#define pmfl_pow_2_div_3(x) ((x)-pmfl_pow_div_3(x))
+#define pmfl_pow_3_div_2(x) ((x) + (x) / 2)
+
+pmf_logarithmic pmfl_square(pmf_logarithmic x);
+
+// pmfl_from() and pmfl_square() as constexpr with bit-identical results for
+// constants like the timer frequency. See PoorManFloat.h
+//
+// The table of log2(1 + i/256), see PoorManFloat32.cpp
+static constexpr uint32_t pmf32_log2_tab[257] = {
+    0, 369, 736, 1102, 1466, 1829, 2190, 2551, 2909, 3267, 3623, 3978, 4331,
+    4683, 5034, 5384, 5732, 6079, 6425, 6769, 7112, 7454, 7795, 8134, 8473,
+    8810, 9146, 9480, 9814, 10146, 10477, 10807, 11136, 11464, 11791, 12116,
+    12440, 12764, 13086, 13407, 13727, 14046, 14363, 14680, 14996, 15310, 15624,
+    15937, 16248, 16559, 16868, 17177, 17484, 17791, 18096, 18401, 18704, 19007,
+    19308, 19609, 19909, 20207, 20505, 20802, 21098, 21393, 21687, 21980, 22272,
+    22564, 22854, 23144, 23433, 23720, 24007, 24293, 24579, 24863, 25146, 25429,
+    25711, 25992, 26272, 26551, 26830, 27108, 27384, 27660, 27936, 28210, 28484,
+    28757, 29029, 29300, 29571, 29840, 30109, 30378, 30645, 30912, 31178, 31443,
+    31707, 31971, 32234, 32496, 32758, 33019, 33279, 33538, 33797, 34055, 34312,
+    34569, 34825, 35080, 35334, 35588, 35841, 36094, 36346, 36597, 36847, 37097,
+    37346, 37595, 37842, 38090, 38336, 38582, 38827, 39072, 39316, 39559, 39802,
+    40044, 40286, 40527, 40767, 41006, 41246, 41484, 41722, 41959, 42196, 42432,
+    42667, 42902, 43137, 43370, 43603, 43836, 44068, 44300, 44530, 44761, 44990,
+    45220, 45448, 45676, 45904, 46131, 46357, 46583, 46809, 47034, 47258, 47482,
+    47705, 47928, 48150, 48372, 48593, 48813, 49034, 49253, 49472, 49691, 49909,
+    50127, 50344, 50560, 50776, 50992, 51207, 51422, 51636, 51850, 52063, 52276,
+    52488, 52700, 52911, 53122, 53332, 53542, 53751, 53960, 54169, 54377, 54584,
+    54791, 54998, 55204, 55410, 55615, 55820, 56025, 56229, 56432, 56635, 56838,
+    57040, 57242, 57443, 57644, 57845, 58045, 58245, 58444, 58643, 58841, 59039,
+    59237, 59434, 59631, 59827, 60023, 60219, 60414, 60609, 60803, 60997, 61190,
+    61384, 61576, 61769, 61961, 62152, 62343, 62534, 62725, 62915, 63104, 63294,
+    63483, 63671, 63859, 64047, 64234, 64421, 64608, 64794, 64980, 65166, 65351,
+    65536};
+
+static constexpr uint8_t pmfl_const_msb_pos(uint32_t x) {
+  return (x & 0x80000000) ? 31 : pmfl_const_msb_pos(x << 1) - 1;
+}
+static constexpr uint32_t pmfl_const_interpolate(uint8_t index, uint32_t f) {
+  return pmf32_log2_tab[index] +
+         (((pmf32_log2_tab[index + 1] - pmf32_log2_tab[index]) * f + 0x8000) >>
+          16);
+}
+// n is x shifted left until the msb is bit 31
+static constexpr pmf_logarithmic pmfl_const_from_n(uint32_t n, uint8_t e) {
+  return (((int32_t)e) << 16) +
+         pmfl_const_interpolate((n >> 23) & 0xff, (n >> 7) & 0xffff);
+}
+static constexpr pmf_logarithmic pmfl_const_from(uint32_t x) {
+  return (x == 0) ? PMF_CONST_INVALID
+                  : pmfl_const_from_n(x << (31 - pmfl_const_msb_pos(x)),
+                                      pmfl_const_msb_pos(x));
+}
+static constexpr pmf_logarithmic pmfl_const_square(pmf_logarithmic x) {
+  return (x >= 0x40000000)    ? PMF_CONST_MAX
+         : (x <= -0x40000000) ? PMF_CONST_INVALID + 1
+                              : x + x;
+}
+#endif
@@ -2,27 +2,30 @@
 #define RAMP_CALCULATOR_H
 
 #include <stdint.h>
+#include <string.h>
 
 #include "PoorManFloat.h"
 #include "fas_common.h"
 
+// The timer frequency and the derived constants are evaluated by the
+// compiler for any TICKS_PER_S
+static constexpr pmf_logarithmic pmfl_timer_freq =
+    pmfl_const_from((uint32_t)TICKS_PER_S);
+static constexpr pmf_logarithmic pmfl_timer_freq_div_sqrt_of_2 =
+    pmfl_divide(pmfl_timer_freq, pmfl_sqrt(pmfl_const_from(2)));
+static constexpr pmf_logarithmic pmfl_timer_freq_square_div_2 =
+    pmfl_divide(pmfl_const_square(pmfl_timer_freq), pmfl_const_from(2));
+#define PMF_TICKS_PER_S pmfl_timer_freq
+#define PMF_TICKS_PER_S_DIV_SQRT_OF_2 pmfl_timer_freq_div_sqrt_of_2
+#define PMF_ACCEL_FACTOR pmfl_timer_freq_square_div_2
+
 #if (TICKS_PER_S == 16000000L)
-#define PMF_TICKS_PER_S PMF_CONST_16E6
-#define PMF_TICKS_PER_S_DIV_SQRT_OF_2 PMF_CONST_16E6_DIV_SQRT_OF_2
-#define PMF_ACCEL_FACTOR PMF_CONST_128E12
 #define US_TO_TICKS(u32) (u32 * 16)
 #define TICKS_TO_US(u32) (u32 / 16)
 #elif (TICKS_PER_S == 21000000L)
-#define PMF_TICKS_PER_S PMF_CONST_21E6
-#define PMF_TICKS_PER_S_DIV_SQRT_OF_2 PMF_CONST_21E6_DIV_SQRT_OF_2
-#define PMF_ACCEL_FACTOR PMF_CONST_2205E11
 #define US_TO_TICKS(u32) (u32 * 21)
 #define TICKS_TO_US(u32) (u32 / 21)
 #else
-#define SUPPORT_PMF_TIMER_FREQ_VARIABLES
-#define PMF_TICKS_PER_S pmfl_timer_freq
-#define PMF_TICKS_PER_S_DIV_SQRT_OF_2 pmfl_timer_freq_div_sqrt_of_2
-#define PMF_ACCEL_FACTOR pmfl_timer_freq_square_div_2
 // This overflows for approx. 1s at 40 MHz, only
 #define US_TO_TICKS(u32) \
   ((uint32_t)((((uint32_t)((u32) * (TICKS_PER_S / 10000L))) / 100L)))
@@ -50,6 +53,13 @@ struct ramp_parameters_s {
   uint32_t s_h;
   uint32_t s_jump;
   pmf_logarithmic pmfl_accel;
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  // in steps/s³. 0 selects the constant acceleration ramp
+  uint32_t jerk;
+#endif
+  // optional caller provided memory for caching calculate_ticks()
+  uint32_t *ticks_cache;
+  uint16_t ticks_cache_entries;
   bool apply : 1;              // clear on read by stepper task. Triggers read !
   bool any_change : 1;         // clear on read by stepper task
   bool recalc_ramp_steps : 1;  // clear on read by stepper task
@@ -72,6 +82,11 @@ struct ramp_parameters_s {
     s_h = 0;
     s_jump = 0;
     min_travel_ticks = 0;
+    ticks_cache = NULL;
+    ticks_cache_entries = 0;
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+    jerk = 0;
+#endif
   }
   inline void applyParameters() {
     if (any_change) {
@@ -121,6 +136,13 @@ struct ramp_parameters_s {
       fasEnableInterrupts();
     }
   }
+  inline void setTicksCache(uint32_t *cache, uint16_t entries) {
+    fasDisableInterrupts();
+    ticks_cache = cache;
+    ticks_cache_entries = cache == NULL ? 0 : entries;
+    any_change = true;
+    fasEnableInterrupts();
+  }
   inline void setSpeedInTicks(uint32_t min_step_ticks) {
     if (!valid_speed || (min_travel_ticks != min_step_ticks)) {
       fasDisableInterrupts();
@@ -142,6 +164,19 @@ struct ramp_parameters_s {
     }
   }
   inline void setJumpStart(uint32_t jump_step) { s_jump = jump_step; }
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  inline void setJerk(uint32_t new_jerk) {
+    if (jerk != new_jerk) {
+      fasDisableInterrupts();
+      jerk = new_jerk;
+      // on return to the constant acceleration ramp, performed_ramp_up_steps
+      // needs to be derived from the current speed
+      recalc_ramp_steps = true;
+      any_change = true;
+      fasEnableInterrupts();
+    }
+  }
+#endif
   inline int8_t checkValidConfig() const {
     if (!valid_speed) {
       return MOVE_ERR_SPEED_IS_UNDEFINED;
@@ -161,8 +196,33 @@ struct ramp_config_s {
   pmf_logarithmic pmfl_ticks_h;
   pmf_logarithmic cubic;
 
-  void init() { parameters.init(); }
+  // The ticks cache content is valid for these parameters
+  uint32_t *cache_valid_for;
+  uint16_t cache_entries;
+  uint32_t cache_s_h;
+  pmf_logarithmic cache_pmfl_accel;
+
+  void init() {
+    parameters.init();
+    cache_valid_for = NULL;
+  }
   inline void update() {
+    if ((parameters.ticks_cache != cache_valid_for) ||
+        (parameters.ticks_cache_entries != cache_entries) ||
+        (parameters.s_h != cache_s_h) ||
+        (parameters.pmfl_accel != cache_pmfl_accel)) {
+      // The cache is filled by calculate_ticks() on demand, because update()
+      // runs in the context of the fill isr. Here only the old values need
+      // to be invalidated, with 0 marking an entry as not yet calculated.
+      if (parameters.ticks_cache != NULL) {
+        memset(parameters.ticks_cache, 0,
+               parameters.ticks_cache_entries * sizeof(uint32_t));
+      }
+      cache_valid_for = parameters.ticks_cache;
+      cache_entries = parameters.ticks_cache_entries;
+      cache_s_h = parameters.s_h;
+      cache_pmfl_accel = parameters.pmfl_accel;
+    }
     if (parameters.s_h > 0) {
       pmf_logarithmic pmfl_s_h = pmfl_from(parameters.s_h);
       // 1/cubic = sqrt(3/2 * a) / s_h^(1/6) / TICKS_PER_S
@@ -177,17 +237,33 @@ struct ramp_config_s {
     } else {
       pmfl_ticks_h = PMF_CONST_MAX;
     }
-    max_ramp_up_steps = calculate_ramp_steps(parameters.min_travel_ticks);
+    updateSpeed(parameters.min_travel_ticks);
+  }
+  // Only the speed changes: the values derived from acceleration and linear
+  // acceleration steps stay valid, so this is cheaper than update()
+  inline void updateSpeed(uint32_t min_travel_ticks) {
+    parameters.min_travel_ticks = min_travel_ticks;
+    max_ramp_up_steps = calculate_ramp_steps(min_travel_ticks);
     if (max_ramp_up_steps == 0) {
       max_ramp_up_steps = 1;
     }
 #ifdef TEST
     printf("MAX_RAMP_UP_STEPS=%d from %d ticks\n", max_ramp_up_steps,
-           parameters.min_travel_ticks);
+           min_travel_ticks);
 #endif
   }
 
   uint32_t calculate_ticks(uint32_t steps) const {
+    if (steps < parameters.ticks_cache_entries) {
+      uint32_t *entry = &parameters.ticks_cache[steps];
+      if (*entry == 0) {
+        *entry = calculate_ticks_uncached(steps);
+      }
+      return *entry;
+    }
+    return calculate_ticks_uncached(steps);
+  }
+  uint32_t calculate_ticks_uncached(uint32_t steps) const {
     // s = 1/2 * a * t^2
     // 2*a*s = (a*t)^2 = v^2 = (TICKS_PER_S/ticks)^2
     // ticks = TICKS_PER_S / sqrt(2*a*s)
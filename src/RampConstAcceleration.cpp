@@ -6,30 +6,8 @@
 #include "RampConstAcceleration.h"
 #include "fas_common.h"
 
-#ifdef SUPPORT_PMF_TIMER_FREQ_VARIABLES
-static pmf_logarithmic pmfl_timer_freq;
-static pmf_logarithmic pmfl_timer_freq_div_sqrt_of_2;
-static pmf_logarithmic pmfl_timer_freq_square_div_2;
-#endif
-
-void init_ramp_module() {
-#ifdef SUPPORT_PMF_TIMER_FREQ_VARIABLES
-  pmfl_timer_freq = pmfl_from((uint32_t)TICKS_PER_S);
-  pmfl_timer_freq_div_sqrt_of_2 =
-      pmfl_shr(pmfl_multiply(pmfl_timer_freq, pmfl_timer_freq));
-  pmfl_timer_freq_square_div_2 = pmfl_shr(pmfl_square(pmfl_timer_freq));
-#endif
-}
-
 //*************************************************************************************************
 
-//#define TRACE
-#ifdef TRACE
-#define TRACE_OUTPUT(x) Serial.print(x)
-#else
-#define TRACE_OUTPUT(x)
-#endif
-
 #ifdef TEST
 void print_ramp_state(uint8_t this_state) {
   switch (this_state & RAMP_DIRECTION_MASK) {
@@ -104,32 +82,19 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
     remaining_steps = fas_abs(delta);
   }
 
-#ifdef TRACE
-  if (remaining_steps == performed_ramp_up_steps) {
-    Serial.print('=');
-  } else if (remaining_steps > performed_ramp_up_steps) {
-    uint32_t dx = remaining_steps - performed_ramp_up_steps;
-    if (dx < 10) {
-      char ch = '0' + dx;
-      Serial.print(ch);
-      Serial.print('x');
-    }
-  } else {
-    uint32_t dx = performed_ramp_up_steps - remaining_steps;
-    if (dx < 10) {
-      char ch = '0' + dx;
-      Serial.print(ch);
-      Serial.print('y');
-    }
-  }
-#endif
-
   // If not moving, then use requested direction
   uint32_t performed_ramp_up_steps = rw->performed_ramp_up_steps;
   if (performed_ramp_up_steps == 0) {
     count_up = need_count_up;
   }
 
+  // A following planned segment in same direction: the ramp needs to reach
+  // only the exit speed at target_pos. So decelerate to standstill at a
+  // virtual target, which is exit_ramp_steps behind target_pos.
+  if ((count_up == need_count_up) && !ramp->config.parameters.keep_running) {
+    remaining_steps += ramp->exit_ramp_steps;
+  }
+
   if ((remaining_steps == 0) && (performed_ramp_up_steps <= 1)) {
     command->command.ticks = 0;
     command->rw.pause_ticks_left = 0;
@@ -166,7 +131,6 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
       // remaining_steps = performed_ramp_up_steps;
     } else if (remaining_steps < performed_ramp_up_steps) {
       // We will overshoot
-      TRACE_OUTPUT('O');
       this_state = RAMP_STATE_REVERSE;
       remaining_steps = performed_ramp_up_steps;
     } else if (ramp->config.parameters.min_travel_ticks < rw->curr_ticks) {
@@ -182,7 +146,6 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
           // curr_ticks is not necessarily correct due to speed increase
           uint32_t coast_time = possible_coast_steps * rw->curr_ticks;
           if (coast_time < 2 * MIN_CMD_TICKS) {
-            TRACE_OUTPUT('l');
             this_state = RAMP_STATE_COAST;
 #ifdef TEST
             printf("high speed coast %d %d\n", possible_coast_steps,
@@ -201,7 +164,6 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
         }
       }
     } else if (ramp->config.parameters.min_travel_ticks > rw->curr_ticks) {
-      TRACE_OUTPUT('d');
       this_state = RAMP_STATE_DECELERATE;
       if (performed_ramp_up_steps <= planning_steps) {
         if (performed_ramp_up_steps > 0) {
@@ -211,10 +173,19 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
         }
       }
     } else {
-      TRACE_OUTPUT('c');
       this_state = RAMP_STATE_COAST;
       uint32_t possible_coast_steps = remaining_steps - performed_ramp_up_steps;
-      if (possible_coast_steps < 2 * planning_steps) {
+#if defined(SUPPORT_WIDE_STEPS)
+      // At the target speed of a move plan for COAST_PLANNING_TICKS in one
+      // command. Running forward/backward keeps the 2ms for speed changes
+      if (!ramp->config.parameters.keep_running &&
+          (curr_ticks < TICKS_PER_S / 1000)) {
+        uint32_t coast_steps = COAST_PLANNING_TICKS / curr_ticks;
+        coast_steps = fas_min(coast_steps, MAX_CMD_STEPS);
+        planning_steps = fas_max(planning_steps, coast_steps);
+      }
+#endif
+      if (possible_coast_steps < 2 * (uint32_t)planning_steps) {
         planning_steps = possible_coast_steps;
         if (curr_ticks < MIN_CMD_TICKS) {
           uint32_t cmd_ticks = curr_ticks * planning_steps;
@@ -258,7 +229,6 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
   uint32_t d_ticks_new;
   {
     if (this_state & RAMP_STATE_ACCELERATING_FLAG) {
-      TRACE_OUTPUT('A');
       // do not overshoot ramp down start
       //
       // seems to be not necessary, as consideration already done above
@@ -292,7 +262,6 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
         d_ticks_new = ramp->config.parameters.min_travel_ticks;
       }
     } else if (this_state & RAMP_STATE_DECELERATING_FLAG) {
-      TRACE_OUTPUT('D');
       if (performed_ramp_up_steps == 1) {
         d_ticks_new = ramp->config.parameters.min_travel_ticks;
 #ifdef TEST
@@ -318,11 +287,22 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
           d_ticks_new = min_travel_ticks;
 #ifdef TEST
           printf("Clip d_ticks_new=%d for deceleration\n", d_ticks_new);
+#endif
+        }
+        // If decelerating to a lower speed, then do not undershoot the speed.
+        // calculate_ticks() and calculate_ramp_steps() are not exactly
+        // inverse, so rs can be slightly below the equivalent of
+        // min_travel_ticks.
+        if ((remaining_steps > performed_ramp_up_steps) &&
+            (min_travel_ticks > curr_ticks) &&
+            (d_ticks_new > min_travel_ticks)) {
+          d_ticks_new = min_travel_ticks;
+#ifdef TEST
+          printf("Clip d_ticks_new=%d to min_travel_ticks\n", d_ticks_new);
 #endif
         }
       }
     } else {
-      TRACE_OUTPUT('C');
       d_ticks_new = rw->curr_ticks;
       // do not overshoot ramp down start
       uint32_t coast_steps = remaining_steps - performed_ramp_up_steps;
@@ -342,7 +322,8 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
   // The above plannings_steps evaluation uses curr_ticks,
   // but new_ticks can be lower and so the command time not sufficient
   if (d_ticks_new < MIN_CMD_TICKS) {
-    uint32_t cmd_ticks = d_ticks_new * planning_steps;
+    // The steps of the command are limited to the remaining steps
+    uint32_t cmd_ticks = d_ticks_new * fas_min(planning_steps, remaining_steps);
     if (cmd_ticks < MIN_CMD_TICKS) {
       // using planning_steps and d_ticks_new would create invalid commands
 
@@ -424,24 +405,25 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
   uint16_t steps = planning_steps;
   steps = fas_min(steps, remaining_steps);  // This could be problematic
   steps = fas_max(steps, 1);
-  steps = fas_min(255, steps);
+  steps = fas_min(MAX_CMD_STEPS, steps);
 
-  // Check if pauses need to be added. If yes, reduce next_ticks and calculate
-  // pause_ticks_left
-  uint32_t pause_ticks_left;
+  // A step with pause is a single step
   if (next_ticks > 65535) {
     steps = 1;
-    pause_ticks_left = next_ticks;
-    next_ticks >>= 1;
-    next_ticks = fas_min(next_ticks, 65535);
-    pause_ticks_left -= next_ticks;
-  } else {
-    pause_ticks_left = 0;
   }
 
   // determine performed_ramp_up_steps after command enqueued
   if (this_state & RAMP_STATE_ACCELERATING_FLAG) {
+    uint32_t max_ramp_up_steps = ramp->config.max_ramp_up_steps;
     performed_ramp_up_steps += steps;
+    // A speed clipped to min_travel_ticks corresponds to max_ramp_up_steps.
+    // Otherwise performed_ramp_up_steps runs away from the speed, if the
+    // speed limit is raised in small increments
+    if ((next_ticks == ramp->config.parameters.min_travel_ticks) &&
+        (performed_ramp_up_steps > max_ramp_up_steps)) {
+      performed_ramp_up_steps =
+          fas_max(performed_ramp_up_steps - steps, max_ramp_up_steps);
+    }
   } else if (this_state & RAMP_STATE_DECELERATING_FLAG) {
     if (performed_ramp_up_steps < steps) {
       // This can occur with performed_ramp_up_steps = 0 and steps = 1
@@ -492,6 +474,20 @@ void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
     }
   }
 
+  // Check if pauses need to be added. If yes, reduce next_ticks and calculate
+  // pause_ticks_left. This is done after the clipping of
+  // performed_ramp_up_steps, which may change next_ticks.
+  uint32_t pause_ticks_left;
+  if (next_ticks > 65535) {
+    steps = 1;
+    pause_ticks_left = next_ticks;
+    next_ticks >>= 1;
+    next_ticks = fas_min(next_ticks, 65535);
+    pause_ticks_left -= next_ticks;
+  } else {
+    pause_ticks_left = 0;
+  }
+
   if (count_up) {
     this_state |= RAMP_DIRECTION_COUNT_UP;
   } else {
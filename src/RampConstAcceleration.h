@@ -6,11 +6,14 @@
 struct ramp_ro_s {
   struct ramp_config_s config;
   uint32_t target_pos;
+  // Speed in ramp steps to reach at target_pos, if a planned segment follows
+  uint32_t exit_ramp_steps;
   bool force_stop : 1;
   bool force_immediate_stop : 1;
   bool incomplete_immediate_stop : 1;
   inline void init() {
     config.init();
+    exit_ramp_steps = 0;
     force_stop = false;
     force_immediate_stop = false;
   }
@@ -39,11 +42,22 @@ struct ramp_rw_s {
   uint32_t pause_ticks_left;
   // Current ticks for ongoing step
   uint32_t curr_ticks;
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  // State of the jerk limited ramp at the end of the queue in steps/s and
+  // steps/s². The acceleration is positive for increasing speed.
+  // performed_ramp_up_steps is then the number of steps needed to stop.
+  float curr_speed;
+  float curr_accel;
+#endif
   inline void stopRamp() {
     ramp_state = RAMP_STATE_IDLE;  // this prevents fill_queue to be executed
     pause_ticks_left = 0;
     performed_ramp_up_steps = 0;
     curr_ticks = TICKS_FOR_STOPPED_MOTOR;
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+    curr_speed = 0;
+    curr_accel = 0;
+#endif
 #ifdef TEST
     printf("stopRamp() called\n");
 #endif
@@ -71,9 +85,21 @@ class NextCommand {
  public:
   struct stepper_command_s command;
   struct ramp_rw_s rw;  // new _rw, if command has been queued
+
+  // A pause of 65535 ticks is followed by more of them, if enough pause
+  // ticks are left. Those are taken over into this command up to max_periods
+  // in total. Returns the periods of the pause for the queue entry.
+  inline fas_steps_t repeatPause(fas_steps_t max_periods) {
+    if ((command.steps != 0) || (command.ticks != 65535)) {
+      return 1;
+    }
+    uint32_t more = fas_pause_periods(rw.pause_ticks_left);
+    more = fas_min(more, (uint32_t)(max_periods - 1));
+    rw.pause_ticks_left -= more * 65535;
+    return 1 + more;
+  }
 };
 
-void init_ramp_module();
 void _getNextCommand(const struct ramp_ro_s *ramp, const struct ramp_rw_s *rw,
                      const struct queue_end_s *queue_end, NextCommand *command);
 #endif
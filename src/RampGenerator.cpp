@@ -14,7 +14,9 @@ void RampGenerator::init() {
   _parameters.init();
   _ro.init();
   _rw.init();
-  init_ramp_module();
+  _planner.init();
+  _velocity.init();
+  _playback.init();
 }
 int8_t RampGenerator::setAcceleration(int32_t accel) {
   if (accel <= 0) {
@@ -35,6 +37,8 @@ int8_t RampGenerator::startRun(bool countUp) {
     return res;
   }
   _ro.force_stop = false;
+  _velocity.active = false;
+  _planner.requestFlush();
   _parameters.setRunning(countUp);
   _rw.startRampIfNotRunning(_parameters.s_jump);
 #ifdef DEBUG
@@ -48,6 +52,7 @@ int8_t RampGenerator::startRun(bool countUp) {
 
 void RampGenerator::_startMove(bool position_changed) {
   _ro.force_stop = false;
+  _velocity.active = false;
 
   if (position_changed) {
     // Only start the ramp generator, if the target position is different
@@ -85,6 +90,7 @@ int8_t RampGenerator::moveTo(int32_t position,
     curr_target = queue_end->pos;
   }
   inject_fill_interrupt(1);
+  _planner.requestFlush();
   _parameters.setTargetPosition(position);
   _startMove(curr_target != position);
   inject_fill_interrupt(2);
@@ -95,10 +101,290 @@ int8_t RampGenerator::move(int32_t move, const struct queue_end_s *queue_end) {
   if (res != MOVE_OK) {
     return res;
   }
+  _planner.requestFlush();
   _parameters.setTargetRelativePosition(move);
   _startMove(move != 0);
   return MOVE_OK;
 }
+uint32_t RampGenerator::_plannerRampSteps(uint32_t ticks) {
+  // The ramp steps are calculated with the application's parameters, as the
+  // ramp generator's config may not have been updated yet
+  struct ramp_config_s config;
+  config.init();
+  config.parameters = _parameters;
+  config.parameters.ticks_cache = NULL;
+  config.parameters.ticks_cache_entries = 0;
+  config.parameters.min_travel_ticks = ticks;
+  config.update();
+  return config.max_ramp_up_steps;
+}
+int8_t RampGenerator::planMoveTo(int32_t position, uint32_t min_step_ticks,
+                                 const struct queue_end_s *queue_end) {
+  uint8_t res = _parameters.checkValidConfig();
+  if (res != MOVE_OK) {
+    return res;
+  }
+  struct ramp_planner_s *p = &_planner;
+  if (!isRampGeneratorActive()) {
+    // getNextCommand() is not called, so the application can clear the planner
+    fasDisableInterrupts();
+    p->read_idx = p->write_idx;
+    p->flush = false;
+    fasEnableInterrupts();
+  }
+  if (p->isFull()) {
+    return MOVE_ERR_PLANNER_FULL;
+  }
+  uint8_t wp = p->write_idx;
+  struct planner_segment_s *prev = NULL;
+  int32_t start;
+  if (!p->isEmpty()) {
+    prev = &p->segments[p->prev(wp)];
+    start = prev->target_pos;
+  } else if (isRampGeneratorActive() && !_ro.isRunningContinuously()) {
+    start = _ro.target_pos;
+  } else {
+    start = queue_end->pos;
+  }
+  int32_t delta = position - start;
+  if ((delta == 0) && (prev != NULL)) {
+    return MOVE_OK;
+  }
+  struct planner_segment_s *seg = &p->segments[wp];
+  seg->target_pos = position;
+  seg->min_travel_ticks = min_step_ticks;
+  seg->steps = fas_abs(delta);
+  seg->count_up = delta >= 0;
+  seg->junction_ramp_steps = 0;
+  seg->exit_ramp_steps = 0;
+  uint8_t rp = p->read_idx;
+  fasDisableInterrupts();
+  p->write_idx = p->next(wp);
+  fasEnableInterrupts();
+
+  if (prev != NULL) {
+    // Backward pass: the exit speed of each segment is limited by the
+    // junction speed and by the steps to decelerate within the next segment
+    uint32_t ramp_steps = 0;
+    if (prev->count_up == seg->count_up) {
+      ramp_steps = _plannerRampSteps(
+          fas_max(prev->min_travel_ticks, seg->min_travel_ticks));
+    }
+    prev->junction_ramp_steps = ramp_steps;
+    uint8_t idx = p->prev(wp);
+    uint32_t budget = seg->steps;
+    while (true) {
+      struct planner_segment_s *s = &p->segments[idx];
+      uint32_t exit_ramp_steps = fas_min(s->junction_ramp_steps, budget);
+      if (exit_ramp_steps == s->exit_ramp_steps) {
+        break;
+      }
+      fasDisableInterrupts();
+      s->exit_ramp_steps = exit_ramp_steps;
+      fasEnableInterrupts();
+      if (idx == rp) {
+        break;
+      }
+      budget = s->steps + exit_ramp_steps;
+      idx = p->prev(idx);
+    }
+  }
+
+  _parameters.applyParameters();
+  fasDisableInterrupts();
+  _ro.force_stop = false;
+  _velocity.active = false;
+  _rw.startRampIfNotRunning(_parameters.s_jump);
+  fasEnableInterrupts();
+  return MOVE_OK;
+}
+int8_t RampGenerator::setTargetVelocityInTicks(uint32_t ticks,
+                                               bool count_up) {
+  int32_t target = 0;
+  if (ticks != 0) {
+    target = count_up ? (int32_t)ticks : -(int32_t)ticks;
+  }
+  if (_velocity.active) {
+    // Only the target is stored. It is read with the next getNextCommand()
+    fasDisableInterrupts();
+    _velocity.target = target;
+    if (target != 0) {
+      _rw.startRampIfNotRunning(0);
+    }
+    fasEnableInterrupts();
+    return MOVE_OK;
+  }
+  if (!_parameters.valid_acceleration) {
+    return MOVE_ERR_ACCELERATION_IS_UNDEFINED;
+  }
+  // Entering the mode transfers the acceleration settings to the stepper
+  // task once and ends any move or planned segments.
+  _planner.requestFlush();
+  _parameters.setRunning(count_up);
+  fasDisableInterrupts();
+  _velocity.target = target;
+  _velocity.applied = 0;
+  _velocity.active = true;
+  _ro.force_stop = false;
+  if (target != 0) {
+    _rw.startRampIfNotRunning(0);
+  }
+  fasEnableInterrupts();
+  return MOVE_OK;
+}
+int8_t RampGenerator::startPlayback(const struct stepper_command_s *table,
+                                    uint16_t entries, bool in_progmem,
+                                    TrajectoryStream *stream,
+                                    int32_t end_pos) {
+  // speed and acceleration are needed, if the ramp generator takes over
+  uint8_t res = _parameters.checkValidConfig();
+  if (res != MOVE_OK) {
+    return res;
+  }
+  if (isRampGeneratorActive()) {
+    return MOVE_ERR_STEPPER_IS_RUNNING;
+  }
+  _planner.requestFlush();
+  _playback.table = table;
+  _playback.entries = entries;
+  _playback.idx = 0;
+  _playback.in_progmem = in_progmem;
+  _playback.stream = stream;
+  fasDisableInterrupts();
+  _ro.force_stop = false;
+  _ro.clearImmediateStop();
+  _ro.target_pos = end_pos;
+  _velocity.active = false;
+  _playback.active = true;
+  _rw.startRampIfNotRunning(0);
+  fasEnableInterrupts();
+  return MOVE_OK;
+}
+// Returns false, if the stream is corrupted
+bool RampGenerator::_getNextPlaybackCommand(const struct queue_end_s *queue_end,
+                                            NextCommand *command) {
+  command->rw = _rw;
+  bool complete = (_playback.idx == _playback.entries);
+  TrajectoryStream *stream = _playback.stream;
+  if (stream != NULL) {
+    int8_t res = stream->peek(&command->command);
+    if (res == TRAJECTORY_NEED_DATA) {
+      // try again with the next fill
+      command->command.ticks = 0;
+      return true;
+    }
+    if (res < 0) {
+      return false;
+    }
+    complete = (res == TRAJECTORY_END);
+  }
+  if (complete) {
+    // the trajectory is complete
+    _playback.active = false;
+    fasDisableInterrupts();
+    _ro.target_pos = queue_end->pos;
+    fasEnableInterrupts();
+    command->command.ticks = 0;
+    command->rw.stopRamp();
+    return true;
+  }
+  if (stream != NULL) {
+    // The end position of a stream is not known in advance
+    uint32_t target_pos = queue_end->pos;
+    if (command->command.count_up) {
+      target_pos += command->command.steps;
+    } else {
+      target_pos -= command->command.steps;
+    }
+    _ro.target_pos = target_pos;
+  } else if (_playback.in_progmem) {
+    fas_read_command_P(&command->command, &_playback.table[_playback.idx]);
+  } else {
+    command->command = _playback.table[_playback.idx];
+  }
+  // The speed of the played commands is kept for getCurrentSpeedInTicks()
+  // and for the ramp generator, if it takes over
+  struct ramp_rw_s *rw = &command->rw;
+  uint16_t ticks = command->command.ticks;
+  if (command->command.steps != 0) {
+    rw->curr_ticks = ticks;
+  } else if (rw->curr_ticks < TICKS_FOR_STOPPED_MOTOR - ticks) {
+    rw->curr_ticks += ticks;
+  } else {
+    rw->curr_ticks = TICKS_FOR_STOPPED_MOTOR;
+  }
+  rw->ramp_state = RAMP_STATE_COAST | (command->command.count_up
+                                           ? RAMP_DIRECTION_COUNT_UP
+                                           : RAMP_DIRECTION_COUNT_DOWN);
+  rw->performed_ramp_up_steps = 0;
+  rw->pause_ticks_left = 0;
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  rw->curr_speed = 0;
+  rw->curr_accel = 0;
+#endif
+  return true;
+}
+void RampGenerator::_processVelocity(bool parameters_applied) {
+  // Applied parameters have overwritten speed and direction of the config
+  int32_t target = _velocity.target;
+  if ((target == _velocity.applied) && !parameters_applied) {
+    return;
+  }
+  _velocity.applied = target;
+#ifdef TEST
+  printf("Velocity target: %d ticks\n", target);
+#endif
+  if (target == 0) {
+    // decelerate to standstill like stopMove()
+    _ro.force_stop = true;
+    return;
+  }
+  _ro.config.parameters.keep_running = true;
+  _ro.config.parameters.keep_running_count_up = target > 0;
+  uint32_t ticks = fas_abs(target);
+  if (ticks != _ro.config.parameters.min_travel_ticks) {
+    _ro.config.updateSpeed(ticks);
+  }
+}
+void RampGenerator::_processPlanner(const struct queue_end_s *queue_end) {
+  struct ramp_planner_s *p = &_planner;
+  if (p->flush) {
+    p->read_idx = p->flush_idx;
+    p->flush = false;
+  }
+  uint8_t rp = p->read_idx;
+  uint8_t wp = p->write_idx;
+  if (rp == wp) {
+    _ro.exit_ramp_steps = 0;
+    return;
+  }
+  // Advance to the next segment, if the end of the active one has been
+  // reached or passed. The last segment stays active.
+  struct planner_segment_s *seg = &p->segments[rp];
+  while (p->next(rp) != wp) {
+    int32_t delta = seg->target_pos - queue_end->pos;
+    if (seg->count_up ? (delta > 0) : (delta < 0)) {
+      break;
+    }
+    rp = p->next(rp);
+    seg = &p->segments[rp];
+  }
+  p->read_idx = rp;
+#ifdef TEST
+  if ((_ro.target_pos != (uint32_t)seg->target_pos) ||
+      (_ro.exit_ramp_steps != seg->exit_ramp_steps)) {
+    printf("Planner segment: target=%d ticks=%u exit ramp steps=%u\n",
+           seg->target_pos, seg->min_travel_ticks, seg->exit_ramp_steps);
+  }
+#endif
+  _ro.target_pos = seg->target_pos;
+  _ro.exit_ramp_steps = seg->exit_ramp_steps;
+  _ro.config.parameters.keep_running = false;
+  if (_ro.config.parameters.min_travel_ticks != seg->min_travel_ticks) {
+    _ro.config.parameters.min_travel_ticks = seg->min_travel_ticks;
+    _ro.config.update();
+  }
+}
 void RampGenerator::advanceTargetPosition(int32_t delta,
                                           const struct queue_end_s *queue) {
   // called with interrupts disabled
@@ -114,14 +400,38 @@ void RampGenerator::afterCommandEnqueued(NextCommand *command) {
       command->rw.curr_ticks);
 #endif
   _rw = command->rw;
+  if (_playback.active && (command->command.ticks != 0)) {
+    if (_playback.stream != NULL) {
+      _playback.stream->consume();
+    } else {
+      _playback.idx++;
+    }
+  }
 }
 void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
                                    NextCommand *command) {
+  bool end_of_playback = false;
+  if (_playback.active) {
+    // The table is only copied, unless a new command or a stop ends the
+    // playback. Then the ramp generator takes over with the speed of the
+    // last played command and the parameters of the application.
+    if (!_parameters.apply && !_ro.force_stop &&
+        !_ro.isImmediateStopInitiated()) {
+      if (_getNextPlaybackCommand(queue_end, command)) {
+        return;
+      }
+      // A corrupted stream is stopped like by stopMove()
+      _ro.force_stop = true;
+    }
+    _playback.active = false;
+    end_of_playback = true;
+  }
   // we are running in higher priority than the application
   // so we can just read the config without disable interrupts
   // copy consistent ramp state
   bool was_keep_running = _ro.config.parameters.keep_running;
-  if (_parameters.apply) {
+  bool parameters_applied = _parameters.apply;
+  if (_parameters.apply || end_of_playback) {
     _ro.config.parameters = _parameters;
     _parameters.apply = false;
     _parameters.any_change = false;
@@ -129,6 +439,16 @@ void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
     _parameters.move_absolute = false;
     _parameters.recalc_ramp_steps = false;
     _ro.config.update();
+    if (end_of_playback && (_rw.curr_ticks != TICKS_FOR_STOPPED_MOTOR)) {
+      // The playback does not track the ramp steps. Both ramps continue
+      // from the speed of the last played command. Below one ramp step,
+      // e.g. after a dwell, the stepper is at standstill.
+      uint32_t ramp_steps = _ro.config.calculate_ramp_steps(_rw.curr_ticks);
+      if (ramp_steps == 0) {
+        _rw.curr_ticks = TICKS_FOR_STOPPED_MOTOR;
+      }
+      _rw.performed_ramp_up_steps = ramp_steps;
+    }
     // if new move command,then reset any immediate stop flag
     if (_ro.isImmediateStopInitiated()) {
       if (_ro.config.parameters.move_absolute) {
@@ -163,14 +483,18 @@ void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
 #endif
   }
 
+  if (_velocity.active) {
+    _processVelocity(parameters_applied);
+  }
+
   fasDisableInterrupts();
   struct queue_end_s qe = *queue_end;
   fasEnableInterrupts();
 
   uint32_t curr_ticks = _rw.curr_ticks;
   if (curr_ticks == TICKS_FOR_STOPPED_MOTOR) {
-    // just started
-    uint32_t s_jump = _ro.config.parameters.s_jump;
+    // just started. The jerk limited ramp always starts from standstill
+    uint32_t s_jump = _isJerkLimited() ? 0 : _ro.config.parameters.s_jump;
     if (s_jump != 0) {
       uint32_t ticks = _ro.config.calculate_ticks(s_jump);
       if (ticks < _ro.config.parameters.min_travel_ticks) {
@@ -186,7 +510,8 @@ void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
   // which is the equivalent to the current speed.
   // Even if the acceleration value is constant, the calculated value
   // can deviate due to precision or clipping effect
-  if (_ro.config.parameters.recalc_ramp_steps) {
+  // The jerk limited ramp keeps speed and acceleration instead.
+  if (_ro.config.parameters.recalc_ramp_steps && !_isJerkLimited()) {
     uint32_t performed_ramp_up_steps =
         _ro.config.calculate_ramp_steps(curr_ticks);
 #ifdef TEST
@@ -204,8 +529,16 @@ void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
     _rw.performed_ramp_up_steps = performed_ramp_up_steps;
   }
 
+  if (_ro.force_stop || _ro.isImmediateStopInitiated()) {
+    // any stop discards the planned segments
+    _planner.read_idx = _planner.write_idx;
+    _planner.flush = false;
+  }
+
   if (_ro.force_stop) {
     _ro.config.parameters.keep_running = false;
+    // a move command applied together with the stop is discarded, too
+    _ro.config.parameters.any_change = false;
     uint32_t target_pos = qe.pos;
     if (qe.count_up) {
       target_pos += _rw.performed_ramp_up_steps;
@@ -245,6 +578,8 @@ void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
 
   _ro.force_stop = false;
 
+  _processPlanner(&qe);
+
   // clear recalc flag
   _ro.config.parameters.recalc_ramp_steps = false;
 
@@ -256,9 +591,43 @@ void RampGenerator::getNextCommand(const struct queue_end_s *queue_end,
     command->rw.stopRamp();
     return;
   }
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  if (_isJerkLimited()) {
+    _getNextCommandJerkLimited(&_ro, &_rw, &qe, command);
+    return;
+  }
+#endif
+  if ((curr_ticks == TICKS_FOR_STOPPED_MOTOR) &&
+      (_rw.performed_ramp_up_steps != 0)) {
+    // A jump start begins at speed, so the ramp must not take the direction
+    // of the previous move as current direction
+    if (_ro.config.parameters.keep_running) {
+      qe.count_up = _ro.config.parameters.keep_running_count_up;
+    } else if (_ro.target_pos != (uint32_t)qe.pos) {
+      qe.count_up = (int32_t)(_ro.target_pos - qe.pos) > 0;
+    }
+  }
   _getNextCommand(&_ro, &_rw, &qe, command);
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  // The constant acceleration ramp does not track speed and acceleration.
+  // This is detected by the jerk limited ramp on change of the ramp type.
+  command->rw.curr_speed = 0;
+  command->rw.curr_accel = 0;
+#endif
 }
 int32_t RampGenerator::getCurrentAcceleration() {
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  if (_isJerkLimited()) {
+    fasDisableInterrupts();
+    float accel = _rw.curr_accel;
+    uint8_t rs = _rw.rampState();
+    fasEnableInterrupts();
+    if (rs == RAMP_STATE_IDLE) {
+      return 0;
+    }
+    return (rs & RAMP_DIRECTION_COUNT_UP) ? (int32_t)accel : -(int32_t)accel;
+  }
+#endif
   switch (_rw.rampState() &
           (RAMP_STATE_ACCELERATING_FLAG | RAMP_STATE_DECELERATING_FLAG |
            RAMP_DIRECTION_MASK)) {
@@ -4,15 +4,48 @@
 #include "FastAccelStepper.h"
 #include "RampCalculator.h"
 #include "RampConstAcceleration.h"
+#include "RampJerkLimited.h"
+#include "RampPlanner.h"
+#include "TrajectoryStream.h"
 #include "fas_common.h"
 
 class FastAccelStepper;
 
-#ifdef SUPPORT_PMF_TIMER_FREQ_VARIABLES
-extern pmf_logarithmic pmfl_timer_freq;
-extern pmf_logarithmic pmfl_timer_freq_div_sqrt_of_2;
-extern pmf_logarithmic pmfl_timer_freq_square_div_2;
-#endif
+// Velocity streaming: the target speed is written by the application and
+// read by the stepper task, which slews the speed towards it
+struct ramp_velocity_s {
+  // ticks per step with the sign as direction and 0 for standstill
+  volatile int32_t target;
+  // the target in use by the stepper task
+  int32_t applied;
+  volatile bool active;
+  inline void init() {
+    target = 0;
+    applied = 0;
+    active = false;
+  }
+};
+
+// Playback of a precomputed table of commands. The table is written once by
+// the application before the playback is activated. idx is only written by
+// the stepper task. With stream set, the commands are decoded from the
+// stream instead of the table.
+struct ramp_playback_s {
+  const struct stepper_command_s *table;
+  uint16_t entries;
+  uint16_t idx;
+  bool in_progmem;
+  TrajectoryStream *stream;
+  volatile bool active;
+  inline void init() {
+    table = NULL;
+    stream = NULL;
+    entries = 0;
+    idx = 0;
+    in_progmem = false;
+    active = false;
+  }
+};
 
 class RampGenerator {
  private:
@@ -24,6 +57,13 @@ class RampGenerator {
   struct ramp_ro_s _ro;
   struct ramp_rw_s _rw;
 
+  // Look-ahead planner for a sequence of moveTo targets
+  struct ramp_planner_s _planner;
+
+  struct ramp_velocity_s _velocity;
+
+  struct ramp_playback_s _playback;
+
  public:
   uint32_t acceleration;
   inline uint8_t rampState() { return _rw.rampState(); }
@@ -68,22 +108,61 @@ class RampGenerator {
   inline void setJumpStart(uint32_t jump_step) {
     _parameters.setJumpStart(jump_step);
   }
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+  inline void setJerk(uint32_t jerk) { _parameters.setJerk(jerk); }
+  inline uint32_t getJerk() { return _parameters.jerk; }
+#endif
+  inline void setTicksCache(uint32_t *cache, uint16_t entries) {
+    _parameters.setTicksCache(cache, entries);
+  }
   int32_t getCurrentAcceleration();
   inline bool hasValidConfig() {
-    return _parameters.checkValidConfig() == MOVE_OK;
+    int8_t res = _parameters.checkValidConfig();
+    // The velocity streaming needs no speed and has a valid acceleration
+    return (res == MOVE_OK) ||
+           (_velocity.active && (res == MOVE_ERR_SPEED_IS_UNDEFINED));
   }
   void applySpeedAcceleration();
   int8_t move(int32_t move, const struct queue_end_s *queue);
   int8_t moveTo(int32_t position, const struct queue_end_s *queue);
   int8_t startRun(bool countUp);
-  inline void forceStop() { _ro.immediateStop(); }
-  inline void initiateStop() { _ro.initiateStop(); }
+  inline void setPlannerBuffer(struct planner_segment_s *buffer,
+                               uint8_t entries) {
+    fasDisableInterrupts();
+    _planner.segments = buffer;
+    _planner.size = buffer == NULL ? 0 : entries;
+    _planner.write_idx = 0;
+    _planner.flush_idx = 0;
+    _planner.flush = true;
+    fasEnableInterrupts();
+  }
+  int8_t planMoveTo(int32_t position, uint32_t min_step_ticks,
+                    const struct queue_end_s *queue);
+  inline bool isPlannerFull() { return _planner.isFull(); }
+  int8_t setTargetVelocityInTicks(uint32_t ticks, bool count_up);
+  inline bool isVelocityMode() { return _velocity.active; }
+  int8_t startPlayback(const struct stepper_command_s *table, uint16_t entries,
+                       bool in_progmem, TrajectoryStream *stream,
+                       int32_t end_pos);
+  inline bool isPlayingTrajectory() { return _playback.active; }
+  inline void forceStop() {
+    _velocity.active = false;
+    _ro.immediateStop();
+  }
+  inline void initiateStop() {
+    _velocity.active = false;
+    _ro.initiateStop();
+  }
   inline bool isStopping() {
     return _ro.isStopInitiated() && isRampGeneratorActive();
   }
   inline bool isRampGeneratorActive() { return rampState() != RAMP_STATE_IDLE; }
 
-  inline void stopRamp() { _rw.stopRamp(); }
+  inline void stopRamp() {
+    _velocity.active = false;
+    _playback.active = false;
+    _rw.stopRamp();
+  }
   inline void setKeepRunning() { _ro.setKeepRunning(); }
   inline bool isRunningContinuously() { return _ro.isRunningContinuously(); }
   void getNextCommand(const struct queue_end_s *queue_end,
@@ -107,7 +186,19 @@ class RampGenerator {
   }
 
  private:
+  inline bool _isJerkLimited() {
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+    return _ro.config.parameters.jerk != 0;
+#else
+    return false;
+#endif
+  }
   void _startMove(bool position_changed);
+  uint32_t _plannerRampSteps(uint32_t ticks);
+  void _processPlanner(const struct queue_end_s *queue_end);
+  void _processVelocity(bool parameters_applied);
+  bool _getNextPlaybackCommand(const struct queue_end_s *queue_end,
+                               NextCommand *command);
 };
 
 #endif
@@ -0,0 +1,506 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "FastAccelStepper.h"
+#include "RampJerkLimited.h"
+#include "StepperISR.h"
+
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+
+// The jerk limited ramp consists of up to seven phases:
+//
+//   1. acceleration increases with the jerk
+//   2. constant acceleration
+//   3. acceleration decreases with the jerk while approaching the speed
+//   4. coasting
+//   5. deceleration increases with the jerk
+//   6. constant deceleration
+//   7. deceleration decreases with the jerk until standstill
+//
+// The ramp is calculated in time domain. The speed and the acceleration at
+// the end of the queue are kept in ramp_rw_s. For each command the jerk is
+// chosen from a list of candidates: first the one tracking the target speed,
+// then holding the acceleration and last maximum braking. The first candidate
+// is used, after which the stepper still can stop at the target position.
+//
+// As for the constant acceleration ramp, performed_ramp_up_steps are the
+// steps needed to come to standstill. So forced stop, reversing and the
+// look-ahead planner work unchanged.
+
+// Same forward planning as the constant acceleration ramp
+#define PLANNING_TIME_S 0.002f
+
+// Steps needed to come to standstill from speed v and acceleration a.
+static float stop_distance(float v, float a, float jerk, float accel) {
+  float d = 0;
+  if (a > 0) {
+    // reduce the acceleration to zero first
+    float t = a / jerk;
+    d += t * (v + t * (a / 2 - jerk * t / 6));
+    v += a * t / 2;
+    a = 0;
+  }
+  float a0 = -a;
+  if (v <= a0 * a0 / (2 * jerk)) {
+    // releasing the brake immediately stops before a has returned to 0
+    float disc = fas_max(a0 * a0 - 2 * jerk * v, 0.0f);
+    float t = (a0 - sqrtf(disc)) / jerk;
+    return d + t * (v - t * (a0 / 2 - jerk * t / 6));
+  }
+  // peak deceleration, if the constant deceleration phase is not needed
+  float ap = sqrtf((2 * jerk * v + a0 * a0) / 2);
+  ap = fas_min(ap, accel);
+  ap = fas_max(ap, a0);
+  float t1 = (ap - a0) / jerk;
+  d += t1 * (v - t1 * (a0 / 2 + jerk * t1 / 6));
+  v -= t1 * (a0 + jerk * t1 / 2);
+  float v_release = ap * ap / (2 * jerk);
+  if (v > v_release) {
+    float t2 = (v - v_release) / ap;
+    d += t2 * (v + v_release) / 2;
+    v = v_release;
+  }
+  float t3 = ap / jerk;
+  return d + t3 * (v - t3 * (ap / 2 - jerk * t3 / 6));
+}
+
+// Speed at the end of releasing the acceleration a with the jerk.
+static inline float release_speed(float v, float a, float jerk) {
+  return v + a * fabsf(a) / (2 * jerk);
+}
+
+static inline float travel_steps(float v, float a, float j, float t) {
+  return t * (v + t * (a / 2 + j * t / 6));
+}
+
+// Time to travel the given steps with constant jerk j. Returns 0, if the
+// speed drops to zero before.
+static float travel_time(float v, float a, float j, float steps) {
+  // smallest positive time with v + a*t + j*t²/2 = 0
+  float t_hi = 0;
+  if (j != 0) {
+    float disc = a * a - 2 * j * v;
+    if (disc >= 0) {
+      t_hi = (-a - sqrtf(disc)) / j;
+    }
+  } else if (a < 0) {
+    t_hi = -v / a;
+  }
+  if (t_hi > 1000.0f) {
+    // e.g. a tiny jerk or acceleration left over from the jerk search. The
+    // speed drops to zero far beyond any command and the iteration from
+    // there would not converge.
+    t_hi = 0;
+  }
+  if (t_hi > 0) {
+    if (travel_steps(v, a, j, t_hi) < steps) {
+      return 0;
+    }
+  } else {
+    t_hi = 0.001f;
+    while (travel_steps(v, a, j, t_hi) < steps) {
+      t_hi *= 2;
+      if (t_hi > 1000.0f) {
+        return 0;
+      }
+    }
+  }
+  // Newton iteration on the monotonic travel_steps() with bisection as
+  // fallback
+  float t_lo = 0;
+  float t = t_hi;
+  for (uint8_t i = 0; i < 30; i++) {
+    float ds = travel_steps(v, a, j, t) - steps;
+    if (fabsf(ds) < steps * 1e-5f) {
+      break;
+    }
+    if (ds > 0) {
+      t_hi = t;
+    } else {
+      t_lo = t;
+    }
+    float speed = v + t * (a + j * t / 2);
+    float t_next = speed > 0 ? t - ds / speed : 0;
+    if ((t_next <= t_lo) || (t_next >= t_hi)) {
+      t_next = (t_lo + t_hi) / 2;
+    }
+    t = t_next;
+  }
+  return t;
+}
+
+struct jerk_candidate_s {
+  float j;
+  float a_lo;
+  float a_hi;
+  // results
+  float t;
+  float v;
+  float a;
+};
+
+// Apply the candidate's jerk for the given steps. If the acceleration would
+// leave [a_lo,a_hi], then the jerk is reduced to reach the limit at the end
+// of the command. Returns false, if the speed drops to zero before.
+static bool apply_jerk(float v, float a, float steps,
+                       struct jerk_candidate_s *c) {
+  float j = c->j;
+  float t = travel_time(v, a, j, steps);
+  if ((t == 0) && (v > 0)) {
+    // The speed drops to zero with the unlimited jerk, but may not with the
+    // acceleration kept within the limits. Otherwise braking with a low
+    // acceleration limit is never possible at the end of a step.
+    float t_est = steps / v;
+    float a_end = a + j * t_est;
+    a_end = fas_min(a_end, c->a_hi);
+    a_end = fas_max(a_end, c->a_lo);
+    j = (a_end - a) / t_est;
+    t = travel_time(v, a, j, steps);
+  }
+  if (t == 0) {
+    return false;
+  }
+  for (uint8_t i = 0; i < 3; i++) {
+    float a_end = a + j * t;
+    if ((a_end <= c->a_hi) && (a_end >= c->a_lo)) {
+      break;
+    }
+    a_end = fas_min(a_end, c->a_hi);
+    a_end = fas_max(a_end, c->a_lo);
+    j = (a_end - a) / t;
+    t = travel_time(v, a, j, steps);
+    if (t == 0) {
+      return false;
+    }
+  }
+  float a_end = a + j * t;
+  a_end = fas_min(a_end, c->a_hi);
+  a_end = fas_max(a_end, c->a_lo);
+  c->j = j;
+  c->t = t;
+  c->v = v + t * (a + j * t / 2);
+  c->a = a_end;
+  return true;
+}
+
+void _getNextCommandJerkLimited(const struct ramp_ro_s *ramp,
+                                const struct ramp_rw_s *rw,
+                                const struct queue_end_s *queue_end,
+                                NextCommand *command) {
+  {
+    // If there is a pause from last step, then just output a pause
+    uint32_t pause_ticks = rw->pause_ticks_left;
+    if (pause_ticks > 0) {
+      if (pause_ticks > 65535) {
+        pause_ticks >>= 1;
+        pause_ticks = fas_min(pause_ticks, 65535);
+      }
+      command->command.ticks = pause_ticks;
+      command->command.steps = 0;
+      command->command.count_up = queue_end->count_up;
+      command->rw = *rw;
+      command->rw.pause_ticks_left -= pause_ticks;
+      return;
+    }
+  }
+
+  const struct ramp_parameters_s *par = &ramp->config.parameters;
+  bool count_up = queue_end->count_up;
+  uint32_t remaining_steps;
+  bool need_count_up;
+  if (par->keep_running) {
+    need_count_up = par->keep_running_count_up;
+    remaining_steps = 0xfffffff;
+  } else {
+    // this can overflow, which is legal
+    int32_t delta = ramp->target_pos - queue_end->pos;
+    if (delta == 0) {
+      need_count_up = !count_up;
+    } else {
+      need_count_up = delta > 0;
+    }
+    remaining_steps = fas_abs(delta);
+  }
+
+  float jerk = par->jerk;
+  float accel = pmfl_to_u32(par->pmfl_accel);
+  float v_max = (float)TICKS_PER_S / par->min_travel_ticks;
+
+  float v = rw->curr_speed;
+  float a = rw->curr_accel;
+  if (rw->performed_ramp_up_steps == 0) {
+    v = 0;
+    a = 0;
+  } else if ((v == 0) && (rw->curr_ticks != TICKS_FOR_STOPPED_MOTOR)) {
+    // switched from the constant acceleration ramp while running
+    v = (float)TICKS_PER_S / rw->curr_ticks;
+    a = 0;
+  }
+  float s_stop = fas_min(stop_distance(v, a, jerk, accel), 1e9f);
+  uint32_t stop_steps = (uint32_t)s_stop;
+  if ((stop_steps == 0) && (count_up != need_count_up)) {
+    // less than one step to standstill, so reverse immediately. Into the
+    // right direction the ramp continues. Otherwise a low speed limit or a
+    // low acceleration would restart the ramp from standstill again and
+    // again.
+    v = 0;
+    a = 0;
+    count_up = need_count_up;
+  }
+
+  // A following planned segment in same direction: decelerate to standstill
+  // at a virtual target behind target_pos
+  if ((count_up == need_count_up) && !par->keep_running) {
+    remaining_steps += ramp->exit_ramp_steps;
+  }
+
+  if ((remaining_steps == 0) && (stop_steps == 0)) {
+    command->command.ticks = 0;
+    command->rw.stopRamp();
+#ifdef TEST
+    puts("ramp complete");
+#endif
+    return;
+  }
+
+  uint8_t this_state = 0;
+  // The stopping distance may exceed the remaining steps by rounding, which
+  // is absorbed at the end of the ramp
+  if ((count_up != need_count_up) || (remaining_steps + 1 < stop_steps)) {
+    // decelerate to standstill and then reverse direction
+    this_state = RAMP_STATE_REVERSE;
+    remaining_steps = stop_steps;
+  }
+
+  // the remaining steps are only relevant with the ramp's stopping distance
+  float max_steps = fas_min(remaining_steps, 0x7fffffff);
+
+  uint32_t planning_steps = (uint32_t)(v * PLANNING_TIME_S);
+  planning_steps = fas_min(planning_steps, MAX_CMD_STEPS);
+  planning_steps = fas_max(planning_steps, 1);
+  planning_steps = fas_min(planning_steps, remaining_steps);
+
+  struct jerk_candidate_s cand[3];
+  struct jerk_candidate_s *best;
+  uint32_t next_ticks;
+  for (uint8_t pass = 0;; pass++) {
+    float steps = planning_steps;
+
+    // The jerk tracking v_max: releasing the acceleration now ends at
+    // v_release. Inside the tolerance, the acceleration is reduced to zero.
+    float dt = v > 0 ? steps / v : cbrtf(6 * steps / jerk);
+    float tolerance = jerk * dt * dt / 2;
+    // With a low v_max and a high jerk, the tolerance must not prevent the
+    // start from standstill
+    tolerance = fas_min(tolerance, v_max / 2);
+    float v_release = release_speed(v, a, jerk);
+    bool approach = true;
+    cand[0].a_lo = -accel;
+    cand[0].a_hi = accel;
+    if (v_release < v_max - tolerance) {
+      cand[0].j = jerk;
+    } else if (v_release > v_max + tolerance) {
+      cand[0].j = -jerk;
+    } else if (a > 0) {
+      approach = false;
+      cand[0].j = -jerk;
+      cand[0].a_lo = 0;
+    } else {
+      approach = false;
+      cand[0].j = jerk;
+      cand[0].a_hi = 0;
+    }
+    if (a < 0) {
+      // no acceleration directly out of deceleration
+      cand[0].a_hi = 0;
+    }
+    // hold the acceleration
+    cand[1].j = 0;
+    cand[1].a_lo = -accel;
+    cand[1].a_hi = accel;
+    // maximum braking
+    cand[2].j = -jerk;
+    cand[2].a_lo = -accel;
+    cand[2].a_hi = accel;
+
+    best = NULL;
+    float best_stop = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+      struct jerk_candidate_s *c = &cand[i];
+      if (!apply_jerk(v, a, steps, c)) {
+        continue;
+      }
+      if ((i == 0) && approach &&
+          ((release_speed(c->v, c->a, jerk) > v_max) != (v_release > v_max))) {
+        // v_max is passed within this command. Search the jerk, which ends
+        // at v_max after releasing the acceleration.
+        float j_lo = -jerk;
+        float j_hi = jerk;
+        for (uint8_t k = 0; k < 10; k++) {
+          struct jerk_candidate_s m = *c;
+          m.j = (j_lo + j_hi) / 2;
+          if (!apply_jerk(v, a, steps, &m)) {
+            j_lo = (j_lo + j_hi) / 2;
+            continue;
+          }
+          *c = m;
+          if (release_speed(m.v, m.a, jerk) > v_max) {
+            j_hi = (j_lo + j_hi) / 2;
+          } else {
+            j_lo = (j_lo + j_hi) / 2;
+          }
+        }
+      }
+      float s = stop_distance(c->v, c->a, jerk, accel);
+      if (steps + s < max_steps + 1) {
+        if (i > 0) {
+          // The previous candidate is not feasible. Search the jerk in
+          // between, which follows the stopping curve. Otherwise the ramp
+          // brakes too early and stops before the target.
+          float j_lo = c->j;
+          float j_hi = cand[i - 1].j;
+          for (uint8_t k = 0; k < 8; k++) {
+            struct jerk_candidate_s m = *c;
+            m.j = (j_lo + j_hi) / 2;
+            if (apply_jerk(v, a, steps, &m) &&
+                (steps + stop_distance(m.v, m.a, jerk, accel) <
+                 max_steps + 1)) {
+              *c = m;
+              j_lo = (j_lo + j_hi) / 2;
+            } else {
+              j_hi = (j_lo + j_hi) / 2;
+            }
+          }
+        }
+        best = c;
+        break;
+      }
+      if ((best == NULL) || (s < best_stop)) {
+        // not able to stop in time. Use the one with least overshoot
+        best = c;
+        best_stop = s;
+      }
+    }
+    if ((best != NULL) && (best_stop > 0) && (v == 0) && (best->j > 0) &&
+        (planning_steps < remaining_steps)) {
+      // From standstill, the full jerk overshoots the target of a short move
+      // already with the first step. Search the lower jerk, which can stop
+      // in time. Otherwise the stepper oscillates around the target.
+      float j_lo = 0;
+      float j_hi = best->j;
+      for (uint8_t k = 0; k < 10; k++) {
+        struct jerk_candidate_s m = *best;
+        m.j = (j_lo + j_hi) / 2;
+        if (apply_jerk(v, a, steps, &m) &&
+            (steps + stop_distance(m.v, m.a, jerk, accel) < max_steps + 1)) {
+          *best = m;
+          j_lo = (j_lo + j_hi) / 2;
+        } else {
+          j_hi = (j_lo + j_hi) / 2;
+        }
+      }
+    }
+    if (best == NULL) {
+      // all candidates stop before: continue with current speed
+      best = &cand[1];
+      best->j = 0;
+      best->v = fas_max(v, 1.0f);
+      best->a = 0;
+      best->t = steps / best->v;
+    }
+
+    float ticks = best->t * TICKS_PER_S / steps + 0.5f;
+    next_ticks = (ticks >= 4e9f) ? 4000000000u : (uint32_t)ticks;
+    next_ticks = fas_max(next_ticks, 1);
+    uint32_t cmd_ticks = next_ticks * planning_steps;
+    if ((next_ticks >= MIN_CMD_TICKS) || (cmd_ticks >= MIN_CMD_TICKS)) {
+      break;
+    }
+    // command time too low
+    uint32_t min_steps = (MIN_CMD_TICKS + next_ticks - 1) / next_ticks;
+    min_steps = fas_min(min_steps, MAX_CMD_STEPS);
+    min_steps = fas_min(min_steps, remaining_steps);
+    if ((pass > 0) || (min_steps == planning_steps)) {
+      // at the end of the ramp, so reduce the speed
+      next_ticks = (MIN_CMD_TICKS + planning_steps - 1) / planning_steps;
+      break;
+    }
+#ifdef TEST
+    printf("Increase planning steps %d => %d due to command time\n",
+           planning_steps, min_steps);
+#endif
+    planning_steps = min_steps;
+  }
+
+  float v_new = best->v;
+  float a_new = best->a;
+  if ((v <= v_max) && (v_new >= v_max)) {
+    // do not exceed the max speed
+    v_new = v_max;
+    a_new = fas_min(a_new, 0.0f);
+    next_ticks = fas_max(next_ticks, par->min_travel_ticks);
+  } else if ((v >= v_max) && (v_new <= v_max) && (best == &cand[0]) &&
+             (this_state == 0)) {
+    // tracking a lowered max speed: do not fall below it by rounding
+    v_new = v_max;
+    a_new = fas_max(a_new, 0.0f);
+    next_ticks = fas_min(next_ticks, par->min_travel_ticks);
+  }
+  if (this_state == 0) {
+    if (v_new > v) {
+      this_state = RAMP_STATE_ACCELERATE;
+    } else if (v_new < v) {
+      this_state = RAMP_STATE_DECELERATE;
+    } else {
+      this_state = RAMP_STATE_COAST;
+    }
+  }
+
+  uint32_t performed_ramp_up_steps;
+  if (planning_steps == remaining_steps) {
+    // target or reversing point reached
+    v_new = 0;
+    a_new = 0;
+    performed_ramp_up_steps = 0;
+  } else {
+    float s = stop_distance(v_new, a_new, jerk, accel);
+    performed_ramp_up_steps = (uint32_t)fas_min(s, 1e9f);
+    performed_ramp_up_steps = fas_max(performed_ramp_up_steps, 1);
+  }
+
+  uint32_t pause_ticks_left = 0;
+  if (next_ticks > 65535) {
+    // only possible with planning_steps == 1
+    pause_ticks_left = next_ticks;
+    next_ticks >>= 1;
+    next_ticks = fas_min(next_ticks, 65535);
+    pause_ticks_left -= next_ticks;
+  }
+
+  if (count_up) {
+    this_state |= RAMP_DIRECTION_COUNT_UP;
+  } else {
+    this_state |= RAMP_DIRECTION_COUNT_DOWN;
+  }
+
+  command->command.ticks = next_ticks;
+  command->command.steps = planning_steps;
+  command->command.count_up = count_up;
+
+  command->rw.ramp_state = this_state;
+  command->rw.performed_ramp_up_steps = performed_ramp_up_steps;
+  command->rw.pause_ticks_left = pause_ticks_left;
+  command->rw.curr_ticks = pause_ticks_left + next_ticks;
+  command->rw.curr_speed = v_new;
+  command->rw.curr_accel = a_new;
+
+#ifdef TEST
+  printf(
+      "jerk ramp: pos@queue_end=%d remaining=%u stop steps=%u v=%.1f a=%.1f "
+      "j=%.0f => steps=%u ticks=%u pause=%u v=%.1f a=%.1f prus=%u state=%d\n",
+      queue_end->pos, remaining_steps, stop_steps, v, a, best->j,
+      planning_steps, next_ticks, pause_ticks_left, v_new, a_new,
+      performed_ramp_up_steps, this_state);
+#endif
+}
+#endif
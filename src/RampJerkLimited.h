@@ -0,0 +1,14 @@
+#ifndef RAMP_JERK_LIMITED_H
+#define RAMP_JERK_LIMITED_H
+
+#include "RampCalculator.h"
+#include "RampConstAcceleration.h"
+#include "fas_common.h"
+
+#ifdef SUPPORT_JERK_LIMITED_RAMP
+void _getNextCommandJerkLimited(const struct ramp_ro_s *ramp,
+                                const struct ramp_rw_s *rw,
+                                const struct queue_end_s *queue_end,
+                                NextCommand *command);
+#endif
+#endif
@@ -0,0 +1,65 @@
+#ifndef RAMP_PLANNER_H
+#define RAMP_PLANNER_H
+
+#include "fas_common.h"
+
+// A segment of the look-ahead planner. The speed at the junction to the next
+// segment is expressed like the ramp generator's speed in ramp steps, which
+// are the steps needed to decelerate to standstill.
+struct planner_segment_s {
+  int32_t target_pos;
+  uint32_t min_travel_ticks;
+  uint32_t steps;
+  // limit by the speed of this and the next segment. 0 on direction change
+  uint32_t junction_ramp_steps;
+  // speed at the end of the segment, which still allows to stop at the end
+  // of the last planned segment
+  uint32_t exit_ramp_steps;
+  bool count_up;
+};
+
+// Ring buffer of planner segments in application provided memory.
+//
+// The segments and write_idx are written by the application only. read_idx
+// is only written by the ramp generator's getNextCommand(), which keeps the
+// segment at read_idx as the active one. A flush requested by the
+// application is executed by getNextCommand(), too.
+//
+// The application updates exit_ramp_steps of queued segments on every new
+// segment. These values only increase, so the ramp generator operates on a
+// safe value, even if it reads an old one.
+struct ramp_planner_s {
+  struct planner_segment_s *segments;
+  uint8_t size;
+  volatile uint8_t write_idx;
+  volatile uint8_t read_idx;
+  volatile uint8_t flush_idx;
+  volatile bool flush;
+
+  inline void init() {
+    segments = NULL;
+    size = 0;
+    write_idx = 0;
+    read_idx = 0;
+    flush = false;
+  }
+  inline uint8_t next(uint8_t idx) const {
+    idx++;
+    return idx == size ? 0 : idx;
+  }
+  inline uint8_t prev(uint8_t idx) const {
+    return idx == 0 ? size - 1 : idx - 1;
+  }
+  inline bool isEmpty() const { return flush || (read_idx == write_idx); }
+  inline bool isFull() const {
+    return (segments == NULL) || (next(write_idx) == read_idx);
+  }
+  inline void requestFlush() {
+    fasDisableInterrupts();
+    flush_idx = write_idx;
+    flush = true;
+    fasEnableInterrupts();
+  }
+};
+
+#endif
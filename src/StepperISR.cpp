@@ -1,9 +1,83 @@
 #include <stdint.h>
 
 #include "StepperISR.h"
+#include "fas_trace.h"
+
+// Fill the queue entry e from cmd and advance the queue end qe. The entry is
+// not yet visible to the isr.
+int8_t StepperQueue::_encodeEntry(struct queue_entry* e,
+                                  const struct stepper_command_s* cmd,
+                                  struct queue_end_s* qe,
+                                  bool may_set_dir_pin,
+                                  fas_steps_t pause_periods, uint8_t events) {
+  uint16_t period = cmd->ticks;
+  fas_steps_t steps = cmd->steps;
+  uint32_t command_rate_ticks = period;
+  if (steps > 1) {
+    command_rate_ticks *= steps;
+  }
+  if (command_rate_ticks < MIN_CMD_TICKS) {
+    return AQE_ERROR_TICKS_TOO_LOW;
+  }
+
+  bool dir = (cmd->count_up == dirHighCountsUp);
+  bool toggle_dir = false;
+#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
+  bool repeat_entry = false;
+#endif
+  if (dirPin != PIN_UNDEFINED) {
+    if (may_set_dir_pin && (isQueueEmpty() && !isRunning()) &&
+        ((dirPin & PIN_EXTERNAL_FLAG) == 0)) {
+      // set the dirPin here. Necessary with shared direction pins
+      digitalWrite(dirPin, dir);
+#ifdef ARDUINO_ARCH_SAM
+      delayMicroseconds(30);  // Make sure the driver has enough time to see
+                              // the dir pin change
+#endif
+      qe->dir = dir;
+    } else {
+      toggle_dir = (dir != qe->dir);
+#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
+      if (toggle_dir && (dirPin & PIN_EXTERNAL_FLAG)) {
+        repeat_entry = toggle_dir;
+        toggle_dir = false;
+      }
+#endif
+    }
+  }
+  e->steps = steps;
+  if ((steps == 0) && (pause_periods > 1)) {
+    e->steps = pause_periods;
+  }
+#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
+  e->repeat_entry = repeat_entry;
+  e->dirPinState = dir;
+#endif
+  e->toggle_dir = toggle_dir;
+  e->countUp = cmd->count_up ? 1 : 0;
+  e->moreThanOneStep = steps > 1 ? 1 : 0;
+  e->hasSteps = steps > 0 ? 1 : 0;
+#if defined(SUPPORT_POSITION_EVENTS)
+  e->events = events;
+#endif
+  e->ticks = period;
+#if defined(SUPPORT_QUEUE_ENTRY_START_POS_U16)
+  e->start_pos_last16 = (fas_entry_pos_t)qe->pos;
+#endif
+  qe->pos += cmd->count_up ? steps : -steps;
+#if defined(SUPPORT_QUEUE_ENTRY_END_POS_U16)
+  e->end_pos_last16 = (fas_entry_pos_t)qe->pos;
+#endif
+  qe->dir = dir;
+  qe->count_up = cmd->count_up;
+  FAS_TRACE_EVENT(FAS_TRACE_PUSH | (cmd->count_up ? FAS_TRACE_COUNT_UP : 0),
+                  this - fas_queue, steps, period);
+  return AQE_OK;
+}
 
 int8_t StepperQueue::addQueueEntry(const struct stepper_command_s* cmd,
-                                   bool start) {
+                                   bool start, fas_steps_t pause_periods,
+                                   uint8_t events) {
   // Just to check if, if the struct has the correct size
   // if (sizeof(entry) != 6 * QUEUE_LEN) {
   //  return -1;
@@ -16,6 +90,7 @@ int8_t StepperQueue::addQueueEntry(const struct stepper_command_s* cmd,
       if (next_write_idx == read_idx) {
         return AQE_ERROR_EMPTY_QUEUE_TO_START;
       }
+      FAS_TRACE_EVENT(FAS_TRACE_START, this - fas_queue, 0, 0);
       startQueue();
     }
     return AQE_OK;
@@ -23,8 +98,6 @@ int8_t StepperQueue::addQueueEntry(const struct stepper_command_s* cmd,
   if (isQueueFull()) {
     return AQE_QUEUE_FULL;
   }
-  uint16_t period = cmd->ticks;
-  uint8_t steps = cmd->steps;
   // generation discrepancy: pc vs target
   // after Command Enqueued: performed ramp up steps = 1, pause left = 0,
   // curr_ticks = 11320 after Command Enqueued: performed ramp up steps = 3,
@@ -50,76 +123,23 @@ int8_t StepperQueue::addQueueEntry(const struct stepper_command_s* cmd,
   //  :2:13432X:2:13248X:2:13072X:2:12896X:2:12736X:2:12584X:2:12432X:2:12280X:2:12128X:2:12000X:2:11872X:2:11744X:2:11616X:2:11488X:2:11384X:2:11264X:2:11152X:2:11048X:2:10944X:2:10840X:2:10736X:2:10656X:3:10512X:3:10384X:3:10248X:3:10120X:3:10008X:3:9888X:3:9784X:3:9680X:3:9576X:3:9472X:3:9368X:3:9280X:3:9176X:3:9096X:3:9008X:3:8928X:3:8840X:3:8760X:3:8688X:3:8600X:3:8528X:3:8464X:3:8392X:3:8328X:3:8256X:3:8192X:3:8124X:3:8060X:3:8008X:3:7944X:4:7864X:4:7792X:4:7720X:4:7648X:4:7584X:4:7512X:4:7452X:4:7384X:4:7324X
   //  :4:7264X:4:7204X:4:7148X:4:7088X:4:7040X:4:6984X:4:6928X
 
-//#define TRACE
-#ifdef TRACE
-  Serial.print(':');
-  Serial.print(start ? "START" : "PUSH");
-  Serial.print(':');
-  Serial.print(cmd->count_up ? 'U' : 'D');
-  Serial.print(':');
-  Serial.print(steps);
-  Serial.print(':');
-  Serial.print(period);
-  Serial.print('X');
-#endif
-
-  uint32_t command_rate_ticks = period;
-  if (steps > 1) {
-    command_rate_ticks *= steps;
-  }
-  if (command_rate_ticks < MIN_CMD_TICKS) {
-    return AQE_ERROR_TICKS_TOO_LOW;
+  fas_queue_idx_t wp = next_write_idx;
+  struct queue_end_s next_queue_end = queue_end;
+  int8_t res = _encodeEntry(&entry[wp & QUEUE_LEN_MASK], cmd, &next_queue_end,
+                            true, pause_periods, events);
+  if (res != AQE_OK) {
+    return res;
   }
 
-  uint8_t wp = next_write_idx;
-  struct queue_entry* e = &entry[wp & QUEUE_LEN_MASK];
-  bool dir = (cmd->count_up == dirHighCountsUp);
-  bool toggle_dir = false;
-#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
-  bool repeat_entry = false;
-#endif
-  if (dirPin != PIN_UNDEFINED) {
-    if ((isQueueEmpty() && !isRunning()) &&
-        ((dirPin & PIN_EXTERNAL_FLAG) == 0)) {
-      // set the dirPin here. Necessary with shared direction pins
-      digitalWrite(dirPin, dir);
-#ifdef ARDUINO_ARCH_SAM
-      delayMicroseconds(30);  // Make sure the driver has enough time to see
-                              // the dir pin change
-#endif
-      queue_end.dir = dir;
-    } else {
-      toggle_dir = (dir != queue_end.dir);
-#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
-      if (toggle_dir && (dirPin & PIN_EXTERNAL_FLAG)) {
-        repeat_entry = toggle_dir;
-        toggle_dir = false;
-      }
-#endif
+  // Advance write pointer
+#if defined(SUPPORT_SPSC_QUEUE)
+  if (!ignore_commands) {
+    if (!isReadyForCommands()) {
+      return AQE_DEVICE_NOT_READY;
     }
+    _publishEntries(wp + 1, &next_queue_end);
   }
-  e->steps = steps;
-#if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
-  e->repeat_entry = repeat_entry;
-  e->dirPinState = dir;
-#endif
-  e->toggle_dir = toggle_dir;
-  e->countUp = cmd->count_up ? 1 : 0;
-  e->moreThanOneStep = steps > 1 ? 1 : 0;
-  e->hasSteps = steps > 0 ? 1 : 0;
-  e->ticks = period;
-  struct queue_end_s next_queue_end = queue_end;
-#if defined(SUPPORT_QUEUE_ENTRY_START_POS_U16)
-  e->start_pos_last16 = (uint32_t)next_queue_end.pos & 0xffff;
-#endif
-  next_queue_end.pos += cmd->count_up ? steps : -steps;
-#if defined(SUPPORT_QUEUE_ENTRY_END_POS_U16)
-  e->end_pos_last16 = (uint32_t)next_queue_end.pos & 0xffff;
-#endif
-  next_queue_end.dir = dir;
-  next_queue_end.count_up = cmd->count_up;
-
-  // Advance write pointer
+#else
   fasDisableInterrupts();
   if (!ignore_commands) {
     if (isReadyForCommands()) {
@@ -131,42 +151,169 @@ int8_t StepperQueue::addQueueEntry(const struct stepper_command_s* cmd,
     }
   }
   fasEnableInterrupts();
+#endif
 
   if (!isRunning() && start) {
     // stepper is not yet running and start is requested
-#ifdef TRACE
-    Serial.print('S');
-#endif
+    FAS_TRACE_EVENT(FAS_TRACE_START, this - fas_queue, 0, 0);
     startQueue();
   }
-#ifdef TRACE
-  else {
-    // WHY IS start 0 in seq_01c
-    Serial.print(isRunning() ? 'R' : 'T');
-    Serial.print(start ? '1' : '0');
-    Serial.println('N');
+  return AQE_OK;
+}
+
+#if defined(SUPPORT_SPSC_QUEUE)
+// The entries up to wp are handed over to the isr. queue_end is updated
+// under the sequence lock for readers on other cores.
+void StepperQueue::_publishEntries(fas_queue_idx_t wp, const struct queue_end_s* qe) {
+  beginQueueEndUpdate();
+  queue_end = *qe;
+  fas_store_release(&next_write_idx, wp);
+  endQueueEndUpdate();
+}
+#endif
+
+// Batched adding of commands: the entries are prepared without critical
+// section, so a batch needs only two of them in total.
+void StepperQueue::beginBatch(struct queue_batch_s* batch) {
+  fas_queue_idx_t rp;
+  fas_queue_idx_t wp;
+#if defined(SUPPORT_SPSC_QUEUE)
+  // queue_end and next_write_idx are only written by the caller itself
+  _readIndices(&rp, &wp);
+  batch->queue_end = queue_end;
+#else
+  fasDisableInterrupts();
+  rp = read_idx;
+  wp = next_write_idx;
+  batch->queue_end = queue_end;
+  fasEnableInterrupts();
+#endif
+  batch->write_idx = wp;
+  batch->entries = 0;
+  batch->free = QUEUE_LEN - (fas_queue_idx_t)(wp - rp);
+}
+
+int8_t StepperQueue::addBatchEntry(struct queue_batch_s* batch,
+                                   const struct stepper_command_s* cmd,
+                                   fas_steps_t pause_periods,
+                                   uint8_t events) {
+  if (batch->entries == batch->free) {
+    return AQE_QUEUE_FULL;
+  }
+  fas_queue_idx_t wp = batch->write_idx + batch->entries;
+  // The dir pin is not set here, because the isr could run the queue empty
+  // in the meantime. Instead the entry toggles the dir pin, if needed.
+  int8_t res = _encodeEntry(&entry[wp & QUEUE_LEN_MASK], cmd,
+                            &batch->queue_end, false, pause_periods, events);
+  if (res == AQE_OK) {
+    batch->entries++;
+  }
+  return res;
+}
+
+int8_t StepperQueue::commitBatch(struct queue_batch_s* batch, bool start) {
+  fas_queue_idx_t entries = batch->entries;
+  if (entries == 0) {
+    return AQE_OK;
+  }
+  batch->entries = 0;
+  int8_t res = AQE_OK;
+  // Advance write pointer
+#if !defined(SUPPORT_SPSC_QUEUE)
+  fasDisableInterrupts();
+#endif
+  if (!ignore_commands && isReadyForCommands()) {
+    batch->write_idx += entries;
+    batch->free -= entries;
+#if defined(SUPPORT_SPSC_QUEUE)
+    _publishEntries(batch->write_idx, &batch->queue_end);
+#else
+    next_write_idx = batch->write_idx;
+    queue_end = batch->queue_end;
+#endif
+  } else {
+    // the prepared entries are discarded
+    if (!ignore_commands) {
+      res = AQE_DEVICE_NOT_READY;
+    }
+    batch->queue_end = queue_end;
   }
+#if !defined(SUPPORT_SPSC_QUEUE)
+  fasEnableInterrupts();
 #endif
-  return AQE_OK;
+  if ((res == AQE_OK) && !isRunning() && start) {
+    FAS_TRACE_EVENT(FAS_TRACE_START, this - fas_queue, 0, 0);
+    startQueue();
+  }
+  return res;
 }
 
 int32_t StepperQueue::getCurrentPosition() {
+  uint32_t pos;
+  fas_queue_idx_t rp;
+  fas_queue_idx_t wp;
+  fas_entry_pos_t pos_last16;
+  fas_steps_t steps;
+  bool count_up;
+#if defined(SUPPORT_ESP32)
+  int16_t done_p;
+#endif
+#if defined(SUPPORT_SPSC_QUEUE)
+#if defined(SUPPORT_ESP32)
+  bool retried = false;
+#endif
+  // Snapshot without critical section. It is retried, if queue_end has been
+  // updated or the isr has advanced to the next entry in the meantime.
+  while (true) {
+    uint32_t seq = fas_load_acquire(&queue_end_seq);
+    if (seq & 1) {
+      continue;
+    }
+    _readIndices(&rp, &wp);
+    pos = (uint32_t)queue_end.pos;
+    struct queue_entry* e = &entry[rp & QUEUE_LEN_MASK];
+#if defined(SUPPORT_QUEUE_ENTRY_END_POS_U16)
+    pos_last16 = e->end_pos_last16;
+#endif
+#if defined(SUPPORT_QUEUE_ENTRY_START_POS_U16)
+    pos_last16 = e->start_pos_last16;
+#endif
+    steps = e->hasSteps ? e->steps : 0;
+    count_up = e->countUp;
+#if defined(SUPPORT_ESP32)
+    done_p = (int16_t)_getPerformedPulses();
+#endif
+    fas_fence_acquire();
+    if ((seq != queue_end_seq) || (rp != read_idx)) {
+      continue;
+    }
+#if defined(SUPPORT_ESP32)
+    // fix for possible race condition described in issue #68
+    if ((done_p == 0) && !retried) {
+      retried = true;
+      continue;
+    }
+#endif
+    break;
+  }
+#else
   fasDisableInterrupts();
-  uint32_t pos = (uint32_t)queue_end.pos;
-  uint8_t rp = read_idx;
-  bool is_empty = (rp == next_write_idx);
+  pos = (uint32_t)queue_end.pos;
+  rp = read_idx;
+  wp = next_write_idx;
   struct queue_entry* e = &entry[rp & QUEUE_LEN_MASK];
 #if defined(SUPPORT_QUEUE_ENTRY_END_POS_U16)
-  uint16_t pos_last16 = e->end_pos_last16;
+  pos_last16 = e->end_pos_last16;
 #endif
 #if defined(SUPPORT_QUEUE_ENTRY_START_POS_U16)
-  uint16_t pos_last16 = e->start_pos_last16;
+  pos_last16 = e->start_pos_last16;
 #endif
-  uint8_t steps = e->steps;
+  steps = e->hasSteps ? e->steps : 0;
+  count_up = e->countUp;
 #if defined(SUPPORT_ESP32)
-  // pulse counter should go max up to 255 with perhaps few pulses overrun, so
-  // this conversion is safe
-  int16_t done_p = (int16_t)_getPerformedPulses();
+  // pulse counter should go max up to MAX_CMD_STEPS with perhaps few pulses
+  // overrun, so this conversion is safe
+  done_p = (int16_t)_getPerformedPulses();
 #endif
   fasEnableInterrupts();
 #if defined(SUPPORT_ESP32)
@@ -174,17 +321,23 @@ int32_t StepperQueue::getCurrentPosition() {
     // fix for possible race condition described in issue #68
     fasDisableInterrupts();
     rp = read_idx;
-    is_empty = (rp == next_write_idx);
+    wp = next_write_idx;
     e = &entry[rp & QUEUE_LEN_MASK];
     pos_last16 = e->start_pos_last16;
-    steps = e->steps;
+    steps = e->hasSteps ? e->steps : 0;
+    count_up = e->countUp;
     done_p = (int16_t)_getPerformedPulses();
     fasEnableInterrupts();
   }
 #endif
+#endif
+  bool is_empty = (rp == wp);
   if (!is_empty) {
-    int16_t adjust = 0;
+    int32_t adjust = 0;
 
+#if defined(SUPPORT_QUEUE_ENTRY_FULL_POS)
+    pos = pos_last16;
+#else
     uint16_t pos16 = pos & 0xffff;
     uint8_t transition = ((pos16 >> 12) & 0x0c) | (pos_last16 >> 14);
     switch (transition) {
@@ -212,9 +365,10 @@ int32_t StepperQueue::getCurrentPosition() {
         break;  // TODO: ERROR
     }
     pos = (int32_t)((pos & 0xffff0000) | pos_last16);
+#endif
 
     if (steps != 0) {
-      if (e->countUp) {
+      if (count_up) {
 #if defined(SUPPORT_QUEUE_ENTRY_END_POS_U16)
         adjust = -steps;
 #endif
@@ -235,20 +389,33 @@ int32_t StepperQueue::getCurrentPosition() {
   return pos;
 }
 
+// The isr counts down the periods of a pause entry, so the periods after the
+// current one are still to come.
+uint32_t StepperQueue::_remainingPauseTicks(fas_queue_idx_t rp) {
+  struct queue_entry* e = &entry[rp & QUEUE_LEN_MASK];
+  fas_steps_t steps = e->steps;
+  if (e->hasSteps || (steps <= 1)) {
+    return 0;
+  }
+  uint32_t ticks = e->ticks;
+  ticks *= steps - 1;
+  return ticks;
+}
+
 uint32_t StepperQueue::ticksInQueue() {
-  fasDisableInterrupts();
-  uint8_t rp = read_idx;
-  uint8_t wp = next_write_idx;
-  fasEnableInterrupts();
+  fas_queue_idx_t rp;
+  fas_queue_idx_t wp;
+  _readIndices(&rp, &wp);
   if (wp == rp) {
     return 0;
   }
-  uint32_t ticks = 0;
-  rp++;  // ignore currently processed entry
+  // ignore currently processed entry, except the remaining periods of a pause
+  uint32_t ticks = _remainingPauseTicks(rp);
+  rp++;
   while (wp != rp) {
     struct queue_entry* e = &entry[rp++ & QUEUE_LEN_MASK];
     ticks += e->ticks;
-    uint8_t steps = e->steps;
+    fas_steps_t steps = e->steps;
     if (steps > 1) {
       uint32_t tmp = e->ticks;
       tmp *= steps - 1;
@@ -259,18 +426,23 @@ uint32_t StepperQueue::ticksInQueue() {
 }
 
 bool StepperQueue::hasTicksInQueue(uint32_t min_ticks) {
-  fasDisableInterrupts();
-  uint8_t rp = read_idx;
-  uint8_t wp = next_write_idx;
-  fasEnableInterrupts();
+  fas_queue_idx_t rp;
+  fas_queue_idx_t wp;
+  _readIndices(&rp, &wp);
   if (wp == rp) {
     return false;
   }
-  rp++;  // ignore currently processed entry
+  // ignore currently processed entry, except the remaining periods of a pause
+  uint32_t tmp = _remainingPauseTicks(rp);
+  if (tmp >= min_ticks) {
+    return true;
+  }
+  min_ticks -= tmp;
+  rp++;
   while (wp != rp) {
     struct queue_entry* e = &entry[rp & QUEUE_LEN_MASK];
-    uint32_t tmp = e->ticks;
-    uint8_t steps = fas_max(e->steps, (uint8_t)1);
+    tmp = e->ticks;
+    fas_steps_t steps = fas_max(e->steps, (fas_steps_t)1);
     tmp *= steps;
     if (tmp >= min_ticks) {
       return true;
@@ -281,14 +453,69 @@ bool StepperQueue::hasTicksInQueue(uint32_t min_ticks) {
   return false;
 }
 
+#if defined(SUPPORT_TASK_WAKEUP)
+// The wakeup entry is the last one, from which on the remaining ticks in the
+// queue are at least low_watermark_ticks, but at most half of the queue is
+// left. Returns the ticks until this entry is reached, or 0 if the task should
+// not wait for the notification. For the currently processed entry only the
+// steps, which are certainly left, are taken into account.
+//
+// If the isr reaches the entry while arming, then the notification is
+// dropped. On esp32 this can happen even with the critical section, if the
+// isr runs on the other core. So the caller has to use the returned ticks as
+// timeout in any case.
+uint32_t StepperQueue::armWakeup(uint32_t low_watermark_ticks) {
+  wakeup_armed = false;
+  fas_queue_idx_t rp;
+  fas_queue_idx_t wp;
+  _readIndices(&rp, &wp);
+  if (wp == rp) {
+    return 0;
+  }
+  fas_queue_idx_t idx = wp;
+  uint32_t remaining = 0;  // ticks of the entries from idx on
+  while ((fas_queue_idx_t)(idx - rp) > 1) {
+    idx--;
+    struct queue_entry* e = &entry[idx & QUEUE_LEN_MASK];
+    uint32_t tmp = e->ticks;
+    tmp *= fas_max(e->steps, (fas_steps_t)1);
+    remaining += tmp;
+    if (remaining >= low_watermark_ticks) {
+      break;
+    }
+    if ((fas_queue_idx_t)(wp - idx) >= QUEUE_LEN / 2) {
+      break;
+    }
+  }
+  struct queue_entry* e = &entry[rp & QUEUE_LEN_MASK];
+  uint32_t ticks = e->ticks;
+  ticks *= e->steps > 1 ? e->steps - 1 : 0;
+  for (fas_queue_idx_t i = rp + 1; i != idx; i++) {
+    e = &entry[i & QUEUE_LEN_MASK];
+    uint32_t tmp = e->ticks;
+    tmp *= fas_max(e->steps, (fas_steps_t)1);
+    ticks += tmp;
+  }
+  fasDisableInterrupts();
+  fas_queue_idx_t distance = idx - read_idx;
+  if ((distance > 0) && (distance <= QUEUE_LEN)) {
+    wakeup_idx = idx;
+    fas_store_release(&wakeup_armed, true);
+  } else {
+    ticks = 0;
+  }
+  fasEnableInterrupts();
+  return ticks;
+}
+#endif
+
 bool StepperQueue::getActualTicksWithDirection(struct actual_ticks_s* speed) {
   // Retrieve current step rate from the current command.
   // This is valid only, if the command describes more than one step,
   // or if the next command contains one step, too.
-  fasDisableInterrupts();
-  uint8_t rp = read_idx;
-  uint8_t wp = next_write_idx;
-  fasEnableInterrupts();
+  fas_queue_idx_t rp;
+  fas_queue_idx_t wp;
+  _readIndices(&rp, &wp);
   if (wp == rp) {
     speed->ticks = 0;
     return true;
@@ -320,9 +547,23 @@ void StepperQueue::_initVars() {
   ignore_commands = false;
   read_idx = 0;
   next_write_idx = 0;
+  stat_isr_calls = 0;
+  stat_late_refills = 0;
   queue_end.dir = true;
   queue_end.count_up = true;
   queue_end.pos = 0;
+#if defined(SUPPORT_SPSC_QUEUE)
+  queue_end_seq = 0;
+#endif
+#if defined(SUPPORT_TASK_WAKEUP)
+  wakeup_idx = 0;
+  wakeup_armed = false;
+#endif
+#if defined(SUPPORT_POSITION_EVENTS)
+  events_raised = 0;
+  event_stepper = NULL;
+  event_callback = NULL;
+#endif
   dirHighCountsUp = true;
 #if defined(ARDUINO_ARCH_AVR)
   _isRunning = false;
@@ -8,8 +8,19 @@
 // These variables control the stepper timing behaviour
 #define QUEUE_LEN_MASK (QUEUE_LEN - 1)
 
+// The entries store the last 16 bits of the position. With
+// SUPPORT_QUEUE_ENTRY_FULL_POS the complete position is stored instead.
+#if defined(SUPPORT_QUEUE_ENTRY_FULL_POS)
+typedef uint32_t fas_entry_pos_t;
+#else
+typedef uint16_t fas_entry_pos_t;
+#endif
+
+// A pause has hasSteps == 0. Then steps is the number of periods of ticks,
+// for which the pause lasts. 0 and 1 are both a single period. So a pause of
+// up to MAX_PAUSE_PERIODS * 65535 ticks needs only one entry.
 struct queue_entry {
-  uint8_t steps;  // if 0,  then the command only adds a delay
+  fas_steps_t steps;  // if 0,  then the command only adds a delay
   uint8_t toggle_dir : 1;
   uint8_t countUp : 1;
   uint8_t moreThanOneStep : 1;
@@ -20,13 +31,17 @@ struct queue_entry {
   // Used for external direction pin
   uint8_t repeat_entry : 1;
   uint8_t dirPinState : 1;
+#endif
+#if defined(SUPPORT_POSITION_EVENTS)
+  // bit mask of the position events raised at start of this entry
+  uint8_t events : MAX_POSITION_EVENTS;
 #endif
   uint16_t ticks;
 #if defined(SUPPORT_QUEUE_ENTRY_END_POS_U16)
-  uint16_t end_pos_last16;
+  fas_entry_pos_t end_pos_last16;
 #endif
 #if defined(SUPPORT_QUEUE_ENTRY_START_POS_U16)
-  uint16_t start_pos_last16;
+  fas_entry_pos_t start_pos_last16;
 #endif
 };
 
@@ -37,6 +52,32 @@ void _esp32_clearPulseCounter(uint8_t pcnt_unit);
 int16_t _esp32_readPulseCounter(uint8_t pcnt_unit);
 #endif
 
+// A batch of queue entries is prepared behind next_write_idx, so the entries
+// are not visible to the isr. commitBatch() publishes all of them with one
+// update of next_write_idx.
+struct queue_batch_s {
+  struct queue_end_s queue_end;  // queue end after the prepared entries
+  fas_queue_idx_t write_idx;     // next_write_idx at begin of the batch
+  fas_queue_idx_t entries;       // prepared entries
+  fas_queue_idx_t free;          // free entries at begin of the batch
+};
+
+#if defined(SUPPORT_TASK_WAKEUP)
+// Wake up the stepper task. The isr variant is called by checkWakeup(), the
+// other one by the application on ramp changes.
+void fas_notify_task_from_isr();
+void fas_notify_task();
+#if defined(TEST)
+extern uint32_t fas_test_task_notifications;
+#endif
+
+// The stepper task sleeps at most this time, even if not notified. If a
+// stepper cannot wait for a notification, then the task polls as without
+// wakeup.
+#define TASK_WAKEUP_MAX_SLEEP_TICKS (TICKS_PER_S / 10)
+#define TASK_WAKEUP_POLL_TICKS (TICKS_PER_S / 1000 * DELAY_MS_BASE)
+#endif
+
 class StepperQueue {
  public:
   struct queue_entry entry[QUEUE_LEN];
@@ -44,8 +85,11 @@ class StepperQueue {
   // In case of forceStopAndNewPosition() the adding of commands has to be
   // temporarily suspended
   volatile bool ignore_commands;
-  volatile uint8_t read_idx;  // ISR stops if readptr == next_writeptr
-  volatile uint8_t next_write_idx;
+  volatile fas_queue_idx_t read_idx;  // ISR stops if readptr == next_writeptr
+  volatile fas_queue_idx_t next_write_idx;
+  // Statistics of the isr, see FastAccelStepper::getStats()
+  volatile uint32_t stat_isr_calls;
+  volatile uint32_t stat_late_refills;
   bool dirHighCountsUp;
   uint8_t dirPin;
 
@@ -112,15 +156,94 @@ class StepperQueue {
   struct queue_end_s queue_end;
   uint16_t max_speed_in_ticks;
 
+#if defined(SUPPORT_SPSC_QUEUE)
+  // queue_end is only written by the application. An odd value of
+  // queue_end_seq marks an update in progress, so readers on another core
+  // retry instead of using a torn queue_end.
+  volatile uint32_t queue_end_seq;
+  inline void beginQueueEndUpdate() {
+    fas_store_release(&queue_end_seq, queue_end_seq + 1);
+    fas_fence_release();
+  }
+  inline void endQueueEndUpdate() {
+    fas_store_release(&queue_end_seq, queue_end_seq + 1);
+  }
+#else
+  inline void beginQueueEndUpdate() {}
+  inline void endQueueEndUpdate() {}
+#endif
+
+#if defined(SUPPORT_TASK_WAKEUP)
+  // Low watermark of the queue: The isr notifies the stepper task, when
+  // read_idx reaches wakeup_idx. armWakeup() is called by the task after
+  // having filled the queue.
+  volatile fas_queue_idx_t wakeup_idx;
+  volatile bool wakeup_armed;
+  inline void checkWakeup(fas_queue_idx_t rp) {
+    if (wakeup_armed && (rp == wakeup_idx)) {
+      wakeup_armed = false;
+      fas_notify_task_from_isr();
+    }
+  }
+  uint32_t armWakeup(uint32_t low_watermark_ticks);
+  inline void disarmWakeup() { wakeup_armed = false; }
+#else
+  inline void checkWakeup(fas_queue_idx_t rp) {}
+#endif
+
+#if defined(SUPPORT_POSITION_EVENTS)
+  // Position events: checkPositionEvents() is called by the isr, when it
+  // starts an entry. The events of the entry are cleared, because some
+  // drivers process an entry more than once.
+  volatile uint8_t events_raised;
+  FastAccelStepper* event_stepper;
+  void (*event_callback)(FastAccelStepper* stepper, uint8_t event);
+  inline void checkPositionEvents(struct queue_entry* e) {
+    uint8_t events = e->events;
+    if (events == 0) {
+      return;
+    }
+    e->events = 0;
+    events_raised |= events;
+    if (event_callback != NULL) {
+      for (uint8_t i = 0; i < MAX_POSITION_EVENTS; i++) {
+        if (events & (1 << i)) {
+          event_callback(event_stepper, i);
+        }
+      }
+    }
+  }
+#else
+  inline void checkPositionEvents(struct queue_entry* e) {}
+#endif
+
   void init(uint8_t queue_num, uint8_t step_pin);
-  inline uint8_t queueEntries() {
+  inline fas_queue_idx_t queueEntries() {
+    fas_queue_idx_t rp;
+    fas_queue_idx_t wp;
+    _readIndices(&rp, &wp);
+    inject_fill_interrupt(0);
+    return (fas_queue_idx_t)(wp - rp);
+  }
+#if defined(SUPPORT_SPSC_QUEUE)
+  // Consistent snapshot without critical section: next_write_idx is stable
+  // while read_idx is read, so rp <= wp <= rp + QUEUE_LEN
+  inline void _readIndices(fas_queue_idx_t* rp, fas_queue_idx_t* wp) {
+    fas_queue_idx_t w;
+    do {
+      w = fas_load_acquire(&next_write_idx);
+      *rp = fas_load_acquire(&read_idx);
+    } while (w != fas_load_acquire(&next_write_idx));
+    *wp = w;
+  }
+#else
+  inline void _readIndices(fas_queue_idx_t* rp, fas_queue_idx_t* wp) {
     fasDisableInterrupts();
-    uint8_t rp = read_idx;
-    uint8_t wp = next_write_idx;
+    *rp = read_idx;
+    *wp = next_write_idx;
     fasEnableInterrupts();
-    inject_fill_interrupt(0);
-    return (uint8_t)(wp - rp);
   }
+#endif
   inline bool isQueueFull() { return queueEntries() == QUEUE_LEN; }
   inline bool isQueueEmpty() { return queueEntries() == 0; }
 #if defined(SUPPORT_EXTERNAL_DIRECTION_PIN)
@@ -138,10 +261,20 @@ class StepperQueue {
   void setAbsoluteSpeedLimit(uint16_t max_speed_in_ticks);
 #endif
 
-  int8_t addQueueEntry(const struct stepper_command_s* cmd, bool start);
+  // For a pause command (steps == 0) pause_periods is the number of periods
+  // of cmd->ticks for the entry. events is the bit mask of position events
+  // to be raised at start of the entry.
+  int8_t addQueueEntry(const struct stepper_command_s* cmd, bool start,
+                       fas_steps_t pause_periods = 1, uint8_t events = 0);
+  void beginBatch(struct queue_batch_s* batch);
+  int8_t addBatchEntry(struct queue_batch_s* batch,
+                       const struct stepper_command_s* cmd,
+                       fas_steps_t pause_periods = 1, uint8_t events = 0);
+  int8_t commitBatch(struct queue_batch_s* batch, bool start);
   int32_t getCurrentPosition();
   uint32_t ticksInQueue();
   bool hasTicksInQueue(uint32_t min_ticks);
+  uint32_t _remainingPauseTicks(fas_queue_idx_t rp);
   bool getActualTicksWithDirection(struct actual_ticks_s* speed);
 
   volatile uint16_t getMaxSpeedInTicks() { return max_speed_in_ticks; }
@@ -150,6 +283,13 @@ class StepperQueue {
   void startQueue();
   void forceStop();
   void _initVars();
+#if defined(SUPPORT_SPSC_QUEUE)
+  void _publishEntries(fas_queue_idx_t wp, const struct queue_end_s* qe);
+#endif
+  int8_t _encodeEntry(struct queue_entry* e,
+                      const struct stepper_command_s* cmd,
+                      struct queue_end_s* qe, bool may_set_dir_pin,
+                      fas_steps_t pause_periods, uint8_t events);
   void connect();
   void disconnect();
 
@@ -129,6 +129,7 @@ void StepperQueue::init(uint8_t queue_num, uint8_t step_pin) {
 #define AVR_STEPPER_ISR(T, CHANNEL)                                           \
   ISR(TIMER##T##_COMP##CHANNEL##_vect) {                                      \
     enterStepperISR();                                                        \
+    fas_queue_##CHANNEL.stat_isr_calls++;                                     \
     uint8_t rp = fas_queue_##CHANNEL.read_idx;                                \
     if (rp == fas_queue_##CHANNEL.next_write_idx) {                           \
       /* queue is empty => set to disconnect */                               \
@@ -160,7 +161,9 @@ void StepperQueue::init(uint8_t queue_num, uint8_t step_pin) {
       /* if this new command requires a step, then this step would be lost    \
        */                                                                     \
       fas_queue_##CHANNEL._prepareForStop = false;                            \
-      if (e->steps > 0) {                                                     \
+      fas_queue_##CHANNEL.stat_late_refills++;                                \
+      fas_queue_##CHANNEL.checkPositionEvents(e);                             \
+      if (e->hasSteps) {                                                      \
         /* That's the problem, so generate a step */                          \
         Stepper_One(T, CHANNEL);                                              \
         ForceCompare(T, CHANNEL);                                             \
@@ -177,6 +180,12 @@ void StepperQueue::init(uint8_t queue_num, uint8_t step_pin) {
         }                                                                     \
       }                                                                       \
     }                                                                         \
+    if (!e->hasSteps && (e->steps > 1)) {                                     \
+      /* pause with more periods: OCR has been advanced already */            \
+      e->steps--;                                                             \
+      exitStepperISR();                                                       \
+      return;                                                                 \
+    }                                                                         \
     if (TEST_NOT_REPEATING_ENTRY) {                                           \
       rp++;                                                                   \
     }                                                                         \
@@ -184,12 +193,13 @@ void StepperQueue::init(uint8_t queue_num, uint8_t step_pin) {
     if (rp != fas_queue_##CHANNEL.next_write_idx) {                           \
       /* command in queue */                                                  \
       e = &fas_queue_##CHANNEL.entry[rp & QUEUE_LEN_MASK];                    \
-      if (e->steps != 0) {                                                    \
+      if (e->hasSteps) {                                                      \
         Stepper_One(T, CHANNEL);                                              \
       }                                                                       \
       if (e->toggle_dir) {                                                    \
         *fas_queue_##CHANNEL._dirPinPort ^= fas_queue_##CHANNEL._dirPinMask;  \
       }                                                                       \
+      fas_queue_##CHANNEL.checkPositionEvents(e);                             \
     } else {                                                                  \
       fas_queue_##CHANNEL._prepareForStop = true;                             \
     }                                                                         \
@@ -240,10 +250,11 @@ AVR_CYCLIC_ISR_GEN(FAS_TIMER_MODULE)
 #define AVR_START_QUEUE(T, CHANNEL)              \
   _isRunning = true;                             \
   _prepareForStop = false;                       \
+  checkPositionEvents(e);                        \
   /* ensure no compare event */                  \
   SetTimerCompareRelative(T, CHANNEL, 32768);    \
   /* set output one, if steps to be generated */ \
-  if (e->steps > 0) {                            \
+  if (e->hasSteps) {                             \
     Stepper_One(T, CHANNEL);                     \
   } else {                                       \
     Stepper_Zero(T, CHANNEL);                    \
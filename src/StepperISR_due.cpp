@@ -169,9 +169,10 @@ void PWM_Handler(void) {
   // simple.  Figure out which channel had a period reset event, and service it.
   // Since we have to read the entire ISR1 register, we need to make sure we
   // don't have multiple period update events.  It should be rare, but it can
-  // happen! Then, because we only use this for pausing, and each pause has one
-  // period cycle, we simply advance rp, and decide what to do from there (pause
-  // again or switch to outputting steps).  Pretty easy :)
+  // happen! Then, because we only use this for pausing, and each pause period
+  // has one period cycle, we count down the periods of the pause entry, then
+  // advance rp, and decide what to do from there (pause again or switch to
+  // outputting steps).  Pretty easy :)
 
   uint32_t sr = PWM_INTERFACE->PWM_ISR1;
   // uint32_t sr2 = PWM_INTERFACE->PWM_ISR2;
@@ -232,7 +233,7 @@ void PWM_Handler(void) {
     Pio* port = mapping->port;
 
     // Now with the queue, we can get the current entry, and see if we need to
-    uint8_t rp = q->read_idx;
+    fas_queue_idx_t rp = q->read_idx;
     if (rp == q->next_write_idx) {
       // I believe this is solved by the gating of _delayCommanded and
       // hasISRActive, but its not a bad idea to double check!
@@ -240,8 +241,15 @@ void PWM_Handler(void) {
       // We're going to write rp and wp out as pulses onto pin32.
       continue;
     }
-    rp = ++q->read_idx;
     struct queue_entry* e = &q->entry[rp & QUEUE_LEN_MASK];
+    if (!e->hasSteps && (e->steps > 1)) {
+      // A pause of several periods. The period is unchanged, so just wait
+      // for the next period update
+      e->steps--;
+      continue;
+    }
+    rp = ++q->read_idx;
+    e = &q->entry[rp & QUEUE_LEN_MASK];
     if (rp == q->next_write_idx) {
       q->_hasISRactive = false;
       // Since we arent sure about more pauses, we need to say no we aren't
@@ -260,7 +268,8 @@ void PWM_Handler(void) {
 
       continue;  // We're done apparently
     }
-    if (e->steps > 0) {
+    q->checkPositionEvents(e);
+    if (e->hasSteps) {
       // stop the interrupt on the PWM generator, set the period,
       // re-attach the PIO handler, disconnect the  PWM generator
       // interrupt, and send it on its way...One problem, we have to use
@@ -344,7 +353,8 @@ inline void attachPWMPeripheral(Pio* port, uint8_t pin, uint32_t channelMask) {
       return;                                                                  \
     }                                                                          \
     IncrementQueue(Q);                                                         \
-    uint8_t rp = q->read_idx;                                                  \
+    q->stat_isr_calls++;                                                       \
+    fas_queue_idx_t rp = q->read_idx;                                          \
     /*This case should hopefully be elimiated....Unfortunately, it is not :(*/ \
     /*It is quite rare though.*/                                               \
     if (rp == q->next_write_idx) {                                             \
@@ -352,7 +362,7 @@ inline void attachPWMPeripheral(Pio* port, uint8_t pin, uint32_t channelMask) {
       return;                                                                  \
     }                                                                          \
     struct queue_entry* e = &q->entry[rp & QUEUE_LEN_MASK];                    \
-    uint8_t s = --e->steps;                                                    \
+    fas_steps_t s = --e->steps;                                                \
     /*Obvious case, if we have done all of the steps in this queue entry....*/ \
     if (s == 0) {                                                              \
       /*Setup for the next move...The PWM Peripheral is pretty smart.  We set  \
@@ -382,9 +392,10 @@ inline void attachPWMPeripheral(Pio* port, uint8_t pin, uint32_t channelMask) {
       /*Since we're done with e, e is now e_next...*/                          \
       e = &q->entry[rp & QUEUE_LEN_MASK];                                      \
       q->read_idx = rp;                                                        \
+      q->checkPositionEvents(e);                                               \
       /*We need to look for queue entries with some sort of command            \
         in them..*/                                                            \
-      if (e->steps == 0 || !e->hasSteps) {                                     \
+      if (!e->hasSteps) {                                                      \
         delayMicroseconds(7);                                                  \
         q->_pauseCommanded = true;                                             \
         q->timePWMInterruptEnabled = micros();                                 \
@@ -611,6 +622,7 @@ void StepperQueue::startQueue() {
   // the no-start issue.
   interrupts();
   _hasISRactive = true;
+  checkPositionEvents(e);
 
   const PWMCHANNELMAPPING* mapping = (const PWMCHANNELMAPPING*)driver_data;
 
@@ -629,7 +641,7 @@ void StepperQueue::startQueue() {
     PWM_INTERFACE->PWM_CH_NUM[mapping->channel].PWM_CPRD = e->ticks;
   }
 
-  if (e->steps > 0 || e->hasSteps) {
+  if (e->hasSteps) {
     attachPWMPeripheral(mapping->port, mapping->pin, mapping->channelMask);
     return;
   } else {
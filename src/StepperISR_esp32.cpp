@@ -110,6 +110,37 @@ bool StepperQueue::isValidStepPin(uint8_t step_pin) {
 int8_t StepperQueue::queueNumForStepPin(uint8_t step_pin) { return -1; }
 
 //*************************************************************************************************
+#if defined(SUPPORT_TASK_WAKEUP)
+static TaskHandle_t fas_task_handle = NULL;
+
+void IRAM_ATTR fas_notify_task_from_isr() {
+  if (fas_task_handle != NULL) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(fas_task_handle, &higher_priority_task_woken);
+    if (higher_priority_task_woken) {
+      portYIELD_FROM_ISR();
+    }
+  }
+}
+
+void fas_notify_task() {
+  if (fas_task_handle != NULL) {
+    xTaskNotifyGive(fas_task_handle);
+  }
+}
+
+void StepperTask(void *parameter) {
+  FastAccelStepperEngine *engine = (FastAccelStepperEngine *)parameter;
+  while (true) {
+    engine->manageSteppers();
+    esp_task_wdt_reset();
+    // Rounded down, so the timeout is never behind the low watermark
+    uint32_t sleep_ms = engine->taskSleepInTicks() / (TICKS_PER_S / 1000);
+    TickType_t delay = fas_max(sleep_ms / portTICK_PERIOD_MS, (uint32_t)1);
+    ulTaskNotifyTake(pdTRUE, delay);
+  }
+}
+#else
 void StepperTask(void *parameter) {
   FastAccelStepperEngine *engine = (FastAccelStepperEngine *)parameter;
   const TickType_t delay_4ms =
@@ -120,6 +151,7 @@ void StepperTask(void *parameter) {
     vTaskDelay(delay_4ms);
   }
 }
+#endif
 
 void StepperQueue::adjustSpeedToStepperCount(uint8_t steppers) {
   max_speed_in_ticks = 80;  // This equals 200kHz @ 16MHz
@@ -132,11 +164,17 @@ void StepperQueue::setAbsoluteSpeedLimit(uint16_t ticks) {
 void fas_init_engine(FastAccelStepperEngine *engine, uint8_t cpu_core) {
 #define STACK_SIZE 2000
 #define PRIORITY configMAX_PRIORITIES
+#if defined(SUPPORT_TASK_WAKEUP)
+  TaskHandle_t *handle = &fas_task_handle;
+#else
+  TaskHandle_t *handle = NULL;
+#endif
   if (cpu_core > 1) {
-    xTaskCreate(StepperTask, "StepperTask", STACK_SIZE, engine, PRIORITY, NULL);
+    xTaskCreate(StepperTask, "StepperTask", STACK_SIZE, engine, PRIORITY,
+                handle);
   } else {
     xTaskCreatePinnedToCore(StepperTask, "StepperTask", STACK_SIZE, engine,
-                            PRIORITY, NULL, cpu_core);
+                            PRIORITY, handle, cpu_core);
   }
 }
 
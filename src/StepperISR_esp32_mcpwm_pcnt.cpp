@@ -91,8 +91,8 @@ static struct mapping_s channel2mapping[NUM_QUEUES] = {
 
 static void IRAM_ATTR prepare_for_next_command(
     StepperQueue *queue, const struct queue_entry *e_next) {
-  uint8_t next_steps = e_next->steps;
-  if (next_steps > 0) {
+  fas_steps_t next_steps = e_next->steps;
+  if (e_next->hasSteps) {
     const struct mapping_s *mapping =
         (const struct mapping_s *)queue->driver_data;
     pcnt_unit_t pcnt_unit = mapping->pcnt_unit;
@@ -110,18 +110,19 @@ static void IRAM_ATTR prepare_for_next_command(
   REG_CLR_BIT(PCNT_CTRL_REG, (1 << (2 * pcnt_unit)))
 
 static void IRAM_ATTR apply_command(StepperQueue *queue,
-                                    const struct queue_entry *e) {
+                                    struct queue_entry *e) {
   const struct mapping_s *mapping =
       (const struct mapping_s *)queue->driver_data;
   mcpwm_unit_t mcpwm_unit = mapping->mcpwm_unit;
   mcpwm_dev_t *mcpwm = mcpwm_unit == MCPWM_UNIT_0 ? &MCPWM0 : &MCPWM1;
   pcnt_unit_t pcnt_unit = mapping->pcnt_unit;
   uint8_t timer = mapping->timer;
-  uint8_t steps = e->steps;
+  fas_steps_t steps = e->steps;
   if (e->toggle_dir) {
     gpio_num_t dirPin = (gpio_num_t)queue->dirPin;
     gpio_set_level(dirPin, gpio_get_level(dirPin) ^ 1);
   }
+  queue->checkPositionEvents(e);
   uint16_t ticks = e->ticks;
 #ifndef __ESP32_IDF_V44__
   if (mcpwm->timer[timer].status.value <= 1) {  // mcpwm Timer is stopped ?
@@ -145,7 +146,7 @@ static void IRAM_ATTR apply_command(StepperQueue *queue,
 #else  /* __ESP32_IDF_V44__ */
   mcpwm->timer[timer].timer_cfg0.timer_period = ticks;
 #endif /* __ESP32_IDF_V44__ */
-  if (steps == 0) {
+  if (!e->hasSteps) {
     // timer value = 1 - upcounting: output low
 #ifndef __ESP32_IDF_V44__
     mcpwm->channel[timer].generator[0].utea = 1;
@@ -267,17 +268,31 @@ static void IRAM_ATTR what_is_next(StepperQueue *q) {
   // when starting the queue, apply_command for the first entry is called.
   // the read pointer stays at this position. This function is reached,
   // if the command to which read pointer points to is completed.
+  q->stat_isr_calls++;
   bool isPrepared = q->_nextCommandIsPrepared;
   q->_nextCommandIsPrepared = false;
-  uint8_t rp = q->read_idx;
-  if (rp != q->next_write_idx) {
+  fas_queue_idx_t rp = q->read_idx;
+  if (rp != fas_load_acquire(&q->next_write_idx)) {
     struct queue_entry *e_completed = &q->entry[rp & QUEUE_LEN_MASK];
+    if (!e_completed->hasSteps && (e_completed->steps > 1)) {
+      // A pause of several periods: the timer just continues with the same
+      // period. So only the interrupt flag needs to be cleared.
+      e_completed->steps--;
+      q->_nextCommandIsPrepared = isPrepared;
+      const struct mapping_s *mapping =
+          (const struct mapping_s *)q->driver_data;
+      mcpwm_dev_t *mcpwm =
+          mapping->mcpwm_unit == MCPWM_UNIT_0 ? &MCPWM0 : &MCPWM1;
+      mcpwm->int_clr.val = mapping->cmpr_tea_int_clr;
+      return;
+    }
     bool repeat_entry = e_completed->repeat_entry != 0;
     if (!repeat_entry) {
       rp++;
-      q->read_idx = rp;
+      fas_store_release(&q->read_idx, rp);
+      q->checkWakeup(rp);
     }
-    if (rp != q->next_write_idx) {
+    if (rp != fas_load_acquire(&q->next_write_idx)) {
       struct queue_entry *e_curr = &q->entry[rp & QUEUE_LEN_MASK];
       if (!isPrepared) {
         prepare_for_next_command(q, e_curr);  // a no-op for pause command
@@ -288,7 +303,7 @@ static void IRAM_ATTR what_is_next(StepperQueue *q) {
       apply_command(q, e_curr);
       if (!repeat_entry) {
         rp++;
-        if (rp != q->next_write_idx) {
+        if (rp != fas_load_acquire(&q->next_write_idx)) {
           struct queue_entry *e_next = &q->entry[rp & QUEUE_LEN_MASK];
           q->_nextCommandIsPrepared = true;
           prepare_for_next_command(q, e_next);  // a no-op for pause command
@@ -48,11 +48,12 @@ void IRAM_ATTR StepperQueue::stop_rmt(bool both) {
 
 static void IRAM_ATTR apply_command(StepperQueue *q, bool fill_part_one,
                                     uint32_t *data) {
+  q->stat_isr_calls++;
   if (!fill_part_one) {
     data += PART_SIZE;
   }
-  uint8_t rp = q->read_idx;
-  if (rp == q->next_write_idx) {
+  fas_queue_idx_t rp = q->read_idx;
+  if (rp == fas_load_acquire(&q->next_write_idx)) {
     // no command in queue
     if (fill_part_one) {
       q->bufferContainsSteps[0] = false;
@@ -88,14 +89,19 @@ static void IRAM_ATTR apply_command(StepperQueue *q, bool fill_part_one,
     // and delete the request
     e_curr->toggle_dir = 0;
   }
+  // The events are raised, when the entry is written into the rmt buffer.
+  // This is up to one buffer half before the steps.
+  q->checkPositionEvents(e_curr);
 
-  uint8_t steps = e_curr->steps;
+  fas_steps_t steps = e_curr->steps;
   uint16_t ticks = e_curr->ticks;
   //  if (steps != 0) {
   //  	PROBE_2_TOGGLE;
   //}
   uint32_t last_entry;
-  if (steps == 0) {
+  if (!e_curr->hasSteps) {
+    // a pause of several periods is repeated until the last period
+    steps = steps > 1 ? steps - 1 : 0;
     q->bufferContainsSteps[fill_part_one ? 0 : 1] = false;
     for (uint8_t i = 0; i < PART_SIZE - 1; i++) {
       // two pauses à 3 ticks. the 2 for debugging
@@ -191,7 +197,8 @@ static void IRAM_ATTR apply_command(StepperQueue *q, bool fill_part_one,
   if (steps == 0) {
     // The command has been completed
     if (e_curr->repeat_entry == 0) {
-      q->read_idx = rp + 1;
+      fas_store_release(&q->read_idx, (fas_queue_idx_t)(rp + 1));
+      q->checkWakeup(rp + 1);
     }
   } else {
     e_curr->steps = steps;
@@ -439,7 +446,7 @@ void StepperQueue::startQueue_rmt() {
 #endif
 
   // set dirpin toggle here
-  uint8_t rp = read_idx;
+  fas_queue_idx_t rp = read_idx;
   if (rp == next_write_idx) {
     // nothing to do ?
     // Should not happen, so bail
@@ -0,0 +1,242 @@
+#include "TrajectoryStream.h"
+
+// This define in order to not shoot myself.
+#ifndef TEST
+#define printf DO_NOT_USE_PRINTF
+#define puts DO_NOT_USE_PRINTF
+#endif
+
+static uint8_t write_varint(uint8_t* out, uint32_t value) {
+  uint8_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+//*************************************************************************************************
+// Encoder
+//*************************************************************************************************
+void TrajectoryEncoder::init() {
+  _prev.ticks = 0;
+  _prev.steps = 0;
+  _prev.count_up = true;
+  _run_count = 0;
+}
+
+uint8_t TrajectoryEncoder::header(uint8_t* out) {
+  uint32_t ticks_per_s = TICKS_PER_S;
+  out[0] = 'F';
+  out[1] = 'A';
+  out[2] = 'S';
+  out[3] = 'C';
+  out[4] = TRAJECTORY_VERSION;
+  for (uint8_t i = 0; i < 4; i++) {
+    out[5 + i] = ticks_per_s & 0xff;
+    ticks_per_s >>= 8;
+  }
+  return TRAJECTORY_HEADER_LEN;
+}
+
+uint8_t TrajectoryEncoder::_flush(uint8_t* out) {
+  if (_run_count == 0) {
+    return 0;
+  }
+  int32_t delta = (int32_t)_run.ticks - (int32_t)_prev.ticks;
+  uint32_t tag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+  tag <<= 3;
+  if (_run.steps != _prev.steps) {
+    tag |= TRAJECTORY_FLAG_STEPS;
+  }
+  if (_run.count_up != _prev.count_up) {
+    tag |= TRAJECTORY_FLAG_TOGGLE_DIR;
+  }
+  if (_run_count > 1) {
+    tag |= TRAJECTORY_FLAG_REPEAT;
+  }
+  uint8_t n = write_varint(out, tag);
+  if (tag & TRAJECTORY_FLAG_STEPS) {
+    n += write_varint(&out[n], _run.steps);
+  }
+  if (tag & TRAJECTORY_FLAG_REPEAT) {
+    n += write_varint(&out[n], _run_count);
+  }
+  _prev = _run;
+  _run_count = 0;
+  return n;
+}
+
+uint8_t TrajectoryEncoder::add(const struct stepper_command_s* cmd,
+                               uint8_t* out) {
+  if ((_run_count > 0) && (_run_count < 0xffffffff) &&
+      (cmd->ticks == _run.ticks) && (cmd->steps == _run.steps) &&
+      (cmd->count_up == _run.count_up)) {
+    _run_count++;
+    return 0;
+  }
+  uint8_t n = _flush(out);
+  _run = *cmd;
+  _run_count = 1;
+  return n;
+}
+
+uint8_t TrajectoryEncoder::finish(uint8_t* out) {
+  uint8_t n = _flush(out);
+  out[n++] = TRAJECTORY_FLAG_REPEAT;
+  out[n++] = 0;
+  return n;
+}
+
+//*************************************************************************************************
+// Decoder
+//*************************************************************************************************
+void TrajectoryStream::reset() {
+  _write_idx = 0;
+  _read_idx = 0;
+  _state = TRAJECTORY_OK;
+  _header_done = false;
+  _allow_count_down = true;
+  _min_ticks = 0;
+  _prev.ticks = 0;
+  _prev.steps = 0;
+  _prev.count_up = true;
+  _repeat_left = 0;
+  _pending_len = 0;
+}
+
+uint8_t TrajectoryStream::availableForWrite() {
+  uint8_t rd = fas_load_acquire(&_read_idx);
+  return TRAJECTORY_BUFFER_LEN - (uint8_t)(_write_idx - rd);
+}
+
+uint8_t TrajectoryStream::write(const uint8_t* data, uint8_t len) {
+  uint8_t n = fas_min(len, availableForWrite());
+  uint8_t wr = _write_idx;
+  for (uint8_t i = 0; i < n; i++) {
+    _buffer[wr++ & (TRAJECTORY_BUFFER_LEN - 1)] = data[i];
+  }
+  fas_store_release(&_write_idx, wr);
+  return n;
+}
+
+void TrajectoryStream::setLimits(uint16_t min_ticks, bool allow_count_down) {
+  _min_ticks = min_ticks;
+  _allow_count_down = allow_count_down;
+}
+
+// Reads a varint at pos, which is relative to the read index. Returns
+// TRAJECTORY_NEED_DATA, if the varint is not complete
+int8_t TrajectoryStream::_readVarint(uint8_t* pos, uint8_t avail,
+                                     uint32_t* value) {
+  uint32_t v = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (*pos == avail) {
+      return TRAJECTORY_NEED_DATA;
+    }
+    uint8_t b = _buffer[(uint8_t)(_read_idx + *pos) &
+                        (TRAJECTORY_BUFFER_LEN - 1)];
+    (*pos)++;
+    v |= (uint32_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      *value = v;
+      return TRAJECTORY_OK;
+    }
+  }
+  return TRAJECTORY_ERR_FORMAT;
+}
+
+int8_t TrajectoryStream::peek(struct stepper_command_s* cmd) {
+  if (_repeat_left > 0) {
+    *cmd = _prev;
+    return TRAJECTORY_OK;
+  }
+  if (_state != TRAJECTORY_OK) {
+    return _state;
+  }
+  uint8_t avail = fas_load_acquire(&_write_idx) - _read_idx;
+  if (!_header_done) {
+    if (avail < TRAJECTORY_HEADER_LEN) {
+      return TRAJECTORY_NEED_DATA;
+    }
+    uint8_t header[TRAJECTORY_HEADER_LEN];
+    for (uint8_t i = 0; i < TRAJECTORY_HEADER_LEN; i++) {
+      header[i] = _buffer[(uint8_t)(_read_idx + i) &
+                          (TRAJECTORY_BUFFER_LEN - 1)];
+    }
+    uint32_t ticks_per_s = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      ticks_per_s |= (uint32_t)header[5 + i] << (8 * i);
+    }
+    if ((header[0] != 'F') || (header[1] != 'A') || (header[2] != 'S') ||
+        (header[3] != 'C') || (header[4] != TRAJECTORY_VERSION) ||
+        (ticks_per_s != TICKS_PER_S)) {
+      _state = TRAJECTORY_ERR_HEADER;
+      return _state;
+    }
+    _header_done = true;
+    fas_store_release(&_read_idx, _read_idx + TRAJECTORY_HEADER_LEN);
+    avail -= TRAJECTORY_HEADER_LEN;
+  }
+
+  uint8_t pos = 0;
+  uint32_t tag;
+  int8_t res = _readVarint(&pos, avail, &tag);
+  uint32_t steps = _prev.steps;
+  if ((res == TRAJECTORY_OK) && (tag & TRAJECTORY_FLAG_STEPS)) {
+    res = _readVarint(&pos, avail, &steps);
+  }
+  uint32_t count = 1;
+  if ((res == TRAJECTORY_OK) && (tag & TRAJECTORY_FLAG_REPEAT)) {
+    res = _readVarint(&pos, avail, &count);
+  }
+  if (res == TRAJECTORY_NEED_DATA) {
+    return res;
+  }
+  if (res != TRAJECTORY_OK) {
+    _state = res;
+    return _state;
+  }
+  if ((tag == TRAJECTORY_FLAG_REPEAT) && (count == 0)) {
+    fas_store_release(&_read_idx, _read_idx + pos);
+    _state = TRAJECTORY_END;
+    return _state;
+  }
+
+  uint32_t zigzag = tag >> 3;
+  int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+  int32_t ticks = (int32_t)_prev.ticks + delta;
+  bool count_up = _prev.count_up;
+  if (tag & TRAJECTORY_FLAG_TOGGLE_DIR) {
+    count_up = !count_up;
+  }
+  // The same checks as for the table of playTrajectory()
+  uint32_t cmd_ticks = ticks;
+  if (steps > 1) {
+    cmd_ticks *= steps;
+  }
+  if ((ticks < (int32_t)_min_ticks) || (ticks > 0xffff) ||
+      (steps > MAX_CMD_STEPS) || (count == 0) || (cmd_ticks < MIN_CMD_TICKS) ||
+      (!count_up && !_allow_count_down)) {
+    _state = TRAJECTORY_ERR_COMMAND;
+    return _state;
+  }
+  _pending.ticks = ticks;
+  _pending.steps = steps;
+  _pending.count_up = count_up;
+  _pending_count = count;
+  _pending_len = pos;
+  *cmd = _pending;
+  return TRAJECTORY_OK;
+}
+
+void TrajectoryStream::consume() {
+  if (_repeat_left > 0) {
+    _repeat_left--;
+    return;
+  }
+  fas_store_release(&_read_idx, _read_idx + _pending_len);
+  _prev = _pending;
+  _repeat_left = _pending_count - 1;
+}
@@ -0,0 +1,142 @@
+#ifndef TRAJECTORY_STREAM_H
+#define TRAJECTORY_STREAM_H
+#include <stdint.h>
+
+#include "fas_common.h"
+
+// Compressed trajectory stream for playTrajectoryStream().
+//
+// A trajectory is a sequence of stepper commands like the table of
+// playTrajectory(). Consecutive commands of a ramp differ only slightly in
+// ticks and mostly repeat steps and direction. So each command is encoded
+// relative to the previous one with varints (7 bits per byte, lsb first,
+// bit 7 set for more bytes):
+//
+//   header:  "FASC", version, TICKS_PER_S as uint32_t little endian
+//   record:  tag [steps] [count]
+//            tag = zigzag(ticks - previous ticks) << 3 | flags
+//            flag 1: steps follows as varint, else the previous steps
+//            flag 2: the direction toggles
+//            flag 4: count follows as varint, the command is repeated
+//                    count times
+//   end:     the tag 4 with count 0
+//
+// The previous command before the first record is {0, 0, count_up}.
+// A coasting ramp is a single record with repeat count. The ramp commands
+// need mostly two bytes instead of four bytes for the raw command.
+//
+// The application writes the stream e.g. from SD card or Serial into a
+// ring buffer of TRAJECTORY_BUFFER_LEN bytes, and the stepper task decodes
+// the commands from there:
+//
+//   TrajectoryStream stream;
+//   stream.reset();
+//   fill from the source with stream.write(), then
+//   stepper->playTrajectoryStream(&stream);
+//   while (stream.isActive()) {
+//     uint8_t n = stream.availableForWrite();
+//     ... read up to n bytes from the source and stream.write() them
+//   }
+//
+// If the ring buffer runs empty during the playback, the queue runs empty
+// and the stepper stops without deceleration. So the source needs to keep
+// up with the data rate of the trajectory and the buffer needs to hold at
+// least the data read in one loop.
+
+// The ring buffer size can be set with the build flag FAS_TRAJECTORY_BUFFER.
+// It must be a power of two and at most 128.
+#if defined(FAS_TRAJECTORY_BUFFER)
+#define TRAJECTORY_BUFFER_LEN FAS_TRAJECTORY_BUFFER
+#else
+#define TRAJECTORY_BUFFER_LEN 64
+#endif
+#if (TRAJECTORY_BUFFER_LEN & (TRAJECTORY_BUFFER_LEN - 1)) || \
+    (TRAJECTORY_BUFFER_LEN > 128)
+#error "FAS_TRAJECTORY_BUFFER must be a power of two and at most 128"
+#endif
+
+#define TRAJECTORY_HEADER_LEN 9
+#define TRAJECTORY_VERSION 1
+// max. length of a record: tag 3, steps 3 and count 5 bytes
+#define TRAJECTORY_MAX_RECORD_LEN 11
+
+#define TRAJECTORY_FLAG_STEPS 1
+#define TRAJECTORY_FLAG_TOGGLE_DIR 2
+#define TRAJECTORY_FLAG_REPEAT 4
+
+// Return codes of peek() and state()
+#define TRAJECTORY_OK 0
+#define TRAJECTORY_NEED_DATA 1
+#define TRAJECTORY_END 2
+#define TRAJECTORY_ERR_HEADER -1
+#define TRAJECTORY_ERR_FORMAT -2
+#define TRAJECTORY_ERR_COMMAND -3
+
+// The encoder of the stream. It keeps only the previous command and the
+// run of identical commands. Used by trajectory_gen on the host, but can
+// record commands on the target, too.
+class TrajectoryEncoder {
+ public:
+  void init();
+  // Writes the header into out, returns TRAJECTORY_HEADER_LEN
+  uint8_t header(uint8_t* out);
+  // Adds a command and writes up to TRAJECTORY_MAX_RECORD_LEN bytes into
+  // out. Returns the number of bytes written.
+  uint8_t add(const struct stepper_command_s* cmd, uint8_t* out);
+  // Writes the pending record and the end of the stream into out. Needs up
+  // to TRAJECTORY_MAX_RECORD_LEN + 2 bytes. Returns the number of bytes.
+  uint8_t finish(uint8_t* out);
+
+ private:
+  uint8_t _flush(uint8_t* out);
+  struct stepper_command_s _prev;
+  struct stepper_command_s _run;
+  uint32_t _run_count;
+};
+
+// The streaming decoder. The application is the only writer and the
+// stepper task the only reader of the ring buffer. The write and read
+// indices are only written by one side each.
+class TrajectoryStream {
+ public:
+  // Clears the buffer and expects a new header. Must not be called during
+  // the playback.
+  void reset();
+  // Bytes, which can be written without blocking
+  uint8_t availableForWrite();
+  // Writes up to len bytes and returns the number of bytes written
+  uint8_t write(const uint8_t* data, uint8_t len);
+  // TRAJECTORY_OK during decoding, TRAJECTORY_END after the end record or
+  // an error code
+  inline int8_t state() { return _state; }
+  inline bool isActive() { return _state == TRAJECTORY_OK; }
+
+  // The commands are checked against these limits while decoding. This is
+  // done by playTrajectoryStream()
+  void setLimits(uint16_t min_ticks, bool allow_count_down);
+
+  // Used by the stepper task: peek() decodes the next command, which is
+  // removed by consume() after having been added to the queue. Returns
+  // TRAJECTORY_NEED_DATA, if the buffer does not contain the whole record.
+  int8_t peek(struct stepper_command_s* cmd);
+  void consume();
+
+ private:
+  int8_t _readVarint(uint8_t* pos, uint8_t avail, uint32_t* value);
+  uint8_t _buffer[TRAJECTORY_BUFFER_LEN];
+  volatile uint8_t _write_idx;
+  volatile uint8_t _read_idx;
+  volatile int8_t _state;
+  bool _header_done;
+  bool _allow_count_down;
+  uint16_t _min_ticks;
+  // the last consumed command and the remaining repetitions
+  struct stepper_command_s _prev;
+  uint32_t _repeat_left;
+  // the command returned by peek() and its record
+  struct stepper_command_s _pending;
+  uint32_t _pending_count;
+  uint8_t _pending_len;
+};
+
+#endif /* TRAJECTORY_STREAM_H */
@@ -7,12 +7,24 @@
 #define MOVE_ERR_NO_DIRECTION_PIN -1
 #define MOVE_ERR_SPEED_IS_UNDEFINED -2
 #define MOVE_ERR_ACCELERATION_IS_UNDEFINED -3
+#define MOVE_ERR_STEPPER_IS_RUNNING -4
+#define MOVE_ERR_INVALID_AXES -5
+#define MOVE_ERR_PLANNER_FULL -6
+#define MOVE_ERR_INVALID_TRAJECTORY -7
+
+// The steps of a command and a queue entry. With the build flag
+// FAS_WIDE_STEPS up to MAX_CMD_STEPS = 32767, otherwise 255.
+#if defined(FAS_WIDE_STEPS)
+typedef uint16_t fas_steps_t;
+#else
+typedef uint8_t fas_steps_t;
+#endif
 
 //	ticks is multiplied by (1/TICKS_PER_S) in s
 //	If steps is 0, then a pause is generated
 struct stepper_command_s {
   uint16_t ticks;
-  uint8_t steps;
+  fas_steps_t steps;
   bool count_up;
 };
 
@@ -59,17 +71,25 @@ struct queue_end_s {
 #include "../extras/tests/pc_based/stubs.h"
 
 // For pc-based testing, the macro TEST is defined. The pc-based testing does
-// not support the concept of interrupts, so provide an empty definition
+// not support the concept of interrupts, so provide an empty definition.
+// The critical sections are only counted for the benchmark
+extern uint32_t fas_test_critical_sections;
 #define fasEnableInterrupts()
-#define fasDisableInterrupts()
+#define fasDisableInterrupts() fas_test_critical_sections++
 
 // The TEST target needs a couple of arduino like definitions
 #define LOW 0
 #define HIGH 1
 
-// queue definitions for pc based testing
-#define MAX_STEPPER 2
-#define NUM_QUEUES 2
+// queue definitions for pc based testing. The benchmark of the fill order
+// needs more steppers
+#if defined(FAS_TEST_STEPPERS)
+#define MAX_STEPPER FAS_TEST_STEPPERS
+#define NUM_QUEUES FAS_TEST_STEPPERS
+#else
+#define MAX_STEPPER 3
+#define NUM_QUEUES 3
+#endif
 #define fas_queue_A fas_queue[0]
 #define fas_queue_B fas_queue[1]
 #define QUEUE_LEN 16
@@ -86,6 +106,9 @@ struct queue_end_s {
 
 #define SUPPORT_QUEUE_ENTRY_END_POS_U16
 
+// The wakeup of the stepper task is tested with a simulated clock
+#define SUPPORT_TASK_WAKEUP
+
 //==========================================================================
 //
 // This for ESP32 derivates using arduino core
@@ -237,6 +260,13 @@ struct queue_end_s {
 // have more than one core
 #define SUPPORT_CPU_AFFINITY
 
+// With FAS_TASK_WAKEUP the StepperTask sleeps until a queue reaches its low
+// watermark or the application changes a ramp, instead of polling every
+// DELAY_MS_BASE
+#if defined(FAS_TASK_WAKEUP)
+#define SUPPORT_TASK_WAKEUP
+#endif
+
 //==========================================================================
 //
 // This for ESP32 derivates using espidf
@@ -305,6 +335,13 @@ struct queue_end_s {
 // have more than one core
 #define SUPPORT_CPU_AFFINITY
 
+// With FAS_TASK_WAKEUP the StepperTask sleeps until a queue reaches its low
+// watermark or the application changes a ramp, instead of polling every
+// DELAY_MS_BASE
+#if defined(FAS_TASK_WAKEUP)
+#define SUPPORT_TASK_WAKEUP
+#endif
+
 //==========================================================================
 //
 // This for SAM-architecture
@@ -441,6 +478,154 @@ enum channels { channelA, channelB, channelC };
 #include <soc/periph_defs.h>
 #endif /* __ESP32_IDF_V44__ */
 
+//==========================================================================
+// The 32 bit math backend for the ramp calculation is selected by the build
+// flag FAS_PMF_32BIT. It needs 2kB tables and 32 bit arithmetic.
+#if defined(FAS_PMF_32BIT) && defined(SUPPORT_AVR)
+#error "FAS_PMF_32BIT is not supported for avr"
+#endif
+
+//==========================================================================
+// The queue length per stepper can be set with the build flag FAS_QUEUE_LEN,
+// e.g. 256 on esp32, so fill_queue() can run less often with more entries.
+// It must be a power of two. Up to 128 entries the read/write indices are
+// uint8_t, for longer queues uint16_t. With more than 64 entries, the steps
+// in the queue can exceed the range of the 16 bit positions in the entries,
+// so the entries store the complete position.
+#if defined(FAS_QUEUE_LEN)
+#undef QUEUE_LEN
+#define QUEUE_LEN FAS_QUEUE_LEN
+#endif
+#if (QUEUE_LEN < 2) || ((QUEUE_LEN & (QUEUE_LEN - 1)) != 0)
+#error "QUEUE_LEN must be a power of two"
+#endif
+#if QUEUE_LEN > 128
+#if defined(SUPPORT_AVR)
+#error "QUEUE_LEN > 128 is not supported for avr"
+#endif
+#if QUEUE_LEN > 32768
+#error "QUEUE_LEN is too big"
+#endif
+typedef uint16_t fas_queue_idx_t;
+#else
+typedef uint8_t fas_queue_idx_t;
+#endif
+#if QUEUE_LEN > 64
+#define SUPPORT_QUEUE_ENTRY_FULL_POS
+#endif
+
+//==========================================================================
+// With the build flag FAS_WIDE_STEPS a command and a queue entry hold up to
+// 32767 steps instead of 255. The limit is given by the 16 bit signed pulse
+// counter of esp32. The ramp generator plans the coasting phase of a move
+// with commands of COAST_PLANNING_TICKS instead of 2ms, so at high speed a
+// coast needs far fewer queue entries, isr calls for the next entry and
+// fill_queue() iterations. In turn stopMove() or a new speed may be delayed
+// by up to COAST_PLANNING_TICKS. runForward()/runBackward() and the velocity
+// mode keep the 2ms commands. The steps in the queue can exceed the range of the
+// 16 bit positions in the entries, so the entries store the complete
+// position.
+#if defined(FAS_WIDE_STEPS)
+#define SUPPORT_WIDE_STEPS
+#define MAX_CMD_STEPS 32767
+#define COAST_PLANNING_TICKS (TICKS_PER_S / 100)
+#if !defined(SUPPORT_QUEUE_ENTRY_FULL_POS)
+#define SUPPORT_QUEUE_ENTRY_FULL_POS
+#endif
+#else
+#define MAX_CMD_STEPS 255
+#endif
+
+//==========================================================================
+// A long pause is split into periods of 65535 ticks, as long as at least
+// 131070 ticks are left, and the rest into two halves. This is done by the
+// ramp generator for slow speeds and for the delay to enable. The periods
+// are not queued one by one, but as one pause entry, which the isr repeats
+// up to MAX_PAUSE_PERIODS times. So one entry covers about 1s at 16MHz.
+// fas_pause_periods() returns the number of 65535 tick periods of a pause.
+#define MAX_PAUSE_PERIODS MAX_CMD_STEPS
+static inline uint32_t fas_pause_periods(uint32_t pause_ticks) {
+  if (pause_ticks < 131070) {
+    return 0;
+  }
+  return (pause_ticks - 131070) / 65535 + 1;
+}
+
+//==========================================================================
+// The build flag FAS_SPSC_QUEUE selects the lock-free variant of the
+// StepperQueue: the application is the single producer and the isr the
+// single consumer. read_idx/next_write_idx are accessed with acquire/release
+// semantics and queue_end is protected by a sequence lock. So polling e.g.
+// getCurrentPosition() needs no critical section and is correct across
+// cores. The isr of all esp32 drivers (mcpwm/pcnt, rmt of esp32/c3/s3) uses
+// acquire/release, too. On sam application and isr share one core, so the
+// volatile accesses of the isr are sufficient.
+// The avr does not need it, because it has only one core and 8 bit variables
+// are always read atomically.
+#if defined(FAS_SPSC_QUEUE)
+#if defined(SUPPORT_AVR)
+#error "FAS_SPSC_QUEUE is not supported for avr"
+#endif
+#define SUPPORT_SPSC_QUEUE
+#define fas_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define fas_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define fas_fence_acquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define fas_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+#define fas_load_acquire(p) (*(p))
+#define fas_store_release(p, v) (*(p) = (v))
+#endif
+
+//==========================================================================
+// The build flag FAS_TRACE enables the binary trace ring of the fill path,
+// see fas_trace.h. The number of events is set by FAS_TRACE_LEN, which must
+// be a power of two. The pc based tests use it always.
+#if defined(FAS_TRACE) || defined(TEST)
+#define SUPPORT_TRACE
+#if !defined(FAS_TRACE_LEN)
+#if defined(SUPPORT_AVR)
+#define FAS_TRACE_LEN 32
+#else
+#define FAS_TRACE_LEN 256
+#endif
+#endif
+#if (FAS_TRACE_LEN < 2) || ((FAS_TRACE_LEN & (FAS_TRACE_LEN - 1)) != 0)
+#error "FAS_TRACE_LEN must be a power of two"
+#endif
+#endif
+
+//==========================================================================
+// The build flag FAS_POSITION_EVENTS enables the position events of
+// FastAccelStepper::addPositionEvent(). fill_queue() splits a command at
+// the step to an event's position and the queue entry starting with this
+// step carries a bit mask of the events. The isr raises them, when it
+// starts the entry. With external direction pin (esp32, avr with more pins)
+// the queue entry grows by one byte. The pc based tests use it always.
+#if defined(FAS_POSITION_EVENTS) || defined(TEST)
+#define SUPPORT_POSITION_EVENTS
+#define MAX_POSITION_EVENTS 4
+#endif
+
+//==========================================================================
+// Trajectory tables for playTrajectory() can be placed in flash with
+// FAS_PROGMEM. Only on avr const data is copied to RAM and the flash needs
+// to be read with memcpy_P().
+#if defined(SUPPORT_AVR)
+#define FAS_PROGMEM PROGMEM
+#define fas_read_command_P(dst, src) \
+  memcpy_P((dst), (src), sizeof(struct stepper_command_s))
+#else
+#define FAS_PROGMEM
+#define fas_read_command_P(dst, src) (*(dst) = *(src))
+#endif
+
+//==========================================================================
+// The jerk limited ramp generator uses float arithmetic, which is too slow
+// for the avr fill isr
+#if !defined(SUPPORT_AVR)
+#define SUPPORT_JERK_LIMITED_RAMP
+#endif
+
 //==========================================================================
 // determine, if driver type selection should be supported
 #if defined(QUEUES_MCPWM_PCNT) && defined(QUEUES_RMT)
@@ -0,0 +1,51 @@
+#include "fas_trace.h"
+
+#if defined(SUPPORT_TRACE)
+struct fas_trace_event_s fas_trace_ring[FAS_TRACE_LEN];
+volatile uint16_t fas_trace_wr = 0;
+static uint16_t fas_trace_rd = 0;
+static uint32_t fas_trace_lost_events = 0;
+
+uint16_t fas_trace_read(struct fas_trace_event_s* dst, uint16_t max_events) {
+  fasDisableInterrupts();
+  uint16_t wr = fas_trace_wr;
+  uint16_t pending = wr - fas_trace_rd;
+  if (pending > FAS_TRACE_LEN) {
+    fas_trace_lost_events += pending - FAS_TRACE_LEN;
+    fas_trace_rd = wr - FAS_TRACE_LEN;
+    pending = FAS_TRACE_LEN;
+  }
+  uint16_t n = fas_min(pending, max_events);
+  for (uint16_t i = 0; i < n; i++) {
+    dst[i] = fas_trace_ring[fas_trace_rd & (FAS_TRACE_LEN - 1)];
+    fas_trace_rd++;
+  }
+  fasEnableInterrupts();
+  return n;
+}
+
+uint32_t fas_trace_lost() { return fas_trace_lost_events; }
+
+void fas_trace_clear() {
+  fasDisableInterrupts();
+  fas_trace_rd = fas_trace_wr;
+  fas_trace_lost_events = 0;
+  fasEnableInterrupts();
+}
+
+void fas_trace_header(uint8_t* header) {
+  header[0] = 'F';
+  header[1] = 'A';
+  header[2] = 'S';
+  header[3] = 'T';
+  header[4] = FAS_TRACE_VERSION;
+  header[5] = NUM_QUEUES;
+  header[6] = 0;
+  header[7] = 0;
+  uint32_t f = TICKS_PER_S;
+  for (uint8_t i = 0; i < 4; i++) {
+    header[8 + i] = f & 0xff;
+    f >>= 8;
+  }
+}
+#endif
@@ -0,0 +1,90 @@
+#ifndef FAS_TRACE_H
+#define FAS_TRACE_H
+#include <stdint.h>
+
+#include "fas_common.h"
+
+// Binary trace of the fill path with the build flag FAS_TRACE.
+//
+// The events are written into a ring of FAS_TRACE_LEN entries with a few
+// instructions each and without any output, so the timing of the stepper
+// task is not changed noticeably. The oldest events are overwritten. The
+// application reads the events with fas_trace_read() and can send them e.g.
+// as binary dump via Serial:
+//
+//   uint8_t header[FAS_TRACE_HEADER_LEN];
+//   fas_trace_header(header);
+//   Serial.write(header, sizeof(header));
+//   struct fas_trace_event_s ev[16];
+//   uint16_t n;
+//   while ((n = fas_trace_read(ev, 16)) > 0) {
+//     Serial.write((uint8_t *)ev, n * sizeof(ev[0]));
+//   }
+//
+// All supported targets are little endian, so this is the dump format:
+// the header followed by events of 8 bytes. The host tool trace_decode in
+// extras/tests/pc_based prints the dump per command like RampChecker.
+//
+// The events are written by the fill task (the fill interrupt on avr) and by
+// the application calling e.g. moveTo(). So one writer can interrupt another
+// one or run on the other core. Each writer reserves its slot with an atomic
+// increment of the write index: on esp32 and in the threads of the pc based
+// tests by __atomic_fetch_add(), on the single core targets within a short
+// critical section. A reader may still copy an event, while it is being
+// written. The step isr does not write events.
+
+// Event types. The direction of PLAN and PUSH is flagged in the type.
+#define FAS_TRACE_RAMP_STATE 1  // a: new ramp state, b: ticks of the ramp
+#define FAS_TRACE_PLAN 2        // a: steps, b: ticks of the ramp command
+#define FAS_TRACE_PUSH 3        // a: steps, b: ticks of the queue entry
+#define FAS_TRACE_START 4       // the queue has been started
+#define FAS_TRACE_UNDERRUN 5    // the queue ran empty during the ramp
+#define FAS_TRACE_TYPE_MASK 0x0f
+#define FAS_TRACE_COUNT_UP 0x80
+
+struct fas_trace_event_s {
+  uint8_t type;
+  uint8_t queue;
+  uint16_t a;
+  uint32_t b;
+};
+
+// "FAST", version, number of queues, 2 bytes 0, TICKS_PER_S as uint32_t
+#define FAS_TRACE_HEADER_LEN 12
+#define FAS_TRACE_VERSION 1
+
+#if defined(SUPPORT_TRACE)
+extern struct fas_trace_event_s fas_trace_ring[FAS_TRACE_LEN];
+extern volatile uint16_t fas_trace_wr;
+
+static inline void fas_trace(uint8_t type, uint8_t queue, uint16_t a,
+                             uint32_t b) {
+#if defined(SUPPORT_ESP32) || defined(TEST)
+  uint16_t wr = __atomic_fetch_add(&fas_trace_wr, 1, __ATOMIC_RELAXED);
+#else
+  fasDisableInterrupts();
+  uint16_t wr = fas_trace_wr;
+  fas_trace_wr = wr + 1;
+  fasEnableInterrupts();
+#endif
+  struct fas_trace_event_s* ev = &fas_trace_ring[wr & (FAS_TRACE_LEN - 1)];
+  ev->type = type;
+  ev->queue = queue;
+  ev->a = a;
+  ev->b = b;
+}
+
+// Copy up to max_events of the oldest events not yet read into dst.
+// Returns the number of copied events.
+uint16_t fas_trace_read(struct fas_trace_event_s* dst, uint16_t max_events);
+// Number of events overwritten before having been read
+uint32_t fas_trace_lost();
+void fas_trace_clear();
+void fas_trace_header(uint8_t* header);
+
+#define FAS_TRACE_EVENT(type, queue, a, b) fas_trace(type, queue, a, b)
+#else
+#define FAS_TRACE_EVENT(type, queue, a, b)
+#endif
+
+#endif /* FAS_TRACE_H */